@@ -0,0 +1,391 @@
+/*
+ * Benchmarks each stage of getting files out of a capture: reading packets
+ * (mapped, buffered and copied), decoding their headers, finding their TCP
+ * flow, pattern matching, and the whole program end to end. Each stage is
+ * run a number of times and the best round is reported, one JSON object per
+ * line, so results can be compared between builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "../src/decap_includes.h"
+#include "../src/decode.h"
+#include "../src/flow.h"
+#include "../src/match.h"
+
+#define BATCH_SIZE 64
+
+typedef struct {
+    const char* stage;
+    int rounds;
+    uint64_t packets; /* Per round. */
+    uint64_t bytes;
+    double seconds; /* Of the best round. */
+} bench_result;
+
+/* Work the compiler mustn't optimise away. */
+static volatile uint64_t sink;
+
+/* Every packet of the capture, as views into a mapping, for the stages that
+ * don't read. */
+static pcap_packet* packets;
+static uint64_t packetCount;
+
+static void usage() {
+    fprintf(stderr, "Usage: bench [-n rounds] [-r replay] <capturefile>\n");
+    fprintf(stderr, "\t-n\tTimes to run each stage; the best is reported "
+            "(default 5).\n");
+    fprintf(stderr, "\t-r\tThe replay program, for the end to end run "
+            "(default ./replay).\n");
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const bench_result* result) {
+    double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+
+    printf("{\"stage\": \"%s\", \"rounds\": %d, \"packets\": %llu, "
+            "\"bytes\": %llu, \"seconds\": %.6f, "
+            "\"packets_per_second\": %.0f, \"mb_per_second\": %.2f, "
+            "\"ns_per_packet\": %.1f}\n", result->stage, result->rounds,
+            (unsigned long long) result->packets,
+            (unsigned long long) result->bytes, result->seconds,
+            result->packets / seconds, result->bytes / seconds / 1e6,
+            result->packets ? seconds * 1e9 / result->packets : 0);
+    fflush(stdout);
+}
+
+/**
+ * Keeps the quickest of the rounds so far.
+ */
+static void keepBest(bench_result* result, double seconds) {
+    if (result->rounds == 0 || seconds < result->seconds) {
+        result->seconds = seconds;
+    }
+    result->rounds++;
+}
+
+/**
+ * Reads every packet of the capture with readPacketBatch.
+ *
+ * @param fixedSize Passed to load: mapped if non-zero, buffered otherwise.
+ * @return Non-zero on success.
+ */
+static int readBatches(const char* path, int fixedSize,
+        bench_result* result) {
+    static pcap_packet batch[BATCH_SIZE];
+    pcap_file pcapFile;
+    int fd = open(path, O_RDONLY);
+    int count;
+
+    if (fd < 0) {
+        perror(path);
+        return 0;
+    }
+
+    double start = now();
+    if (!load(fd, &pcapFile, fixedSize)) {
+        close(fd);
+        return 0;
+    }
+
+    result->packets = result->bytes = 0;
+    while ((count = readPacketBatch(&pcapFile, batch, BATCH_SIZE)) > 0) {
+        int i;
+        for (i = 0; i < count; i++) {
+            result->bytes += batch[i].payload.payloadSize;
+            sink += batch[i].payload.data[0];
+        }
+        result->packets += count;
+    }
+    unload(&pcapFile);
+    keepBest(result, now() - start);
+
+    close(fd);
+    return count == 0;
+}
+
+/**
+ * Reads every packet of the capture into memory of its own with readPacket,
+ * as a capture that may still be growing is read.
+ */
+static int readCopies(const char* path, bench_result* result) {
+    pcap_file pcapFile;
+    pcap_packet packet;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        perror(path);
+        return 0;
+    }
+
+    double start = now();
+    if (!load(fd, &pcapFile, 0)) {
+        close(fd);
+        return 0;
+    }
+
+    result->packets = result->bytes = 0;
+    while (more(&pcapFile) && readPacket(&pcapFile, &packet)) {
+        result->packets++;
+        result->bytes += packet.payload.payloadSize;
+        sink += packet.payload.data[0];
+        unloadPacket(&packet);
+    }
+    unload(&pcapFile);
+    keepBest(result, now() - start);
+
+    close(fd);
+    return 1;
+}
+
+/**
+ * Decodes the link, IP and TCP headers of every packet.
+ */
+static void decodeAll(bench_result* result) {
+    packet_layers layers;
+    uint64_t i;
+
+    result->packets = result->bytes = 0;
+    double start = now();
+    for (i = 0; i < packetCount; i++) {
+        if (decodePacket(&packets[i], &layers) == DECODE_TCP) {
+            sink += layers.payloadLength;
+        }
+        result->bytes += packets[i].payload.payloadSize;
+    }
+    result->packets = packetCount;
+    keepBest(result, now() - start);
+}
+
+/**
+ * Everything the program needs to know about a TCP segment before looking at
+ * its payload: its flow (and where that goes in a table), sequence number
+ * and flags.
+ */
+static void extractAll(bench_result* result) {
+    packet_layers layers;
+    flow_key key;
+    uint64_t i;
+
+    result->packets = result->bytes = 0;
+    double start = now();
+    for (i = 0; i < packetCount; i++) {
+        if (decodePacket(&packets[i], &layers) == DECODE_TCP) {
+            flowKeyFromLayers(&layers, &key);
+            sink += flowHash(&key) + tcpSequence(&layers)
+                    + tcpSegmentFlags(&layers);
+        }
+        result->bytes += packets[i].payload.payloadSize;
+    }
+    result->packets = packetCount;
+    keepBest(result, now() - start);
+}
+
+/**
+ * Looks for the default pattern in every TCP payload. Only the payloads are
+ * counted as bytes.
+ */
+static void matchAll(const matcher* m, bench_result* result) {
+    packet_layers layers;
+    uint64_t i;
+
+    result->packets = result->bytes = 0;
+    double start = now();
+    for (i = 0; i < packetCount; i++) {
+        if (decodePacket(&packets[i], &layers) != DECODE_TCP
+                || layers.payloadLength == 0) {
+            continue;
+        }
+        sink += matcherScan(m, layers.payload, layers.payloadLength, NULL);
+        result->packets++;
+        result->bytes += layers.payloadLength;
+    }
+    keepBest(result, now() - start);
+}
+
+/**
+ * Empties (and removes) an output directory.
+ */
+static void removeOutput(const char* directory) {
+    char path[4096];
+    struct dirent* entry;
+    DIR* dir = opendir(directory);
+
+    if (dir != NULL) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+                snprintf(path, sizeof (path), "%s/%s", directory,
+                        entry->d_name);
+                unlink(path);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(directory);
+}
+
+/**
+ * Runs the replay program over the capture, writing into a directory of its
+ * own which is cleared up afterwards.
+ *
+ * @return Non-zero if it ran and exited normally.
+ */
+static int runReplay(const char* replay, const char* path,
+        bench_result* result) {
+    char directory[] = "/tmp/replay-bench-XXXXXX";
+    int status;
+
+    if (mkdtemp(directory) == NULL) {
+        perror("mkdtemp");
+        return 0;
+    }
+
+    double start = now();
+    pid_t child = fork();
+
+    if (child == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        execl(replay, replay, "-f", "-o", directory, path, (char*) NULL);
+        _exit(127);
+    }
+
+    if (child < 0 || waitpid(child, &status, 0) < 0) {
+        perror("fork");
+        removeOutput(directory);
+        return 0;
+    }
+    keepBest(result, now() - start);
+    removeOutput(directory);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s exited abnormally (status %d).\n", replay,
+                status);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Holds on to every packet of the capture, as views into its mapping.
+ *
+ * @return Non-zero on success.
+ */
+static int loadPackets(pcap_file* pcapFile) {
+    static pcap_packet batch[BATCH_SIZE];
+    uint64_t capacity = 0;
+    int count;
+
+    while ((count = readPacketBatch(pcapFile, batch, BATCH_SIZE)) > 0) {
+        if (packetCount + count > capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            packets = realloc(packets, capacity * sizeof (pcap_packet));
+            if (packets == NULL) {
+                return 0;
+            }
+        }
+        memcpy(packets + packetCount, batch, count * sizeof (pcap_packet));
+        packetCount += count;
+    }
+    return count == 0;
+}
+
+int main(int argc, char** argv) {
+    const char* replay = "./replay";
+    int rounds = 5;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            case 'r':
+                replay = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || rounds < 1) {
+        usage();
+        return 1;
+    }
+
+    const char* path = argv[optind];
+    pcap_file pcapFile;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || !load(fd, &pcapFile, 1)) {
+        fprintf(stderr, "Can't read %s.\n", path);
+        return 2;
+    }
+
+    //The stages after reading go over views into the mapping.
+    if (pcapFile.map == NULL || !loadPackets(&pcapFile)) {
+        fprintf(stderr, "Can't map %s into memory.\n", path);
+        return 2;
+    }
+
+    matcher m;
+    if (!matcherInit(&m) || !matcherAdd(&m, DEFAULT_PATTERN)
+            || !matcherCompile(&m)) {
+        fprintf(stderr, "Can't set up the matcher.\n");
+        return 2;
+    }
+
+    bench_result results[] = {
+        {"read_mapped"}, {"read_buffered"}, {"read_copy"}, {"decode"},
+        {"tcp"}, {"match"}, {"end_to_end"}
+    };
+
+    for (i = 0; i < rounds; i++) {
+        if (!readBatches(path, 1, &results[0])
+                || !readBatches(path, 0, &results[1])
+                || !readCopies(path, &results[2])) {
+            fprintf(stderr, "Reading %s failed.\n", path);
+            return 2;
+        }
+        decodeAll(&results[3]);
+        extractAll(&results[4]);
+        matchAll(&m, &results[5]);
+    }
+    for (i = 0; i < 6; i++) {
+        report(&results[i]);
+    }
+
+    //Same packets and bytes as reading, for comparison.
+    results[6].packets = results[0].packets;
+    results[6].bytes = results[0].bytes;
+    for (i = 0; i < rounds; i++) {
+        if (!runReplay(replay, path, &results[6])) {
+            return 3;
+        }
+    }
+    report(&results[6]);
+
+    matcherFree(&m);
+    free(packets);
+    unload(&pcapFile);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,418 @@
+/*
+ * Synthetic capture generator for the benchmarks. Writes HTTP downloads over
+ * any number of interleaved TCP connections as an Ethernet pcap. The output
+ * only depends on the options (and the seed), so runs can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../include/pcapfile.h"
+
+#define MAX_MSS 9000 /* Jumbo frames are as big as it gets. */
+#define START_SECONDS 1400000000
+#define PACKET_GAP_NANOS 20000 /* Time between packets. */
+#define SERVER_PORT 80
+
+/* One download: handshake, request, response in segments, FIN. */
+typedef struct {
+    uint32_t id;
+    int ipv6;
+    int stage; /* What's next: see the STAGE_ constants. */
+    uint32_t responseLength; /* Header and body. */
+    char header[160];
+    uint32_t headerLength;
+    uint32_t segments; /* Of the response, MSS bytes at a time. */
+    uint32_t nextSegment;
+    int holding; /* A segment held back to go out after the next one. */
+    uint32_t heldSegment;
+} gen_flow;
+
+enum {
+    STAGE_SYN, STAGE_SYN_ACK, STAGE_REQUEST, STAGE_RESPONSE, STAGE_FIN,
+    STAGE_DONE
+};
+
+typedef struct {
+    uint32_t flows;
+    uint32_t concurrent;
+    uint32_t minBody;
+    uint32_t maxBody;
+    uint32_t mss;
+    uint32_t reorderPercent;
+    uint32_t lossPercent;
+    uint32_t ipv6Percent;
+    uint64_t seed;
+} gen_options;
+
+static uint64_t rngState;
+
+/**
+ * splitmix64: small, fast, and the same everywhere.
+ */
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t nextRandom() {
+    rngState = mix(rngState);
+    return rngState;
+}
+
+static uint32_t randomBelow(uint32_t limit) {
+    return limit ? nextRandom() % limit : 0;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: gen [-6 percent] [-b min:max] [-c concurrent] "
+            "[-f flows] [-l percent]\n"
+            "           [-m mss] [-r percent] [-s seed] -o <capturefile>\n");
+    fprintf(stderr, "\t-6\tPercentage of connections over IPv6 (default 0).\n");
+    fprintf(stderr, "\t-b\tResponse body sizes, in bytes (default "
+            "2000:200000).\n");
+    fprintf(stderr, "\t-c\tConnections in progress at once (default 64).\n");
+    fprintf(stderr, "\t-f\tConnections in all (default 1000).\n");
+    fprintf(stderr, "\t-l\tPercentage of data segments lost (default 0).\n");
+    fprintf(stderr, "\t-m\tMaximum segment size (default 1460, up to %d).\n",
+            MAX_MSS);
+    fprintf(stderr, "\t-r\tPercentage of data segments delivered after the "
+            "next one\n\t\t(default 0).\n");
+    fprintf(stderr, "\t-s\tRandom seed (default 1).\n");
+}
+
+/**
+ * Byte `position` of a connection's response body. Random-looking, but only
+ * depends on where it is.
+ */
+static uint8_t bodyByte(uint32_t flow, uint32_t position) {
+    return mix(((uint64_t) flow << 32) | (position >> 3)) >> ((position & 7)
+            * 8);
+}
+
+static void startFlow(gen_flow* flow, uint32_t id, const gen_options* options) {
+    uint32_t body = options->minBody
+            + randomBelow(options->maxBody - options->minBody + 1);
+
+    memset(flow, 0, sizeof (gen_flow));
+    flow->id = id;
+    flow->ipv6 = randomBelow(100) < options->ipv6Percent;
+    flow->headerLength = snprintf(flow->header, sizeof (flow->header),
+            "HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\n"
+            "Content-Length: %u\r\n\r\n", body);
+    flow->responseLength = flow->headerLength + body;
+    flow->segments = (flow->responseLength + options->mss - 1) / options->mss;
+    flow->stage = STAGE_SYN;
+}
+
+static uint16_t ipChecksum(const uint8_t* header, int length) {
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < length; i += 2) {
+        sum += (header[i] << 8) | header[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return ~sum;
+}
+
+/**
+ * Writes one segment of a connection as an Ethernet frame.
+ *
+ * @param toServer Direction: client to server, or back.
+ */
+static void writeSegment(FILE* out, const gen_flow* flow, int toServer,
+        uint8_t flags, uint32_t sequence, const uint8_t* payload,
+        uint32_t length, uint64_t* clock) {
+    static uint8_t frame[14 + 40 + 20 + MAX_MSS];
+    uint32_t ipLength = flow->ipv6 ? 40 : 20;
+    uint8_t* ip = frame + 14;
+    uint8_t* tcp = ip + ipLength;
+    uint16_t clientPort = htons(1024 + flow->id % 60000);
+    uint16_t serverPort = htons(SERVER_PORT);
+    uint32_t value;
+
+    memset(frame, 0, 14 + ipLength + 20);
+    memcpy(frame, "\x02\x00\x00\x00\x00\x01\x02\x00\x00\x00\x00\x02", 12);
+
+    uint8_t client[16] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    uint8_t server[16] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    value = htonl(flow->id + 2);
+    memcpy(client + 12, &value, 4);
+
+    if (flow->ipv6) {
+        frame[12] = 0x86;
+        frame[13] = 0xDD;
+        ip[0] = 0x60;
+        value = htons(20 + length);
+        memcpy(ip + 4, &value, 2);
+        ip[6] = 6;
+        ip[7] = 64;
+        memcpy(ip + 8, toServer ? client : server, 16);
+        memcpy(ip + 24, toServer ? server : client, 16);
+    } else {
+        uint32_t clientAddress = htonl(0x0A000000 | ((flow->id + 2)
+                & 0xFFFFFF));
+        uint32_t serverAddress = htonl(0xC0A80001);
+
+        frame[12] = 0x08;
+        frame[13] = 0x00;
+        ip[0] = 0x45;
+        value = htons(20 + 20 + length);
+        memcpy(ip + 2, &value, 2);
+        ip[8] = 64;
+        ip[9] = 6;
+        memcpy(ip + 12, toServer ? &clientAddress : &serverAddress, 4);
+        memcpy(ip + 16, toServer ? &serverAddress : &clientAddress, 4);
+        value = htons(ipChecksum(ip, 20));
+        memcpy(ip + 10, &value, 2);
+    }
+
+    memcpy(tcp, toServer ? &clientPort : &serverPort, 2);
+    memcpy(tcp + 2, toServer ? &serverPort : &clientPort, 2);
+    value = htonl(sequence);
+    memcpy(tcp + 4, &value, 4);
+    tcp[12] = 5 << 4;
+    tcp[13] = flags;
+    tcp[14] = 0xFF;
+    tcp[15] = 0xFF;
+    memcpy(tcp + 20, payload, length);
+
+    uint32_t frameLength = 14 + ipLength + 20 + length;
+    pcap_packet_header record;
+    record.ts_sec = *clock / 1000000000;
+    record.ts_usec = (*clock % 1000000000) / 1000;
+    record.incl_len = frameLength;
+    record.orig_len = frameLength;
+    *clock += PACKET_GAP_NANOS;
+
+    fwrite(&record, sizeof (record), 1, out);
+    fwrite(frame, frameLength, 1, out);
+}
+
+/**
+ * Writes response segment `index` of a connection.
+ */
+static void writeResponse(FILE* out, const gen_flow* flow, uint32_t index,
+        const gen_options* options, uint64_t* clock) {
+    static uint8_t payload[MAX_MSS];
+    uint32_t start = index * options->mss;
+    uint32_t end = start + options->mss;
+    uint32_t i;
+
+    if (end > flow->responseLength) {
+        end = flow->responseLength;
+    }
+
+    for (i = start; i < end; i++) {
+        payload[i - start] = i < flow->headerLength ? flow->header[i]
+                : bodyByte(flow->id, i - flow->headerLength);
+    }
+
+    writeSegment(out, flow, 0, 0x18, 1000 + start, payload, end - start,
+            clock);
+}
+
+/**
+ * Writes the next packet of a connection.
+ *
+ * @return Non-zero if one was written (lost segments aren't).
+ */
+static int step(FILE* out, gen_flow* flow, const gen_options* options,
+        uint64_t* clock) {
+    static const char request[] = "GET /stream.mp3 HTTP/1.1\r\n"
+            "Host: bench\r\n\r\n";
+
+    switch (flow->stage) {
+        case STAGE_SYN:
+            writeSegment(out, flow, 1, 0x02, 0, NULL, 0, clock);
+            flow->stage = STAGE_SYN_ACK;
+            return 1;
+
+        case STAGE_SYN_ACK:
+            writeSegment(out, flow, 0, 0x12, 999, NULL, 0, clock);
+            flow->stage = STAGE_REQUEST;
+            return 1;
+
+        case STAGE_REQUEST:
+            writeSegment(out, flow, 1, 0x18, 1, (const uint8_t*) request,
+                    sizeof (request) - 1, clock);
+            flow->stage = STAGE_RESPONSE;
+            return 1;
+
+        case STAGE_RESPONSE:
+        {
+            uint32_t index;
+
+            //A held segment goes out right after the one that overtook it.
+            if (flow->holding && flow->nextSegment > flow->heldSegment + 1) {
+                flow->holding = 0;
+                index = flow->heldSegment;
+            } else {
+                index = flow->nextSegment++;
+
+                //The first segment carries the header, and so the match,
+                //which has to come first.
+                if (!flow->holding && index > 0
+                        && flow->nextSegment < flow->segments
+                        && randomBelow(100) < options->reorderPercent) {
+                    flow->holding = 1;
+                    flow->heldSegment = index;
+                    index = flow->nextSegment++;
+                }
+            }
+
+            if (flow->nextSegment >= flow->segments && !flow->holding) {
+                flow->stage = STAGE_FIN;
+            }
+
+            if (index > 0 && randomBelow(100) < options->lossPercent) {
+                return 0;
+            }
+            writeResponse(out, flow, index, options, clock);
+            return 1;
+        }
+
+        case STAGE_FIN:
+            writeSegment(out, flow, 0, 0x11, 1000 + flow->responseLength,
+                    NULL, 0, clock);
+            flow->stage = STAGE_DONE;
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses min:max.
+ */
+static int parseRange(const char* text, uint32_t* low, uint32_t* high) {
+    char* end;
+
+    *low = strtoul(text, &end, 10);
+    if (*end != ':') {
+        return 0;
+    }
+    *high = strtoul(end + 1, &end, 10);
+    return *end == '\0' && *low <= *high;
+}
+
+int main(int argc, char** argv) {
+    gen_options options = {1000, 64, 2000, 200000, 1460, 0, 0, 0, 1};
+    const char* path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "6:b:c:f:l:m:o:r:s:")) != -1) {
+        switch (opt) {
+            case '6':
+                options.ipv6Percent = atoi(optarg);
+                break;
+            case 'b':
+                if (!parseRange(optarg, &options.minBody, &options.maxBody)) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'c':
+                options.concurrent = atoi(optarg);
+                break;
+            case 'f':
+                options.flows = atoi(optarg);
+                break;
+            case 'l':
+                options.lossPercent = atoi(optarg);
+                break;
+            case 'm':
+                options.mss = atoi(optarg);
+                break;
+            case 'o':
+                path = optarg;
+                break;
+            case 'r':
+                options.reorderPercent = atoi(optarg);
+                break;
+            case 's':
+                options.seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (path == NULL || options.concurrent < 1 || options.mss < 1
+            || options.mss > MAX_MSS) {
+        usage();
+        return 1;
+    }
+
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return 2;
+    }
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+    pcap_header header = {0xa1b2c3d4, 2, 4, 0, 0, 65535, LINKTYPE_ETHERNET};
+    fwrite(&header, sizeof (header), 1, out);
+
+    gen_flow* active = calloc(options.concurrent, sizeof (gen_flow));
+    if (active == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        return 2;
+    }
+    uint32_t started = 0;
+    uint32_t running = 0;
+    uint64_t packets = 0;
+    uint64_t clock = (uint64_t) START_SECONDS * 1000000000;
+    uint32_t i;
+
+    rngState = options.seed;
+
+    for (i = 0; i < options.concurrent; i++) {
+        if (started < options.flows) {
+            startFlow(&active[i], started++, &options);
+            running++;
+        } else {
+            active[i].stage = STAGE_DONE;
+        }
+    }
+
+    //Each packet comes from a connection picked at random, so they're all
+    //interleaved.
+    while (running > 0) {
+        gen_flow* flow = &active[randomBelow(options.concurrent)];
+
+        if (flow->stage == STAGE_DONE) {
+            continue;
+        }
+
+        packets += step(out, flow, &options, &clock);
+
+        if (flow->stage == STAGE_DONE) {
+            if (started < options.flows) {
+                startFlow(flow, started++, &options);
+            } else {
+                running--;
+            }
+        }
+    }
+
+    if (fclose(out) != 0) {
+        perror(path);
+        return 2;
+    }
+
+    fprintf(stderr, "Wrote %u connections, %llu packets to %s.\n",
+            options.flows, (unsigned long long) packets, path);
+    free(active);
+    return 0;
+}
@@ -3,19 +3,111 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "decap.h"
 #include "pcapfile.h"
+#include "pcapng.h"
+#include "slab.h"
+
+#define RESYNC_CHAIN 8 /* Records that must follow a guessed record start. */
+#define RESYNC_MAX_LENGTH (256 * 1024) /* Largest believable incl_len, */
+#define RESYNC_MAX_ORIGINAL (16 * 1024 * 1024) /* and orig_len. */
+#define RESYNC_TIME_SLACK 86400 /* Seconds neighbouring records may differ. */
+
+static int readNativeBatch(pcap_file* pcapFile, pcap_packet* out, int max);
+static int readSwappedBatch(pcap_file* pcapFile, pcap_packet* out, int max);
+static int readNgBatch(pcap_file* pcapFile, pcap_packet* out, int max);
+
+/* Forced even without optimization: the readers below are only specialised
+ * per byte order if these are inlined into them. */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/**
+ * Record headers written on a machine of the same byte order.
+ */
+ALWAYS_INLINE void decodeNative(const uint8_t* raw,
+        pcap_packet_header* header) {
+    memcpy(header, raw, sizeof (pcap_packet_header));
+}
+
+/**
+ * Record headers written on a machine of the opposite byte order.
+ */
+ALWAYS_INLINE void decodeSwapped(const uint8_t* raw,
+        pcap_packet_header* header) {
+    memcpy(header, raw, sizeof (pcap_packet_header));
+    header->ts_sec = __builtin_bswap32(header->ts_sec);
+    header->ts_usec = __builtin_bswap32(header->ts_usec);
+    header->incl_len = __builtin_bswap32(header->incl_len);
+    header->orig_len = __builtin_bswap32(header->orig_len);
+}
+
+/**
+ * Decodes a record header in either byte order. Callers on the per-packet path
+ * pass a constant, so once inlined each is left with one decoder called
+ * directly rather than through pcap_file's decodeRecord.
+ */
+ALWAYS_INLINE void decodeHeader(const uint8_t* raw,
+        pcap_packet_header* header, int swapped) {
+    if (swapped) {
+        decodeSwapped(raw, header);
+    } else {
+        decodeNative(raw, header);
+    }
+}
+
+/**
+ * Puts a file header from the opposite byte order the right way round.
+ */
+static void flipFileHeader(pcap_header* header) {
+    header->version_major = __builtin_bswap16(header->version_major);
+    header->version_minor = __builtin_bswap16(header->version_minor);
+    header->thiszone = __builtin_bswap32(header->thiszone);
+    header->sigfigs = __builtin_bswap32(header->sigfigs);
+    header->snaplen = __builtin_bswap32(header->snaplen);
+    header->network = __builtin_bswap32(header->network);
+}
+
+/**
+ * Reads until `size` bytes are in or there's no more (a pipe may hand them
+ * over a few at a time).
+ * 
+ * @return Bytes read.
+ */
+static ssize_t readFully(int fd, void* buffer, size_t size) {
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t got = read(fd, (uint8_t*) buffer + total, size - total);
+
+        if (got <= 0) {
+            break;
+        }
+        total += got;
+    }
+
+    return total;
+}
 
 int load(int fd, pcap_file* pcapFile, int fixedSize) {
+    struct stat info;
+
     if (fd < 0) {
         return 0;
     }
 
-    lseek(fd, 0, SEEK_SET);
+    //Pipes and sockets can't seek: they're read from where they are.
+    pcapFile->isStream = fstat(fd, &info) == 0
+            && (S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode));
+    pcapFile->streamEnded = 0;
+
+    if (!pcapFile->isStream) {
+        lseek(fd, 0, SEEK_SET);
+    }
 
     //If the file is fixed-size, set the length.
-    if (fixedSize) {
+    if (fixedSize && !pcapFile->isStream) {
         pcapFile->fixedSize = lseek(fd, 0, SEEK_END);
         lseek(fd, 0, SEEK_SET);
     } else {
@@ -24,12 +116,42 @@ int load(int fd, pcap_file* pcapFile, int fixedSize) {
 
 
     pcapFile->fd = fd;
+    pcapFile->isNg = 0;
+    pcapFile->interfaces = NULL;
+    pcapFile->interfaceCount = 0;
+    pcapFile->interfaceCapacity = 0;
+    arenaInit(&(pcapFile->copies));
     pcapFile->header = malloc(sizeof (pcap_header));
+    pcapFile->map = NULL;
+    pcapFile->position = sizeof (pcap_header);
+    pcapFile->buffer = NULL;
+    pcapFile->bufferSize = 0;
+    pcapFile->bufferStart = 0;
+    pcapFile->bufferEnd = 0;
+
+    //A file that won't grow can be mapped once and read without any syscalls.
+    //If mapping doesn't work out (empty file, pipe...) just use read().
+    if (pcapFile->fixedSize >= (off_t) sizeof (pcap_header)) {
+        void* map = mmap(NULL, pcapFile->fixedSize, PROT_READ, MAP_PRIVATE,
+                fd, 0);
+
+        if (map != MAP_FAILED) {
+            madvise(map, pcapFile->fixedSize, MADV_SEQUENTIAL);
+            pcapFile->map = map;
+        }
+    }
 
 
     //Read the header and make sure we found the expected number of bytes.
-    int headerBytesRead =
-            read(pcapFile->fd, pcapFile->header, sizeof (pcap_header));
+    int headerBytesRead;
+
+    if (pcapFile->map) {
+        memcpy(pcapFile->header, pcapFile->map, sizeof (pcap_header));
+        headerBytesRead = sizeof (pcap_header);
+    } else {
+        headerBytesRead = readFully(pcapFile->fd, pcapFile->header,
+                sizeof (pcap_header));
+    }
 
     if (headerBytesRead != sizeof (pcap_header)) {
         fprintf(stderr, "During header read, read %d bytes but expected %d.\n",
@@ -37,6 +159,11 @@ int load(int fd, pcap_file* pcapFile, int fixedSize) {
         return 0;
     }
 
+    if (!pcapFile->map) {
+        pcapFile->buffer = malloc(READ_BUFFER_SIZE);
+        pcapFile->bufferSize = READ_BUFFER_SIZE;
+    }
+
 
     //Read the magic number and infer the precision from it.
     uint32_t mn = pcapFile->header->magic_number;
@@ -51,15 +178,21 @@ int load(int fd, pcap_file* pcapFile, int fixedSize) {
         case 0x4d3cb2a1:
             pcapFile->nanoResolution = 1;
         case 0xd4c3b2a1:
+            //Written on a machine of the other endian-ness.
             pcapFile->bytesNeedFlipping = 1;
-            //TODO: Basically, if the platform that the pcap was created on
-            //matches the platform endian-ness that we're reading it from, this
-            //won't be a problem.
-            //Otherwise, we'll need to do some extra work to flip bits.
-            fprintf(stderr,
-                    "Endian-flipped captures not supported yet.\n");
-            return 0;
-
+            flipFileHeader(pcapFile->header);
+            break;
+        case PCAPNG_MAGIC:
+            //The first "header" was really the start of the first section
+            //header block, which the block parser wants to see whole.
+            pcapFile->isNg = 1;
+            pcapFile->nanoResolution = 1;
+            pcapFile->bytesNeedFlipping = 0;
+            pcapFile->position = 0;
+            if (!pcapFile->map) {
+                memcpy(pcapFile->buffer, pcapFile->header, sizeof (pcap_header));
+                pcapFile->bufferEnd = sizeof (pcap_header);
+            }
             break;
         default:
             fprintf(stderr,
@@ -67,6 +200,21 @@ int load(int fd, pcap_file* pcapFile, int fixedSize) {
             return 0;
     }
 
+    //Everything that depends on the byte order and format is decided here,
+    //once. pcapng sections each say their own byte order, so those are left
+    //to the block parser.
+    if (pcapFile->bytesNeedFlipping) {
+        pcapFile->decodeRecord = decodeSwapped;
+        pcapFile->readBatch = readSwappedBatch;
+    } else {
+        pcapFile->decodeRecord = decodeNative;
+        pcapFile->readBatch = readNativeBatch;
+    }
+
+    if (pcapFile->isNg) {
+        pcapFile->readBatch = readNgBatch;
+    }
+
     return 1;
 }
 
@@ -76,67 +224,560 @@ int unload(pcap_file* pcapFile) {
     }
 
 
+    if (pcapFile->map) {
+        munmap(pcapFile->map, pcapFile->fixedSize);
+        pcapFile->map = NULL;
+    }
+
+    free(pcapFile->buffer);
+    pcapFile->buffer = NULL;
+    arenaFree(&(pcapFile->copies));
+
+    ngFree(pcapFile);
+
     free(pcapFile->header);
     return 1;
 
 }
 
+/**
+ * Mapped version of readPacket, for the record at `offset`: the header is
+ * decoded out (it's tiny and may be unaligned in the mapping) and the payload
+ * is a view into the mapping. Only reads the pcap_file, so any number of
+ * threads can do this at once.
+ */
+ALWAYS_INLINE int readMappedPacketAt(pcap_file* pcapFile, off_t offset,
+        pcap_packet* packet, int swapped) {
+    decodeHeader(pcapFile->map + offset, &(packet->header), swapped);
+
+    packet->payload.payloadSize = packet->header.incl_len;
+    if (packet->payload.payloadSize < 1) {
+        fprintf(stderr, "Packet length less than 1?\n");
+        return 0;
+    }
+
+    off_t dataStart = offset + sizeof (pcap_packet_header);
+
+    if (packet->payload.payloadSize > pcapFile->fixedSize - dataStart) {
+        fprintf(stderr, "Packet runs past the end of the file.\n");
+        return 0;
+    }
+
+    packet->payload.data = pcapFile->map + dataStart;
+    packet->payload.isView = 1;
+    packet->linkType = pcapFile->header->network;
+
+    return 1;
+}
+
+/**
+ * Reads the mapped record at the current position and moves past it.
+ */
+ALWAYS_INLINE int readMappedPacket(pcap_file* pcapFile, pcap_packet* packet,
+        int swapped) {
+    if (!readMappedPacketAt(pcapFile, pcapFile->position, packet, swapped)) {
+        return 0;
+    }
+
+    pcapFile->position += sizeof (pcap_packet_header)
+            + packet->payload.payloadSize;
+    return 1;
+}
+
+/**
+ * Slides any unconsumed bytes to the front of the read buffer and tops it up
+ * with a single read(). This invalidates views previously handed out from the
+ * buffer.
+ * 
+ * @return Number of bytes read, zero at (the current) end of file, negative on
+ * error.
+ */
+static ssize_t fillBuffer(pcap_file* pcapFile) {
+    size_t pending = pcapFile->bufferEnd - pcapFile->bufferStart;
+
+    if (pcapFile->bufferStart > 0) {
+        memmove(pcapFile->buffer, pcapFile->buffer + pcapFile->bufferStart,
+                pending);
+        pcapFile->bufferStart = 0;
+        pcapFile->bufferEnd = pending;
+    }
+
+    ssize_t got;
+    do {
+        got = read(pcapFile->fd, pcapFile->buffer + pcapFile->bufferEnd,
+                pcapFile->bufferSize - pcapFile->bufferEnd);
+    } while (got < 0 && errno == EINTR);
+
+    if (got > 0) {
+        pcapFile->bufferEnd += got;
+    } else if (got == 0 && pcapFile->isStream) {
+        pcapFile->streamEnded = 1;
+    }
+
+    return got;
+}
+
+/**
+ * Checks whether a complete record (header and data) is sitting in the read
+ * buffer.
+ * 
+ * @return 1 if so, 0 if more bytes are needed, -1 if the record header doesn't
+ * make sense.
+ */
+ALWAYS_INLINE int bufferedRecordReady(pcap_file* pcapFile, int swapped) {
+    size_t pending = pcapFile->bufferEnd - pcapFile->bufferStart;
+
+    if (pending < sizeof (pcap_packet_header)) {
+        return 0;
+    }
+
+    pcap_packet_header header;
+    decodeHeader(pcapFile->buffer + pcapFile->bufferStart, &header, swapped);
+    uint32_t inclLen = header.incl_len;
+
+    if (inclLen < 1) {
+        fprintf(stderr, "Packet length less than 1?\n");
+        return -1;
+    }
+
+    //Any record has to fit in the buffer once it's slid to the front.
+    if (inclLen > pcapFile->bufferSize - sizeof (pcap_packet_header)) {
+        fprintf(stderr, "Packet length %u is larger than the read buffer.\n",
+                inclLen);
+        return -1;
+    }
+
+    return pending >= sizeof (pcap_packet_header) + inclLen;
+}
+
+/**
+ * Like bufferedRecordReady, but goes back to the file once if the buffer has
+ * run dry.
+ */
+ALWAYS_INLINE int bufferedRecordAvailable(pcap_file* pcapFile,
+        int swapped) {
+    int ready = bufferedRecordReady(pcapFile, swapped);
+
+    if (ready == 0 && fillBuffer(pcapFile) > 0) {
+        ready = bufferedRecordReady(pcapFile, swapped);
+    }
+
+    return ready;
+}
+
+/**
+ * Slices the next record out of the read buffer as a view. Only call this
+ * once bufferedRecordReady has said there's a whole record.
+ */
+ALWAYS_INLINE void takeBufferedPacket(pcap_file* pcapFile,
+        pcap_packet* packet, int swapped) {
+    uint8_t* record = pcapFile->buffer + pcapFile->bufferStart;
+
+    decodeHeader(record, &(packet->header), swapped);
+    packet->payload.payloadSize = packet->header.incl_len;
+    packet->payload.data = record + sizeof (pcap_packet_header);
+    packet->payload.isView = 1;
+    packet->linkType = pcapFile->header->network;
+
+    size_t recordSize = sizeof (pcap_packet_header) + packet->header.incl_len;
+    pcapFile->bufferStart += recordSize;
+    pcapFile->position += recordSize;
+}
+
+/**
+ * The bytes not yet consumed: the rest of the mapping, or what's in the read
+ * buffer.
+ */
+static uint8_t* unreadBytes(pcap_file* pcapFile, size_t* available) {
+    if (pcapFile->map) {
+        *available = pcapFile->fixedSize - pcapFile->position;
+        return pcapFile->map + pcapFile->position;
+    }
+
+    *available = pcapFile->bufferEnd - pcapFile->bufferStart;
+    return pcapFile->buffer + pcapFile->bufferStart;
+}
+
+static void consumeBytes(pcap_file* pcapFile, size_t count) {
+    if (!pcapFile->map) {
+        pcapFile->bufferStart += count;
+    }
+    pcapFile->position += count;
+}
+
+/**
+ * Walks pcapng blocks, in place, up to the next packet. Section headers and
+ * interface descriptions on the way are taken in.
+ * 
+ * @param pcapFile The capture.
+ * @param packet Fill-in target (a view), or NULL to only check that there's
+ * a packet, leaving it unread.
+ * @param refill Whether the read buffer may be refilled, which invalidates
+ * views already handed out.
+ * @return 1 if there's a packet, 0 if not (yet), -1 if the file is corrupt.
+ */
+static int ngNextPacket(pcap_file* pcapFile, pcap_packet* packet, int refill) {
+    pcap_packet scratch;
+
+    for (;;) {
+        size_t available;
+        uint8_t* block = unreadBytes(pcapFile, &available);
+        uint32_t length = 0;
+        int known = ngBlockLength(pcapFile, block, available, &length);
+
+        if (known < 0) {
+            return -1;
+        }
+
+        if (known && !pcapFile->map && length > pcapFile->bufferSize) {
+            fprintf(stderr, "Block length %u is larger than the read buffer.\n",
+                    length);
+            return -1;
+        }
+
+        if (!known || available < length) {
+            if (refill && !pcapFile->map && fillBuffer(pcapFile) > 0) {
+                continue;
+            }
+            return 0;
+        }
+
+        ng_block kind = ngHandleBlock(pcapFile, block, length,
+                packet ? packet : &scratch);
+
+        if (kind == NG_BLOCK_BAD) {
+            return -1;
+        }
+
+        if (kind == NG_BLOCK_PACKET && packet == NULL) {
+            return 1;
+        }
+
+        consumeBytes(pcapFile, length);
+
+        if (kind == NG_BLOCK_PACKET) {
+            return 1;
+        }
+    }
+}
+
+/**
+ * readPacket's classic-capture step: the next record, straight into `packet`
+ * from a mapping, or as a view of the read buffer into `view`.
+ *
+ * @return Non-zero if there was a record.
+ */
+static int takeClassicPacket(pcap_file* pcapFile, pcap_packet* packet,
+        pcap_packet* view, int swapped) {
+    if (pcapFile->map) {
+        return more(pcapFile) && (swapped
+                ? readMappedPacket(pcapFile, packet, 1)
+                : readMappedPacket(pcapFile, packet, 0));
+    }
+
+    int ready = swapped ? bufferedRecordAvailable(pcapFile, 1)
+            : bufferedRecordAvailable(pcapFile, 0);
+    if (ready <= 0) {
+        return 0;
+    }
+
+    if (swapped) {
+        takeBufferedPacket(pcapFile, view, 1);
+    } else {
+        takeBufferedPacket(pcapFile, view, 0);
+    }
+    return 1;
+}
+
 int readPacket(pcap_file* pcapFile, pcap_packet* packet) {
-    if (!more(pcapFile))
+    pcap_packet view;
+
+    if (pcapFile->isNg) {
+        if (ngNextPacket(pcapFile, &view, 1) <= 0) {
+            return 0;
+        }
+        if (pcapFile->map) {
+            *packet = view;
+            return 1;
+        }
+    } else if (!takeClassicPacket(pcapFile, packet, &view,
+            pcapFile->bytesNeedFlipping)) {
         return 0;
+    } else if (pcapFile->map) {
+        return 1;
+    }
 
-    //Position of filestream should be on the next header. Read it and the data.
-    if (read(pcapFile->fd, &(packet->header), sizeof (pcap_packet_header))
-            != sizeof (pcap_packet_header)) {
-        fprintf(stderr,
-                "Hit EOF reading header, but should have seen it coming.\n");
+    //The buffer gets reused, so this caller gets its own copy of the data.
+    packet->header = view.header;
+    packet->linkType = view.linkType;
+    packet->payload.payloadSize = view.payload.payloadSize;
+    packet->payload.data = slabAlloc(packet->payload.payloadSize);
+    packet->payload.isView = 0;
+    if (packet->payload.data == NULL) {
         return 0;
     }
-    
+    memcpy(packet->payload.data, view.payload.data,
+            packet->payload.payloadSize);
+
+    return 1;
+}
+
+static int readNgBatch(pcap_file* pcapFile, pcap_packet* out, int max) {
+    int count = 0;
+
+    //Only the first packet may refill the buffer, the rest would invalidate
+    //the ones before them.
+    while (count < max) {
+        int got = ngNextPacket(pcapFile, &out[count], count == 0);
+
+        if (got < 0) {
+            return count ? count : -1;
+        }
+        if (got == 0) {
+            break;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * readPacketBatch for classic captures, written once and inlined into a
+ * reader per byte order (`swapped` is a constant in each), so the decoding is
+ * fixed in each.
+ */
+ALWAYS_INLINE int readClassicBatch(pcap_file* pcapFile, pcap_packet* out,
+        int max, int swapped) {
+    int count = 0;
+
+    if (pcapFile->map) {
+        while (count < max && pcapFile->position
+                + (off_t) sizeof (pcap_packet_header) <= pcapFile->fixedSize) {
+            if (!readMappedPacket(pcapFile, &out[count], swapped)) {
+                return count ? count : -1;
+            }
+            count++;
+        }
+
+        return count;
+    }
+
+    //Views from the last batch are still live until now, so this is the only
+    //point where the buffer may be refilled.
+    int ready = bufferedRecordAvailable(pcapFile, swapped);
+
+    while (ready > 0 && count < max) {
+        takeBufferedPacket(pcapFile, &out[count], swapped);
+        count++;
+        ready = bufferedRecordReady(pcapFile, swapped);
+    }
+
+    if (ready < 0 && count == 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+static int readNativeBatch(pcap_file* pcapFile, pcap_packet* out, int max) {
+    return readClassicBatch(pcapFile, out, max, 0);
+}
+
+static int readSwappedBatch(pcap_file* pcapFile, pcap_packet* out, int max) {
+    return readClassicBatch(pcapFile, out, max, 1);
+}
+
+int readPacketBatch(pcap_file* pcapFile, pcap_packet* out, int max) {
+    return pcapFile->readBatch(pcapFile, out, max);
+}
+
+int readPacketAt(pcap_file* pcapFile, off_t offset, pcap_packet* packet) {
+    //Blocks can't be read without the interfaces declared before them.
+    if (pcapFile->isNg) {
+        fprintf(stderr, "pcapng captures can only be read in order.\n");
+        return 0;
+    }
+
+    if (pcapFile->map) {
+        if (offset + (off_t) sizeof (pcap_packet_header)
+                > pcapFile->fixedSize) {
+            return 0;
+        }
+
+        return pcapFile->bytesNeedFlipping
+                ? readMappedPacketAt(pcapFile, offset, packet, 1)
+                : readMappedPacketAt(pcapFile, offset, packet, 0);
+    }
+
+    uint8_t raw[sizeof (pcap_packet_header)];
+
+    if (pread(pcapFile->fd, raw, sizeof (raw), offset) != sizeof (raw)) {
+        return 0;
+    }
+    decodeHeader(raw, &(packet->header), pcapFile->bytesNeedFlipping);
 
-    //Determine the length of this packet and allocate appropriately.
     packet->payload.payloadSize = packet->header.incl_len;
-    if (packet->payload.payloadSize < 1) {
-        fprintf(stderr, "Packet length less than 1?\n");
+    if (packet->payload.payloadSize < 1
+            || packet->payload.payloadSize > READ_BUFFER_SIZE) {
+        fprintf(stderr, "Unreasonable packet length at offset %lld.\n",
+                (long long) offset);
         return 0;
     }
 
-    packet->payload.data = malloc(packet->payload.payloadSize);
+    packet->payload.data = arenaAlloc(&(pcapFile->copies),
+            packet->payload.payloadSize);
+    packet->payload.isView = 1;
+    packet->linkType = pcapFile->header->network;
+    if (packet->payload.data == NULL) {
+        return 0;
+    }
 
-    if (read(pcapFile->fd, packet->payload.data, packet->payload.payloadSize)
-            != packet->payload.payloadSize) {
-        fprintf(stderr,
-                "Hit EOF reading data, but should have seen it coming.\n");
-        unloadPacket(packet);
+    if (pread(pcapFile->fd, packet->payload.data, packet->payload.payloadSize,
+            offset + sizeof (pcap_packet_header))
+            != (ssize_t) packet->payload.payloadSize) {
+        packet->payload.data = NULL;
         return 0;
     }
 
     return 1;
 }
 
+void releasePackets(pcap_file* pcapFile) {
+    arenaReset(&(pcapFile->copies));
+}
+
+/**
+ * Whether a record header looks like one this file would contain.
+ */
+static int plausibleRecord(pcap_file* pcapFile,
+        const pcap_packet_header* header) {
+    uint32_t maxFraction = pcapFile->nanoResolution ? 1000000000 : 1000000;
+
+    return header->incl_len >= 1
+            && header->incl_len <= RESYNC_MAX_LENGTH
+            && header->incl_len <= header->orig_len
+            && header->orig_len <= RESYNC_MAX_ORIGINAL
+            && header->ts_usec < maxFraction;
+}
+
+off_t findRecordBoundary(pcap_file* pcapFile, off_t from, off_t limit) {
+    off_t candidate;
+
+    //Only a mapping can be looked around in.
+    if (pcapFile->isNg || pcapFile->map == NULL) {
+        return -1;
+    }
+
+    for (candidate = from; candidate < limit; candidate++) {
+        off_t position = candidate;
+        uint32_t firstSeconds = 0;
+        int chained = 0;
+
+        while (chained < RESYNC_CHAIN) {
+            //Running exactly into the end of the file is as good as it gets.
+            if (position == pcapFile->fixedSize && chained > 0) {
+                break;
+            }
+            if (position + (off_t) sizeof (pcap_packet_header)
+                    > pcapFile->fixedSize) {
+                chained = -1;
+                break;
+            }
+
+            pcap_packet_header header;
+            pcapFile->decodeRecord(pcapFile->map + position, &header);
+
+            if (!plausibleRecord(pcapFile, &header)) {
+                chained = -1;
+                break;
+            }
+
+            if (chained == 0) {
+                firstSeconds = header.ts_sec;
+            } else if (header.ts_sec - firstSeconds + RESYNC_TIME_SLACK
+                    > 2 * RESYNC_TIME_SLACK) {
+                chained = -1;
+                break;
+            }
+
+            position += sizeof (pcap_packet_header) + header.incl_len;
+            chained++;
+        }
+
+        if (chained > 0) {
+            return candidate;
+        }
+    }
+
+    return -1;
+}
+
 int unloadPacket(pcap_packet* packet) {
     if (packet == NULL)
         return 0;
 
+    //Views into a mapping are owned by the pcap_file, nothing to free.
+    if (!packet->payload.isView) {
+        slabFree(packet->payload.data);
+    }
 
-    free(packet->payload.data);
+    packet->payload.data = NULL;
     return 1;
 }
 
-int more(pcap_file* pcapFile) {
-    off_t cur = lseek(pcapFile->fd, 0, SEEK_CUR);
+int retainPacket(pcap_file* pcapFile, pcap_packet* packet) {
+    if (!packet->payload.isView || pcapFile->map != NULL) {
+        return 1;
+    }
 
+    uint8_t* copy = slabAlloc(packet->payload.payloadSize);
+    if (copy == NULL) {
+        return 0;
+    }
+
+    memcpy(copy, packet->payload.data, packet->payload.payloadSize);
+    packet->payload.data = copy;
+    packet->payload.isView = 0;
+    return 1;
+}
 
-    //Speed optimization if the file isn't going to grow.
+int more(pcap_file* pcapFile) {
+    if (pcapFile->isNg) {
+        return ngNextPacket(pcapFile, NULL, 1) > 0;
+    }
+
+    //Speed optimization if the file isn't going to grow: we track our own
+    //position, so no syscalls at all.
     if (pcapFile->fixedSize) {
-        return cur != pcapFile->fixedSize;
+        return pcapFile->position + (off_t) sizeof (pcap_packet_header)
+                <= pcapFile->fixedSize;
     }
 
-    //Otherwise, we have to find the end of the file every time.
-    off_t end = lseek(pcapFile->fd, 0, SEEK_END);
+    //Otherwise, see whether a whole record is buffered, reading more of the
+    //file only if it isn't.
+    return pcapFile->bytesNeedFlipping
+            ? bufferedRecordAvailable(pcapFile, 1) > 0
+            : bufferedRecordAvailable(pcapFile, 0) > 0;
+}
+
+int seekRecord(pcap_file* pcapFile, off_t position) {
+    struct stat info;
 
-    //And restore the position.
-    lseek(pcapFile->fd, cur, SEEK_SET);
+    if (pcapFile->isStream || fstat(pcapFile->fd, &info) != 0
+            || position > info.st_size) {
+        return 0;
+    }
 
-    return (cur != end);
-}
\ No newline at end of file
+    //Whatever is buffered is from before the record, so it goes.
+    if (!pcapFile->map) {
+        if (lseek(pcapFile->fd, position, SEEK_SET) != position) {
+            return 0;
+        }
+        pcapFile->bufferStart = 0;
+        pcapFile->bufferEnd = 0;
+    }
+
+    pcapFile->position = position;
+    return 1;
+}
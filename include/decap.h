@@ -18,12 +18,26 @@ extern "C" {
      * This function sets the file position to be pointing at the first packet
      * header (immediately following the pcap file header).
      * 
+     * pcapng captures are recognised too and read through the same functions:
+     * their blocks are parsed as packets are read, interface by interface
+     * (each with its own link type and timestamp resolution; timestamps come
+     * out in nanoseconds). They can only be read in order, though - not
+     * through readPacketAt or findRecordBoundary.
+     * 
+     * The descriptor may also be a pipe or socket (tcpdump -w - on stdin, a
+     * FIFO), which is read strictly in order and never seeked or mapped, so
+     * fixedSize makes no difference to it. If it's non-blocking, reads that
+     * would block just find no packets yet; streamEnded is set once the
+     * writer has gone away.
+     * 
      * @param fd An open file descriptor to a pcap file.
      * @param pcapFile Fill-in target.
      * @param fixedSize If this file is not expected to grow in size. This will
      * speed up operations like more() since we can record the file size at the
      * initial opening instead of seeking to the end every time. Set to 0 if
      * this file is live (being appended to), otherwise set to non-zero.
+     * Fixed-size files are memory-mapped where possible, and packets read
+     * from them are views into the mapping rather than copies.
      * @return Non-zero if success (no errors reading and seems like a valid
      * file), zero otherwise.
      */
@@ -50,7 +64,9 @@ extern "C" {
      * 
      * The packetData struct will have its data field allocated on the heap - it
      * is your responsibility to free this memory by calling `unloadPacket` on
-     * the pcap_packet struct.
+     * the pcap_packet struct. If the file is memory-mapped, the data is instead
+     * a view into the mapping (payload.isView is set), valid until the file is
+     * unloaded; `unloadPacket` is then a no-op and may be skipped.
      * 
      * @param pcapFile The pcap to read from.
      * @param packetHeader Handle to put the packet header.
@@ -60,24 +76,106 @@ extern "C" {
      */
     int readPacket(pcap_file* pcapFile, pcap_packet* packet);
 
+    /**
+     * Reads up to `max` packets in one go. Unlike readPacket, the packets are
+     * always views (payload.isView is set): into the mapping for fixed-size
+     * files, or into the pcap_file's read buffer otherwise. Buffered views are
+     * only valid until the next call to readPacketBatch, readPacket or more on
+     * this file, so finish with a batch before asking for the next one.
+     * 
+     * The file is only read from when the buffer doesn't hold a complete
+     * record, and then with a single large read(), so a growing capture is
+     * drained in bulk.
+     * 
+     * @param pcapFile The pcap to read from.
+     * @param out Array of at least `max` packets to fill in.
+     * @param max Most packets to return.
+     * @return Number of packets read (zero if none are available right now),
+     * or negative if the file is corrupt or can't be read.
+     */
+    int readPacketBatch(pcap_file* pcapFile, pcap_packet* out, int max);
+
+    /**
+     * Reads the packet whose record starts at this offset in the file (as
+     * found in a packet index), without disturbing sequential reading. The
+     * packet is always a view: into the mapping, or for files that aren't
+     * mapped into memory the pcap_file keeps for it until releasePackets. On
+     * a mapped file any number of threads can do this at once.
+     * 
+     * @param pcapFile The pcap to read from.
+     * @param offset File offset of the packet's record header.
+     * @param packet Fill-in target.
+     * @return Non-zero on success, zero if there's no sensible record there.
+     */
+    int readPacketAt(pcap_file* pcapFile, off_t offset, pcap_packet* packet);
+
+    /**
+     * Lets go, all at once, of the packets readPacketAt read in since the last
+     * time. Call it between batches, once they're done with (or retained).
+     * 
+     * @param pcapFile The pcap they were read from.
+     */
+    void releasePackets(pcap_file* pcapFile);
+
+    /**
+     * Looks for where a record starts in a mapped file, given an offset that
+     * may be anywhere (in the middle of a record, say). A candidate has to
+     * be followed by a chain of records whose lengths and timestamps all make
+     * sense, and which fit the file exactly. That's a good guess, not a
+     * guarantee - payloads can look like anything.
+     * 
+     * @param pcapFile The pcap, mapped.
+     * @param from First offset to try.
+     * @param limit Stop looking here.
+     * @return The offset of the first likely record in [from, limit), or -1
+     * if there isn't one (or the file isn't mapped).
+     */
+    off_t findRecordBoundary(pcap_file* pcapFile, off_t from, off_t limit);
+
     /**
      * Unloads the packet payload referenced by this packet. Make sure to only
      * pass initialized packets with actual payload, otherwise you'll free non-
-     * allocated memory.
+     * allocated memory. Packets that are views into a mapping are left alone.
      * 
      * @param packetHeader The header whose payload to free.
      * @return Non-zero on success.
      */
     int unloadPacket(pcap_packet* packet);
 
+    /**
+     * Makes sure a packet from readPacketBatch stays valid after the next
+     * read, by copying a view into the read buffer (or from readPacketAt) into
+     * memory of its own, freed by unloadPacket as usual. Views into a mapping already live as
+     * long as the file is loaded and are left alone.
+     * 
+     * @param pcapFile The pcap the packet came from.
+     * @param packet The packet.
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int retainPacket(pcap_file* pcapFile, pcap_packet* packet);
+
     /**
      * Whether there's another packet available from this stream without hitting
-     * EOF.
+     * EOF. For files that aren't mapped this may refill the read buffer, which
+     * invalidates views from an earlier readPacketBatch.
      * @param pcapFile The pcap_file handle.
      * @return Non-zero if packet available, zero otherwise.
      */
     int more(pcap_file* pcapFile);
 
+    /**
+     * Carries on sequential reading from a record (pcapng: block) whose
+     * offset was saved from `position` earlier, skipping everything before
+     * it. A pcapng capture also needs the section's byte order and
+     * interfaces from then put back (see ngRestoreSection). Streams can't
+     * do this.
+     * 
+     * @param pcapFile The pcap, loaded.
+     * @param position Where the record starts.
+     * @return Non-zero on success, zero if the file doesn't reach that far.
+     */
+    int seekRecord(pcap_file* pcapFile, off_t position);
+
 
 #ifdef	__cplusplus
 }
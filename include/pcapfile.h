@@ -2,6 +2,9 @@
 #define	PCAPFILE_H
 
 #include <stdint.h>
+#include <sys/types.h>
+
+#include "slab.h"
 
 
 #ifdef	__cplusplus
@@ -9,6 +12,13 @@ extern "C" {
 #endif
 
 #define MTU 1500 /* This shouldn't change but it could in the far future. */
+#define READ_BUFFER_SIZE (1 << 20) /* Files that can't be mapped are read()
+                                    * in chunks of about this size. */
+#define LINKTYPE_ETHERNET 1 /* Link types (pcap_header.network) we read. */
+#define LINKTYPE_RAW 101 /* Bare IPv4 or IPv6. */
+#define LINKTYPE_LINUX_SLL 113 /* Linux "cooked" capture. */
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
 
     /*
      * A lot of this is documented in the Wireshark development pages.
@@ -25,24 +35,20 @@ extern "C" {
         uint32_t network; /* data link type */
     } pcap_header;
 
+    /* What a pcapng Interface Description Block says about its interface. */
     typedef struct {
-        int fd;
-        int bytesNeedFlipping; /* If the file was created on a platform whose
-                                * endian-ness is opposite to this one, in which
-                                * case any field reads need to be flipped. */
-        int nanoResolution; /* Otherwise, microseconds only. */
-        off_t fixedSize; /* Zero if this file may be appended to, otherwise the
-                           * static size of this file - useful for functions
-                           * like more() which would otherwise have to seek to
-                           * the end of the file every time to determine if 
-                           * there are more bytes to be read. Otherwise, set
-                           * this size to the length of the file in bytes. */
-        pcap_header* header;
-    } pcap_file;
+        uint16_t linkType;
+        uint32_t snapLen;
+        uint8_t tsResolution; /* if_tsresol: units of 10^-n seconds, or of
+                               * 2^-n if the top bit is set. */
+        int64_t tsOffset; /* if_tsoffset: seconds to add to timestamps. */
+    } pcapng_interface;
 
     typedef struct {
         uint32_t payloadSize;
         uint8_t* data;
+        int isView; /* Non-zero if data points into memory owned by the reader
+                     * (e.g. a file mapping) rather than its own allocation. */
     } pcap_packet_data;
 
     typedef struct {
@@ -59,8 +65,66 @@ extern "C" {
     typedef struct {
         pcap_packet_header header;
         pcap_packet_data payload; 
+        uint32_t linkType; /* How to read the data: LINKTYPE_ETHERNET etc. */
     } pcap_packet;
 
+    typedef struct pcap_file pcap_file;
+
+    /* Turns a record header as stored in a file into a native one. */
+    typedef void (*pcap_record_decoder)(const uint8_t* raw,
+            pcap_packet_header* header);
+
+    /* Reads up to max packets, as readPacketBatch. */
+    typedef int (*pcap_batch_reader)(pcap_file* pcapFile, pcap_packet* out,
+            int max);
+
+    struct pcap_file {
+        int fd;
+        int isNg; /* pcapng rather than classic libpcap. */
+        int bytesNeedFlipping; /* If the file was created on a platform whose
+                                * endian-ness is opposite to this one, in which
+                                * case any field reads need to be flipped.
+                                * pcapng: for the current section. */
+        int nanoResolution; /* Otherwise, microseconds only. Packets from
+                             * pcapng files always come out in nanoseconds. */
+        off_t fixedSize; /* Zero if this file may be appended to, otherwise the
+                           * static size of this file - useful for functions
+                           * like more() which would otherwise have to seek to
+                           * the end of the file every time to determine if 
+                           * there are more bytes to be read. Otherwise, set
+                           * this size to the length of the file in bytes. */
+        int isStream; /* A pipe or socket (stdin from tcpdump -w -, a FIFO):
+                       * never seeked or mapped, only read() front to back. */
+        int streamEnded; /* Set once a stream's writer has gone away, so no
+                          * more is coming. */
+        pcap_header* header;
+        uint8_t* map; /* For fixed-size files, the whole file mapped read-only
+                       * into memory (NULL if mapping wasn't possible, in which
+                       * case we fall back to read()). Packets read from a
+                       * mapped file point straight into this mapping. */
+        off_t position; /* Offset of the next packet header (pcapng: block)
+                         * in the file. */
+        uint8_t* buffer; /* For files that aren't mapped, a large read buffer
+                          * that packets are sliced out of. A record that
+                          * straddles the end of the buffer is slid to the
+                          * front on the next refill. */
+        size_t bufferSize; /* Capacity of the buffer. */
+        size_t bufferStart; /* Offset of the first unconsumed buffer byte. */
+        size_t bufferEnd; /* Offset one past the last valid buffer byte. */
+        pcapng_interface* interfaces; /* pcapng: the current section's
+                                       * interfaces, by id. */
+        uint32_t interfaceCount;
+        uint32_t interfaceCapacity;
+        slab_arena copies; /* Packets readPacketAt had to read in from a file
+                            * that isn't mapped, until releasePackets. */
+        pcap_record_decoder decodeRecord; /* Record headers in this file's
+                                           * byte order. */
+        pcap_batch_reader readBatch; /* readPacketBatch for this file's format
+                                      * and byte order. Both are picked once by
+                                      * load(), so reading never has to look
+                                      * at the flags above. */
+    };
+
 
 #ifdef	__cplusplus
 }
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcapng.h"
+
+#define NG_BLOCK_IDB 0x00000001 /* Interface Description */
+#define NG_BLOCK_PB 0x00000002 /* Packet (obsolete, but still around) */
+#define NG_BLOCK_SPB 0x00000003 /* Simple Packet */
+#define NG_BLOCK_EPB 0x00000006 /* Enhanced Packet */
+
+#define NG_OPTION_END 0
+#define NG_OPTION_TSRESOL 9
+#define NG_OPTION_TSOFFSET 14
+
+#define NG_DEFAULT_TSRESOL 6 /* Microseconds. */
+
+/*
+ * Field readers, for a section in this machine's byte order or the other.
+ * They're inlined into block parsing that's been told which, so there's no
+ * checking of the order per field.
+ */
+static inline uint32_t read32(const uint8_t* data, int swapped) {
+    uint32_t value;
+    memcpy(&value, data, sizeof (value));
+    return swapped ? __builtin_bswap32(value) : value;
+}
+
+static inline uint16_t read16(const uint8_t* data, int swapped) {
+    uint16_t value;
+    memcpy(&value, data, sizeof (value));
+    return swapped ? __builtin_bswap16(value) : value;
+}
+
+static inline uint64_t read64(const uint8_t* data, int swapped) {
+    uint64_t value;
+    memcpy(&value, data, sizeof (value));
+    return swapped ? __builtin_bswap64(value) : value;
+}
+
+int ngBlockLength(const pcap_file* pcapFile, const uint8_t* data,
+        size_t available, uint32_t* length) {
+    int swapped = pcapFile->bytesNeedFlipping;
+
+    if (available < 8) {
+        return 0;
+    }
+
+    //A section header starts a new byte order, which it gives after its
+    //length.
+    if (read32(data, 0) == PCAPNG_MAGIC) {
+        if (available < 12) {
+            return 0;
+        }
+        swapped = read32(data + 8, 0) == PCAPNG_BYTE_ORDER_FLIPPED;
+    }
+
+    *length = read32(data + 4, swapped);
+
+    //Type, length, and the length again at the end, all 32-bit aligned.
+    if (*length < 12 || *length % 4 != 0) {
+        fprintf(stderr, "Block length %u doesn't make sense.\n", *length);
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Converts a timestamp in an interface's units to seconds and nanoseconds.
+ */
+static void ngTimestamp(const pcapng_interface* interface, uint64_t units,
+        pcap_packet_header* header) {
+    uint8_t exponent = interface->tsResolution & 0x7F;
+    uint64_t seconds;
+    uint64_t nanos;
+
+    if (interface->tsResolution & 0x80) {
+        //Fractions of a power of two.
+        uint64_t mask = exponent >= 64 ? ~0ULL : (1ULL << exponent) - 1;
+        seconds = exponent >= 64 ? 0 : units >> exponent;
+        nanos = (uint64_t) (((unsigned __int128) (units & mask) * 1000000000)
+                >> exponent);
+    } else {
+        uint64_t perSecond = 1;
+        int i;
+
+        for (i = 0; i < exponent && i < 19; i++) {
+            perSecond *= 10;
+        }
+
+        seconds = units / perSecond;
+        nanos = units % perSecond;
+
+        //Scale the fraction to nanoseconds.
+        for (i = exponent; i < 9; i++) {
+            nanos *= 10;
+        }
+        for (i = 9; i < exponent && i < 19; i++) {
+            nanos /= 10;
+        }
+    }
+
+    header->ts_sec = seconds + interface->tsOffset;
+    header->ts_usec = nanos;
+}
+
+static ng_block ngSectionHeader(pcap_file* pcapFile, const uint8_t* block,
+        uint32_t length) {
+    if (length < 28) {
+        fprintf(stderr, "Section header block too short.\n");
+        return NG_BLOCK_BAD;
+    }
+
+    uint32_t byteOrder = read32(block + 8, 0);
+
+    if (byteOrder != PCAPNG_BYTE_ORDER_MAGIC
+            && byteOrder != PCAPNG_BYTE_ORDER_FLIPPED) {
+        fprintf(stderr, "This isn't a pcapng section.\n");
+        return NG_BLOCK_BAD;
+    }
+
+    //Everything up to the next section is in this one's byte order.
+    int swapped = byteOrder == PCAPNG_BYTE_ORDER_FLIPPED;
+    uint16_t version = read16(block + 12, swapped);
+
+    if (version != 1) {
+        fprintf(stderr, "Unsupported pcapng version %u.\n", version);
+        return NG_BLOCK_BAD;
+    }
+
+    pcapFile->bytesNeedFlipping = swapped;
+
+    //Interface ids start again in every section.
+    pcapFile->interfaceCount = 0;
+    return NG_BLOCK_OTHER;
+}
+
+static inline ng_block ngInterface(pcap_file* pcapFile,
+        const uint8_t* block, uint32_t length, int swapped) {
+    if (length < 20) {
+        fprintf(stderr, "Interface description block too short.\n");
+        return NG_BLOCK_BAD;
+    }
+
+    if (pcapFile->interfaceCount == pcapFile->interfaceCapacity) {
+        uint32_t capacity = pcapFile->interfaceCapacity
+                ? pcapFile->interfaceCapacity * 2 : 4;
+        pcapng_interface* grown = realloc(pcapFile->interfaces,
+                capacity * sizeof (pcapng_interface));
+
+        if (grown == NULL) {
+            return NG_BLOCK_BAD;
+        }
+        pcapFile->interfaces = grown;
+        pcapFile->interfaceCapacity = capacity;
+    }
+
+    pcapng_interface* interface =
+            &(pcapFile->interfaces[pcapFile->interfaceCount++]);
+    interface->linkType = read16(block + 8, swapped);
+    interface->snapLen = read32(block + 12, swapped);
+    interface->tsResolution = NG_DEFAULT_TSRESOL;
+    interface->tsOffset = 0;
+
+    //Options run up to the trailing length.
+    const uint8_t* option = block + 16;
+    const uint8_t* end = block + length - 4;
+
+    while (option + 4 <= end) {
+        uint16_t code = read16(option, swapped);
+        uint16_t optionLength = read16(option + 2, swapped);
+        const uint8_t* value = option + 4;
+
+        if (code == NG_OPTION_END || value + optionLength > end) {
+            break;
+        }
+
+        if (code == NG_OPTION_TSRESOL && optionLength >= 1) {
+            interface->tsResolution = value[0];
+        } else if (code == NG_OPTION_TSOFFSET && optionLength >= 8) {
+            interface->tsOffset = (int64_t) read64(value, swapped);
+        }
+
+        option = value + ((optionLength + 3) & ~3);
+    }
+
+    return NG_BLOCK_OTHER;
+}
+
+/**
+ * Looks up the interface a packet block names.
+ */
+static const pcapng_interface* ngPacketInterface(pcap_file* pcapFile,
+        uint32_t id) {
+    if (id >= pcapFile->interfaceCount) {
+        fprintf(stderr, "Packet from undeclared interface %u.\n", id);
+        return NULL;
+    }
+    return &(pcapFile->interfaces[id]);
+}
+
+/**
+ * Fills in a packet from the parts of a block. The data has to be checked
+ * to lie inside the block already.
+ */
+static ng_block ngPacket(const pcapng_interface* interface, uint64_t units,
+        const uint8_t* data, uint32_t captured, uint32_t original,
+        pcap_packet* packet) {
+    //Nothing to look at.
+    if (captured < 1) {
+        return NG_BLOCK_OTHER;
+    }
+
+    ngTimestamp(interface, units, &(packet->header));
+    packet->header.incl_len = captured;
+    packet->header.orig_len = original;
+    packet->payload.payloadSize = captured;
+    packet->payload.data = (uint8_t*) data;
+    packet->payload.isView = 1;
+    packet->linkType = interface->linkType;
+    return NG_BLOCK_PACKET;
+}
+
+/**
+ * ngHandleBlock, for blocks other than section headers, in the given byte
+ * order.
+ */
+static inline ng_block handleBlock(pcap_file* pcapFile, const uint8_t* block,
+        uint32_t length, pcap_packet* packet, int swapped) {
+    uint32_t type = read32(block, swapped);
+    const pcapng_interface* interface;
+
+    switch (type) {
+        case NG_BLOCK_IDB:
+            return ngInterface(pcapFile, block, length, swapped);
+
+        case NG_BLOCK_EPB:
+        case NG_BLOCK_PB:
+        {
+            if (length < 32) {
+                fprintf(stderr, "Packet block too short.\n");
+                return NG_BLOCK_BAD;
+            }
+
+            //The old Packet Block has a 16-bit interface id and a drop count
+            //where the Enhanced one has a 32-bit id.
+            uint32_t id = type == NG_BLOCK_EPB
+                    ? read32(block + 8, swapped) : read16(block + 8, swapped);
+            uint64_t units = ((uint64_t) read32(block + 12, swapped) << 32)
+                    | read32(block + 16, swapped);
+            uint32_t captured = read32(block + 20, swapped);
+
+            if (captured > length - 32) {
+                fprintf(stderr, "Packet runs past the end of its block.\n");
+                return NG_BLOCK_BAD;
+            }
+
+            interface = ngPacketInterface(pcapFile, id);
+            if (interface == NULL) {
+                return NG_BLOCK_BAD;
+            }
+
+            return ngPacket(interface, units, block + 28, captured,
+                    read32(block + 24, swapped), packet);
+        }
+
+        case NG_BLOCK_SPB:
+        {
+            if (length < 16) {
+                fprintf(stderr, "Packet block too short.\n");
+                return NG_BLOCK_BAD;
+            }
+
+            interface = ngPacketInterface(pcapFile, 0);
+            if (interface == NULL) {
+                return NG_BLOCK_BAD;
+            }
+
+            //No captured length: it's whatever of the packet fits in the
+            //block (and the snap length).
+            uint32_t original = read32(block + 8, swapped);
+            uint32_t captured = original;
+
+            if (captured > length - 16) {
+                captured = length - 16;
+            }
+            if (interface->snapLen && captured > interface->snapLen) {
+                captured = interface->snapLen;
+            }
+
+            //No timestamp either.
+            return ngPacket(interface, 0, block + 12, captured, original,
+                    packet);
+        }
+
+        default:
+            //Name resolution, statistics, custom blocks...
+            return NG_BLOCK_OTHER;
+    }
+}
+
+ng_block ngHandleBlock(pcap_file* pcapFile, const uint8_t* block,
+        uint32_t length, pcap_packet* packet) {
+    //The section header type reads the same either way round.
+    if (read32(block, 0) == PCAPNG_MAGIC) {
+        return ngSectionHeader(pcapFile, block, length);
+    }
+
+    if (pcapFile->bytesNeedFlipping) {
+        return handleBlock(pcapFile, block, length, packet, 1);
+    }
+    return handleBlock(pcapFile, block, length, packet, 0);
+}
+
+int ngRestoreSection(pcap_file* pcapFile, int swapped,
+        const pcapng_interface* interfaces, uint32_t count) {
+    ngFree(pcapFile);
+    pcapFile->bytesNeedFlipping = swapped;
+
+    if (count == 0) {
+        return 1;
+    }
+
+    pcapFile->interfaces = malloc(count * sizeof (pcapng_interface));
+    if (pcapFile->interfaces == NULL) {
+        return 0;
+    }
+
+    memcpy(pcapFile->interfaces, interfaces, count * sizeof (pcapng_interface));
+    pcapFile->interfaceCount = count;
+    pcapFile->interfaceCapacity = count;
+    return 1;
+}
+
+void ngFree(pcap_file* pcapFile) {
+    free(pcapFile->interfaces);
+    pcapFile->interfaces = NULL;
+    pcapFile->interfaceCount = 0;
+    pcapFile->interfaceCapacity = 0;
+}
@@ -0,0 +1,84 @@
+/* 
+ * File:   pcapng.h
+ *
+ * Block parsing for pcapng captures. The reading itself (mapping, buffering)
+ * is done by decap.c, which hands over whole blocks where they lie in memory.
+ * The format is described in the IETF draft, draft-ietf-opsawg-pcapng.
+ */
+
+#ifndef PCAPNG_H
+#define	PCAPNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pcapfile.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define PCAPNG_MAGIC 0x0A0D0D0A /* Section Header Block type, which reads
+                                 * the same in either byte order. */
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_BYTE_ORDER_FLIPPED 0x4D3C2B1A
+
+    typedef enum {
+        NG_BLOCK_PACKET, /* A packet, filled in as a view into the block. */
+        NG_BLOCK_OTHER, /* Dealt with (or of no interest), no packet. */
+        NG_BLOCK_BAD /* Makes no sense, give up on the file. */
+    } ng_block;
+
+    /**
+     * Reads the length of the block at the start of some bytes.
+     * 
+     * @param pcapFile The capture, for the current section's byte order.
+     * @param data Where the block starts.
+     * @param available How many bytes are there.
+     * @param length Fill-in target: the whole block's length.
+     * @return 1 if the length is known, 0 if more bytes are needed to tell,
+     * -1 if it can't be a block.
+     */
+    int ngBlockLength(const pcap_file* pcapFile, const uint8_t* data,
+            size_t available, uint32_t* length);
+
+    /**
+     * Takes in one whole block: section headers and interface descriptions
+     * update the pcap_file, packets are returned.
+     * 
+     * @param pcapFile The capture.
+     * @param block The block.
+     * @param length Its length, as given by ngBlockLength.
+     * @param packet Fill-in target for a packet block. Its data points into
+     * the block, which also has to stay put as long as the packet is used.
+     * @return What kind of block it was.
+     */
+    ng_block ngHandleBlock(pcap_file* pcapFile, const uint8_t* block,
+            uint32_t length, pcap_packet* packet);
+
+    /**
+     * Puts back the state of a section, as it was at some block of it, so
+     * reading can carry on from there (see seekRecord).
+     * 
+     * @param pcapFile The capture.
+     * @param swapped Whether the section is in the other byte order.
+     * @param interfaces Its interfaces (copied).
+     * @param count How many.
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int ngRestoreSection(pcap_file* pcapFile, int swapped,
+            const pcapng_interface* interfaces, uint32_t count);
+
+    /**
+     * Forgets the capture's interfaces.
+     * 
+     * @param pcapFile The capture.
+     */
+    void ngFree(pcap_file* pcapFile);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PCAPNG_H */
@@ -0,0 +1,356 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "slab.h"
+
+#define SLAB_LARGE SLAB_CLASSES /* Class of blocks that came from malloc. */
+
+/* Block sizes, not counting the block header: small segments, a full
+ * Ethernet frame with room to spare, a 9000-byte jumbo frame, and a
+ * coalesced (GRO/TSO) segment of up to 64 KB. */
+static const size_t classSizes[SLAB_CLASSES] = {
+    256, 2048, 4096, 9216 + 256, 65536 + 256
+};
+
+/* Sits in front of every block. 16 bytes, so blocks stay 16-byte aligned. */
+typedef struct {
+    uint64_t sizeClass;
+    uint64_t reserved;
+} block_header;
+
+/* What a free block holds, past its header. */
+typedef struct free_block {
+    struct free_block* next;
+} free_block;
+
+typedef struct thread_cache {
+    free_block* lists[SLAB_CLASSES];
+    uint32_t counts[SLAB_CLASSES];
+    slab_stats stats; /* Only written by the owning thread. */
+    struct thread_cache* prev; /* All live caches, so stats can be */
+    struct thread_cache* next; /* added up. */
+} thread_cache;
+
+/* Free blocks no thread is holding on to, per class. */
+static struct {
+    free_block* lists[SLAB_CLASSES];
+    uint32_t counts[SLAB_CLASSES];
+    thread_cache* caches;
+    slab_stats retired; /* Counters of threads that have exited, and of */
+    pthread_mutex_t lock; /* slabs (which are carved under the lock). */
+} depot = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static __thread thread_cache* localCache;
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Counts something in the calling thread's stats. Only the owner writes, but
+ * slabGetStats reads from other threads, hence the atomic store.
+ */
+static inline void bump(uint64_t* counter) {
+    __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static void addStats(slab_stats* total, const slab_stats* stats) {
+    total->allocations += __atomic_load_n(&(stats->allocations),
+            __ATOMIC_RELAXED);
+    total->cacheHits += __atomic_load_n(&(stats->cacheHits),
+            __ATOMIC_RELAXED);
+    total->depotRefills += __atomic_load_n(&(stats->depotRefills),
+            __ATOMIC_RELAXED);
+    total->largeAllocations += __atomic_load_n(&(stats->largeAllocations),
+            __ATOMIC_RELAXED);
+    total->frees += __atomic_load_n(&(stats->frees), __ATOMIC_RELAXED);
+    total->slabs += stats->slabs;
+    total->slabBytes += stats->slabBytes;
+    total->arenaResets += __atomic_load_n(&(stats->arenaResets),
+            __ATOMIC_RELAXED);
+}
+
+/**
+ * Moves up to `count` blocks from one free list to another.
+ */
+static uint32_t moveBlocks(free_block** from, free_block** to,
+        uint32_t count) {
+    uint32_t moved = 0;
+
+    while (moved < count && *from != NULL) {
+        free_block* block = *from;
+        *from = block->next;
+        block->next = *to;
+        *to = block;
+        moved++;
+    }
+    return moved;
+}
+
+/**
+ * Gives an exiting thread's blocks to the depot and keeps its counters.
+ */
+static void retireCache(void* arg) {
+    thread_cache* cache = arg;
+    int i;
+
+    pthread_mutex_lock(&(depot.lock));
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        depot.counts[i] += moveBlocks(&(cache->lists[i]), &(depot.lists[i]),
+                cache->counts[i]);
+    }
+    addStats(&(depot.retired), &(cache->stats));
+
+    if (cache->prev) {
+        cache->prev->next = cache->next;
+    } else {
+        depot.caches = cache->next;
+    }
+    if (cache->next) {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&(depot.lock));
+
+    free(cache);
+}
+
+static void createCacheKey(void) {
+    pthread_key_create(&cacheKey, retireCache);
+}
+
+/**
+ * The calling thread's cache, set up on first use.
+ */
+static thread_cache* getCache(void) {
+    if (localCache != NULL) {
+        return localCache;
+    }
+
+    thread_cache* cache = calloc(1, sizeof (thread_cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    pthread_once(&cacheKeyOnce, createCacheKey);
+    pthread_setspecific(cacheKey, cache);
+
+    pthread_mutex_lock(&(depot.lock));
+    cache->next = depot.caches;
+    if (depot.caches) {
+        depot.caches->prev = cache;
+    }
+    depot.caches = cache;
+    pthread_mutex_unlock(&(depot.lock));
+
+    localCache = cache;
+    return cache;
+}
+
+/**
+ * Refills a thread's list for one class from the depot, carving a new slab
+ * if the depot has nothing spare.
+ * 
+ * @return Non-zero if the list has blocks now.
+ */
+static int refill(thread_cache* cache, int sizeClass) {
+    pthread_mutex_lock(&(depot.lock));
+
+    if (depot.counts[sizeClass] == 0) {
+        size_t blockSize = sizeof (block_header) + classSizes[sizeClass];
+        size_t blocks = SLAB_BYTES / blockSize;
+        uint8_t* slab;
+
+        if (blocks < SLAB_TRANSFER) {
+            blocks = SLAB_TRANSFER;
+        }
+
+        slab = malloc(blocks * blockSize);
+        if (slab == NULL) {
+            pthread_mutex_unlock(&(depot.lock));
+            return 0;
+        }
+
+        size_t i;
+        for (i = 0; i < blocks; i++) {
+            block_header* header = (block_header*) (slab + i * blockSize);
+            free_block* block = (free_block*) (header + 1);
+
+            header->sizeClass = sizeClass;
+            block->next = depot.lists[sizeClass];
+            depot.lists[sizeClass] = block;
+        }
+        depot.counts[sizeClass] += blocks;
+        depot.retired.slabs++;
+        depot.retired.slabBytes += blocks * blockSize;
+    }
+
+    uint32_t moved = moveBlocks(&(depot.lists[sizeClass]),
+            &(cache->lists[sizeClass]), SLAB_TRANSFER);
+    depot.counts[sizeClass] -= moved;
+    pthread_mutex_unlock(&(depot.lock));
+
+    cache->counts[sizeClass] += moved;
+    bump(&(cache->stats.depotRefills));
+    return moved > 0;
+}
+
+void* slabAlloc(size_t size) {
+    thread_cache* cache = getCache();
+    int sizeClass = 0;
+
+    if (cache == NULL) {
+        return NULL;
+    }
+    bump(&(cache->stats.allocations));
+
+    while (sizeClass < SLAB_CLASSES && classSizes[sizeClass] < size) {
+        sizeClass++;
+    }
+
+    if (sizeClass == SLAB_LARGE) {
+        block_header* header = malloc(sizeof (block_header) + size);
+
+        if (header == NULL) {
+            return NULL;
+        }
+        header->sizeClass = SLAB_LARGE;
+        bump(&(cache->stats.largeAllocations));
+        return header + 1;
+    }
+
+    if (cache->lists[sizeClass] != NULL) {
+        bump(&(cache->stats.cacheHits));
+    } else if (!refill(cache, sizeClass)) {
+        return NULL;
+    }
+
+    free_block* block = cache->lists[sizeClass];
+    cache->lists[sizeClass] = block->next;
+    cache->counts[sizeClass]--;
+    return block;
+}
+
+void slabFree(void* memory) {
+    if (memory == NULL) {
+        return;
+    }
+
+    block_header* header = (block_header*) memory - 1;
+    thread_cache* cache = getCache();
+
+    if (header->sizeClass == SLAB_LARGE) {
+        free(header);
+        if (cache != NULL) {
+            bump(&(cache->stats.frees));
+        }
+        return;
+    }
+
+    int sizeClass = header->sizeClass;
+
+    //Without a cache of our own, straight back to the depot.
+    if (cache == NULL) {
+        free_block* block = memory;
+
+        pthread_mutex_lock(&(depot.lock));
+        block->next = depot.lists[sizeClass];
+        depot.lists[sizeClass] = block;
+        depot.counts[sizeClass]++;
+        pthread_mutex_unlock(&(depot.lock));
+        return;
+    }
+
+    free_block* block = memory;
+    block->next = cache->lists[sizeClass];
+    cache->lists[sizeClass] = block;
+    cache->counts[sizeClass]++;
+    bump(&(cache->stats.frees));
+
+    //A thread that frees more than it allocates (a consumer of another
+    //thread's packets) passes the surplus on.
+    if (cache->counts[sizeClass] > SLAB_CACHE_LIMIT) {
+        pthread_mutex_lock(&(depot.lock));
+        uint32_t moved = moveBlocks(&(cache->lists[sizeClass]),
+                &(depot.lists[sizeClass]), SLAB_TRANSFER);
+        depot.counts[sizeClass] += moved;
+        pthread_mutex_unlock(&(depot.lock));
+
+        cache->counts[sizeClass] -= moved;
+    }
+}
+
+void slabGetStats(slab_stats* stats) {
+    thread_cache* cache;
+
+    memset(stats, 0, sizeof (slab_stats));
+
+    pthread_mutex_lock(&(depot.lock));
+    addStats(stats, &(depot.retired));
+    for (cache = depot.caches; cache != NULL; cache = cache->next) {
+        addStats(stats, &(cache->stats));
+    }
+    pthread_mutex_unlock(&(depot.lock));
+}
+
+void arenaInit(slab_arena* arena) {
+    arena->head = NULL;
+    arena->current = NULL;
+}
+
+void* arenaAlloc(slab_arena* arena, size_t size) {
+    //Keep everything 16-byte aligned, like malloc.
+    size = (size + 15) & ~(size_t) 15;
+
+    arena_block* block = arena->current;
+
+    //Move on through blocks kept from before the last reset, then add more.
+    while (block == NULL || block->size - block->used < size) {
+        arena_block* next = block ? block->next : arena->head;
+
+        if (next == NULL) {
+            size_t capacity = size > ARENA_BLOCK_SIZE
+                    ? size : ARENA_BLOCK_SIZE;
+
+            next = malloc(sizeof (arena_block) + capacity);
+            if (next == NULL) {
+                return NULL;
+            }
+            next->next = NULL;
+            next->size = capacity;
+            if (block) {
+                block->next = next;
+            } else {
+                arena->head = next;
+            }
+        }
+
+        next->used = 0;
+        block = next;
+        arena->current = block;
+    }
+
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void arenaReset(slab_arena* arena) {
+    thread_cache* cache = getCache();
+
+    if (arena->head != NULL) {
+        arena->head->used = 0;
+    }
+    arena->current = arena->head;
+
+    if (cache != NULL) {
+        bump(&(cache->stats.arenaResets));
+    }
+}
+
+void arenaFree(slab_arena* arena) {
+    while (arena->head != NULL) {
+        arena_block* next = arena->head->next;
+        free(arena->head);
+        arena->head = next;
+    }
+    arena->current = NULL;
+}
@@ -0,0 +1,118 @@
+/* 
+ * File:   slab.h
+ * 
+ * Memory for packet and segment payloads, which come and go millions of times
+ * a second. Blocks come in a few size classes (small, a full frame, a jumbo
+ * frame, a coalesced 64 KB segment) carved out of large slabs, and each thread
+ * keeps its own free lists so most allocations take no lock at all. Blocks
+ * may be freed by a different thread than the one that allocated them: the
+ * freeing thread keeps them, and hands surplus back to a shared depot in
+ * batches.
+ * 
+ * For memory that lives exactly as long as one batch of packets, there's also
+ * a bump arena that's let go of all at once.
+ */
+
+#ifndef SLAB_H
+#define	SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SLAB_CLASSES 5
+#define SLAB_BYTES (1 << 20) /* Carved into blocks of one class at a time. */
+#define SLAB_CACHE_LIMIT 128 /* Free blocks a thread keeps per class, */
+#define SLAB_TRANSFER 32 /* moved to and from the depot this many at once. */
+#define ARENA_BLOCK_SIZE (256 * 1024) /* Arenas grow in at least this much. */
+
+    typedef struct {
+        uint64_t allocations; /* slabAlloc calls, */
+        uint64_t cacheHits; /* how many were served by the thread's own */
+        uint64_t depotRefills; /* cache, how often it went to the depot, */
+        uint64_t largeAllocations; /* and how many were too big for any class
+                                    * and went to malloc. */
+        uint64_t frees;
+        uint64_t slabs; /* Slabs carved so far (never handed back). */
+        uint64_t slabBytes;
+        uint64_t arenaResets; /* Bulk releases of arena memory. */
+    } slab_stats;
+
+    typedef struct arena_block {
+        struct arena_block* next;
+        size_t size;
+        size_t used;
+        _Alignas(16) uint8_t data[]; /* Aligned like malloc's. */
+    } arena_block;
+
+    /* A bump allocator: allocations are never freed one by one, the whole
+     * arena is reset instead. Its blocks are kept for reuse. Not thread-safe;
+     * each arena has one owner. */
+    typedef struct {
+        arena_block* head;
+        arena_block* current;
+    } slab_arena;
+
+    /**
+     * Gets a block of memory. Like malloc, but quicker for the sizes packets
+     * come in. Safe from any thread.
+     * 
+     * @param size How many bytes are needed.
+     * @return The memory (aligned for any use), or NULL if out of memory.
+     */
+    void* slabAlloc(size_t size);
+
+    /**
+     * Gives back a block from slabAlloc, from any thread.
+     * 
+     * @param block The block, or NULL.
+     */
+    void slabFree(void* block);
+
+    /**
+     * Adds up the counters of every thread that's used the allocator.
+     * 
+     * @param stats Fill-in target.
+     */
+    void slabGetStats(slab_stats* stats);
+
+    /**
+     * Sets up an empty arena. It takes no memory until first used.
+     * 
+     * @param arena Fill-in target.
+     */
+    void arenaInit(slab_arena* arena);
+
+    /**
+     * Gets memory that stays good until the arena is reset.
+     * 
+     * @param arena The arena.
+     * @param size How many bytes are needed.
+     * @return The memory (aligned for any use), or NULL if out of memory.
+     */
+    void* arenaAlloc(slab_arena* arena, size_t size);
+
+    /**
+     * Lets go of everything allocated from the arena so far, keeping its
+     * blocks for what comes next.
+     * 
+     * @param arena The arena.
+     */
+    void arenaReset(slab_arena* arena);
+
+    /**
+     * Releases the arena's memory.
+     * 
+     * @param arena The arena.
+     */
+    void arenaFree(slab_arena* arena);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SLAB_H */
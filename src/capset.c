@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <glob.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "capset.h"
+#include "decap_includes.h"
+#include "../include/pcapng.h"
+#include "index.h"
+
+/* What a capture starts with, in either byte order. */
+static const uint32_t captureMagics[] = {
+    0xa1b2c3d4, 0xd4c3b2a1, 0xa1b23c4d, 0x4d3cb2a1, PCAPNG_MAGIC
+};
+
+void captureSetInit(capture_set* set) {
+    memset(set, 0, sizeof (capture_set));
+}
+
+/**
+ * Where a path is or would go in the sorted paths.
+ *
+ * @param found Set to whether it's there.
+ */
+static size_t findPath(const capture_set* set, const char* path, int* found) {
+    size_t low = 0;
+    size_t high = set->count;
+
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        int order = strcmp(set->paths[middle], path);
+
+        if (order == 0) {
+            *found = 1;
+            return middle;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    *found = 0;
+    return low;
+}
+
+static int known(const capture_set* set, const char* path) {
+    int found;
+
+    findPath(set, path, &found);
+    return found;
+}
+
+/**
+ * Adds a string to a list, unless it's there already.
+ *
+ * @return Non-zero on success, zero if out of memory.
+ */
+static int remember(char*** list, size_t* count, const char* text) {
+    size_t i;
+
+    for (i = 0; i < *count; i++) {
+        if (strcmp((*list)[i], text) == 0) {
+            return 1;
+        }
+    }
+
+    char** grown = realloc(*list, (*count + 1) * sizeof (char*));
+    if (grown == NULL) {
+        return 0;
+    }
+    *list = grown;
+
+    grown[*count] = strdup(text);
+    if (grown[*count] == NULL) {
+        return 0;
+    }
+    (*count)++;
+    return 1;
+}
+
+/**
+ * Looks at the start of a file for its first packet.
+ *
+ * @return 1 if it's a capture (entry filled in), 0 if it isn't (or not yet:
+ * too short to tell).
+ */
+static int probe(const char* path, capture_entry* entry) {
+    struct stat info;
+    uint32_t magic;
+    size_t i;
+
+    entry->firstPacket = UINT64_MAX;
+    entry->splittable = 0;
+    entry->isStream = 0;
+
+    if (stat(path, &info) != 0) {
+        return 0;
+    }
+    if (S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode)) {
+        entry->isStream = 1;
+        return 1;
+    }
+    if (!S_ISREG(info.st_mode)
+            || info.st_size < (off_t) sizeof (pcap_header)) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    //Checked here so load() doesn't complain about every stray file.
+    int isCapture = 0;
+    if (read(fd, &magic, sizeof (magic)) == sizeof (magic)) {
+        for (i = 0; i < sizeof (captureMagics) / sizeof (uint32_t); i++) {
+            isCapture |= magic == captureMagics[i];
+        }
+    }
+
+    pcap_file file;
+    pcap_packet packet;
+
+    if (isCapture && load(fd, &file, 1)) {
+        if (readPacketBatch(&file, &packet, 1) == 1) {
+            entry->firstPacket = (uint64_t) packet.header.ts_sec * 1000000000
+                    + (file.nanoResolution ? packet.header.ts_usec
+                    : (uint64_t) packet.header.ts_usec * 1000);
+        }
+        entry->splittable = file.map != NULL && !file.isNg;
+        unload(&file);
+    } else {
+        isCapture = 0;
+    }
+
+    close(fd);
+    return isCapture;
+}
+
+/**
+ * Adds one file, if it's a capture we don't have yet.
+ *
+ * @param path Its path, already resolved (see realpath), or -.
+ * @return 1 if added, 0 if not a capture (or already there), -1 if out of
+ * memory.
+ */
+static int addFile(capture_set* set, const char* path) {
+    capture_entry entry;
+    int found;
+    size_t position = findPath(set, path, &found);
+
+    if (found) {
+        return 0;
+    }
+
+    if (strcmp(path, "-") == 0) {
+        entry.firstPacket = UINT64_MAX;
+        entry.splittable = 0;
+        entry.isStream = 1;
+    } else if (!probe(path, &entry)) {
+        return 0;
+    }
+
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 16;
+        capture_entry* grown = realloc(set->entries,
+                capacity * sizeof (capture_entry));
+        char** paths = realloc(set->paths, capacity * sizeof (char*));
+
+        if (grown != NULL) {
+            set->entries = grown;
+        }
+        if (paths != NULL) {
+            set->paths = paths;
+        }
+        if (grown == NULL || paths == NULL) {
+            return -1;
+        }
+        set->capacity = capacity;
+    }
+
+    entry.path = strdup(path);
+    if (entry.path == NULL) {
+        return -1;
+    }
+
+    memmove(set->paths + position + 1, set->paths + position,
+            (set->count - position) * sizeof (char*));
+    set->paths[position] = entry.path;
+    set->entries[set->count++] = entry;
+    return 1;
+}
+
+/**
+ * Adds a file by whatever name it was found under.
+ */
+static int addNamedFile(capture_set* set, const char* path) {
+    char resolved[PATH_MAX];
+
+    //The same file may be reached by more than one name.
+    if (strcmp(path, "-") != 0) {
+        if (realpath(path, resolved) == NULL) {
+            return 0;
+        }
+        path = resolved;
+    }
+    return addFile(set, path);
+}
+
+/**
+ * Whether a name in a directory could be a capture: not hidden, and not one
+ * of our indexes.
+ */
+static int candidateName(const char* name) {
+    size_t length = strlen(name);
+    size_t suffix = strlen(INDEX_SUFFIX);
+
+    return name[0] != '.' && !(length >= suffix
+            && strcmp(name + length - suffix, INDEX_SUFFIX) == 0);
+}
+
+/**
+ * Adds whatever captures a directory or pattern has.
+ *
+ * @return Captures added, or -1 if out of memory.
+ */
+static long expand(capture_set* set, const char* source) {
+    char path[PATH_MAX];
+    struct stat info;
+    long added = 0;
+    int got;
+
+    if (stat(source, &info) == 0 && S_ISDIR(info.st_mode)) {
+        char resolved[PATH_MAX];
+        DIR* directory;
+        struct dirent* item;
+
+        //Resolved once, so its files' paths are as realpath would give them
+        //without asking for each (a refresh goes through all of them).
+        if (realpath(source, resolved) == NULL
+                || (directory = opendir(resolved)) == NULL) {
+            return 0;
+        }
+        while ((item = readdir(directory)) != NULL) {
+            if (!candidateName(item->d_name)) {
+                continue;
+            }
+            int length = snprintf(path, sizeof (path), "%s/%s",
+                    strcmp(resolved, "/") ? resolved : "", item->d_name);
+
+            if (length < 0 || length >= (int) sizeof (path)) {
+                continue;
+            }
+            if ((got = addFile(set, path)) < 0) {
+                closedir(directory);
+                return -1;
+            }
+            added += got;
+        }
+        closedir(directory);
+        return added;
+    }
+
+    glob_t matches;
+    size_t i;
+
+    if (glob(source, 0, NULL, &matches) != 0) {
+        return 0;
+    }
+    for (i = 0; i < matches.gl_pathc; i++) {
+        char* name = strrchr(matches.gl_pathv[i], '/');
+
+        if (!candidateName(name ? name + 1 : matches.gl_pathv[i])) {
+            continue;
+        }
+        if ((got = addNamedFile(set, matches.gl_pathv[i])) < 0) {
+            globfree(&matches);
+            return -1;
+        }
+        added += got;
+    }
+    globfree(&matches);
+    return added;
+}
+
+int captureSetAdd(capture_set* set, const char* source) {
+    struct stat info;
+    int isDirectory = stat(source, &info) == 0 && S_ISDIR(info.st_mode);
+
+    //A file (or stdin) by name has to be a capture.
+    if (strcmp(source, "-") == 0 || (!isDirectory
+            && strpbrk(source, "*?[") == NULL)) {
+        char resolved[PATH_MAX];
+        const char* path = source;
+
+        if (strcmp(source, "-") != 0) {
+            if (realpath(source, resolved) == NULL) {
+                printf("Can't open %s.\n", source);
+                return 0;
+            }
+            path = resolved;
+        }
+
+        int got = known(set, path) ? 1 : addFile(set, path);
+        if (got < 0) {
+            printf("Out of memory for the list of captures.\n");
+        } else if (got == 0) {
+            printf("%s isn't a capture we can read.\n", source);
+        }
+        return got > 0;
+    }
+
+    //Directories and patterns are kept to look through again, along with
+    //where new files would turn up.
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof (copy), "%s", source);
+
+    if (expand(set, source) < 0
+            || !remember(&(set->sources), &(set->sourceCount), source)
+            || !remember(&(set->directories), &(set->directoryCount),
+            isDirectory ? source : dirname(copy))) {
+        printf("Out of memory for the list of captures.\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int compareEntries(const void* a, const void* b) {
+    const capture_entry* first = a;
+    const capture_entry* second = b;
+
+    if (first->firstPacket != second->firstPacket) {
+        return first->firstPacket < second->firstPacket ? -1 : 1;
+    }
+    return strcmp(first->path, second->path);
+}
+
+void captureSetSort(capture_set* set, size_t from) {
+    if (from < set->count) {
+        qsort(set->entries + from, set->count - from, sizeof (capture_entry),
+                compareEntries);
+    }
+}
+
+size_t captureSetRefresh(capture_set* set) {
+    size_t before = set->count;
+    size_t i;
+
+    for (i = 0; i < set->sourceCount; i++) {
+        if (expand(set, set->sources[i]) < 0) {
+            break;
+        }
+    }
+
+    captureSetSort(set, before);
+    return set->count - before;
+}
+
+void captureSetPrefetch(const capture_set* set, size_t index) {
+    if (index >= set->count || set->entries[index].isStream) {
+        return;
+    }
+
+    //The pages stay cached after the descriptor is closed.
+    int fd = open(set->entries[index].path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, CAPTURE_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+void captureSetFree(capture_set* set) {
+    size_t i;
+
+    for (i = 0; i < set->count; i++) {
+        free(set->entries[i].path);
+    }
+    for (i = 0; i < set->sourceCount; i++) {
+        free(set->sources[i]);
+    }
+    for (i = 0; i < set->directoryCount; i++) {
+        free(set->directories[i]);
+    }
+    free(set->entries);
+    free(set->paths);
+    free(set->sources);
+    free(set->directories);
+    captureSetInit(set);
+}
@@ -0,0 +1,108 @@
+/*
+ * File:   capset.h
+ *
+ * A set of captures read one after another as if they were one, such as the
+ * files tcpdump -G or -C rotates through. They can be given as files,
+ * directories or glob patterns, and are read in order of their first packet.
+ * Directories and patterns can be looked at again for files that have
+ * appeared since, while following a live capture.
+ */
+
+#ifndef CAPSET_H
+#define	CAPSET_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_PREFETCH_BYTES (64 * 1024 * 1024) /* Read ahead of the next
+                                                   * capture while on this
+                                                   * one. */
+
+    typedef struct {
+        char* path;
+        uint64_t firstPacket; /* Capture time of its first packet in
+                               * nanoseconds, UINT64_MAX if it has none yet. */
+        int splittable; /* A classic capture that can be mapped, as a
+                         * parallel scan wants. */
+        int isStream; /* A pipe or socket (or - for stdin), which can't be
+                       * looked into beforehand. */
+    } capture_entry;
+
+    typedef struct {
+        capture_entry* entries; /* In the order to read them. */
+        size_t count;
+        size_t capacity;
+        char** paths; /* The entries' paths, sorted, to find them by. */
+        char** sources; /* Directories and patterns given, to look through
+                         * again for new captures. */
+        size_t sourceCount;
+        char** directories; /* Where new captures would appear. */
+        size_t directoryCount;
+    } capture_set;
+
+    /**
+     * Sets up an empty set.
+     *
+     * @param set Fill-in target.
+     */
+    void captureSetInit(capture_set* set);
+
+    /**
+     * Adds a capture file, every capture in a directory or every capture
+     * matching a glob pattern. Files that don't start like a capture are
+     * left out of directories and patterns, but are an error if named.
+     * Captures are added in no particular order: sort them once they're all
+     * in.
+     *
+     * @param set The set.
+     * @param source A path, directory or pattern, or - for stdin.
+     * @return Non-zero on success, zero (having said why) if a named file
+     * isn't a capture or we're out of memory.
+     */
+    int captureSetAdd(capture_set* set, const char* source);
+
+    /**
+     * Puts the captures from `from` on in order of their first packets
+     * (captures with none yet last, and ties by name).
+     *
+     * @param set The set.
+     * @param from The first entry to sort.
+     */
+    void captureSetSort(capture_set* set, size_t from);
+
+    /**
+     * Looks through the directories and patterns again and adds any captures
+     * that have appeared since, after the others. Files too short to have a
+     * header yet are left for next time.
+     *
+     * @param set The set.
+     * @return How many were added.
+     */
+    size_t captureSetRefresh(capture_set* set);
+
+    /**
+     * Asks the kernel to start reading a capture in, in the background, so
+     * it's in the page cache by the time we get to it.
+     *
+     * @param set The set.
+     * @param index The capture.
+     */
+    void captureSetPrefetch(const capture_set* set, size_t index);
+
+    /**
+     * Releases the set's memory.
+     *
+     * @param set The set.
+     */
+    void captureSetFree(capture_set* set);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CAPSET_H */
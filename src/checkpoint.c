@@ -0,0 +1,384 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+#include "reassembly.h"
+
+/*
+ * On disk, in this machine's byte order: a checkpoint_header, the capture's
+ * path, its pcapng interfaces, then each flow as a checkpoint_flow followed
+ * by its response headers so far and its held segments (each a
+ * checkpoint_segment and its bytes).
+ */
+
+typedef struct {
+    char magic[4]; /* "RPCK" */
+    uint32_t version;
+    uint64_t firstPacket;
+    int64_t position;
+    uint64_t now;
+    uint32_t ruleCount;
+    uint32_t pathLength;
+    uint32_t interfaceCount;
+    uint32_t bytesNeedFlipping;
+    uint64_t flowCount;
+} checkpoint_header;
+
+typedef struct {
+    flow_key key;
+    uint32_t nextSequence;
+    int32_t rule;
+    uint32_t segments;
+    uint32_t responses;
+    uint32_t heldSegments;
+    uint32_t finSequence;
+    uint64_t bytesWritten;
+    uint64_t started;
+    uint64_t lastSeen;
+    char filename[17];
+    uint8_t writing;
+    uint8_t sawFin;
+    uint8_t failed;
+    uint8_t done;
+    uint8_t httpState;
+    uint8_t chunkState;
+    uint8_t chunked;
+    uint8_t untilClose;
+    uint8_t copy;
+    uint8_t reserved[2];
+    int32_t statusCode;
+    uint32_t trailerLineLength;
+    int64_t contentLength;
+    int64_t remaining;
+    uint32_t headerLength;
+    uint32_t pendingCount;
+    char contentType[HTTP_MAX_CONTENT_TYPE];
+    digest_state digest;
+    uint8_t head[CLASSIFY_BYTES];
+    uint32_t headLength;
+    uint8_t prefix[DIGEST_SIZE];
+    uint8_t copyOf[DIGEST_SIZE];
+} checkpoint_flow;
+
+typedef struct {
+    uint32_t sequence;
+    uint32_t length;
+} checkpoint_segment;
+
+static void put(checkpoint_writer* writer, const void* data, size_t len) {
+    if (len > 0 && fwrite(data, len, 1, writer->out) != 1) {
+        writer->ok = 0;
+    }
+}
+
+int checkpointBegin(checkpoint_writer* writer, const char* path,
+        const checkpoint_state* state) {
+    checkpoint_header header;
+    memset(&header, 0, sizeof (header));
+
+    snprintf(writer->path, sizeof (writer->path), "%s", path);
+    snprintf(writer->tempPath, sizeof (writer->tempPath), "%s.tmp", path);
+    writer->flowCount = 0;
+    writer->ok = 1;
+    writer->out = fopen(writer->tempPath, "wb");
+
+    if (writer->out == NULL) {
+        printf("Couldn't create checkpoint %s.\n", writer->tempPath);
+        return 0;
+    }
+
+    memcpy(header.magic, "RPCK", 4);
+    header.version = CHECKPOINT_VERSION;
+    header.firstPacket = state->firstPacket;
+    header.position = state->position;
+    header.now = state->now;
+    header.ruleCount = state->ruleCount;
+    header.pathLength = strlen(state->capture);
+    header.interfaceCount = state->interfaceCount;
+    header.bytesNeedFlipping = state->bytesNeedFlipping;
+
+    //The flow count goes in once it's known.
+    put(writer, &header, sizeof (header));
+    put(writer, state->capture, header.pathLength);
+    put(writer, state->interfaces,
+            state->interfaceCount * sizeof (pcapng_interface));
+    return 1;
+}
+
+void checkpointAddFlow(checkpoint_writer* writer, const flow* current) {
+    const http_response* http = &(current->http);
+    const pending_segment* segment;
+    checkpoint_flow saved;
+
+    memset(&saved, 0, sizeof (saved));
+    saved.key = current->key;
+    saved.nextSequence = current->nextSequence;
+    saved.rule = current->rule;
+    saved.segments = current->segments;
+    saved.responses = current->responses;
+    saved.heldSegments = current->heldSegments;
+    saved.finSequence = current->finSequence;
+    saved.bytesWritten = current->bytesWritten;
+    saved.started = current->started;
+    saved.lastSeen = current->lastSeen;
+    memcpy(saved.filename, current->filename, sizeof (saved.filename));
+    saved.writing = current->output != NULL;
+    saved.sawFin = current->sawFin;
+    saved.failed = current->failed;
+    saved.done = current->done;
+    saved.httpState = http->state;
+    saved.chunkState = http->chunk;
+    saved.chunked = http->chunked;
+    saved.untilClose = http->untilClose;
+    saved.statusCode = http->statusCode;
+    saved.trailerLineLength = http->trailerLineLength;
+    saved.contentLength = http->contentLength;
+    saved.remaining = http->remaining;
+    saved.headerLength = http->header != NULL ? http->headerLength : 0;
+    memcpy(saved.contentType, http->contentType, sizeof (saved.contentType));
+    saved.digest = current->digest;
+    memcpy(saved.head, current->head, CLASSIFY_BYTES);
+    saved.headLength = current->headLength;
+    memcpy(saved.prefix, current->prefix, DIGEST_SIZE);
+    saved.copy = current->copy;
+    memcpy(saved.copyOf, current->copyOf, DIGEST_SIZE);
+
+    for (segment = current->pending; segment; segment = segment->next) {
+        saved.pendingCount++;
+    }
+
+    put(writer, &saved, sizeof (saved));
+    put(writer, http->header, saved.headerLength);
+
+    for (segment = current->pending; segment; segment = segment->next) {
+        checkpoint_segment held = {segment->sequence, segment->length};
+
+        put(writer, &held, sizeof (held));
+        put(writer, segment->data, segment->length);
+    }
+    writer->flowCount++;
+}
+
+/**
+ * Makes sure a rename in a directory is on disk, not just the file renamed.
+ */
+static void syncDirectory(const char* path) {
+    char copy[PATH_MAX];
+    snprintf(copy, sizeof (copy), "%s", path);
+
+    int fd = open(dirname(copy), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int checkpointCommit(checkpoint_writer* writer) {
+    uint64_t count = writer->flowCount;
+
+    //Only once it's all on disk can it take the old one's place.
+    if (writer->ok) {
+        writer->ok = fseek(writer->out, offsetof(checkpoint_header, flowCount),
+                SEEK_SET) == 0 && fwrite(&count, sizeof (count), 1,
+                writer->out) == 1 && fflush(writer->out) == 0
+                && fsync(fileno(writer->out)) == 0;
+    }
+
+    if (fclose(writer->out) != 0 || !writer->ok
+            || rename(writer->tempPath, writer->path) != 0) {
+        printf("Couldn't write checkpoint %s.\n", writer->path);
+        unlink(writer->tempPath);
+        return 0;
+    }
+
+    syncDirectory(writer->path);
+    return 1;
+}
+
+/**
+ * Takes the next `len` bytes of the checkpoint.
+ *
+ * @return Where they are, or NULL if the checkpoint ends first.
+ */
+static const uint8_t* take(checkpoint_reader* reader, size_t len) {
+    if (reader->size - reader->next < len) {
+        return NULL;
+    }
+
+    const uint8_t* data = reader->data + reader->next;
+    reader->next += len;
+    return data;
+}
+
+int checkpointOpen(checkpoint_reader* reader, const char* path,
+        checkpoint_state* state) {
+    checkpoint_header header;
+    struct stat info;
+    const uint8_t* data;
+
+    memset(reader, 0, sizeof (checkpoint_reader));
+    memset(state, 0, sizeof (checkpoint_state));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        printf("Couldn't open checkpoint %s.\n", path);
+        return -1;
+    }
+
+    //It's small enough to take in one go.
+    if (fstat(fd, &info) == 0) {
+        reader->size = info.st_size;
+        reader->data = malloc(reader->size ? reader->size : 1);
+    }
+    if (reader->data == NULL || read(fd, reader->data, reader->size)
+            != (ssize_t) reader->size) {
+        printf("Couldn't read checkpoint %s.\n", path);
+        close(fd);
+        checkpointClose(reader, state);
+        return -1;
+    }
+    close(fd);
+
+    if ((data = take(reader, sizeof (header))) != NULL) {
+        memcpy(&header, data, sizeof (header));
+    }
+    if (data == NULL || memcmp(header.magic, "RPCK", 4) != 0
+            || header.version != CHECKPOINT_VERSION
+            || header.pathLength >= sizeof (state->capture)
+            || (data = take(reader, header.pathLength)) == NULL) {
+        printf("%s isn't a checkpoint we can read.\n", path);
+        checkpointClose(reader, state);
+        return -1;
+    }
+
+    memcpy(state->capture, data, header.pathLength);
+    state->capture[header.pathLength] = '\0';
+    state->firstPacket = header.firstPacket;
+    state->position = header.position;
+    state->now = header.now;
+    state->ruleCount = header.ruleCount;
+    state->bytesNeedFlipping = header.bytesNeedFlipping;
+    reader->flowsLeft = header.flowCount;
+
+    size_t interfaceBytes = (size_t) header.interfaceCount
+            * sizeof (pcapng_interface);
+
+    if (header.interfaceCount > 0) {
+        data = take(reader, interfaceBytes);
+        state->interfaces = malloc(interfaceBytes);
+
+        if (data == NULL || state->interfaces == NULL) {
+            printf("%s isn't a checkpoint we can read.\n", path);
+            checkpointClose(reader, state);
+            return -1;
+        }
+        memcpy(state->interfaces, data, interfaceBytes);
+        state->interfaceCount = header.interfaceCount;
+    }
+    return 1;
+}
+
+int checkpointNextFlow(checkpoint_reader* reader, flow* saved,
+        int* writing) {
+    const uint8_t* data;
+    checkpoint_flow record;
+    uint32_t i;
+
+    if (reader->flowsLeft == 0) {
+        return reader->next == reader->size ? 0 : -1;
+    }
+    if ((data = take(reader, sizeof (record))) == NULL) {
+        return -1;
+    }
+    memcpy(&record, data, sizeof (record));
+    reader->flowsLeft--;
+
+    memset(saved, 0, sizeof (flow));
+    saved->key = record.key;
+    saved->inUse = 1;
+    saved->hash = flowHash(&(record.key));
+    saved->nextSequence = record.nextSequence;
+    saved->rule = record.rule;
+    saved->segments = record.segments;
+    saved->responses = record.responses;
+    saved->finSequence = record.finSequence;
+    saved->bytesWritten = record.bytesWritten;
+    saved->started = record.started;
+    saved->lastSeen = record.lastSeen;
+    memcpy(saved->filename, record.filename, sizeof (saved->filename));
+    saved->filename[sizeof (saved->filename) - 1] = '\0';
+    saved->sawFin = record.sawFin;
+    saved->failed = record.failed;
+    saved->done = record.done;
+    saved->digest = record.digest;
+    memcpy(saved->head, record.head, CLASSIFY_BYTES);
+    saved->headLength = record.headLength < CLASSIFY_BYTES
+            ? record.headLength : CLASSIFY_BYTES;
+    memcpy(saved->prefix, record.prefix, DIGEST_SIZE);
+    saved->copy = record.copy;
+    memcpy(saved->copyOf, record.copyOf, DIGEST_SIZE);
+    *writing = record.writing;
+
+    http_response* http = &(saved->http);
+    httpResponseInit(http);
+    http->state = record.httpState;
+    http->chunk = record.chunkState;
+    http->chunked = record.chunked;
+    http->untilClose = record.untilClose;
+    http->statusCode = record.statusCode;
+    http->trailerLineLength = record.trailerLineLength;
+    http->contentLength = record.contentLength;
+    http->remaining = record.remaining;
+    memcpy(http->contentType, record.contentType, sizeof (http->contentType));
+    http->contentType[sizeof (http->contentType) - 1] = '\0';
+
+    if (record.headerLength > 0) {
+        if (record.headerLength > HTTP_MAX_HEADER
+                || (data = take(reader, record.headerLength)) == NULL
+                || (http->header = malloc(record.headerLength)) == NULL) {
+            return -1;
+        }
+        memcpy(http->header, data, record.headerLength);
+        http->headerLength = record.headerLength;
+        http->headerCapacity = record.headerLength;
+    }
+
+    for (i = 0; i < record.pendingCount; i++) {
+        checkpoint_segment held;
+
+        if ((data = take(reader, sizeof (held))) == NULL) {
+            break;
+        }
+        memcpy(&held, data, sizeof (held));
+
+        if (held.length > FLOW_PENDING_LIMIT
+                || (data = take(reader, held.length)) == NULL
+                || !restoreSegment(saved, held.sequence, data, held.length)) {
+            break;
+        }
+    }
+    saved->heldSegments = record.heldSegments;
+
+    if (i < record.pendingCount) {
+        discardPending(saved);
+        httpResponseFree(http);
+        return -1;
+    }
+    return 1;
+}
+
+void checkpointClose(checkpoint_reader* reader, checkpoint_state* state) {
+    free(reader->data);
+    reader->data = NULL;
+    free(state->interfaces);
+    state->interfaces = NULL;
+    state->interfaceCount = 0;
+}
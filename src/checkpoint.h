@@ -0,0 +1,133 @@
+/*
+ * File:   checkpoint.h
+ *
+ * Checkpoints of how far through the captures we've got: where reading the
+ * current one carries on, and every flow's reassembly state (the sequence
+ * number wanted next, segments held out of order, response headers so far,
+ * and how much of the current body has been written, with its digest and
+ * first bytes). A run started with the checkpoint of an earlier one picks up
+ * where it left off instead of reading everything again, and carries on with
+ * the files it had in progress.
+ *
+ * A checkpoint is written next to the real thing and swapped in once it's
+ * safely on disk, so there's always a whole one there, however a run ends.
+ */
+
+#ifndef CHECKPOINT_H
+#define	CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "decap_includes.h"
+#include "flow.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_SECONDS 30 /* Default for -C. */
+
+    typedef struct {
+        char capture[PATH_MAX]; /* The capture being read (as its capture_set
+                                 * entry has it), */
+        uint64_t firstPacket; /* with its first packet's capture time, to be
+                               * sure it's the same file. */
+        off_t position; /* Where reading it carries on. */
+        int bytesNeedFlipping; /* pcapng: the section's byte order there, */
+        pcapng_interface* interfaces; /* and its interfaces. */
+        uint32_t interfaceCount;
+        uint64_t now; /* Capture time reached, in nanoseconds. */
+        uint32_t ruleCount; /* Patterns the flows' rules refer to. */
+    } checkpoint_state;
+
+    typedef struct {
+        FILE* out;
+        char path[PATH_MAX];
+        char tempPath[PATH_MAX];
+        uint64_t flowCount;
+        int ok; /* Cleared by the first write that fails. */
+    } checkpoint_writer;
+
+    typedef struct {
+        uint8_t* data; /* The whole checkpoint file. */
+        size_t size;
+        size_t next; /* Where the next flow starts. */
+        uint64_t flowsLeft;
+    } checkpoint_reader;
+
+    /**
+     * Starts writing a checkpoint. Nothing replaces the one already there
+     * until checkpointCommit.
+     *
+     * @param writer Fill-in target.
+     * @param path Where the checkpoint goes.
+     * @param state Where reading has got to.
+     * @return Non-zero on success.
+     */
+    int checkpointBegin(checkpoint_writer* writer, const char* path,
+            const checkpoint_state* state);
+
+    /**
+     * Adds a flow to a checkpoint.
+     *
+     * @param writer The writer.
+     * @param current The flow. If it has an output file, everything written
+     * to it so far must be on its way to the disk already (see
+     * outputWriterSync), as the checkpoint says the file is that long.
+     */
+    void checkpointAddFlow(checkpoint_writer* writer, const flow* current);
+
+    /**
+     * Finishes a checkpoint, and makes it the one there.
+     *
+     * @param writer The writer.
+     * @return Non-zero on success; otherwise the old checkpoint (if any) is
+     * left where it was.
+     */
+    int checkpointCommit(checkpoint_writer* writer);
+
+    /**
+     * Reads in a checkpoint.
+     *
+     * @param reader Fill-in target.
+     * @param path The checkpoint.
+     * @param state Fill-in target: where reading had got to. Its interfaces
+     * belong to the reader.
+     * @return 1 on success, 0 if there's no checkpoint, -1 (having said why)
+     * if it can't be used.
+     */
+    int checkpointOpen(checkpoint_reader* reader, const char* path,
+            checkpoint_state* state);
+
+    /**
+     * Reads the next flow of a checkpoint, rebuilt apart from its place in a
+     * table and its output file. Its held segments and response headers are
+     * its own (see discardPending and httpResponseFree).
+     *
+     * @param reader The reader.
+     * @param saved Fill-in target.
+     * @param writing Set to whether it had an output file, as long as
+     * saved->bytesWritten, named saved->filename.
+     * @return 1 if there was a flow, 0 if there are no more, -1 if the rest
+     * of the checkpoint doesn't make sense or we're out of memory.
+     */
+    int checkpointNextFlow(checkpoint_reader* reader, flow* saved,
+            int* writing);
+
+    /**
+     * Lets go of a checkpoint that's been read.
+     *
+     * @param reader The reader.
+     * @param state What checkpointOpen filled in.
+     */
+    void checkpointClose(checkpoint_reader* reader, checkpoint_state* state);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CHECKPOINT_H */
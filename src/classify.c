@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "classify.h"
+
+static const file_type jpeg = {"image", "jpg"};
+static const file_type png = {"image", "png"};
+static const file_type gif = {"image", "gif"};
+static const file_type webp = {"image", "webp"};
+static const file_type tiff = {"image", "tif"};
+static const file_type mp3 = {"audio", "mp3"};
+static const file_type aac = {"audio", "aac"};
+static const file_type m4a = {"audio", "m4a"};
+static const file_type ogg = {"audio", "ogg"};
+static const file_type flac = {"audio", "flac"};
+static const file_type wav = {"audio", "wav"};
+static const file_type mp4 = {"video", "mp4"};
+static const file_type matroska = {"video", "mkv"};
+static const file_type avi = {"video", "avi"};
+static const file_type flv = {"video", "flv"};
+static const file_type pdf = {"document", "pdf"};
+static const file_type zip = {"archive", "zip"};
+static const file_type gzip = {"archive", "gz"};
+static const file_type sevenZip = {"archive", "7z"};
+static const file_type rar = {"archive", "rar"};
+static const file_type other = {"other", NULL};
+
+/*
+ * A signature is the bytes a kind of file starts with, from the first. Where
+ * only some bits count (MPEG frame headers) or some bytes vary (box and chunk
+ * sizes), its mask says which; the signature's own bits are already masked.
+ * Each first byte's signatures are tried in order, most specific first, and
+ * end with one of length zero.
+ */
+typedef struct {
+    uint8_t length;
+    const char* value;
+    const char* mask; /* NULL if every bit counts. */
+    const file_type* type;
+} signature;
+
+static const signature startsWithZero[] = {
+    //ISO media: a box size, then the ftyp box with its brand.
+    {12, "\0\0\0\0ftypM4A ", "\xFF\0\0\0\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF",
+        &m4a},
+    {8, "\0\0\0\0ftyp", "\xFF\0\0\0\xFF\xFF\xFF\xFF", &mp4},
+    {0}
+};
+
+static const signature startsWith1A[] = {
+    {4, "\x1A\x45\xDF\xA3", NULL, &matroska}, /* EBML, so WebM too. */
+    {0}
+};
+
+static const signature startsWith1F[] = {
+    {3, "\x1F\x8B\x08", NULL, &gzip},
+    {0}
+};
+
+static const signature startsWithPercent[] = {
+    {5, "%PDF-", NULL, &pdf},
+    {0}
+};
+
+static const signature startsWith7[] = {
+    {6, "7z\xBC\xAF\x27\x1C", NULL, &sevenZip},
+    {0}
+};
+
+static const signature startsWithF[] = {
+    {4, "FLV\x01", NULL, &flv},
+    {0}
+};
+
+static const signature startsWithG[] = {
+    {6, "GIF87a", NULL, &gif},
+    {6, "GIF89a", NULL, &gif},
+    {0}
+};
+
+static const signature startsWithI[] = {
+    {3, "ID3", NULL, &mp3},
+    {4, "II*\0", NULL, &tiff},
+    {0}
+};
+
+static const signature startsWithM[] = {
+    {4, "MM\0*", NULL, &tiff},
+    {0}
+};
+
+static const signature startsWithO[] = {
+    {4, "OggS", NULL, &ogg},
+    {0}
+};
+
+static const signature startsWithP[] = {
+    {4, "PK\x03\x04", NULL, &zip},
+    {0}
+};
+
+static const signature startsWithR[] = {
+    //RIFF: a chunk size, then what's in it.
+    {12, "RIFF\0\0\0\0WEBP", "\xFF\xFF\xFF\xFF\0\0\0\0\xFF\xFF\xFF\xFF",
+        &webp},
+    {12, "RIFF\0\0\0\0WAVE", "\xFF\xFF\xFF\xFF\0\0\0\0\xFF\xFF\xFF\xFF",
+        &wav},
+    {12, "RIFF\0\0\0\0AVI ", "\xFF\xFF\xFF\xFF\0\0\0\0\xFF\xFF\xFF\xFF",
+        &avi},
+    {6, "Rar!\x1A\x07", NULL, &rar},
+    {0}
+};
+
+static const signature startsWithLowerF[] = {
+    {4, "fLaC", NULL, &flac},
+    {0}
+};
+
+static const signature startsWith89[] = {
+    {8, "\x89PNG\r\n\x1A\n", NULL, &png},
+    {0}
+};
+
+static const signature startsWithFF[] = {
+    //JFIF and EXIF alike: start of image, then any marker.
+    {3, "\xFF\xD8\xFF", NULL, &jpeg},
+    //MPEG audio frame sync, layer III; then ADTS (AAC), which has layer 0.
+    {2, "\xFF\xE2", "\xFF\xE6", &mp3},
+    {2, "\xFF\xF0", "\xFF\xF6", &aac},
+    {0}
+};
+
+static const signature* const byFirstByte[256] = {
+    [0x00] = startsWithZero,
+    [0x1A] = startsWith1A,
+    [0x1F] = startsWith1F,
+    ['%'] = startsWithPercent,
+    ['7'] = startsWith7,
+    ['F'] = startsWithF,
+    ['G'] = startsWithG,
+    ['I'] = startsWithI,
+    ['M'] = startsWithM,
+    ['O'] = startsWithO,
+    ['P'] = startsWithP,
+    ['R'] = startsWithR,
+    ['f'] = startsWithLowerF,
+    [0x89] = startsWith89,
+    [0xFF] = startsWithFF,
+};
+
+static int matches(const signature* candidate, const uint8_t* head,
+        uint32_t len) {
+    const uint8_t* value = (const uint8_t*) candidate->value;
+    const uint8_t* mask = (const uint8_t*) candidate->mask;
+    uint32_t i;
+
+    if (len < candidate->length) {
+        return 0;
+    }
+
+    for (i = 1; i < candidate->length; i++) {
+        if ((mask != NULL ? head[i] & mask[i] : head[i]) != value[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+const file_type* classifyBody(const uint8_t* head, uint32_t len) {
+    const signature* candidate;
+
+    if (len == 0 || (candidate = byFirstByte[head[0]]) == NULL) {
+        return &other;
+    }
+
+    //The first byte already matches, whatever the candidate.
+    for (; candidate->length > 0; candidate++) {
+        if (matches(candidate, head, len)) {
+            return candidate->type;
+        }
+    }
+    return &other;
+}
+
+void classifyName(const file_type* type, const char* base, char* name) {
+    if (type->extension != NULL) {
+        snprintf(name, CLASSIFY_NAME_MAX, "%s/%s.%s", type->directory, base,
+                type->extension);
+    } else {
+        snprintf(name, CLASSIFY_NAME_MAX, "%s/%s", type->directory, base);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * File:   classify.h
+ *
+ * Tells what kind of file a body is from its first few bytes (the magic
+ * numbers JPEG, PNG, MP3 and the rest start with), so extracted files can be
+ * sorted into a directory per kind as they're saved. Only the first byte is
+ * looked up; that picks out the handful of signatures that could follow.
+ */
+
+#ifndef CLASSIFY_H
+#define	CLASSIFY_H
+
+#include <stdint.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define CLASSIFY_BYTES 16 /* Enough of the start of a body for any
+                           * signature. */
+#define CLASSIFY_NAME_MAX 64 /* Room for a name from classifyName. */
+
+    typedef struct {
+        const char* directory; /* Where files of this kind go, */
+        const char* extension; /* and what they end in (NULL for nothing). */
+    } file_type;
+
+    /**
+     * Works out what kind of file a body is.
+     *
+     * @param head The start of the body.
+     * @param len How much of it there is (any more than CLASSIFY_BYTES
+     * isn't looked at).
+     * @return Its kind; never NULL, as anything not recognised is "other".
+     */
+    const file_type* classifyBody(const uint8_t* head, uint32_t len);
+
+    /**
+     * Makes the name a file is saved under: its kind's directory, then the
+     * given name with the kind's extension.
+     *
+     * @param type The file's kind.
+     * @param base Its name, such as a digest of it.
+     * @param name Fill-in target, CLASSIFY_NAME_MAX characters.
+     */
+    void classifyName(const file_type* type, const char* base, char* name);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CLASSIFY_H */
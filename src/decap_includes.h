@@ -9,6 +9,7 @@ extern "C" {
 //In the future when we link dynamically we can just extern these, but for now
 //we'll include the actual files...
 #include "../include/decap.h"
+#include "../include/slab.h"
 
 
 #ifdef	__cplusplus
@@ -0,0 +1,273 @@
+#include "decode.h"
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86DD
+#define ETHERTYPE_VLAN 0x8100 /* 802.1Q */
+#define ETHERTYPE_QINQ 0x88A8 /* 802.1ad service tag */
+#define ETHERTYPE_QINQ_OLD 0x9100 /* Pre-standard service tag */
+
+#define ETHERNET_HEADER_LENGTH 14
+#define SLL_HEADER_LENGTH 16
+#define VLAN_TAG_LENGTH 4
+#define IPV4_HEADER_LENGTH 20
+#define IPV6_HEADER_LENGTH 40
+#define TCP_HEADER_LENGTH 20
+
+#define IP_PROTOCOL_TCP 6
+#define IPV6_HOP_BY_HOP 0
+#define IPV6_ROUTING 43
+#define IPV6_FRAGMENT 44
+#define IPV6_AUTHENTICATION 51
+#define IPV6_DESTINATION 60
+
+/**
+ * Goes through any VLAN tags after a link header, to the Ethertype of what
+ * they carry.
+ * 
+ * @param data The frame.
+ * @param length What was captured of it.
+ * @param typeOffset Where the first Ethertype is.
+ * @param layers Gets the VLAN ids, and the link header including tags.
+ * @return The Ethertype, or 0 if the tags run past the capture.
+ */
+static uint16_t skipVlanTags(const uint8_t* data, uint32_t length,
+        uint32_t typeOffset, packet_layers* layers) {
+    uint16_t type = read16be(data + typeOffset);
+
+    while (type == ETHERTYPE_VLAN || type == ETHERTYPE_QINQ
+            || type == ETHERTYPE_QINQ_OLD) {
+        if (typeOffset + 2 + VLAN_TAG_LENGTH > length) {
+            return 0;
+        }
+
+        //The tag control information, then the next Ethertype.
+        if (layers->vlanCount < DECODE_MAX_VLANS) {
+            layers->vlans[layers->vlanCount] =
+                    read16be(data + typeOffset + 2) & 0x0FFF;
+        }
+        layers->vlanCount++;
+        typeOffset += VLAN_TAG_LENGTH;
+        type = read16be(data + typeOffset);
+    }
+
+    layers->linkLength = typeOffset + 2;
+    return type;
+}
+
+/**
+ * Finds the IP packet in a frame, going by its link type.
+ * 
+ * @return DECODE_TCP if there is one (meaning: carry on), otherwise why not.
+ */
+static decode_result decodeLink(const pcap_packet* packet,
+        packet_layers* layers) {
+    const uint8_t* data = packet->payload.data;
+    uint32_t length = packet->payload.payloadSize;
+    uint16_t type;
+
+    layers->link = data;
+
+    switch (packet->linkType) {
+        case LINKTYPE_ETHERNET:
+            if (length < ETHERNET_HEADER_LENGTH) {
+                return DECODE_TRUNCATED;
+            }
+            type = skipVlanTags(data, length, 12, layers);
+            break;
+
+        case LINKTYPE_LINUX_SLL:
+            if (length < SLL_HEADER_LENGTH) {
+                return DECODE_TRUNCATED;
+            }
+            type = skipVlanTags(data, length, 14, layers);
+            break;
+
+        case LINKTYPE_RAW:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_IPV6:
+            //The version nibble says which.
+            layers->link = NULL;
+            layers->linkLength = 0;
+            if (length < 1) {
+                return DECODE_TRUNCATED;
+            }
+            switch (data[0] >> 4) {
+                case 4:
+                    type = ETHERTYPE_IPV4;
+                    break;
+                case 6:
+                    type = ETHERTYPE_IPV6;
+                    break;
+                default:
+                    return DECODE_NOT_IP;
+            }
+            break;
+
+        default:
+            return DECODE_NOT_LINK;
+    }
+
+    if (type == 0) {
+        return DECODE_TRUNCATED;
+    }
+
+    if (type == ETHERTYPE_IPV4) {
+        layers->ipVersion = 4;
+    } else if (type == ETHERTYPE_IPV6) {
+        layers->ipVersion = 6;
+    } else {
+        return DECODE_NOT_IP;
+    }
+
+    layers->network = data + layers->linkLength;
+    return DECODE_TCP;
+}
+
+/**
+ * Reads an IPv4 header and its options.
+ * 
+ * @param available Bytes captured from the header on.
+ * @param ipLength Fill-in target: how long the IP packet says it is.
+ */
+static decode_result decodeIpv4(packet_layers* layers, uint32_t available,
+        uint32_t* ipLength) {
+    const uint8_t* ip = layers->network;
+
+    if (available < IPV4_HEADER_LENGTH || (ip[0] >> 4) != 4) {
+        return DECODE_TRUNCATED;
+    }
+
+    uint32_t headerLength = (ip[0] & 0x0F) * 4;
+    *ipLength = read16be(ip + 2);
+
+    //Segmentation offload leaves the total length 0 on packets captured
+    //before the NIC splits them up: they're as long as what was captured.
+    if (*ipLength == 0) {
+        *ipLength = available;
+    }
+
+    if (headerLength < IPV4_HEADER_LENGTH || headerLength > available
+            || *ipLength < headerLength) {
+        return DECODE_TRUNCATED;
+    }
+
+    layers->networkLength = headerLength;
+
+    //Only the first fragment has the TCP header.
+    if (ip[9] != IP_PROTOCOL_TCP || (read16be(ip + 6) & 0x1FFF) != 0) {
+        return DECODE_NOT_TCP;
+    }
+
+    return DECODE_TCP;
+}
+
+/**
+ * Reads an IPv6 header and any extension headers before the TCP header.
+ * 
+ * @param available Bytes captured from the header on.
+ * @param ipLength Fill-in target: how long the IP packet says it is.
+ */
+static decode_result decodeIpv6(packet_layers* layers, uint32_t available,
+        uint32_t* ipLength) {
+    const uint8_t* ip = layers->network;
+
+    if (available < IPV6_HEADER_LENGTH || (ip[0] >> 4) != 6) {
+        return DECODE_TRUNCATED;
+    }
+
+    //A zero payload length means a jumbogram, which is too much trouble.
+    *ipLength = IPV6_HEADER_LENGTH + read16be(ip + 4);
+    if (*ipLength == IPV6_HEADER_LENGTH) {
+        return DECODE_NOT_TCP;
+    }
+
+    uint8_t next = ip[6];
+    uint32_t offset = IPV6_HEADER_LENGTH;
+
+    while (next != IP_PROTOCOL_TCP) {
+        const uint8_t* extension = ip + offset;
+        uint32_t length;
+
+        if (offset + 8 > available) {
+            return DECODE_TRUNCATED;
+        }
+
+        switch (next) {
+            case IPV6_HOP_BY_HOP:
+            case IPV6_ROUTING:
+            case IPV6_DESTINATION:
+                length = (extension[1] + 1) * 8;
+                break;
+            case IPV6_AUTHENTICATION:
+                length = (extension[1] + 2) * 4;
+                break;
+            case IPV6_FRAGMENT:
+                if ((read16be(extension + 2) & 0xFFF8) != 0) {
+                    return DECODE_NOT_TCP;
+                }
+                length = 8;
+                break;
+            default:
+                //Including "no next header", and ESP, which we can't see into.
+                return DECODE_NOT_TCP;
+        }
+
+        next = extension[0];
+        offset += length;
+    }
+
+    if (offset > available || offset > *ipLength) {
+        return DECODE_TRUNCATED;
+    }
+
+    layers->networkLength = offset;
+    return DECODE_TCP;
+}
+
+decode_result decodePacket(const pcap_packet* packet,
+        packet_layers* layers) {
+    uint32_t ipLength;
+    decode_result result;
+
+    layers->vlanCount = 0;
+
+    result = decodeLink(packet, layers);
+    if (result != DECODE_TCP) {
+        return result;
+    }
+
+    uint32_t available = packet->payload.payloadSize - layers->linkLength;
+
+    if (layers->ipVersion == 4) {
+        result = decodeIpv4(layers, available, &ipLength);
+    } else {
+        result = decodeIpv6(layers, available, &ipLength);
+    }
+    if (result != DECODE_TCP) {
+        return result;
+    }
+
+    //Ethernet pads short frames, so believe the IP length over the capture,
+    //unless the capture was cut short.
+    if (ipLength < available) {
+        available = ipLength;
+    }
+
+    layers->transport = layers->network + layers->networkLength;
+    available -= layers->networkLength;
+
+    if (available < TCP_HEADER_LENGTH) {
+        return DECODE_TRUNCATED;
+    }
+
+    uint32_t tcpLength = (layers->transport[12] >> 4) * 4;
+    if (tcpLength < TCP_HEADER_LENGTH || tcpLength > available) {
+        return DECODE_TRUNCATED;
+    }
+
+    layers->transportLength = tcpLength;
+    layers->payload = layers->transport + tcpLength;
+    layers->payloadLength = available - tcpLength;
+
+    return DECODE_TCP;
+}
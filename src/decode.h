@@ -0,0 +1,104 @@
+/* 
+ * File:   decode.h
+ *
+ * Finds the protocol layers of a captured frame without copying anything: the
+ * result is a set of views into the packet's own data, each one checked to
+ * lie within what was captured. Header fields are read from the views as
+ * needed, in network byte order.
+ */
+
+#ifndef DECODE_H
+#define	DECODE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "decap_includes.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define DECODE_MAX_VLANS 2 /* Tags we go through: 802.1Q, or QinQ. */
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+
+    typedef enum {
+        DECODE_TCP, /* Everything down to the TCP payload was found. */
+        DECODE_NOT_LINK, /* A link type we can't read. */
+        DECODE_NOT_IP, /* Not IPv4 or IPv6 (ARP, LLDP...). */
+        DECODE_NOT_TCP, /* IP, but not (the start of) a TCP segment. */
+        DECODE_TRUNCATED /* A header runs past what was captured, or makes
+                          * no sense. */
+    } decode_result;
+
+    /*
+     * Where each layer of a frame starts and how long it is. All the pointers
+     * are into the pcap_packet's data, so they're only good as long as it is.
+     */
+    typedef struct {
+        const uint8_t* link; /* Link layer header (none for raw IP). */
+        uint32_t linkLength;
+        uint16_t vlans[DECODE_MAX_VLANS]; /* VLAN ids, outermost first. */
+        int vlanCount;
+        int ipVersion; /* 4 or 6. */
+        const uint8_t* network; /* IP header, with IPv4 options or IPv6 */
+        uint32_t networkLength; /* extension headers. */
+        const uint8_t* transport; /* TCP header, with options. */
+        uint32_t transportLength;
+        const uint8_t* payload; /* TCP payload, trimmed to the IP length */
+        uint32_t payloadLength; /* (frames may be padded) and the capture. */
+    } packet_layers;
+
+    /**
+     * Finds the layers of a captured frame, down to its TCP payload. Reads
+     * Ethernet (with 802.1Q/QinQ tags), Linux cooked (SLL) and raw IP link
+     * types, IPv4 with options and IPv6 with extension headers. Fragments
+     * other than the first have no TCP header, so aren't TCP here.
+     * 
+     * @param packet The captured packet.
+     * @param layers Fill-in target. Only complete if the result is DECODE_TCP.
+     * @return How far the decoding got.
+     */
+    decode_result decodePacket(const pcap_packet* packet,
+            packet_layers* layers);
+
+    static inline uint16_t read16be(const uint8_t* data) {
+        uint16_t value;
+        memcpy(&value, data, sizeof (value));
+        return ntohs(value);
+    }
+
+    static inline uint32_t read32be(const uint8_t* data) {
+        uint32_t value;
+        memcpy(&value, data, sizeof (value));
+        return ntohl(value);
+    }
+
+    /* Fields of a decoded TCP header, in host byte order. */
+
+    static inline uint16_t tcpSourcePort(const packet_layers* layers) {
+        return read16be(layers->transport);
+    }
+
+    static inline uint16_t tcpDestPort(const packet_layers* layers) {
+        return read16be(layers->transport + 2);
+    }
+
+    static inline uint32_t tcpSequence(const packet_layers* layers) {
+        return read32be(layers->transport + 4);
+    }
+
+    static inline uint8_t tcpSegmentFlags(const packet_layers* layers) {
+        return layers->transport[13];
+    }
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* DECODE_H */
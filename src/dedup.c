@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+
+/* Grow once the table is this many percent full, to keep probes short. */
+#define DEDUP_MAX_LOAD 70
+
+/**
+ * Where probing for a key starts. The prefix digest is already well mixed,
+ * so a word of it with the size folded in will do.
+ */
+static size_t slotFor(const dedup_index* index, uint64_t size,
+        const uint8_t* prefix) {
+    uint64_t h;
+    memcpy(&h, prefix, sizeof (h));
+
+    h ^= size * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+    return h & (index->capacity - 1);
+}
+
+static int sameKey(const dedup_entry* entry, uint64_t size,
+        const uint8_t* prefix) {
+    return entry->size == size
+            && memcmp(entry->prefix, prefix, DIGEST_SIZE) == 0;
+}
+
+int dedupInit(dedup_index* index) {
+    index->slots = calloc(DEDUP_INITIAL_CAPACITY, sizeof (dedup_entry));
+    if (index->slots == NULL) {
+        return 0;
+    }
+
+    index->capacity = DEDUP_INITIAL_CAPACITY;
+    index->count = 0;
+    return pthread_mutex_init(&(index->lock), NULL) == 0;
+}
+
+/**
+ * Doubles the table, moving every entry to its new slot.
+ *
+ * @return Non-zero on success.
+ */
+static int grow(dedup_index* index) {
+    dedup_entry* old = index->slots;
+    size_t oldCapacity = index->capacity;
+    size_t i;
+
+    dedup_entry* slots = calloc(oldCapacity * 2, sizeof (dedup_entry));
+    if (slots == NULL) {
+        return 0;
+    }
+
+    index->slots = slots;
+    index->capacity = oldCapacity * 2;
+
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].inUse) {
+            size_t slot = slotFor(index, old[i].size, old[i].prefix);
+
+            while (slots[slot].inUse) {
+                slot = (slot + 1) & (index->capacity - 1);
+            }
+            slots[slot] = old[i];
+        }
+    }
+
+    free(old);
+    return 1;
+}
+
+int dedupFind(dedup_index* index, uint64_t size, const uint8_t* prefix,
+        uint8_t* digest) {
+    int found = 0;
+
+    pthread_mutex_lock(&(index->lock));
+
+    size_t slot = slotFor(index, size, prefix);
+    while (index->slots[slot].inUse) {
+        if (index->slots[slot].saved
+                && sameKey(&(index->slots[slot]), size, prefix)) {
+            memcpy(digest, index->slots[slot].digest, DIGEST_SIZE);
+            found = 1;
+            break;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+
+    pthread_mutex_unlock(&(index->lock));
+    return found;
+}
+
+/**
+ * Finds the slot holding a body, or the free slot that ends its probe
+ * sequence if it isn't there. Call with the lock held.
+ */
+static size_t findBody(const dedup_index* index, uint64_t size,
+        const uint8_t* prefix, const uint8_t* digest) {
+    size_t slot = slotFor(index, size, prefix);
+
+    while (index->slots[slot].inUse) {
+        if (sameKey(&(index->slots[slot]), size, prefix)
+                && memcmp(index->slots[slot].digest, digest,
+                DIGEST_SIZE) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+    return slot;
+}
+
+int dedupHas(dedup_index* index, uint64_t size, const uint8_t* prefix,
+        const uint8_t* digest) {
+    pthread_mutex_lock(&(index->lock));
+
+    int found = index->slots[findBody(index, size, prefix, digest)].inUse;
+
+    pthread_mutex_unlock(&(index->lock));
+    return found;
+}
+
+int dedupAdd(dedup_index* index, uint64_t size, const uint8_t* prefix,
+        const uint8_t* digest) {
+    pthread_mutex_lock(&(index->lock));
+
+    size_t slot = findBody(index, size, prefix, digest);
+    if (index->slots[slot].inUse) {
+        pthread_mutex_unlock(&(index->lock));
+        return 0;
+    }
+
+    //Not remembering it only costs another copy later.
+    if ((index->count + 1) * 100 > index->capacity * DEDUP_MAX_LOAD) {
+        if (!grow(index)) {
+            pthread_mutex_unlock(&(index->lock));
+            return 1;
+        }
+
+        slot = slotFor(index, size, prefix);
+        while (index->slots[slot].inUse) {
+            slot = (slot + 1) & (index->capacity - 1);
+        }
+    }
+
+    dedup_entry* entry = &(index->slots[slot]);
+    entry->size = size;
+    memcpy(entry->prefix, prefix, DIGEST_SIZE);
+    memcpy(entry->digest, digest, DIGEST_SIZE);
+    entry->saved = 0;
+    entry->inUse = 1;
+    index->count++;
+
+    pthread_mutex_unlock(&(index->lock));
+    return 1;
+}
+
+void dedupPlaced(dedup_index* index, uint64_t size, const uint8_t* prefix,
+        const uint8_t* digest, int saved) {
+    pthread_mutex_lock(&(index->lock));
+
+    size_t mask = index->capacity - 1;
+    size_t hole = findBody(index, size, prefix, digest);
+    size_t i = hole;
+
+    if (!index->slots[hole].inUse || saved) {
+        index->slots[hole].saved = index->slots[hole].inUse;
+        pthread_mutex_unlock(&(index->lock));
+        return;
+    }
+
+    //Backward-shift, as for flows: pull up any later entry in the run whose
+    //home slot is at or before the hole, so every remaining entry stays
+    //reachable.
+    for (;;) {
+        i = (i + 1) & mask;
+        if (!index->slots[i].inUse) {
+            break;
+        }
+
+        size_t home = slotFor(index, index->slots[i].size,
+                index->slots[i].prefix);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            index->slots[hole] = index->slots[i];
+            hole = i;
+        }
+    }
+
+    index->slots[hole].inUse = 0;
+    index->count--;
+
+    pthread_mutex_unlock(&(index->lock));
+}
+
+void dedupFree(dedup_index* index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+    pthread_mutex_destroy(&(index->lock));
+}
@@ -0,0 +1,126 @@
+/*
+ * File:   dedup.h
+ *
+ * The bodies saved so far, by size and the digest of their start, with the
+ * digest of the whole thing. A response whose start matches one already
+ * saved (at the same size) is taken to be another copy as soon as that much
+ * of it has turned up, so the rest needn't be written; its own digest, at the
+ * end, confirms it. Bodies go in as soon as they're complete, so copies that
+ * finish while the first is still on its way to disk are known for what they
+ * are, but only count as saved once their file is on disk under its name:
+ * leaving out the rest of a copy never relies on a save that didn't happen.
+ * Shared by every worker.
+ */
+
+#ifndef DEDUP_H
+#define	DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "digest.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define DEDUP_PREFIX_BYTES (64 * 1024) /* How much of a body goes into the
+                                        * digest of its start. */
+#define DEDUP_INITIAL_CAPACITY 1024 /* Slots; always a power of two. */
+
+    typedef struct {
+        uint64_t size;
+        uint8_t prefix[DIGEST_SIZE]; /* The first DEDUP_PREFIX_BYTES (or all
+                                      * of it, if it's no longer). */
+        uint8_t digest[DIGEST_SIZE];
+        int saved; /* Its file is on disk (or else on its way there). */
+        int inUse;
+    } dedup_entry;
+
+    /*
+     * Open-addressing hash table with linear probing, keyed by size and
+     * prefix. Only a body whose file couldn't be saved is ever removed.
+     * Bodies that start the same but differ later share a key, so each gets
+     * its own slot.
+     */
+    typedef struct {
+        dedup_entry* slots;
+        size_t capacity;
+        size_t count;
+        pthread_mutex_t lock;
+    } dedup_index;
+
+    /**
+     * Sets up an empty index.
+     *
+     * @param index Fill-in target.
+     * @return Non-zero on success.
+     */
+    int dedupInit(dedup_index* index);
+
+    /**
+     * Looks for a body saved already with this size and start (one still on
+     * its way to disk doesn't count).
+     *
+     * @param index The index.
+     * @param size The body's size in bytes.
+     * @param prefix The digest of its start.
+     * @param digest Fill-in target: the digest of the one found.
+     * @return Non-zero if there was one.
+     */
+    int dedupFind(dedup_index* index, uint64_t size, const uint8_t* prefix,
+            uint8_t* digest);
+
+    /**
+     * Looks for this very body among those saved already, or on their way.
+     *
+     * @param index The index.
+     * @param size The body's size in bytes.
+     * @param prefix The digest of its start.
+     * @param digest The digest of all of it.
+     * @return Non-zero if it's been saved, or is being.
+     */
+    int dedupHas(dedup_index* index, uint64_t size, const uint8_t* prefix,
+            const uint8_t* digest);
+
+    /**
+     * Adds a body that's on its way to disk, unless it's there already.
+     * dedupPlaced says how that went.
+     *
+     * @param index The index.
+     * @param size The body's size in bytes.
+     * @param prefix The digest of its start.
+     * @param digest The digest of all of it.
+     * @return Non-zero if it's new (also if there's no memory to remember it),
+     * zero if it had been saved already, or is on its way.
+     */
+    int dedupAdd(dedup_index* index, uint64_t size, const uint8_t* prefix,
+            const uint8_t* digest);
+
+    /**
+     * Settles a body added with dedupAdd: it's kept as saved, or taken back
+     * out if its file couldn't be saved.
+     *
+     * @param index The index.
+     * @param size The body's size in bytes.
+     * @param prefix The digest of its start.
+     * @param digest The digest of all of it.
+     * @param saved Whether its file is on disk under its name.
+     */
+    void dedupPlaced(dedup_index* index, uint64_t size, const uint8_t* prefix,
+            const uint8_t* digest, int saved);
+
+    /**
+     * Releases the index.
+     *
+     * @param index The index.
+     */
+    void dedupFree(dedup_index* index);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* DEDUP_H */
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "digest.h"
+
+#define C1 0x87c37b91114253d5ULL
+#define C2 0x4cf5ad432745937fULL
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * Reads 8 bytes little-endian, wherever they are.
+ */
+static inline uint64_t read64(const uint8_t* data) {
+    uint64_t value;
+    memcpy(&value, data, sizeof (value));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+/**
+ * Mixes whole 16-byte blocks into the state.
+ */
+static void mixBlocks(digest_state* state, const uint8_t* data,
+        size_t blocks) {
+    uint64_t h1 = state->h1;
+    uint64_t h2 = state->h2;
+    size_t i;
+
+    for (i = 0; i < blocks; i++, data += 16) {
+        uint64_t k1 = read64(data);
+        uint64_t k2 = read64(data + 8);
+
+        k1 *= C1;
+        k1 = rotl64(k1, 31);
+        k1 *= C2;
+        h1 ^= k1;
+
+        h1 = rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= C2;
+        k2 = rotl64(k2, 33);
+        k2 *= C1;
+        h2 ^= k2;
+
+        h2 = rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    state->h1 = h1;
+    state->h2 = h2;
+}
+
+void digestInit(digest_state* state) {
+    memset(state, 0, sizeof (digest_state));
+}
+
+void digestUpdate(digest_state* state, const uint8_t* data, size_t len) {
+    state->length += len;
+
+    //Finish off a block started last time.
+    if (state->tailLength > 0) {
+        size_t take = 16 - state->tailLength;
+
+        if (take > len) {
+            take = len;
+        }
+        memcpy(state->tail + state->tailLength, data, take);
+        state->tailLength += take;
+        data += take;
+        len -= take;
+
+        if (state->tailLength < 16) {
+            return;
+        }
+        mixBlocks(state, state->tail, 1);
+        state->tailLength = 0;
+    }
+
+    mixBlocks(state, data, len / 16);
+
+    state->tailLength = len % 16;
+    memcpy(state->tail, data + len - state->tailLength, state->tailLength);
+}
+
+void digestFinal(const digest_state* state, uint8_t* digest) {
+    uint64_t h1 = state->h1;
+    uint64_t h2 = state->h2;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    int i;
+
+    //The last few bytes, with the block padded out with zeroes.
+    for (i = state->tailLength - 1; i >= 8; i--) {
+        k2 = (k2 << 8) | state->tail[i];
+    }
+    for (i = state->tailLength < 8 ? state->tailLength - 1 : 7; i >= 0; i--) {
+        k1 = (k1 << 8) | state->tail[i];
+    }
+
+    if (state->tailLength > 8) {
+        k2 *= C2;
+        k2 = rotl64(k2, 33);
+        k2 *= C1;
+        h2 ^= k2;
+    }
+    if (state->tailLength > 0) {
+        k1 *= C1;
+        k1 = rotl64(k1, 31);
+        k1 *= C2;
+        h1 ^= k1;
+    }
+
+    h1 ^= state->length;
+    h2 ^= state->length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    for (i = 0; i < 8; i++) {
+        digest[i] = h1 >> (56 - 8 * i);
+        digest[8 + i] = h2 >> (56 - 8 * i);
+    }
+}
+
+void digestHex(const uint8_t* digest, char* text) {
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < DIGEST_SIZE; i++) {
+        text[2 * i] = digits[digest[i] >> 4];
+        text[2 * i + 1] = digits[digest[i] & 0xF];
+    }
+    text[2 * DIGEST_SIZE] = '\0';
+}
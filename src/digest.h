@@ -0,0 +1,69 @@
+/*
+ * File:   digest.h
+ *
+ * 128-bit content digests (MurmurHash3, x64 128-bit variant), taken a piece
+ * at a time as a body streams past, so naming a file by its content never
+ * needs a second pass over it. Not cryptographic: good for telling files
+ * apart, not for resisting someone crafting collisions.
+ */
+
+#ifndef DIGEST_H
+#define	DIGEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define DIGEST_SIZE 16
+#define DIGEST_HEX_SIZE (DIGEST_SIZE * 2 + 1) /* With the terminator. */
+
+    typedef struct {
+        uint64_t h1;
+        uint64_t h2;
+        uint64_t length; /* Bytes taken in so far. */
+        uint8_t tail[16]; /* The start of a block not yet complete. */
+        uint32_t tailLength;
+    } digest_state;
+
+    /**
+     * Starts a digest.
+     *
+     * @param state Fill-in target.
+     */
+    void digestInit(digest_state* state);
+
+    /**
+     * Takes in the next bytes.
+     *
+     * @param state The digest so far.
+     * @param data The bytes.
+     * @param len How many.
+     */
+    void digestUpdate(digest_state* state, const uint8_t* data, size_t len);
+
+    /**
+     * Works out the digest of everything taken in so far. The state isn't
+     * changed, so it can go on taking bytes in afterwards.
+     *
+     * @param state The digest so far.
+     * @param digest Fill-in target, DIGEST_SIZE bytes.
+     */
+    void digestFinal(const digest_state* state, uint8_t* digest);
+
+    /**
+     * Spells a digest out in hex.
+     *
+     * @param digest DIGEST_SIZE bytes.
+     * @param text Fill-in target, DIGEST_HEX_SIZE characters.
+     */
+    void digestHex(const uint8_t* digest, char* text);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* DIGEST_H */
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "filter.h"
+
+#define FILTER_NIBBLES 32 /* In an IPv6 address. */
+#define V4_MAPPED_NIBBLES 24 /* In ::ffff:0:0/96. */
+
+static const uint8_t v4MappedPrefix[12] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF
+};
+
+static inline int nibble(const uint8_t* address, int i) {
+    return (address[i >> 1] >> ((i & 1) ? 0 : 4)) & 0x0F;
+}
+
+static void prefixSetInit(prefix_set* set) {
+    memset(set, 0, sizeof (prefix_set));
+}
+
+/**
+ * Gets a new, empty node.
+ *
+ * @return Its index, or 0 if out of memory (or if it's the root).
+ */
+static uint32_t addNode(prefix_set* set) {
+    if (set->nodeCount == set->capacity) {
+        uint32_t capacity = set->capacity ? set->capacity * 2 : 64;
+        filter_node* grown = realloc(set->nodes,
+                capacity * sizeof (filter_node));
+
+        if (grown == NULL) {
+            return 0;
+        }
+        set->nodes = grown;
+        set->capacity = capacity;
+    }
+
+    memset(&(set->nodes[set->nodeCount]), 0, sizeof (filter_node));
+    return set->nodeCount++;
+}
+
+/**
+ * Walks from a node along an address.
+ *
+ * @return Non-zero if a prefix on the way covers the address.
+ */
+static int walk(const prefix_set* set, uint32_t node, const uint8_t* address,
+        int from, int to) {
+    int i;
+
+    for (i = from; i < to; i++) {
+        const filter_node* current = &(set->nodes[node]);
+        int n = nibble(address, i);
+
+        if (current->covered & (1 << n)) {
+            return 1;
+        }
+        node = current->children[n];
+        if (node == 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Works out where lookups of IPv4 addresses can start, so they don't walk
+ * through the same 24 nibbles of ::ffff: every time.
+ */
+static void findV4Root(prefix_set* set) {
+    uint32_t node = 0;
+    int i;
+
+    set->v4Covered = set->everything;
+    set->v4Root = 0;
+
+    for (i = 0; i < V4_MAPPED_NIBBLES && set->nodeCount > 0; i++) {
+        const filter_node* current = &(set->nodes[node]);
+        int n = nibble(v4MappedPrefix, i);
+
+        if (current->covered & (1 << n)) {
+            set->v4Covered = 1;
+            return;
+        }
+        node = current->children[n];
+        if (node == 0) {
+            return;
+        }
+    }
+    set->v4Root = node;
+}
+
+/**
+ * Adds a prefix: every address whose first `bits` bits are those of
+ * `address`. The last nibble of a prefix that doesn't end on a nibble
+ * boundary is expanded to all the nibbles it stands for.
+ *
+ * @return Non-zero on success, zero if out of memory.
+ */
+static int prefixSetAdd(prefix_set* set, const uint8_t* address, int bits) {
+    if (bits == 0) {
+        set->everything = 1;
+        set->v4Covered = 1;
+        return 1;
+    }
+
+    //The root comes first, as node 0.
+    if (set->nodeCount == 0) {
+        addNode(set);
+        if (set->nodeCount == 0) {
+            return 0;
+        }
+    }
+
+    uint32_t node = 0;
+    int last = (bits - 1) / 4; /* The nibble with the prefix's last bit. */
+    int i;
+
+    for (i = 0; i < last; i++) {
+        int n = nibble(address, i);
+
+        //Already in there, as part of something shorter.
+        if (set->nodes[node].covered & (1 << n)) {
+            return 1;
+        }
+
+        if (set->nodes[node].children[n] == 0) {
+            uint32_t child = addNode(set);
+
+            if (child == 0) {
+                return 0;
+            }
+            set->nodes[node].children[n] = child;
+        }
+        node = set->nodes[node].children[n];
+    }
+
+    int open = 4 - (bits - last * 4); /* Bits of the nibble left open. */
+    int base = nibble(address, last) & (0x0F << open) & 0x0F;
+    int k;
+
+    for (k = 0; k < (1 << open); k++) {
+        set->nodes[node].covered |= 1 << (base | k);
+    }
+
+    findV4Root(set);
+    return 1;
+}
+
+static int prefixSetContains(const prefix_set* set, const uint8_t* address) {
+    if (set->v4Covered && memcmp(address, v4MappedPrefix, 12) == 0) {
+        return 1;
+    }
+    if (set->everything) {
+        return 1;
+    }
+    if (set->nodeCount == 0) {
+        return 0;
+    }
+
+    if (memcmp(address, v4MappedPrefix, 12) == 0) {
+        return set->v4Root != 0 && walk(set, set->v4Root, address,
+                V4_MAPPED_NIBBLES, FILTER_NIBBLES);
+    }
+    return walk(set, 0, address, 0, FILTER_NIBBLES);
+}
+
+static inline int portSetContains(const port_set* set, uint16_t port) {
+    return (set->bits[port >> 3] >> (port & 7)) & 1;
+}
+
+static void portSetAdd(port_set* set, uint16_t low, uint16_t high) {
+    uint32_t port;
+
+    for (port = low; port <= high; port++) {
+        set->bits[port >> 3] |= 1 << (port & 7);
+    }
+}
+
+/**
+ * Whether either end of a segment is in a direction's set.
+ */
+static int hostIn(const prefix_set* sets, const flow_key* key) {
+    return prefixSetContains(&(sets[FILTER_EITHER]), key->sourceAddress)
+            || prefixSetContains(&(sets[FILTER_EITHER]), key->destAddress)
+            || prefixSetContains(&(sets[FILTER_SOURCE]), key->sourceAddress)
+            || prefixSetContains(&(sets[FILTER_DEST]), key->destAddress);
+}
+
+static int portIn(const port_set* sets, uint16_t source, uint16_t dest) {
+    return portSetContains(&(sets[FILTER_EITHER]), source)
+            || portSetContains(&(sets[FILTER_EITHER]), dest)
+            || portSetContains(&(sets[FILTER_SOURCE]), source)
+            || portSetContains(&(sets[FILTER_DEST]), dest);
+}
+
+void filterInit(packet_filter* filter) {
+    int i;
+
+    memset(filter, 0, sizeof (packet_filter));
+    for (i = 0; i < FILTER_DIRECTIONS; i++) {
+        prefixSetInit(&(filter->hosts[i]));
+        prefixSetInit(&(filter->excludedHosts[i]));
+    }
+}
+
+/**
+ * Parses an address, with or without /bits, into an IPv6 prefix (IPv4 ones
+ * IPv4-mapped).
+ *
+ * @param allowLength Whether /bits may be given.
+ * @return Non-zero on success.
+ */
+static int parsePrefix(const char* text, int allowLength, uint8_t* address,
+        int* bits) {
+    char host[INET6_ADDRSTRLEN];
+    const char* slash = strchr(text, '/');
+    size_t length = slash ? (size_t) (slash - text) : strlen(text);
+    struct in_addr parsed;
+    int v4 = 0;
+
+    if (length >= sizeof (host) || (slash && !allowLength)) {
+        return 0;
+    }
+    memcpy(host, text, length);
+    host[length] = '\0';
+
+    if (inet_pton(AF_INET6, host, address) != 1) {
+        if (inet_pton(AF_INET, host, &parsed) != 1) {
+            return 0;
+        }
+        memcpy(address, v4MappedPrefix, 12);
+        memcpy(address + 12, &parsed, 4);
+        v4 = 1;
+    }
+
+    *bits = 128;
+    if (slash) {
+        char* end;
+        long given = strtol(slash + 1, &end, 10);
+
+        if (*end != '\0' || end == slash + 1 || given < 0
+                || given > (v4 ? 32 : 128)) {
+            return 0;
+        }
+        *bits = v4 ? 96 + given : given;
+    }
+    return 1;
+}
+
+/**
+ * Parses a port, or a range of them.
+ *
+ * @return Non-zero on success.
+ */
+static int parsePorts(const char* text, uint16_t* low, uint16_t* high) {
+    char* end;
+    long first = strtol(text, &end, 10);
+    long last = first;
+
+    if (end == text) {
+        return 0;
+    }
+    if (*end == '-') {
+        text = end + 1;
+        last = strtol(text, &end, 10);
+        if (end == text) {
+            return 0;
+        }
+    }
+
+    if (*end != '\0' || first < 0 || last > 65535 || first > last) {
+        return 0;
+    }
+    *low = first;
+    *high = last;
+    return 1;
+}
+
+/**
+ * Adds one term (already split into words).
+ *
+ * @return Non-zero on success.
+ */
+static int addTerm(packet_filter* filter, char** words, int count) {
+    filter_direction direction = FILTER_EITHER;
+    int excluded = 0;
+    int i = 0;
+
+    if (i < count && strcmp(words[i], "not") == 0) {
+        excluded = 1;
+        i++;
+    }
+    if (i < count && strcmp(words[i], "src") == 0) {
+        direction = FILTER_SOURCE;
+        i++;
+    } else if (i < count && strcmp(words[i], "dst") == 0) {
+        direction = FILTER_DEST;
+        i++;
+    }
+
+    if (i + 2 != count) {
+        return 0;
+    }
+
+    const char* kind = words[i];
+    const char* value = words[i + 1];
+
+    if (strcmp(kind, "port") == 0) {
+        uint16_t low;
+        uint16_t high;
+
+        if (!parsePorts(value, &low, &high)) {
+            return 0;
+        }
+        if (excluded) {
+            portSetAdd(&(filter->excludedPorts[direction]), low, high);
+            filter->excludedPortTerms++;
+        } else {
+            portSetAdd(&(filter->ports[direction]), low, high);
+            filter->portTerms++;
+        }
+        return 1;
+    }
+
+    int isNet = strcmp(kind, "net") == 0;
+    uint8_t address[16];
+    int bits;
+
+    if ((!isNet && strcmp(kind, "host") != 0)
+            || !parsePrefix(value, isNet, address, &bits)) {
+        return 0;
+    }
+
+    if (excluded) {
+        filter->excludedHostTerms++;
+        return prefixSetAdd(&(filter->excludedHosts[direction]), address,
+                bits);
+    }
+    filter->hostTerms++;
+    return prefixSetAdd(&(filter->hosts[direction]), address, bits);
+}
+
+int filterAdd(packet_filter* filter, const char* text) {
+    char* copy = strdup(text);
+    char* term;
+    char* termState;
+    int ok = 1;
+
+    if (copy == NULL) {
+        return 0;
+    }
+
+    for (term = strtok_r(copy, ",", &termState); term != NULL && ok;
+            term = strtok_r(NULL, ",", &termState)) {
+        char* words[5];
+        char* wordState;
+        int count = 0;
+        char* word;
+
+        for (word = strtok_r(term, " \t", &wordState);
+                word != NULL && count < 5;
+                word = strtok_r(NULL, " \t", &wordState)) {
+            words[count++] = word;
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        if (word != NULL || !addTerm(filter, words, count)) {
+            printf("Can't make sense of filter term \"%s", words[0]);
+            int i;
+            for (i = 1; i < count; i++) {
+                printf(" %s", words[i]);
+            }
+            printf("\".\n");
+            ok = 0;
+        }
+    }
+
+    free(copy);
+    return ok;
+}
+
+int filterActive(const packet_filter* filter) {
+    return filter->hostTerms || filter->portTerms || filter->excludedHostTerms
+            || filter->excludedPortTerms;
+}
+
+int filterMatches(const packet_filter* filter, const flow_key* key) {
+    uint16_t source = ntohs(key->sourcePort);
+    uint16_t dest = ntohs(key->destPort);
+
+    //Ports first: a couple of bit tests, where addresses take a trie walk.
+    if (filter->portTerms && !portIn(filter->ports, source, dest)) {
+        return 0;
+    }
+    if (filter->excludedPortTerms
+            && portIn(filter->excludedPorts, source, dest)) {
+        return 0;
+    }
+    if (filter->hostTerms && !hostIn(filter->hosts, key)) {
+        return 0;
+    }
+    if (filter->excludedHostTerms && hostIn(filter->excludedHosts, key)) {
+        return 0;
+    }
+    return 1;
+}
+
+void filterFree(packet_filter* filter) {
+    int i;
+
+    for (i = 0; i < FILTER_DIRECTIONS; i++) {
+        free(filter->hosts[i].nodes);
+        free(filter->excludedHosts[i].nodes);
+    }
+    filterInit(filter);
+}
@@ -0,0 +1,124 @@
+/*
+ * File:   filter.h
+ *
+ * Decides from a segment's addresses and ports alone whether it's worth
+ * looking at, before any of the expensive work (copying it, finding its flow,
+ * pattern matching) is done. Filters are written as terms such as
+ *
+ *     port 80, port 8000-8100, net 10.0.0.0/8, not src host 10.1.2.3
+ *
+ * and compiled into bitmaps of ports and tries of address prefixes, so
+ * checking a segment takes a handful of lookups however many terms there are.
+ */
+
+#ifndef FILTER_H
+#define	FILTER_H
+
+#include <stdint.h>
+
+#include "flow.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define FILTER_PORT_BYTES (65536 / 8)
+
+    /* Which end of a segment a term is about. */
+    typedef enum {
+        FILTER_EITHER, FILTER_SOURCE, FILTER_DEST, FILTER_DIRECTIONS
+    } filter_direction;
+
+    /* A trie node, one nibble of address per level. */
+    typedef struct {
+        uint32_t children[16]; /* Node indices, 0 for none (the root, node 0,
+                                * is nobody's child). */
+        uint16_t covered; /* Nibbles below which every address is in the set,
+                           * a bit each. */
+    } filter_node;
+
+    /* A set of address prefixes, as IPv6 (IPv4 ones IPv4-mapped). */
+    typedef struct {
+        filter_node* nodes;
+        uint32_t nodeCount;
+        uint32_t capacity;
+        int everything; /* A /0 was added. */
+        int v4Covered; /* Every IPv4 address is in the set. */
+        uint32_t v4Root; /* The node after ::ffff:0:0/96, where lookups of
+                          * IPv4 addresses can start; 0 if there's none. */
+    } prefix_set;
+
+    typedef struct {
+        uint8_t bits[FILTER_PORT_BYTES];
+    } port_set;
+
+    /* What it takes to be let through: an address in `hosts` (if any were
+     * given) and a port in `ports` (if any were given), and neither in the
+     * excluded ones. Each set has a copy per direction. */
+    typedef struct {
+        prefix_set hosts[FILTER_DIRECTIONS];
+        prefix_set excludedHosts[FILTER_DIRECTIONS];
+        port_set ports[FILTER_DIRECTIONS];
+        port_set excludedPorts[FILTER_DIRECTIONS];
+        int hostTerms;
+        int portTerms;
+        int excludedHostTerms;
+        int excludedPortTerms;
+    } packet_filter;
+
+    /**
+     * Sets up a filter that lets everything through.
+     *
+     * @param filter Fill-in target.
+     */
+    void filterInit(packet_filter* filter);
+
+    /**
+     * Adds terms, separated by commas. Each term is
+     *
+     *     [not] [src|dst] host <address>
+     *     [not] [src|dst] net <address>/<bits>
+     *     [not] [src|dst] port <port>[-<port>]
+     *
+     * where addresses may be IPv4 or IPv6. Without src or dst a term is
+     * about either end. Host and net terms are alternatives to each other, as
+     * are port terms, and a segment must satisfy both kinds (where given)
+     * and no "not" term.
+     *
+     * @param filter The filter.
+     * @param text The terms.
+     * @return Non-zero on success, zero (having said why) if a term is bad
+     * or we're out of memory.
+     */
+    int filterAdd(packet_filter* filter, const char* text);
+
+    /**
+     * Whether the filter has any terms at all.
+     *
+     * @param filter The filter.
+     * @return Non-zero if it does.
+     */
+    int filterActive(const packet_filter* filter);
+
+    /**
+     * Checks a segment against the filter.
+     *
+     * @param filter The filter.
+     * @param key The segment's flow, straight from its headers.
+     * @return Non-zero if it's let through.
+     */
+    int filterMatches(const packet_filter* filter, const flow_key* key);
+
+    /**
+     * Releases the filter's memory.
+     *
+     * @param filter The filter.
+     */
+    void filterFree(packet_filter* filter);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FILTER_H */
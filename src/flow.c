@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "flow.h"
+
+/* Grow once the table is this many percent full, to keep probes short. */
+#define FLOW_TABLE_MAX_LOAD 70
+
+static const uint8_t mappedPrefix[12] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF
+};
+
+uint32_t flowHash(const flow_key* key) {
+    //Fold the addresses into 64 bits a word at a time, mix in the ports, then
+    //finalize (murmur3 fmix64).
+    uint64_t words[4];
+    memcpy(words, key->sourceAddress, 16);
+    memcpy(words + 2, key->destAddress, 16);
+
+    uint64_t h = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    h ^= (((uint64_t) key->sourcePort << 16) | key->destPort)
+            * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (uint32_t) h;
+}
+
+int flowKeysEqual(const flow_key* a, const flow_key* b) {
+    return memcmp(a->sourceAddress, b->sourceAddress, 16) == 0
+            && memcmp(a->destAddress, b->destAddress, 16) == 0
+            && a->sourcePort == b->sourcePort
+            && a->destPort == b->destPort;
+}
+
+void flowKeyReverse(const flow_key* key, flow_key* reverse) {
+    memcpy(reverse->sourceAddress, key->destAddress, 16);
+    memcpy(reverse->destAddress, key->sourceAddress, 16);
+    reverse->sourcePort = key->destPort;
+    reverse->destPort = key->sourcePort;
+}
+
+void flowKeyFromLayers(const packet_layers* layers, flow_key* key) {
+    //Addresses straight from the IP header, ports as they sit in the TCP
+    //header (both still in network byte order).
+    if (layers->ipVersion == 4) {
+        memcpy(key->sourceAddress, mappedPrefix, 12);
+        memcpy(key->sourceAddress + 12, layers->network + 12, 4);
+        memcpy(key->destAddress, mappedPrefix, 12);
+        memcpy(key->destAddress + 12, layers->network + 16, 4);
+    } else {
+        memcpy(key->sourceAddress, layers->network + 8, 16);
+        memcpy(key->destAddress, layers->network + 24, 16);
+    }
+    memcpy(&(key->sourcePort), layers->transport, 2);
+    memcpy(&(key->destPort), layers->transport + 2, 2);
+}
+
+int packetFlowKey(const pcap_packet* packet, flow_key* key, uint8_t* tcpFlags) {
+    packet_layers layers;
+
+    if (decodePacket(packet, &layers) != DECODE_TCP) {
+        return 0;
+    }
+
+    flowKeyFromLayers(&layers, key);
+
+    if (tcpFlags != NULL) {
+        *tcpFlags = tcpSegmentFlags(&layers);
+    }
+    return 1;
+}
+
+int flowTableInit(flow_table* table, size_t capacity) {
+    size_t slots = 16;
+
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+
+    table->slots = calloc(slots, sizeof (flow));
+    table->capacity = slots;
+    table->count = 0;
+
+    return table->slots != NULL;
+}
+
+void flowTableFree(flow_table* table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+flow* flowLookup(flow_table* table, const flow_key* key) {
+    uint32_t hash = flowHash(key);
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+
+    while (table->slots[i].inUse) {
+        if (table->slots[i].hash == hash
+                && flowKeysEqual(&(table->slots[i].key), key)) {
+            return &(table->slots[i]);
+        }
+        i = (i + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/**
+ * Puts an existing entry into the first free slot of its probe sequence. Only
+ * for use while rebuilding, when the key is known not to be present.
+ */
+static flow* place(flow_table* table, const flow* entry) {
+    size_t mask = table->capacity - 1;
+    size_t i = entry->hash & mask;
+
+    while (table->slots[i].inUse) {
+        i = (i + 1) & mask;
+    }
+
+    table->slots[i] = *entry;
+    return &(table->slots[i]);
+}
+
+static int grow(flow_table* table) {
+    flow* old = table->slots;
+    size_t oldCapacity = table->capacity;
+    flow* slots = calloc(oldCapacity * 2, sizeof (flow));
+
+    if (slots == NULL) {
+        return 0;
+    }
+
+    table->slots = slots;
+    table->capacity = oldCapacity * 2;
+
+    size_t i;
+    for (i = 0; i < oldCapacity; i++) {
+        if (old[i].inUse) {
+            place(table, &old[i]);
+        }
+    }
+
+    free(old);
+    return 1;
+}
+
+flow* flowInsert(flow_table* table, const flow_key* key) {
+    if ((table->count + 1) * 100 > table->capacity * FLOW_TABLE_MAX_LOAD) {
+        if (!grow(table)) {
+            return NULL;
+        }
+    }
+
+    flow entry;
+    memset(&entry, 0, sizeof (entry));
+    entry.key = *key;
+    entry.inUse = 1;
+    entry.hash = flowHash(key);
+    entry.output = NULL;
+
+    table->count++;
+    return place(table, &entry);
+}
+
+void flowRemove(flow_table* table, flow* entry) {
+    size_t mask = table->capacity - 1;
+    size_t hole = entry - table->slots;
+    size_t i = hole;
+
+    //Backward-shift: pull up any later entry in the run whose home slot is at
+    //or before the hole, so every remaining entry stays reachable.
+    for (;;) {
+        i = (i + 1) & mask;
+        if (!table->slots[i].inUse) {
+            break;
+        }
+
+        size_t home = table->slots[i].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+    }
+
+    table->slots[hole].inUse = 0;
+    table->count--;
+}
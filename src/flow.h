@@ -0,0 +1,182 @@
+/* 
+ * File:   flow.h
+ *
+ * Table of the TCP streams we're currently reassembling, so any number of
+ * transfers can be rebuilt from the same pass over a capture.
+ */
+
+#ifndef FLOW_H
+#define	FLOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decap_includes.h"
+#include "decode.h"
+#include "http.h"
+#include "output.h"
+#include "digest.h"
+#include "classify.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define FLOW_TABLE_INITIAL_CAPACITY 1024 /* Slots; always a power of two. */
+
+    /*
+     * Identifies one direction of a TCP connection. Addresses and ports are
+     * kept exactly as they appear on the wire (network byte order), which is
+     * all we need for hashing and comparing. IPv4 addresses are stored
+     * IPv4-mapped (::ffff:a.b.c.d), so both kinds share one layout.
+     */
+    typedef struct {
+        uint8_t sourceAddress[16];
+        uint8_t destAddress[16];
+        uint16_t sourcePort;
+        uint16_t destPort;
+    } flow_key;
+
+    typedef struct {
+        flow_key key;
+        int inUse;
+        uint32_t hash; /* flowHash(&key), kept to make probing cheap. */
+        uint32_t nextSequence; /* Sequence number of the next byte we want. */
+        int rule; /* Which pattern the current response matched, or -1 for a
+                   * later response on the connection not yet checked. */
+        output_file* output; /* Where the current body is written. */
+        char filename[17]; /* Its name until it's complete. */
+        uint64_t bytesWritten; /* Bytes of the current body written to it. */
+        uint32_t segments; /* Body pieces of the current response. */
+        digest_state digest; /* Of the body so far, to name the file by. */
+        uint8_t head[CLASSIFY_BYTES]; /* The body's first bytes, to tell */
+        uint32_t headLength; /* what kind of file it is. */
+        uint8_t prefix[DIGEST_SIZE]; /* Digest of the body's start, once it
+                                      * has DEDUP_PREFIX_BYTES of it. */
+        int copy; /* Set when the body is taken to be a copy of one already
+                   * saved (same size, same start): the rest of it is
+                   * compared with that one instead of being written. */
+        uint8_t copyOf[DIGEST_SIZE]; /* The saved body's digest (its name), */
+        int original; /* and the saved body, open. */
+        uint32_t responses; /* Responses extracted from this connection. */
+        struct pending_segment* pending; /* Early segments, in sequence order
+                                          * (see reassembly.h). */
+        uint32_t pendingBytes; /* Memory held by pending. */
+        uint32_t heldSegments; /* Segments that ever had to be held. */
+        uint32_t finSequence; /* Sequence number just past the last byte, */
+        int sawFin; /* once we've seen the FIN. */
+        uint64_t id; /* Tells flows of the same key apart, over time. */
+        uint64_t started; /* Capture time (nanoseconds) of its first packet, */
+        uint64_t lastSeen; /* and of its latest. */
+        uint32_t memory; /* Bytes it was last counted as holding. */
+        http_response http; /* The response being extracted. */
+        int failed; /* Set when we can't go on with this flow. */
+        int done; /* Set when there's nothing more we want from it. */
+    } flow;
+
+    /*
+     * Open-addressing hash table with linear probing. Deletion shifts later
+     * entries back instead of leaving tombstones, so lookups never have to
+     * walk over dead slots.
+     */
+    typedef struct {
+        flow* slots;
+        size_t capacity;
+        size_t count;
+    } flow_table;
+
+    /**
+     * Hashes a flow key. The same function is used wherever flows need to be
+     * spread out (table slots, and anything else keyed by flow).
+     * 
+     * @param key The key to hash.
+     * @return The hash.
+     */
+    uint32_t flowHash(const flow_key* key);
+
+    /**
+     * Compares two flow keys.
+     * 
+     * @return Non-zero if they're the same flow (in the same direction).
+     */
+    int flowKeysEqual(const flow_key* a, const flow_key* b);
+
+    /**
+     * Gives the key of the other direction of the same connection.
+     * 
+     * @param key The key.
+     * @param reverse Fill-in target.
+     */
+    void flowKeyReverse(const flow_key* key, flow_key* reverse);
+
+    /**
+     * Makes the key of a decoded TCP segment.
+     * 
+     * @param layers The segment, as decodePacket found it.
+     * @param key Fill-in target.
+     */
+    void flowKeyFromLayers(const packet_layers* layers, flow_key* key);
+
+    /**
+     * Works out which TCP stream a captured frame belongs to, without looking
+     * any further into it than that.
+     * 
+     * @param packet The captured packet.
+     * @param key Fill-in target.
+     * @param tcpFlags If not NULL, filled in with the segment's TCP flags.
+     * @return Non-zero if it's a TCP segment, zero otherwise.
+     */
+    int packetFlowKey(const pcap_packet* packet, flow_key* key,
+            uint8_t* tcpFlags);
+
+    /**
+     * Sets up an empty flow table.
+     * 
+     * @param table Fill-in target.
+     * @param capacity Initial number of slots, rounded up to a power of two.
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int flowTableInit(flow_table* table, size_t capacity);
+
+    /**
+     * Releases the table's memory. Doesn't touch any open output files.
+     * 
+     * @param table The table.
+     */
+    void flowTableFree(flow_table* table);
+
+    /**
+     * Finds the flow with this key.
+     * 
+     * @param table The table.
+     * @param key The key to look for.
+     * @return The flow, or NULL if we're not tracking it. The pointer is only
+     * good until the next insert or remove.
+     */
+    flow* flowLookup(flow_table* table, const flow_key* key);
+
+    /**
+     * Starts tracking a flow. The key must not already be in the table. The
+     * new flow is zeroed apart from its key, with no output file.
+     * 
+     * @param table The table.
+     * @param key The key of the new flow.
+     * @return The new flow, or NULL if out of memory. The pointer is only good
+     * until the next insert or remove.
+     */
+    flow* flowInsert(flow_table* table, const flow_key* key);
+
+    /**
+     * Stops tracking a flow. This may move other flows around in the table.
+     * 
+     * @param table The table.
+     * @param entry A flow returned by flowLookup/flowInsert.
+     */
+    void flowRemove(flow_table* table, flow* entry);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FLOW_H */
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE /* pipe2 */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+
+#include "follow.h"
+
+/* Interval for re-checking the file when inotify can't tell us about it. */
+#define POLL_FALLBACK_MS 1000
+#define STREAM_PIPE_SIZE (1 << 20) /* What we ask a pipe to hold, so a busy
+                                    * writer fills it in large reads rather
+                                    * than waking us every 64 KB. */
+
+static volatile sig_atomic_t stopping = 0;
+
+/* Self-pipe: the signal handler writes here so a blocked epoll_wait wakes. */
+static int stopPipe[2] = {-1, -1};
+
+static void onStopSignal(int sig) {
+    (void) sig;
+    int savedErrno = errno;
+
+    stopping = 1;
+    if (stopPipe[1] >= 0) {
+        if (write(stopPipe[1], "x", 1) < 0) {
+            //Pipe full means a wakeup is already pending.
+        }
+    }
+
+    errno = savedErrno;
+}
+
+int installStopHandler(void) {
+    if (pipe2(stopPipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        return 0;
+    }
+
+    struct sigaction action;
+    action.sa_handler = onStopSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+
+    return sigaction(SIGINT, &action, NULL) == 0
+            && sigaction(SIGTERM, &action, NULL) == 0;
+}
+
+int stopRequested(void) {
+    return stopping;
+}
+
+/**
+ * Sets up the epoll set, with the stop pipe in it.
+ * 
+ * @return Non-zero on success.
+ */
+static int startFollowing(file_follower* follower) {
+    follower->inotifyFd = -1;
+    follower->watch = -1;
+    follower->streamFd = -1;
+    follower->epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (follower->epollFd < 0) {
+        return 0;
+    }
+
+    if (stopPipe[0] >= 0) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = stopPipe[0];
+        epoll_ctl(follower->epollFd, EPOLL_CTL_ADD, stopPipe[0], &event);
+    }
+
+    return 1;
+}
+
+int follow(file_follower* follower, const char* path) {
+    if (!startFollowing(follower)) {
+        return 0;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+
+    //No inotify (or an unsupported filesystem) isn't fatal, we just go back
+    //to checking on an interval.
+    follower->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follower->inotifyFd >= 0) {
+        follower->watch = inotify_add_watch(follower->inotifyFd, path,
+                IN_MODIFY | IN_CLOSE_WRITE);
+
+        if (follower->watch < 0) {
+            close(follower->inotifyFd);
+            follower->inotifyFd = -1;
+        } else {
+            event.data.fd = follower->inotifyFd;
+            epoll_ctl(follower->epollFd, EPOLL_CTL_ADD, follower->inotifyFd,
+                    &event);
+        }
+    }
+
+    if (follower->inotifyFd < 0) {
+        fprintf(stderr, "Can't watch %s, polling for new data instead.\n",
+                path);
+    }
+
+    return 1;
+}
+
+int watchDirectory(file_follower* follower, const char* path) {
+    if (follower->inotifyFd < 0) {
+        return 0;
+    }
+
+    //Files written inside it count as changes to it, too.
+    return inotify_add_watch(follower->inotifyFd, path,
+            IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE) >= 0;
+}
+
+int followStream(file_follower* follower, int fd) {
+    if (!startFollowing(follower)) {
+        return 0;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        unfollow(follower);
+        return 0;
+    }
+
+    //Only pipes can be grown (and only so far without privileges), so this
+    //is just a hint.
+    fcntl(fd, F_SETPIPE_SZ, STREAM_PIPE_SIZE);
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(follower->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        unfollow(follower);
+        return 0;
+    }
+
+    follower->streamFd = fd;
+    return 1;
+}
+
+/**
+ * Empties a non-blocking descriptor - we only care that it was readable, not
+ * about the individual events.
+ */
+static void drain(int fd) {
+    char scratch[4096];
+
+    while (read(fd, scratch, sizeof (scratch)) > 0) {
+    }
+}
+
+int waitForInput(file_follower* follower, int timeoutMs) {
+    if (stopping) {
+        return -1;
+    }
+
+    int pollOnly = follower->inotifyFd < 0 && follower->streamFd < 0;
+    int wait = timeoutMs;
+
+    if (pollOnly && (wait < 0 || wait > POLL_FALLBACK_MS)) {
+        wait = POLL_FALLBACK_MS;
+    }
+
+    struct epoll_event events[2];
+    int ready = epoll_wait(follower->epollFd, events, 2, wait);
+
+    if (stopping) {
+        return -1;
+    }
+
+    if (ready < 0) {
+        return errno == EINTR ? 1 : -1;
+    }
+
+    if (ready == 0) {
+        //When polling, a short wait isn't the caller's timeout yet.
+        return (pollOnly && wait != timeoutMs) ? 1 : 0;
+    }
+
+    if (follower->inotifyFd >= 0) {
+        drain(follower->inotifyFd);
+    }
+
+    return 1;
+}
+
+int unfollow(file_follower* follower) {
+    //The stream itself belongs to the caller, it's only left blocking again.
+    if (follower->streamFd >= 0) {
+        int flags = fcntl(follower->streamFd, F_GETFL);
+
+        if (flags >= 0) {
+            fcntl(follower->streamFd, F_SETFL, flags & ~O_NONBLOCK);
+        }
+        follower->streamFd = -1;
+    }
+
+    if (follower->inotifyFd >= 0) {
+        close(follower->inotifyFd);
+        follower->inotifyFd = -1;
+    }
+
+    if (follower->epollFd >= 0) {
+        close(follower->epollFd);
+        follower->epollFd = -1;
+    }
+
+    return 1;
+}
@@ -0,0 +1,99 @@
+/* 
+ * File:   follow.h
+ *
+ * Waiting on a live capture file without polling: we block on inotify events
+ * for the file (and on a stop signal) instead of sleeping and re-checking.
+ * Captures streamed through a pipe are waited on with epoll directly.
+ */
+
+#ifndef FOLLOW_H
+#define	FOLLOW_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    typedef struct {
+        int epollFd;
+        int inotifyFd; /* -1 if inotify isn't available for this file, in
+                        * which case waits fall back to short timeouts. */
+        int watch;
+        int streamFd; /* The pipe or socket waited on, -1 when following a
+                       * file. */
+    } file_follower;
+
+    /**
+     * Installs SIGINT/SIGTERM handlers that ask the program to stop rather
+     * than killing it, so capture files and outputs get closed properly. Call
+     * this once, before `follow`.
+     * 
+     * @return Non-zero on success.
+     */
+    int installStopHandler(void);
+
+    /**
+     * Whether a stop signal has been received.
+     * 
+     * @return Non-zero if we should wind down.
+     */
+    int stopRequested(void);
+
+    /**
+     * Starts watching a capture file for appended data. Any writes after this
+     * call will wake a later `waitForInput`, so call it before reading the
+     * file to avoid missing data appended in between.
+     * 
+     * @param follower Fill-in target.
+     * @param path Path of the capture file.
+     * @return Non-zero on success, zero otherwise.
+     */
+    int follow(file_follower* follower, const char* path);
+
+    /**
+     * Also wakes `waitForInput` when files appear in (or are written in) a
+     * directory, such as where tcpdump rotates its captures to.
+     * 
+     * @param follower A follower set up by `follow`.
+     * @param path The directory.
+     * @return Non-zero if it's being watched, zero if it can't be (waits
+     * then fall back to short timeouts anyway).
+     */
+    int watchDirectory(file_follower* follower, const char* path);
+
+    /**
+     * Starts waiting on a capture streamed through a pipe or socket instead.
+     * The descriptor is made non-blocking, so reads return what has arrived
+     * and `waitForInput` blocks until more does (or the writer goes away).
+     * 
+     * @param follower Fill-in target.
+     * @param fd The pipe or socket, still owned by the caller.
+     * @return Non-zero on success, zero otherwise.
+     */
+    int followStream(file_follower* follower, int fd);
+
+    /**
+     * Blocks until the followed file (or stream) is written to or closed by
+     * its writer, the timeout passes, or a stop is requested.
+     * 
+     * @param follower The follower.
+     * @param timeoutMs Longest time to wait in milliseconds, or -1 to wait as
+     * long as it takes.
+     * @return 1 if the file may have grown, 0 on timeout, -1 if we should stop
+     * (stop requested or an error).
+     */
+    int waitForInput(file_follower* follower, int timeoutMs);
+
+    /**
+     * Releases the watch and descriptors held by a follower.
+     * 
+     * @param follower The follower.
+     * @return Should always be non-zero.
+     */
+    int unfollow(file_follower* follower);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* FOLLOW_H */
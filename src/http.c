@@ -0,0 +1,394 @@
+#define _GNU_SOURCE /* strcasestr */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define MAX_CHUNK_SIZE (1LL << 40) /* Anything bigger is framing gone wrong. */
+
+#include "http.h"
+
+static long findHeaderEndScalar(const uint8_t* data, size_t len, size_t i) {
+    for (; i + 4 <= len; i++) {
+        if (data[i] == '\r' && data[i + 1] == '\n'
+                && data[i + 2] == '\r' && data[i + 3] == '\n') {
+            return i + 4;
+        }
+    }
+
+    return -1;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Both vector versions compare four shifted loads against \r \n \r \n, so a
+ * set bit in the combined mask means the full terminator starts there.
+ */
+
+static long findHeaderEndSSE2(const uint8_t* data, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 + 3 <= len; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i)), cr);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 1)), lf);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 2)), cr);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + i + 3)), lf);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b),
+                _mm_and_si128(c, d)));
+
+        if (mask) {
+            return i + __builtin_ctz(mask) + 4;
+        }
+    }
+
+    return findHeaderEndScalar(data, len, i);
+}
+
+__attribute__((target("avx2")))
+static long findHeaderEndAVX2(const uint8_t* data, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 32 + 3 <= len; i += 32) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i)), cr);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 1)), lf);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 2)), cr);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + i + 3)), lf);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_and_si256(
+                _mm256_and_si256(a, b), _mm256_and_si256(c, d)));
+
+        if (mask) {
+            return i + __builtin_ctz(mask) + 4;
+        }
+    }
+
+    return findHeaderEndScalar(data, len, i);
+}
+
+long findHeaderEnd(const uint8_t* data, size_t len) {
+    static int haveAVX2 = -1;
+
+    if (haveAVX2 < 0) {
+        haveAVX2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+
+    return haveAVX2 ? findHeaderEndAVX2(data, len)
+            : findHeaderEndSSE2(data, len);
+}
+
+#else
+
+long findHeaderEnd(const uint8_t* data, size_t len) {
+    return findHeaderEndScalar(data, len, 0);
+}
+
+#endif
+
+long findResponseStart(const uint8_t* data, size_t len) {
+    size_t i = len;
+
+    while (i >= 7) {
+        i--;
+        size_t start = i - 6;
+
+        if (data[start] == 'H' && memcmp(data + start, "HTTP/1.", 7) == 0) {
+            return start;
+        }
+    }
+
+    return -1;
+}
+
+void httpResponseInit(http_response* response) {
+    memset(response, 0, sizeof (http_response));
+    response->state = HTTP_HEADERS;
+    response->contentLength = -1;
+}
+
+/**
+ * Copies a header value, dropping surrounding whitespace.
+ */
+static void copyValue(char* out, size_t outSize, const char* value,
+        size_t len) {
+    while (len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        len--;
+    }
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')) {
+        len--;
+    }
+    if (len >= outSize) {
+        len = outSize - 1;
+    }
+
+    memcpy(out, value, len);
+    out[len] = '\0';
+}
+
+/**
+ * Parses the complete header block: the status line and whichever fields we
+ * have a use for.
+ */
+static void parseHeaders(http_response* response, const char* text,
+        size_t len) {
+    const char* end = text + len;
+    const char* line = text;
+
+    while (line < end) {
+        const char* eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        size_t lineLength = eol - line;
+        if (lineLength > 0 && line[lineLength - 1] == '\r') {
+            lineLength--;
+        }
+
+        const char* colon = memchr(line, ':', lineLength);
+
+        if (line == text && lineLength > 5 && strncmp(line, "HTTP/", 5) == 0) {
+            //The block ends in a blank line, so atoi can't run off the end.
+            const char* space = memchr(line, ' ', lineLength);
+            if (space) {
+                response->statusCode = atoi(space + 1);
+            }
+        } else if (colon) {
+            size_t nameLength = colon - line;
+            const char* value = colon + 1;
+            size_t valueLength = lineLength - nameLength - 1;
+
+            if (nameLength == 12 && strncasecmp(line, "Content-Type", 12) == 0) {
+                copyValue(response->contentType, sizeof (response->contentType),
+                        value, valueLength);
+            } else if (nameLength == 14
+                    && strncasecmp(line, "Content-Length", 14) == 0) {
+                char number[32];
+                copyValue(number, sizeof (number), value, valueLength);
+                response->contentLength = strtoll(number, NULL, 10);
+            } else if (nameLength == 17
+                    && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+                char coding[64];
+                copyValue(coding, sizeof (coding), value, valueLength);
+                //Chunked is always applied last, so it's all we need to see.
+                response->chunked = strcasestr(coding, "chunked") != NULL;
+            }
+        }
+
+        line = eol + 1;
+    }
+}
+
+uint32_t httpConsumeHeaders(http_response* response, const uint8_t* data,
+        uint32_t len) {
+    if (response->state != HTTP_HEADERS) {
+        return 0;
+    }
+
+    //The terminator may straddle segments, so look back over the last few
+    //bytes we already had as well as the new ones.
+    uint32_t take = len;
+    if (response->headerLength + take > HTTP_MAX_HEADER) {
+        take = HTTP_MAX_HEADER - response->headerLength;
+    }
+
+    if (response->headerLength + take > response->headerCapacity) {
+        uint32_t capacity = response->headerCapacity ? response->headerCapacity : 2048;
+        while (capacity < response->headerLength + take) {
+            capacity *= 2;
+        }
+
+        uint8_t* header = realloc(response->header, capacity);
+        if (header == NULL) {
+            response->state = HTTP_ERROR;
+            return 0;
+        }
+        response->header = header;
+        response->headerCapacity = capacity;
+    }
+
+    uint32_t lookBack = response->headerLength < 3 ? response->headerLength : 3;
+    uint32_t searchFrom = response->headerLength - lookBack;
+
+    memcpy(response->header + response->headerLength, data, take);
+
+    long end = findHeaderEnd(response->header + searchFrom,
+            response->headerLength + take - searchFrom);
+
+    if (end < 0) {
+        response->headerLength += take;
+        if (response->headerLength >= HTTP_MAX_HEADER) {
+            response->state = HTTP_ERROR;
+        }
+        return take;
+    }
+
+    //Only the bytes up to the terminator were header.
+    uint32_t headerEnd = searchFrom + end;
+    uint32_t consumed = headerEnd - response->headerLength;
+
+    response->headerLength = headerEnd;
+    parseHeaders(response, (const char*) response->header, headerEnd);
+    response->state = HTTP_BODY;
+
+    //Work out how the body is framed (RFC 7230 section 3.3.3). Without a
+    //status line this is the tail of a header block, not a response, and
+    //there's no telling where its body ends.
+    int status = response->statusCode;
+
+    if (status == 0) {
+        response->state = HTTP_ERROR;
+    } else if ((status >= 100 && status < 200) || status == 204 || status == 304) {
+        response->state = HTTP_DONE;
+    } else if (response->chunked) {
+        response->chunk = CHUNK_SIZE;
+        response->remaining = 0;
+    } else if (response->contentLength >= 0) {
+        response->remaining = response->contentLength;
+        if (response->remaining == 0) {
+            response->state = HTTP_DONE;
+        }
+    } else {
+        response->untilClose = 1;
+    }
+
+    return consumed;
+}
+
+void httpReleaseHeaders(http_response* response) {
+    free(response->header);
+    response->header = NULL;
+    response->headerLength = 0;
+    response->headerCapacity = 0;
+}
+
+static int hexDigit(uint8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Chunked transfer coding, a byte (or a run of chunk data) at a time, so it
+ * can stop and pick up again at any segment boundary.
+ */
+static uint32_t consumeChunked(http_response* response, const uint8_t* data,
+        uint32_t len, http_body_sink sink, void* context) {
+    uint32_t i = 0;
+
+    while (i < len && response->state == HTTP_BODY) {
+        uint8_t c = data[i];
+
+        switch (response->chunk) {
+            case CHUNK_SIZE:
+                if (hexDigit(c) >= 0) {
+                    response->remaining = response->remaining * 16 + hexDigit(c);
+                    if (response->remaining > MAX_CHUNK_SIZE) {
+                        response->state = HTTP_ERROR;
+                    }
+                } else if (c == '\n') {
+                    response->chunk = response->remaining
+                            ? CHUNK_DATA : CHUNK_TRAILER;
+                    response->trailerLineLength = 0;
+                } else if (c != '\r') {
+                    response->chunk = CHUNK_EXTENSION;
+                }
+                i++;
+                break;
+
+            case CHUNK_EXTENSION:
+                if (c == '\n') {
+                    response->chunk = response->remaining
+                            ? CHUNK_DATA : CHUNK_TRAILER;
+                    response->trailerLineLength = 0;
+                }
+                i++;
+                break;
+
+            case CHUNK_DATA:
+            {
+                uint32_t take = len - i;
+                if (take > response->remaining) {
+                    take = response->remaining;
+                }
+
+                sink(context, data + i, take);
+                response->remaining -= take;
+                i += take;
+
+                if (response->remaining == 0) {
+                    response->chunk = CHUNK_DATA_END;
+                }
+                break;
+            }
+
+            case CHUNK_DATA_END:
+                if (c == '\n') {
+                    response->chunk = CHUNK_SIZE;
+                }
+                i++;
+                break;
+
+            case CHUNK_TRAILER:
+                if (c == '\n') {
+                    if (response->trailerLineLength == 0) {
+                        response->state = HTTP_DONE;
+                    }
+                    response->trailerLineLength = 0;
+                } else if (c != '\r') {
+                    response->trailerLineLength++;
+                }
+                i++;
+                break;
+        }
+    }
+
+    return i;
+}
+
+uint32_t httpConsumeBody(http_response* response, const uint8_t* data,
+        uint32_t len, http_body_sink sink, void* context) {
+    if (response->state != HTTP_BODY) {
+        return 0;
+    }
+
+    if (response->chunked) {
+        return consumeChunked(response, data, len, sink, context);
+    }
+
+    if (response->untilClose) {
+        sink(context, data, len);
+        return len;
+    }
+
+    uint32_t take = len;
+    if (take > response->remaining) {
+        take = response->remaining;
+    }
+
+    sink(context, data, take);
+    response->remaining -= take;
+
+    if (response->remaining == 0) {
+        response->state = HTTP_DONE;
+    }
+
+    return take;
+}
+
+void httpResponseFree(http_response* response) {
+    free(response->header);
+    response->header = NULL;
+    response->headerLength = 0;
+    response->headerCapacity = 0;
+}
@@ -0,0 +1,140 @@
+/* 
+ * File:   http.h
+ *
+ * Incremental HTTP response parsing. A response's headers may arrive over any
+ * number of segments; we collect them until the blank line that ends them,
+ * pull out the fields we care about, and then follow the body's framing
+ * (Content-Length, chunked, or until the connection closes) so we know where
+ * it ends and the next response on a kept-alive connection begins.
+ */
+
+#ifndef HTTP_H
+#define	HTTP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define HTTP_MAX_HEADER (64 * 1024) /* Longest header block we'll collect. */
+#define HTTP_MAX_CONTENT_TYPE 128
+
+    typedef enum {
+        HTTP_HEADERS, /* Still collecting the header block. */
+        HTTP_BODY, /* Headers done, reading the body. */
+        HTTP_DONE, /* The body is complete. */
+        HTTP_ERROR /* Headers or framing didn't make sense. */
+    } http_state;
+
+    typedef enum {
+        CHUNK_SIZE, /* Reading a chunk-size line's hex digits. */
+        CHUNK_EXTENSION, /* Skipping the rest of a chunk-size line. */
+        CHUNK_DATA, /* Inside a chunk. */
+        CHUNK_DATA_END, /* Skipping the CRLF after a chunk. */
+        CHUNK_TRAILER /* After the last chunk, waiting for the blank line. */
+    } chunk_state;
+
+    typedef struct {
+        http_state state;
+        uint8_t* header; /* Header bytes so far. Once the headers are done this
+                          * is the whole block, until httpReleaseHeaders. */
+        uint32_t headerLength;
+        uint32_t headerCapacity;
+        int statusCode; /* Zero if the stream didn't start at a status line. */
+        char contentType[HTTP_MAX_CONTENT_TYPE]; /* Empty if not given. */
+        int64_t contentLength; /* -1 if not given. */
+        int chunked; /* Transfer-Encoding: chunked. */
+        int untilClose; /* No framing at all: the body runs until FIN. */
+        int64_t remaining; /* Body (or current chunk) bytes still to come. */
+        chunk_state chunk;
+        uint32_t trailerLineLength;
+    } http_response;
+
+    /* Receives decoded body bytes. */
+    typedef void (*http_body_sink)(void* context, const uint8_t* data,
+            uint32_t len);
+
+    /**
+     * Finds the blank line ("\r\n\r\n") that ends an HTTP header block. Uses
+     * SSE2 or AVX2 where the CPU has them.
+     * 
+     * @param data Bytes to search.
+     * @param len How many bytes.
+     * @return Offset just past the blank line, or -1 if it isn't there.
+     */
+    long findHeaderEnd(const uint8_t* data, size_t len);
+
+    /**
+     * Finds where the response containing some position starts: the last
+     * status line ("HTTP/1.") before that position. It needn't start a line,
+     * since a response directly follows the body before it.
+     * 
+     * @param data Bytes to search.
+     * @param len Search up to here.
+     * @return Offset of the status line, or -1 if there isn't one (the bytes
+     * may be the middle of a response that started earlier).
+     */
+    long findResponseStart(const uint8_t* data, size_t len);
+
+    /**
+     * Starts parsing a new response.
+     * 
+     * @param response Fill-in target.
+     */
+    void httpResponseInit(http_response* response);
+
+    /**
+     * Feeds the next bytes of the stream to a response still in HTTP_HEADERS.
+     * Header bytes are taken; once the header block is complete the fields
+     * are parsed and the state moves on to HTTP_BODY (or straight to HTTP_DONE
+     * if the response can't or doesn't have a body). A header block that
+     * doesn't start with a status line is an HTTP_ERROR.
+     * 
+     * @param response The response.
+     * @param data Next bytes of the stream.
+     * @param len How many bytes.
+     * @return How many of the bytes belonged to the headers. Anything past
+     * that is body. If the state is HTTP_ERROR, give up on the stream.
+     */
+    uint32_t httpConsumeHeaders(http_response* response, const uint8_t* data,
+            uint32_t len);
+
+    /**
+     * Frees the header block kept after the headers were parsed. Its fields
+     * stay available.
+     * 
+     * @param response The response.
+     */
+    void httpReleaseHeaders(http_response* response);
+
+    /**
+     * Feeds the next bytes of the stream to a response in HTTP_BODY, passing
+     * the decoded body (chunk framing removed) to the sink. Stops at the end
+     * of the body, moving to HTTP_DONE.
+     * 
+     * @param response The response.
+     * @param data Next bytes of the stream.
+     * @param len How many bytes.
+     * @param sink Receives the body.
+     * @param context Passed through to the sink.
+     * @return How many of the bytes belonged to this response. Anything past
+     * that is the start of the next response.
+     */
+    uint32_t httpConsumeBody(http_response* response, const uint8_t* data,
+            uint32_t len, http_body_sink sink, void* context);
+
+    /**
+     * Releases anything the response is holding.
+     * 
+     * @param response The response.
+     */
+    void httpResponseFree(http_response* response);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* HTTP_H */
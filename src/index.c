@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "index.h"
+
+#define INDEX_BUILD_BATCH 256
+
+/**
+ * Fills in the parts of an index header that tie it to a capture.
+ */
+static int describeCapture(const char* capturePath, index_header* header) {
+    struct stat info;
+
+    if (stat(capturePath, &info) != 0) {
+        return 0;
+    }
+
+    memcpy(header->magic, "RPIX", 4);
+    header->version = INDEX_VERSION;
+    header->captureSize = info.st_size;
+    header->captureModified = info.st_mtim.tv_sec;
+    header->captureModifiedNanos = info.st_mtim.tv_nsec;
+    return 1;
+}
+
+int indexBuild(const char* capturePath, const char* indexPath) {
+    index_header header;
+    memset(&header, 0, sizeof (header));
+
+    if (!describeCapture(capturePath, &header)) {
+        return 0;
+    }
+
+    int fd = open(capturePath, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    pcap_file pcapFile;
+    if (!load(fd, &pcapFile, 1)) {
+        close(fd);
+        return 0;
+    }
+
+    //Entries point at records, which pcapng doesn't have.
+    if (pcapFile.isNg) {
+        fprintf(stderr, "pcapng captures can't be indexed.\n");
+        unload(&pcapFile);
+        close(fd);
+        return 0;
+    }
+
+    //Write next to the real thing and swap it in at the end, so a reader
+    //never sees half an index.
+    char tempPath[PATH_MAX];
+    snprintf(tempPath, sizeof (tempPath), "%s.tmp", indexPath);
+    FILE* out = fopen(tempPath, "wb");
+
+    if (out == NULL) {
+        unload(&pcapFile);
+        close(fd);
+        return 0;
+    }
+
+    fwrite(&header, sizeof (header), 1, out);
+
+    //Records are back to back, so offsets just add up.
+    uint64_t offset = sizeof (pcap_header);
+    uint32_t lastSeconds = 0;
+    uint32_t lastFraction = 0;
+    int ok = 1;
+    pcap_packet packets[INDEX_BUILD_BATCH];
+
+    header.timeOrdered = 1;
+
+    for (;;) {
+        int count = readPacketBatch(&pcapFile, packets, INDEX_BUILD_BATCH);
+
+        if (count <= 0) {
+            ok = count == 0;
+            break;
+        }
+
+        int i;
+        for (i = 0; i < count; i++) {
+            pcap_packet* packet = &packets[i];
+            index_entry entry;
+            flow_key key;
+
+            memset(&entry, 0, sizeof (entry));
+            entry.offset = offset;
+            entry.seconds = packet->header.ts_sec;
+            entry.fraction = packet->header.ts_usec;
+
+            if (packetFlowKey(packet, &key, &(entry.tcpFlags))) {
+                entry.isTcp = 1;
+                entry.flowHash = flowHash(&key);
+            }
+
+            if (entry.seconds < lastSeconds || (entry.seconds == lastSeconds
+                    && entry.fraction < lastFraction)) {
+                header.timeOrdered = 0;
+            }
+            lastSeconds = entry.seconds;
+            lastFraction = entry.fraction;
+
+            fwrite(&entry, sizeof (entry), 1, out);
+            offset += sizeof (pcap_packet_header) + packet->header.incl_len;
+            header.count++;
+        }
+    }
+
+    unload(&pcapFile);
+    close(fd);
+
+    //Now that the count is known.
+    if (ok) {
+        ok = fseek(out, 0, SEEK_SET) == 0
+                && fwrite(&header, sizeof (header), 1, out) == 1;
+    }
+
+    if (fclose(out) != 0 || !ok || rename(tempPath, indexPath) != 0) {
+        unlink(tempPath);
+        return 0;
+    }
+
+    return 1;
+}
+
+int indexOpen(packet_index* index, const char* capturePath,
+        const char* indexPath) {
+    index_header expected;
+    memset(index, 0, sizeof (packet_index));
+
+    if (!describeCapture(capturePath, &expected)) {
+        return 0;
+    }
+
+    int fd = open(indexPath, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof (index_header)) {
+        close(fd);
+        return 0;
+    }
+
+    index->mapSize = info.st_size;
+    index->map = mmap(NULL, index->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (index->map == MAP_FAILED) {
+        index->map = NULL;
+        return 0;
+    }
+
+    index->header = index->map;
+    index->entries = (const index_entry*) (index->header + 1);
+
+    const index_header* header = index->header;
+    if (memcmp(header->magic, expected.magic, 4) != 0
+            || header->version != expected.version
+            || header->captureSize != expected.captureSize
+            || header->captureModified != expected.captureModified
+            || header->captureModifiedNanos != expected.captureModifiedNanos
+            || header->count != (index->mapSize - sizeof (index_header))
+            / sizeof (index_entry)) {
+        indexClose(index);
+        return 0;
+    }
+
+    madvise(index->map, index->mapSize, MADV_SEQUENTIAL);
+    return 1;
+}
+
+void indexClose(packet_index* index) {
+    if (index->map != NULL) {
+        munmap(index->map, index->mapSize);
+        index->map = NULL;
+    }
+}
+
+void indexQueryInit(packet_index* index, index_query* query) {
+    memset(query, 0, sizeof (index_query));
+    query->end = index->header->count;
+}
+
+void indexQueryFlow(index_query* query, const flow_key* key) {
+    flow_key reverse;
+    flowKeyReverse(key, &reverse);
+
+    query->byFlow = 1;
+    query->flow = *key;
+    query->flowHashes[0] = flowHash(key);
+    query->flowHashes[1] = flowHash(&reverse);
+}
+
+/**
+ * Finds the first entry from `low` on that isn't timestamped before `seconds`,
+ * in an index whose timestamps never go backwards.
+ */
+static uint64_t firstAtOrAfter(packet_index* index, uint64_t low,
+        uint64_t high, uint32_t seconds) {
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+
+        if (index->entries[middle].seconds < seconds) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void indexQueryTime(packet_index* index, index_query* query,
+        uint32_t from, uint32_t to) {
+    query->byTime = 1;
+    query->from = from;
+    query->to = to;
+
+    //Otherwise every entry gets checked.
+    if (index->header->timeOrdered) {
+        query->next = firstAtOrAfter(index, query->next, query->end, from);
+        if (to < UINT32_MAX) {
+            query->end = firstAtOrAfter(index, query->next, query->end, to + 1);
+        }
+    }
+}
+
+/**
+ * Whether an entry is one the query wants, going by the index alone.
+ */
+static int entryMatches(const index_query* query, const index_entry* entry) {
+    if (query->byTime && (entry->seconds < query->from
+            || entry->seconds > query->to)) {
+        return 0;
+    }
+
+    if (query->byFlow && !(entry->isTcp
+            && (entry->flowHash == query->flowHashes[0]
+            || entry->flowHash == query->flowHashes[1]))) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Whether a packet really is from the query's flow, not just another flow
+ * with the same hash.
+ */
+static int packetInFlow(const index_query* query, const pcap_packet* packet) {
+    flow_key key;
+    flow_key reverse;
+
+    if (!packetFlowKey(packet, &key, NULL)) {
+        return 0;
+    }
+
+    flowKeyReverse(&key, &reverse);
+
+    return flowKeysEqual(&key, &(query->flow))
+            || flowKeysEqual(&reverse, &(query->flow));
+}
+
+int indexReadBatch(packet_index* index, index_query* query,
+        pcap_file* pcapFile, pcap_packet* out, int max) {
+    int count = 0;
+
+    //The last batch has been dealt with by now.
+    releasePackets(pcapFile);
+
+    while (count < max && query->next < query->end) {
+        const index_entry* entry = &(index->entries[query->next++]);
+
+        if (!entryMatches(query, entry)) {
+            continue;
+        }
+
+        if (!readPacketAt(pcapFile, entry->offset, &out[count])) {
+            return -1;
+        }
+
+        if (query->byFlow && !packetInFlow(query, &out[count])) {
+            unloadPacket(&out[count]);
+            continue;
+        }
+        count++;
+    }
+
+    return count;
+}
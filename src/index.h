@@ -0,0 +1,142 @@
+/* 
+ * File:   index.h
+ *
+ * Sidecar packet index. One pass over a fixed-size capture records where each
+ * packet's record starts, its timestamp, which flow it belongs to and its TCP
+ * flags, in a small file next to the capture. Later runs read the index
+ * instead of the capture to find the packets they want, and only touch those
+ * packets.
+ */
+
+#ifndef INDEX_H
+#define	INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decap_includes.h"
+#include "flow.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define INDEX_SUFFIX ".idx"
+#define INDEX_VERSION 2
+
+    typedef struct {
+        char magic[4]; /* "RPIX" */
+        uint32_t version;
+        uint64_t captureSize; /* The capture as it was indexed; if it's */
+        int64_t captureModified; /* changed since, the index is stale. */
+        int64_t captureModifiedNanos;
+        uint64_t count; /* Entries that follow. */
+        uint32_t timeOrdered; /* Timestamps never go backwards, so time
+                               * windows can be found by binary search. */
+        uint32_t reserved;
+    } index_header;
+
+    typedef struct {
+        uint64_t offset; /* Of the record header in the capture. */
+        uint32_t seconds;
+        uint32_t fraction; /* Micro- or nanoseconds, as in the capture. */
+        uint32_t flowHash; /* flowHash() of the TCP flow, if isTcp. */
+        uint8_t tcpFlags;
+        uint8_t isTcp;
+        uint8_t reserved[2];
+    } index_entry;
+
+    typedef struct {
+        void* map; /* The whole index file. */
+        size_t mapSize;
+        const index_header* header;
+        const index_entry* entries;
+    } packet_index;
+
+    typedef struct {
+        int byFlow; /* Only packets of this flow, in either direction. */
+        flow_key flow;
+        uint32_t flowHashes[2];
+        int byTime; /* Only packets timestamped from..to (inclusive). */
+        uint32_t from;
+        uint32_t to;
+        uint64_t next; /* Next entry to look at. */
+        uint64_t end; /* One past the last entry to look at. */
+    } index_query;
+
+    /**
+     * Indexes a capture, replacing any index that's already there.
+     * 
+     * @param capturePath The capture.
+     * @param indexPath Where the index goes.
+     * @return Non-zero on success.
+     */
+    int indexBuild(const char* capturePath, const char* indexPath);
+
+    /**
+     * Opens an index, if there is one and it's up to date.
+     * 
+     * @param index Fill-in target.
+     * @param capturePath The capture it should describe.
+     * @param indexPath The index.
+     * @return Non-zero if the index can be used, zero if it's missing, stale
+     * or damaged (it should be rebuilt).
+     */
+    int indexOpen(packet_index* index, const char* capturePath,
+            const char* indexPath);
+
+    /**
+     * Releases an index.
+     * 
+     * @param index The index.
+     */
+    void indexClose(packet_index* index);
+
+    /**
+     * Starts a query matching every packet.
+     * 
+     * @param index The index.
+     * @param query Fill-in target.
+     */
+    void indexQueryInit(packet_index* index, index_query* query);
+
+    /**
+     * Narrows a query down to one flow (both directions of it).
+     * 
+     * @param query The query.
+     * @param key The flow, either way round.
+     */
+    void indexQueryFlow(index_query* query, const flow_key* key);
+
+    /**
+     * Narrows a query down to a time window.
+     * 
+     * @param index The index.
+     * @param query The query, not yet read from.
+     * @param from First second wanted.
+     * @param to Last second wanted.
+     */
+    void indexQueryTime(packet_index* index, index_query* query,
+            uint32_t from, uint32_t to);
+
+    /**
+     * Reads the next packets matching a query, like readPacketBatch: they're
+     * views, only good until the next call.
+     * 
+     * @param index The index.
+     * @param query The query.
+     * @param pcapFile The capture the index describes, loaded fixed-size.
+     * @param out Array of at least `max` packets to fill in.
+     * @param max Most packets to return.
+     * @return Number of packets read (zero once there are no more), or
+     * negative if the capture doesn't match the index.
+     */
+    int indexReadBatch(packet_index* index, index_query* query,
+            pcap_file* pcapFile, pcap_packet* out, int max);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* INDEX_H */
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "match.h"
+
+#define ROW(m, state) ((m)->transitions + (size_t) (state) * 256)
+
+/**
+ * Adds a state with no edges.
+ * 
+ * @return The new state, or -1 if out of memory.
+ */
+static int newState(matcher* m) {
+    if (m->stateCount == m->stateCapacity) {
+        int capacity = m->stateCapacity * 2;
+        int32_t* transitions = realloc(m->transitions,
+                (size_t) capacity * 256 * sizeof (int32_t));
+        if (transitions == NULL) {
+            return -1;
+        }
+        m->transitions = transitions;
+
+        int32_t* matches = realloc(m->matches, capacity * sizeof (int32_t));
+        if (matches == NULL) {
+            return -1;
+        }
+        m->matches = matches;
+        m->stateCapacity = capacity;
+    }
+
+    int state = m->stateCount++;
+    memset(ROW(m, state), 0xff, 256 * sizeof (int32_t));
+    m->matches[state] = -1;
+    return state;
+}
+
+int matcherInit(matcher* m) {
+    memset(m, 0, sizeof (matcher));
+    m->stateCapacity = 64;
+    m->transitions = malloc((size_t) m->stateCapacity * 256 * sizeof (int32_t));
+    m->matches = malloc(m->stateCapacity * sizeof (int32_t));
+
+    if (m->transitions == NULL || m->matches == NULL) {
+        return 0;
+    }
+
+    return newState(m) == 0;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Turns pattern text into the bytes to match, handling escapes.
+ * 
+ * @return Number of bytes, or -1 on a bad escape.
+ */
+static int unescape(const char* text, uint8_t* out) {
+    int len = 0;
+
+    while (*text) {
+        if (*text != '\\') {
+            out[len++] = *text++;
+            continue;
+        }
+
+        text++;
+        switch (*text) {
+            case 'r': out[len++] = '\r'; break;
+            case 'n': out[len++] = '\n'; break;
+            case 't': out[len++] = '\t'; break;
+            case '\\': out[len++] = '\\'; break;
+            case 'x':
+                if (hexValue(text[1]) < 0 || hexValue(text[2]) < 0) {
+                    return -1;
+                }
+                out[len++] = hexValue(text[1]) * 16 + hexValue(text[2]);
+                text += 2;
+                break;
+            default:
+                return -1;
+        }
+        text++;
+    }
+
+    return len;
+}
+
+int matcherAdd(matcher* m, const char* pattern) {
+    if (m->compiled) {
+        return 0;
+    }
+
+    uint8_t bytes[strlen(pattern) + 1];
+    int len = unescape(pattern, bytes);
+
+    if (len <= 0) {
+        fprintf(stderr, "Bad pattern: %s\n", pattern);
+        return 0;
+    }
+
+    char** rules = realloc(m->rules, (m->ruleCount + 1) * sizeof (char*));
+    if (rules == NULL) {
+        return 0;
+    }
+    m->rules = rules;
+
+    int rule = m->ruleCount;
+    m->rules[rule] = strdup(pattern);
+    if (m->rules[rule] == NULL) {
+        return 0;
+    }
+    m->ruleCount++;
+
+    //Walk the trie, adding states for whatever isn't there yet.
+    int state = 0;
+    int i;
+    for (i = 0; i < len; i++) {
+        int next = ROW(m, state)[bytes[i]];
+
+        if (next < 0) {
+            next = newState(m);
+            if (next < 0) {
+                return 0;
+            }
+            ROW(m, state)[bytes[i]] = next;
+        }
+        state = next;
+    }
+
+    if (m->matches[state] < 0) {
+        m->matches[state] = rule;
+    }
+
+    return 1;
+}
+
+int matcherLoad(matcher* m, const char* path) {
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Can't open pattern file %s\n", path);
+        return 0;
+    }
+
+    char line[4096];
+    int ok = 1;
+
+    while (ok && fgets(line, sizeof (line), file)) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        ok = matcherAdd(m, line);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+int matcherCompile(matcher* m) {
+    //Breadth-first over the trie: each state's failure state is always
+    //shallower, so it's finished by the time we need it. Missing edges are
+    //filled in from the failure state, which turns the trie into a DFA.
+    int* fail = malloc(m->stateCount * sizeof (int));
+    int* queue = malloc(m->stateCount * sizeof (int));
+
+    if (fail == NULL || queue == NULL) {
+        free(fail);
+        free(queue);
+        return 0;
+    }
+
+    int head = 0;
+    int tail = 0;
+    int c;
+
+    for (c = 0; c < 256; c++) {
+        int next = ROW(m, 0)[c];
+
+        if (next < 0) {
+            ROW(m, 0)[c] = 0;
+        } else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail) {
+        int state = queue[head++];
+        int32_t* row = ROW(m, state);
+
+        //A state also matches whatever its failure state matches.
+        int inherited = m->matches[fail[state]];
+        if (inherited >= 0
+                && (m->matches[state] < 0 || inherited < m->matches[state])) {
+            m->matches[state] = inherited;
+        }
+
+        for (c = 0; c < 256; c++) {
+            if (row[c] < 0) {
+                row[c] = ROW(m, fail[state])[c];
+            } else {
+                fail[row[c]] = ROW(m, fail[state])[c];
+                queue[tail++] = row[c];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    m->compiled = 1;
+    return 1;
+}
+
+int matcherScan(const matcher* m, const uint8_t* data, size_t len,
+        size_t* matchEnd) {
+    const int32_t* transitions = m->transitions;
+    const int32_t* matches = m->matches;
+    int32_t state = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        state = transitions[(size_t) state * 256 + data[i]];
+
+        if (matches[state] >= 0) {
+            if (matchEnd) {
+                *matchEnd = i + 1;
+            }
+            return matches[state];
+        }
+    }
+
+    return -1;
+}
+
+const char* matcherRuleName(const matcher* m, int rule) {
+    return m->rules[rule];
+}
+
+void matcherFree(matcher* m) {
+    int i;
+
+    for (i = 0; i < m->ruleCount; i++) {
+        free(m->rules[i]);
+    }
+
+    free(m->rules);
+    free(m->transitions);
+    free(m->matches);
+    memset(m, 0, sizeof (matcher));
+}
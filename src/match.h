@@ -0,0 +1,106 @@
+/* 
+ * File:   match.h
+ *
+ * Multi-pattern matching over TCP payloads: every pattern is compiled into one
+ * Aho-Corasick automaton, so a payload is scanned once no matter how many
+ * rules there are.
+ */
+
+#ifndef MATCH_H
+#define	MATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define DEFAULT_PATTERN "tent-Type: audio/mp" /* Used if none are given. */
+
+    typedef struct {
+        int32_t* transitions; /* stateCount rows of 256 next states. While
+                               * rules are being added, -1 marks a missing
+                               * edge; compiling fills every edge in. */
+        int32_t* matches; /* Per state, the rule matched on reaching it (the
+                           * lowest numbered one if several), or -1. */
+        int stateCount;
+        int stateCapacity;
+        char** rules; /* Rule text as given, for reporting. */
+        int ruleCount;
+        int compiled;
+    } matcher;
+
+    /**
+     * Sets up a matcher with no rules.
+     * 
+     * @param m Fill-in target.
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int matcherInit(matcher* m);
+
+    /**
+     * Adds a rule. The pattern text understands the escapes \r, \n, \t, \\
+     * and \xHH, so binary signatures and header line endings can be written.
+     * Rules can only be added before compiling.
+     * 
+     * @param m The matcher.
+     * @param pattern The pattern text.
+     * @return Non-zero on success, zero if the pattern is empty or bad.
+     */
+    int matcherAdd(matcher* m, const char* pattern);
+
+    /**
+     * Adds every rule in a file, one pattern per line. Blank lines and lines
+     * starting with '#' are ignored.
+     * 
+     * @param m The matcher.
+     * @param path The rule file.
+     * @return Non-zero on success, zero if the file couldn't be read or a rule
+     * was bad.
+     */
+    int matcherLoad(matcher* m, const char* path);
+
+    /**
+     * Builds the automaton. Call once, after adding every rule.
+     * 
+     * @param m The matcher.
+     * @return Non-zero on success.
+     */
+    int matcherCompile(matcher* m);
+
+    /**
+     * Looks for any rule in a buffer. The buffer isn't copied or terminated,
+     * so binary data (including NULs) is fine.
+     * 
+     * @param m A compiled matcher.
+     * @param data The bytes to search.
+     * @param len How many bytes.
+     * @param matchEnd If not NULL, set to the offset just past the match.
+     * @return The number of the rule that matched first, or -1 for no match.
+     */
+    int matcherScan(const matcher* m, const uint8_t* data, size_t len,
+            size_t* matchEnd);
+
+    /**
+     * The text of a rule, as it was given.
+     * 
+     * @param m The matcher.
+     * @param rule A rule number from matcherScan.
+     * @return The rule text.
+     */
+    const char* matcherRuleName(const matcher* m, int rule);
+
+    /**
+     * Releases the matcher's memory.
+     * 
+     * @param m The matcher.
+     */
+    void matcherFree(matcher* m);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MATCH_H */
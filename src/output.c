@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "output.h"
+#include "decap_includes.h"
+
+#define OUTPUT_MIN_OPEN 16
+
+typedef enum {
+    OUTPUT_WRITE,
+    OUTPUT_CLOSE,
+    OUTPUT_FINISH, /* The channel won't send anything more. */
+    OUTPUT_SYNC /* Say when everything sent before has been written. */
+} output_op;
+
+typedef struct {
+    output_op op;
+    output_file* file;
+    uint8_t* data; /* Owned by the request, freed by the writer. */
+    uint32_t len;
+} output_request;
+
+/*
+ * The open set is a doubly linked list, most recently used at the front.
+ */
+
+static void unlinkOpen(output_pool* pool, output_file* file) {
+    if (file->newer != NULL) {
+        file->newer->older = file->older;
+    } else {
+        pool->newest = file->older;
+    }
+
+    if (file->older != NULL) {
+        file->older->newer = file->newer;
+    } else {
+        pool->oldest = file->newer;
+    }
+
+    file->newer = NULL;
+    file->older = NULL;
+}
+
+static void linkNewest(output_pool* pool, output_file* file) {
+    file->newer = NULL;
+    file->older = pool->newest;
+
+    if (pool->newest != NULL) {
+        pool->newest->newer = file;
+    } else {
+        pool->oldest = file;
+    }
+    pool->newest = file;
+}
+
+static void closeDescriptor(output_pool* pool, output_file* file) {
+    unlinkOpen(pool, file);
+    close(file->fd);
+    file->fd = -1;
+    pool->openCount--;
+}
+
+/**
+ * Makes sure a file is open, closing the least recently used one that isn't
+ * being written if there are too many.
+ * 
+ * @return Non-zero if the file is open, zero if it failed.
+ */
+static int ensureOpen(output_pool* pool, output_file* file) {
+    if (file->fd >= 0) {
+        unlinkOpen(pool, file);
+        linkNewest(pool, file);
+        return 1;
+    }
+
+    if (pool->openCount >= pool->maxOpen) {
+        output_file* victim = pool->oldest;
+
+        while (victim != NULL && victim->inFlight) {
+            victim = victim->newer;
+        }
+        if (victim != NULL) {
+            closeDescriptor(pool, victim);
+        }
+    }
+
+    char path[sizeof (pool->directory) + OUTPUT_NAME_MAX + 1];
+    snprintf(path, sizeof (path), "%s/%s", pool->directory, file->name);
+
+    //Coming back to a file we had to close: carry on where we left off.
+    int flags = O_WRONLY | O_CREAT | (file->created ? 0 : O_TRUNC);
+    file->fd = open(path, flags, S_IRWXU);
+
+    if (file->fd < 0) {
+        printf("Couldn't %s output file %s, skipping.\n",
+                file->created ? "reopen" : "create", path);
+        file->failed = 1;
+        return 0;
+    }
+
+    file->created = 1;
+    linkNewest(pool, file);
+    pool->openCount++;
+    return 1;
+}
+
+static void markDirty(output_pool* pool, output_file* file) {
+    if (file->dirty) {
+        return;
+    }
+
+    file->dirty = 1;
+    file->nextDirty = NULL;
+
+    if (pool->dirtyTail != NULL) {
+        pool->dirtyTail->nextDirty = file;
+    } else {
+        pool->dirtyHead = file;
+    }
+    pool->dirtyTail = file;
+}
+
+/**
+ * Creates the directory a file is to go in, if it's missing.
+ * 
+ * @return Non-zero if it's there now.
+ */
+static int makeParent(const char* path) {
+    char parent[PATH_MAX + OUTPUT_NAME_MAX + 1];
+    snprintf(parent, sizeof (parent), "%s", path);
+
+    char* slash = strrchr(parent, '/');
+    if (slash == NULL) {
+        return 0;
+    }
+    *slash = '\0';
+
+    return mkdir(parent, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == 0
+            || errno == EEXIST;
+}
+
+/**
+ * Gives a closed file its final name, or deletes it, as its owner asked.
+ * 
+ * @return Non-zero if it's there under its final name now.
+ */
+static int placeFile(output_pool* pool, output_file* file) {
+    char path[sizeof (pool->directory) + OUTPUT_NAME_MAX + 1];
+    char target[sizeof (pool->directory) + OUTPUT_NAME_MAX + 1];
+
+    if (!file->created) {
+        return 0;
+    }
+    snprintf(path, sizeof (path), "%s/%s", pool->directory, file->name);
+
+    if (file->discard) {
+        unlink(path);
+        return 0;
+    }
+    if (file->finalName[0] == '\0' || file->failed) {
+        return 0;
+    }
+    snprintf(target, sizeof (target), "%s/%s", pool->directory,
+            file->finalName);
+
+    //link() leaves a file already there alone, and with a name that's a
+    //digest of the content, that file is this one over again.
+    int linked = link(path, target) == 0;
+
+    if (!linked && errno == ENOENT && makeParent(target)) {
+        linked = link(path, target) == 0;
+    }
+
+    if (linked || errno == EEXIST) {
+        unlink(path);
+    } else if (rename(path, target) != 0) {
+        printf("Couldn't rename output file %s to %s.\n", path, target);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Lets go of a file's buffered data once it's been written (or dropped), and
+ * of the file itself if its owner has closed it.
+ */
+static void settle(output_pool* pool, output_file* file) {
+    int i;
+
+    for (i = 0; i < file->pendingCount; i++) {
+        free(file->pending[i].iov_base);
+    }
+    pool->bufferedBytes -= file->pendingCapacity;
+    file->pendingCount = 0;
+    file->pendingCapacity = 0;
+    file->lastRoom = 0;
+
+    if (file->closing) {
+        if (file->fd >= 0) {
+            closeDescriptor(pool, file);
+        }
+        int saved = placeFile(pool, file);
+
+        if (file->placed != NULL) {
+            file->placed(file->placedContext, saved);
+        }
+        free(file);
+    }
+}
+
+/**
+ * Writes a file's buffered data with pwritev(), skipping what's already been
+ * written.
+ * 
+ * @param file The file, open.
+ * @param done Bytes at the front of the buffered data already written (and
+ * counted in the file's offset).
+ */
+static void writeRemaining(output_file* file, size_t done) {
+    struct iovec iov[OUTPUT_FILE_CHUNKS];
+    struct iovec* next = iov;
+    size_t left = 0;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < file->pendingCount; i++) {
+        size_t len = file->pending[i].iov_len;
+
+        if (done >= len) {
+            done -= len;
+            continue;
+        }
+
+        iov[count].iov_base = (uint8_t*) file->pending[i].iov_base + done;
+        iov[count].iov_len = len - done;
+        left += len - done;
+        done = 0;
+        count++;
+    }
+
+    while (left > 0) {
+        ssize_t written = pwritev(file->fd, next, count, file->offset);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error during reconstruction of %s!\n", file->name);
+            file->failed = 1;
+            return;
+        }
+
+        file->offset += written;
+        left -= written;
+
+        //Step over whatever made it out.
+        while (written > 0) {
+            if ((size_t) written >= next->iov_len) {
+                written -= next->iov_len;
+                next++;
+                count--;
+            } else {
+                next->iov_base = (uint8_t*) next->iov_base + written;
+                next->iov_len -= written;
+                written = 0;
+            }
+        }
+    }
+}
+
+/**
+ * Hears back about one write of a batch. Anything short of complete is
+ * finished off (or reported) with pwritev().
+ */
+static void batchWritten(void* context, uint64_t tag, int32_t result) {
+    output_file* file = ((output_file**) context)[tag];
+    file->inFlight = 0;
+
+    if (result < 0) {
+        writeRemaining(file, 0);
+        return;
+    }
+
+    file->offset += result;
+    writeRemaining(file, result);
+}
+
+/**
+ * Writes the buffered data of a batch of open files.
+ */
+static void writeBatch(output_pool* pool, output_file** batch, int count) {
+    int i;
+
+    if (pool->haveRing) {
+        for (i = 0; i < count; i++) {
+            uringQueueWritev(&(pool->ring), batch[i]->fd, batch[i]->pending,
+                    batch[i]->pendingCount, batch[i]->offset, i);
+        }
+
+        if (!uringSubmitAndWait(&(pool->ring), batchWritten, batch)) {
+            printf("Lost track of asynchronous writes, using pwritev from "
+                    "now on.\n");
+            pool->haveRing = 0;
+        }
+    }
+
+    //Whatever io_uring didn't take care of. Rewriting the same bytes at the
+    //same offset is harmless if it did after all.
+    for (i = 0; i < count; i++) {
+        if (batch[i]->inFlight) {
+            writeRemaining(batch[i], 0);
+        }
+    }
+}
+
+void outputPoolFlush(output_pool* pool) {
+    output_file* batch[OUTPUT_BATCH];
+
+    while (pool->dirtyHead != NULL) {
+        int count = 0;
+
+        //Every file in a batch has to be open at the same time.
+        while (pool->dirtyHead != NULL && count < OUTPUT_BATCH
+                && count < pool->maxOpen) {
+            output_file* file = pool->dirtyHead;
+            pool->dirtyHead = file->nextDirty;
+            if (pool->dirtyHead == NULL) {
+                pool->dirtyTail = NULL;
+            }
+            file->dirty = 0;
+
+            //Files are created when first flushed, even if they're empty.
+            if (!file->failed && (file->pendingCount > 0 || !file->created)
+                    && ensureOpen(pool, file) && file->pendingCount > 0) {
+                file->inFlight = 1;
+                batch[count++] = file;
+                continue;
+            }
+            settle(pool, file);
+        }
+
+        writeBatch(pool, batch, count);
+
+        int i;
+        for (i = 0; i < count; i++) {
+            batch[i]->inFlight = 0;
+            settle(pool, batch[i]);
+        }
+    }
+}
+
+/**
+ * Buffers data for a file, flushing the pool when it gets too full.
+ */
+static void bufferWrite(output_pool* pool, output_file* file,
+        const uint8_t* data, uint32_t len) {
+    while (len > 0 && !file->failed) {
+        if (file->lastRoom == 0) {
+            if (file->pendingCount == OUTPUT_FILE_CHUNKS) {
+                outputPoolFlush(pool);
+                continue;
+            }
+
+            size_t capacity = len > OUTPUT_CHUNK_SIZE ? len : OUTPUT_CHUNK_SIZE;
+            uint8_t* chunk = malloc(capacity);
+
+            if (chunk == NULL) {
+                printf("Out of memory writing %s, data lost.\n", file->name);
+                file->failed = 1;
+                break;
+            }
+
+            file->pending[file->pendingCount].iov_base = chunk;
+            file->pending[file->pendingCount].iov_len = 0;
+            file->pendingCount++;
+            file->pendingCapacity += capacity;
+            file->lastRoom = capacity;
+            pool->bufferedBytes += capacity;
+        }
+
+        struct iovec* last = &(file->pending[file->pendingCount - 1]);
+        uint32_t take = len < file->lastRoom ? len : file->lastRoom;
+
+        memcpy((uint8_t*) last->iov_base + last->iov_len, data, take);
+        last->iov_len += take;
+        file->lastRoom -= take;
+        data += take;
+        len -= take;
+    }
+
+    markDirty(pool, file);
+
+    if (pool->bufferedBytes >= OUTPUT_POOL_BYTES) {
+        outputPoolFlush(pool);
+    }
+}
+
+static void closeFile(output_pool* pool, output_file* file) {
+    file->closing = 1;
+    markDirty(pool, file);
+}
+
+int outputPoolInit(output_pool* pool, const char* directory, int maxOpen) {
+    memset(pool, 0, sizeof (output_pool));
+    snprintf(pool->directory, sizeof (pool->directory), "%s", directory);
+
+    if (mkdir(directory, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) != 0
+            && errno != EEXIST) {
+        printf("Couldn't create output directory %s.\n", directory);
+        return 0;
+    }
+
+    //Leave plenty of descriptors for everything else.
+    if (maxOpen <= 0) {
+        struct rlimit limit;
+
+        maxOpen = 256;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+                && limit.rlim_cur != RLIM_INFINITY) {
+            maxOpen = limit.rlim_cur / 2;
+        }
+    }
+    pool->maxOpen = maxOpen < OUTPUT_MIN_OPEN ? OUTPUT_MIN_OPEN : maxOpen;
+
+    pool->haveRing = uringInit(&(pool->ring), OUTPUT_BATCH);
+    return 1;
+}
+
+void outputPoolFree(output_pool* pool) {
+    outputPoolFlush(pool);
+
+    //Only files still open by their owners are left.
+    while (pool->newest != NULL) {
+        closeDescriptor(pool, pool->newest);
+    }
+
+    if (pool->haveRing) {
+        uringFree(&(pool->ring));
+    }
+}
+
+void outputDirect(output_channel* channel, output_pool* pool) {
+    channel->ring = NULL;
+    channel->pool = pool;
+}
+
+output_file* outputOpen(output_channel* channel, const char* name) {
+    output_file* file = calloc(1, sizeof (output_file));
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    //The writer thread sees the file for the first time with its first
+    //request, which is published after this.
+    snprintf(file->name, sizeof (file->name), "%s", name);
+    file->fd = -1;
+    return file;
+}
+
+output_file* outputReopen(output_channel* channel, const char* name,
+        off_t offset) {
+    output_file* file = outputOpen(channel, name);
+
+    //Opened like one we'd had to close, so it isn't truncated.
+    if (file != NULL) {
+        file->created = 1;
+        file->offset = offset;
+    }
+    return file;
+}
+
+void outputWrite(output_channel* channel, output_file* file,
+        const uint8_t* data, uint32_t len) {
+    if (channel->ring == NULL) {
+        bufferWrite(channel->pool, file, data, len);
+        return;
+    }
+
+    output_request request = {OUTPUT_WRITE, file, slabAlloc(len), len};
+    if (request.data == NULL) {
+        printf("Out of memory writing %s, data lost.\n", file->name);
+        return;
+    }
+
+    memcpy(request.data, data, len);
+    spscPush(channel->ring, &request);
+    spscNotify(channel->ring);
+}
+
+void outputClose(output_channel* channel, output_file* file) {
+    if (channel->ring == NULL) {
+        closeFile(channel->pool, file);
+        return;
+    }
+
+    output_request request = {OUTPUT_CLOSE, file, NULL, 0};
+    spscPush(channel->ring, &request);
+    spscNotify(channel->ring);
+}
+
+void outputCloseAs(output_channel* channel, output_file* file,
+        const char* name, output_placed placed, void* context) {
+    //Only looked at once the writer has the close, published after this.
+    snprintf(file->finalName, sizeof (file->finalName), "%s", name);
+    file->placed = placed;
+    file->placedContext = context;
+    outputClose(channel, file);
+}
+
+void outputDiscard(output_channel* channel, output_file* file) {
+    file->discard = 1;
+    outputClose(channel, file);
+}
+
+void outputChannelFinish(output_channel* channel) {
+    output_request request = {OUTPUT_FINISH, NULL, NULL, 0};
+    spscPush(channel->ring, &request);
+    spscNotify(channel->ring);
+}
+
+static void* writerMain(void* arg) {
+    output_writer* writer = arg;
+    output_pool* pool = writer->pool;
+    int channelsOpen = writer->channelCount;
+    unsigned syncsAsked = 0;
+
+    while (channelsOpen > 0) {
+        int worked = 0;
+        int i;
+
+        for (i = 0; i <= writer->channelCount; i++) {
+            output_request request;
+
+            //Take a run from each channel in turn so none of them starves.
+            int taken = 0;
+            while (taken < 64 && spscTryPop(&(writer->rings[i]), &request)) {
+                taken++;
+
+                switch (request.op) {
+                    case OUTPUT_WRITE:
+                        bufferWrite(pool, request.file, request.data,
+                                request.len);
+                        slabFree(request.data);
+                        break;
+                    case OUTPUT_CLOSE:
+                        closeFile(pool, request.file);
+                        break;
+                    case OUTPUT_FINISH:
+                        channelsOpen--;
+                        break;
+                    case OUTPUT_SYNC:
+                        syncsAsked++;
+                        break;
+                }
+            }
+            worked += taken;
+        }
+
+        //Caught up: a good moment to write out what's built up. Whoever
+        //asked for a sync has stopped the channels, so this is everything.
+        if (!worked && channelsOpen > 0) {
+            outputPoolFlush(pool);
+
+            if (syncsAsked != writer->syncsDone) {
+                pthread_mutex_lock(&(writer->syncLock));
+                writer->syncsDone = syncsAsked;
+                pthread_cond_broadcast(&(writer->synced));
+                pthread_mutex_unlock(&(writer->syncLock));
+                continue;
+            }
+            spscWait(&(writer->waiter), writer->rings,
+                    writer->channelCount + 1);
+        }
+    }
+
+    outputPoolFlush(pool);
+    return NULL;
+}
+
+int outputWriterStart(output_writer* writer, output_pool* pool,
+        output_channel* channels, int count) {
+    writer->channelCount = count;
+    writer->pool = pool;
+    writer->syncsAsked = writer->syncsDone = 0;
+    writer->rings = calloc(count + 1, sizeof (spsc_ring));
+    if (writer->rings == NULL
+            || pthread_mutex_init(&(writer->syncLock), NULL) != 0
+            || pthread_cond_init(&(writer->synced), NULL) != 0) {
+        return 0;
+    }
+
+    spscWaiterInit(&(writer->waiter));
+
+    int i;
+    for (i = 0; i <= count; i++) {
+        if (!spscInit(&(writer->rings[i]), OUTPUT_RING_SIZE,
+                sizeof (output_request), &(writer->waiter))) {
+            return 0;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        channels[i].ring = &(writer->rings[i]);
+        channels[i].pool = NULL;
+    }
+
+    return pthread_create(&(writer->thread), NULL, writerMain, writer) == 0;
+}
+
+void outputWriterSync(output_writer* writer) {
+    output_request request = {OUTPUT_SYNC, NULL, NULL, 0};
+    spsc_ring* ring = &(writer->rings[writer->channelCount]);
+    unsigned wanted = ++writer->syncsAsked;
+
+    spscPush(ring, &request);
+    spscNotify(ring);
+
+    pthread_mutex_lock(&(writer->syncLock));
+    while (writer->syncsDone != wanted) {
+        pthread_cond_wait(&(writer->synced), &(writer->syncLock));
+    }
+    pthread_mutex_unlock(&(writer->syncLock));
+}
+
+void outputWriterJoin(output_writer* writer) {
+    pthread_join(writer->thread, NULL);
+
+    int i;
+    for (i = 0; i <= writer->channelCount; i++) {
+        spscFree(&(writer->rings[i]));
+    }
+
+    free(writer->rings);
+    spscWaiterFree(&(writer->waiter));
+    pthread_mutex_destroy(&(writer->syncLock));
+    pthread_cond_destroy(&(writer->synced));
+}
@@ -0,0 +1,247 @@
+/* 
+ * File:   output.h
+ *
+ * Where extracted files get written. A worker talks to the output layer
+ * through a channel: either directly (the worker's own thread does the
+ * writing), or through a ring to a dedicated writer thread so the workers never
+ * block on the disk.
+ * 
+ * Whichever thread does the writing owns an output pool. Data is buffered per
+ * file and written out in batches - one io_uring submission for the lot where
+ * the kernel has it, otherwise a pwritev() per file - and only a bounded
+ * number of files are kept open at once. A file pushed out of that set is
+ * reopened where it left off the next time it has data.
+ */
+
+#ifndef OUTPUT_H
+#define	OUTPUT_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "spsc.h"
+#include "uring.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define OUTPUT_NAME_MAX 256
+#define OUTPUT_RING_SIZE 4096 /* Requests queued per worker. */
+#define OUTPUT_CHUNK_SIZE (64 * 1024) /* Buffered data is kept in chunks of
+                                       * this size... */
+#define OUTPUT_FILE_CHUNKS 64 /* ...up to this many per file... */
+#define OUTPUT_POOL_BYTES (32 * 1024 * 1024) /* ...and this much in total,
+                                              * before it's all written. */
+#define OUTPUT_BATCH 256 /* Most files written per submission. */
+
+    /* Hears, once a file closed with outputCloseAs has been written, whether
+     * it was saved under its new name. Called on whichever thread does the
+     * writing. */
+    typedef void (*output_placed)(void* context, int saved);
+
+    typedef struct output_file {
+        char name[OUTPUT_NAME_MAX];
+        int fd; /* -1 while not open: not created yet, or pushed out of the
+                 * pool's open set. */
+        int created; /* Exists on disk, so reopen without truncating. */
+        int failed; /* Couldn't be created or written: data is dropped. */
+        int closing; /* Its owner is done with it, free once written. */
+        char finalName[OUTPUT_NAME_MAX]; /* What it's renamed to then (if
+                                          * anything), */
+        int discard; /* or deleted instead. */
+        output_placed placed; /* Told how the renaming went (or NULL), */
+        void* placedContext; /* with this. */
+        int dirty; /* On the pool's dirty list. */
+        int inFlight; /* Being written, keep it open. */
+        off_t offset; /* How much has been written. */
+        struct iovec pending[OUTPUT_FILE_CHUNKS]; /* Buffered, not written. */
+        int pendingCount;
+        size_t pendingCapacity; /* Memory held by pending. */
+        size_t lastRoom; /* Free space at the end of the last chunk. */
+        struct output_file* newer; /* Open files, most recently used first. */
+        struct output_file* older;
+        struct output_file* nextDirty;
+    } output_file;
+
+    typedef struct {
+        char directory[PATH_MAX];
+        int maxOpen; /* Most files open at once. */
+        int openCount;
+        output_file* newest;
+        output_file* oldest;
+        output_file* dirtyHead; /* Files with something to write (or that
+                                 * need creating or closing), oldest first. */
+        output_file* dirtyTail;
+        size_t bufferedBytes; /* Memory held by every file's pending data. */
+        uring ring;
+        int haveRing; /* Otherwise pwritev(). */
+    } output_pool;
+
+    typedef struct {
+        spsc_ring* ring; /* NULL to write directly... */
+        output_pool* pool; /* ...through this pool. */
+    } output_channel;
+
+    typedef struct {
+        int channelCount;
+        spsc_ring* rings; /* One per channel, and one more for outputWriterSync
+                           * requests. */
+        spsc_waiter waiter;
+        output_pool* pool;
+        pthread_t thread;
+        pthread_mutex_t syncLock;
+        pthread_cond_t synced;
+        unsigned syncsAsked; /* outputWriterSync requests sent, */
+        unsigned syncsDone; /* and answered. */
+    } output_writer;
+
+    /**
+     * Sets up an output pool. It must only be used from one thread.
+     * 
+     * @param pool Fill-in target.
+     * @param directory Where files go (created if it doesn't exist).
+     * @param maxOpen Most files to keep open at once, or zero to pick a number
+     * that fits the process's descriptor limit.
+     * @return Non-zero on success.
+     */
+    int outputPoolInit(output_pool* pool, const char* directory, int maxOpen);
+
+    /**
+     * Writes out everything buffered, and finishes closing closed files.
+     * 
+     * @param pool The pool.
+     */
+    void outputPoolFlush(output_pool* pool);
+
+    /**
+     * Flushes the pool and releases it. Every file should have been closed.
+     * 
+     * @param pool The pool.
+     */
+    void outputPoolFree(output_pool* pool);
+
+    /**
+     * Sets up a channel that writes on the calling thread.
+     * 
+     * @param channel Fill-in target.
+     * @param pool The calling thread's pool.
+     */
+    void outputDirect(output_channel* channel, output_pool* pool);
+
+    /**
+     * Creates an output file. Nothing touches the disk until the file is
+     * flushed, so errors creating it are reported then and its data is
+     * dropped.
+     * 
+     * @param channel The caller's channel.
+     * @param name The file name, within the pool's directory.
+     * @return A handle for outputWrite/outputClose, or NULL if out of memory.
+     */
+    output_file* outputOpen(output_channel* channel, const char* name);
+
+    /**
+     * Picks up an output file left part-written (by an earlier run, say), to
+     * carry on appending to it. The file isn't touched here: whatever it has
+     * past `offset` should already have been cut off.
+     * 
+     * @param channel The caller's channel.
+     * @param name The file name, within the pool's directory.
+     * @param offset How much of it there is to keep.
+     * @return A handle for outputWrite/outputClose, or NULL if out of memory.
+     */
+    output_file* outputReopen(output_channel* channel, const char* name,
+            off_t offset);
+
+    /**
+     * Appends to an output file. The data is copied.
+     * 
+     * @param channel The caller's channel.
+     * @param file The file.
+     * @param data The bytes.
+     * @param len How many.
+     */
+    void outputWrite(output_channel* channel, output_file* file,
+            const uint8_t* data, uint32_t len);
+
+    /**
+     * Closes an output file. The handle is gone after this.
+     * 
+     * @param channel The caller's channel.
+     * @param file The file.
+     */
+    void outputClose(output_channel* channel, output_file* file);
+
+    /**
+     * Closes an output file, to be renamed once everything's written. If a
+     * file of that name is there already, it's taken to have the same
+     * content (the name being a digest of it), and this one is deleted
+     * instead. The handle is gone after this.
+     * 
+     * @param channel The caller's channel.
+     * @param file The file.
+     * @param name Its new name, within the pool's directory. It may be in a
+     * directory of its own there, which is created if need be.
+     * @param placed If not NULL, told whether the file ended up under that
+     * name (a file already there counts), once it's been written.
+     * @param context Passed through to `placed`.
+     */
+    void outputCloseAs(output_channel* channel, output_file* file,
+            const char* name, output_placed placed, void* context);
+
+    /**
+     * Closes an output file and deletes it: whatever it had was already
+     * saved somewhere else. The handle is gone after this.
+     * 
+     * @param channel The caller's channel.
+     * @param file The file.
+     */
+    void outputDiscard(output_channel* channel, output_file* file);
+
+    /**
+     * Starts a writer thread serving `count` channels, which are filled in.
+     * Each channel must only be used from one thread.
+     * 
+     * @param writer Fill-in target.
+     * @param pool The pool the writer thread writes through.
+     * @param channels Array of `count` channels to set up.
+     * @param count How many.
+     * @return Non-zero on success.
+     */
+    int outputWriterStart(output_writer* writer, output_pool* pool,
+            output_channel* channels, int count);
+
+    /**
+     * Waits until the writer has written out everything sent to it so far.
+     * Only call it from the thread that started the writer, while nothing
+     * is being sent on the channels (see pipelineDrain).
+     * 
+     * @param writer The writer.
+     */
+    void outputWriterSync(output_writer* writer);
+
+    /**
+     * Tells the writer this channel is finished. Once every channel has been
+     * finished, the writer drains what's left and exits.
+     * 
+     * @param channel The channel.
+     */
+    void outputChannelFinish(output_channel* channel);
+
+    /**
+     * Waits for the writer to exit (after every channel was finished) and
+     * releases it. The pool is flushed but left for the caller to free.
+     * 
+     * @param writer The writer.
+     */
+    void outputWriterJoin(output_writer* writer);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* OUTPUT_H */
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+
+typedef enum {
+    ITEM_PACKET,
+    ITEM_BARRIER, /* No packet: tell pipelineDrain we've got this far. */
+    ITEM_STOP /* No packet, just the signal that there are no more. */
+} item_kind;
+
+typedef struct {
+    pcap_packet packet;
+    item_kind kind;
+} packet_item;
+
+typedef struct {
+    pipeline* p;
+    int index;
+} worker_start;
+
+static void* workerMain(void* arg) {
+    worker_start start = *(worker_start*) arg;
+    free(arg);
+
+    pipeline* p = start.p;
+    spsc_ring* ring = &(p->rings[start.index]);
+    void* context = p->contexts[start.index];
+    packet_item item;
+
+    for (;;) {
+        spscPop(ring, &item);
+
+        if (item.kind == ITEM_STOP) {
+            break;
+        }
+        if (item.kind == ITEM_BARRIER) {
+            pthread_mutex_lock(&(p->lock));
+            if (--p->draining == 0) {
+                pthread_cond_signal(&(p->drained));
+            }
+            pthread_mutex_unlock(&(p->lock));
+            continue;
+        }
+        p->handler(context, &(item.packet));
+    }
+
+    p->finish(context);
+    return NULL;
+}
+
+int pipelineStart(pipeline* p, void** contexts, int workers,
+        packet_handler handler, worker_hook finish) {
+    p->workerCount = workers;
+    p->contexts = contexts;
+    p->handler = handler;
+    p->finish = finish;
+    p->rings = calloc(workers, sizeof (spsc_ring));
+    p->waiters = calloc(workers, sizeof (spsc_waiter));
+    p->threads = calloc(workers, sizeof (pthread_t));
+    p->draining = 0;
+
+    if (p->rings == NULL || p->waiters == NULL || p->threads == NULL
+            || pthread_mutex_init(&(p->lock), NULL) != 0
+            || pthread_cond_init(&(p->drained), NULL) != 0) {
+        return 0;
+    }
+
+    int i;
+    for (i = 0; i < workers; i++) {
+        spscWaiterInit(&(p->waiters[i]));
+        if (!spscInit(&(p->rings[i]), PIPELINE_RING_SIZE, sizeof (packet_item),
+                &(p->waiters[i]))) {
+            return 0;
+        }
+    }
+
+    for (i = 0; i < workers; i++) {
+        worker_start* start = malloc(sizeof (worker_start));
+        if (start == NULL) {
+            return 0;
+        }
+        start->p = p;
+        start->index = i;
+
+        if (pthread_create(&(p->threads[i]), NULL, workerMain, start) != 0) {
+            free(start);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void pipelineSubmit(pipeline* p, pcap_packet* packet, uint32_t hash) {
+    packet_item item;
+    item.packet = *packet;
+    item.kind = ITEM_PACKET;
+
+    spscPush(&(p->rings[pipelineShard(hash, p->workerCount)]), &item);
+}
+
+void pipelineFlush(pipeline* p) {
+    int i;
+
+    for (i = 0; i < p->workerCount; i++) {
+        spscNotify(&(p->rings[i]));
+    }
+}
+
+/**
+ * Puts an item with no packet on every worker's queue.
+ */
+static void pushToAll(pipeline* p, item_kind kind) {
+    packet_item item;
+    memset(&item, 0, sizeof (item));
+    item.kind = kind;
+
+    int i;
+    for (i = 0; i < p->workerCount; i++) {
+        spscPush(&(p->rings[i]), &item);
+    }
+    pipelineFlush(p);
+}
+
+void pipelineDrain(pipeline* p) {
+    pthread_mutex_lock(&(p->lock));
+    p->draining = p->workerCount;
+    pthread_mutex_unlock(&(p->lock));
+
+    pushToAll(p, ITEM_BARRIER);
+
+    pthread_mutex_lock(&(p->lock));
+    while (p->draining > 0) {
+        pthread_cond_wait(&(p->drained), &(p->lock));
+    }
+    pthread_mutex_unlock(&(p->lock));
+}
+
+void pipelineStop(pipeline* p) {
+    pushToAll(p, ITEM_STOP);
+
+    int i;
+    for (i = 0; i < p->workerCount; i++) {
+        pthread_join(p->threads[i], NULL);
+        spscFree(&(p->rings[i]));
+        spscWaiterFree(&(p->waiters[i]));
+    }
+
+    free(p->rings);
+    free(p->waiters);
+    free(p->threads);
+    pthread_mutex_destroy(&(p->lock));
+    pthread_cond_destroy(&(p->drained));
+}
@@ -0,0 +1,113 @@
+/* 
+ * File:   pipeline.h
+ *
+ * Spreads packet processing over worker threads. The reader hands each packet
+ * to the worker that owns its flow (picked by the flow's hash), through a
+ * lock-free ring per worker, so all of a flow's state lives on one thread and
+ * needs no locking.
+ */
+
+#ifndef PIPELINE_H
+#define	PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "decap_includes.h"
+#include "spsc.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define PIPELINE_RING_SIZE 8192 /* Packets queued per worker. */
+#define PIPELINE_MAX_WORKERS 64
+
+    /* Processes one packet on a worker thread (and unloads it). */
+    typedef void (*packet_handler)(void* context, pcap_packet* packet);
+
+    /* Called on a worker thread once it has had its last packet. */
+    typedef void (*worker_hook)(void* context);
+
+    typedef struct {
+        int workerCount;
+        void** contexts; /* Per worker, passed to the handler and hook. */
+        spsc_ring* rings;
+        spsc_waiter* waiters;
+        pthread_t* threads;
+        packet_handler handler;
+        worker_hook finish;
+        pthread_mutex_t lock;
+        pthread_cond_t drained;
+        int draining; /* Workers yet to reach the barrier of a pipelineDrain. */
+    } pipeline;
+
+    /**
+     * Picks the worker for a flow hash. Goes by the top bits of the hash: each
+     * worker's flow table indexes on the bottom ones, which would otherwise
+     * all be the same.
+     * 
+     * @param hash The flow's hash.
+     * @param workers How many workers there are.
+     * @return The worker, from 0 to workers - 1.
+     */
+    static inline int pipelineShard(uint32_t hash, int workers) {
+        return ((uint64_t) hash * workers) >> 32;
+    }
+
+    /**
+     * Starts the worker threads.
+     * 
+     * @param p Fill-in target.
+     * @param contexts One context per worker.
+     * @param workers How many workers.
+     * @param handler What each worker does with a packet.
+     * @param finish What each worker does when there are no more packets.
+     * @return Non-zero on success.
+     */
+    int pipelineStart(pipeline* p, void** contexts, int workers,
+            packet_handler handler, worker_hook finish);
+
+    /**
+     * Queues a packet for the worker that owns this hash, waiting for room if
+     * that worker is behind. The packet's data must stay valid until the
+     * worker unloads it, so views into a reader's buffer need retainPacket
+     * first.
+     * 
+     * @param p The pipeline.
+     * @param packet The packet (copied into the queue).
+     * @param hash The hash of the packet's flow.
+     */
+    void pipelineSubmit(pipeline* p, pcap_packet* packet, uint32_t hash);
+
+    /**
+     * Wakes any worker that's waiting on packets already submitted. Call after
+     * each batch.
+     * 
+     * @param p The pipeline.
+     */
+    void pipelineFlush(pipeline* p);
+
+    /**
+     * Waits until every worker has handled everything submitted so far, so
+     * whatever those packets pointed into can go and the workers' contexts
+     * can be touched. The workers carry on afterwards.
+     * 
+     * @param p The pipeline.
+     */
+    void pipelineDrain(pipeline* p);
+
+    /**
+     * Lets every worker finish its queue and run its finish hook, then waits
+     * for all of them and releases the pipeline.
+     * 
+     * @param p The pipeline.
+     */
+    void pipelineStop(pipeline* p);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PIPELINE_H */
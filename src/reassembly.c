@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "reassembly.h"
+
+static uint32_t segmentCost(uint32_t length) {
+    return sizeof (pending_segment) + length;
+}
+
+static void freeSegment(flow* current, pending_segment* segment) {
+    current->pendingBytes -= segmentCost(segment->length);
+    slabFree(segment);
+}
+
+/**
+ * Holds an early segment, trimmed against its neighbours so the held list
+ * stays sorted and non-overlapping.
+ * 
+ * @return Zero if this would take the flow over its memory limit.
+ */
+static int holdSegment(flow* current, uint32_t sequence, const uint8_t* data,
+        uint32_t len) {
+    uint32_t end = sequence + len;
+    pending_segment** link = &(current->pending);
+
+    //Skip everything that starts at or before us, trimming off whatever the
+    //last of those already covers.
+    while (*link && !sequenceBefore(sequence, (*link)->sequence)) {
+        uint32_t heldEnd = (*link)->sequence + (*link)->length;
+
+        if (!sequenceBefore(heldEnd, end)) {
+            return 1; //Nothing new here.
+        }
+        if (sequenceBefore(sequence, heldEnd)) {
+            data += heldEnd - sequence;
+            sequence = heldEnd;
+        }
+        link = &((*link)->next);
+    }
+
+    //Held segments we completely cover are superseded.
+    while (*link && !sequenceBefore(end, (*link)->sequence + (*link)->length)) {
+        pending_segment* covered = *link;
+        *link = covered->next;
+        freeSegment(current, covered);
+    }
+
+    //And we stop where the next held segment starts.
+    if (*link && sequenceBefore((*link)->sequence, end)) {
+        end = (*link)->sequence;
+    }
+
+    len = end - sequence;
+    if (len == 0) {
+        return 1;
+    }
+
+    if (current->pendingBytes + segmentCost(len) > FLOW_PENDING_LIMIT) {
+        return 0;
+    }
+
+    pending_segment* segment = slabAlloc(segmentCost(len));
+    if (segment == NULL) {
+        return 0;
+    }
+
+    segment->sequence = sequence;
+    segment->length = len;
+    memcpy(segment->data, data, len);
+    segment->next = *link;
+    *link = segment;
+
+    current->pendingBytes += segmentCost(len);
+    current->heldSegments++;
+    return 1;
+}
+
+/**
+ * Delivers the part of a segment at or after nextSequence, which the caller
+ * has checked it reaches.
+ */
+static void deliver(flow* current, uint32_t sequence, const uint8_t* data,
+        uint32_t len, stream_sink sink, void* context) {
+    uint32_t skip = current->nextSequence - sequence;
+
+    if (skip >= len) {
+        return;
+    }
+
+    sink(context, current, data + skip, len - skip);
+    current->nextSequence = sequence + len;
+}
+
+stream_status reassembleSegment(flow* current, uint32_t sequence, int fin,
+        const uint8_t* data, uint32_t len, stream_sink sink, void* context) {
+    if (fin) {
+        current->finSequence = sequence + len;
+        current->sawFin = 1;
+    }
+
+    if (len > 0) {
+        if (sequenceBefore(current->nextSequence, sequence)) {
+            if (!holdSegment(current, sequence, data, len)) {
+                return STREAM_OVERFLOW;
+            }
+        } else {
+            deliver(current, sequence, data, len, sink, context);
+        }
+    }
+
+    //Anything held that's now contiguous can go out too (and anything held
+    //that we've since moved past is just dropped).
+    while (current->pending
+            && !sequenceBefore(current->nextSequence,
+            current->pending->sequence)) {
+        pending_segment* head = current->pending;
+        current->pending = head->next;
+
+        deliver(current, head->sequence, head->data, head->length, sink,
+                context);
+        freeSegment(current, head);
+    }
+
+    if (current->sawFin && current->nextSequence == current->finSequence) {
+        return STREAM_FINISHED;
+    }
+
+    return STREAM_OPEN;
+}
+
+int restoreSegment(flow* current, uint32_t sequence, const uint8_t* data,
+        uint32_t len) {
+    pending_segment** link = &(current->pending);
+    pending_segment* segment = slabAlloc(segmentCost(len));
+
+    if (segment == NULL) {
+        return 0;
+    }
+
+    while (*link) {
+        link = &((*link)->next);
+    }
+
+    segment->sequence = sequence;
+    segment->length = len;
+    memcpy(segment->data, data, len);
+    segment->next = NULL;
+    *link = segment;
+
+    current->pendingBytes += segmentCost(len);
+    return 1;
+}
+
+void discardPending(flow* current) {
+    while (current->pending) {
+        pending_segment* head = current->pending;
+        current->pending = head->next;
+        freeSegment(current, head);
+    }
+}
@@ -0,0 +1,95 @@
+/* 
+ * File:   reassembly.h
+ *
+ * Putting a TCP stream back in order: segments that turn up early are held
+ * (in sequence order, trimmed so they never overlap) until the gap before
+ * them is filled, and anything we've already delivered is dropped.
+ */
+
+#ifndef REASSEMBLY_H
+#define	REASSEMBLY_H
+
+#include <stdint.h>
+
+#include "flow.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define FLOW_PENDING_LIMIT (256 * 1024) /* Most bytes (including bookkeeping)
+                                         * a flow may hold waiting for a gap
+                                         * to fill. */
+
+    /* A segment waiting for the bytes before it. */
+    typedef struct pending_segment {
+        struct pending_segment* next;
+        uint32_t sequence;
+        uint32_t length;
+        uint8_t data[];
+    } pending_segment;
+
+    typedef enum {
+        STREAM_OPEN, /* Keep going. */
+        STREAM_FINISHED, /* Everything up to the FIN has been delivered. */
+        STREAM_OVERFLOW /* Too much is waiting on a gap, give up on this flow. */
+    } stream_status;
+
+    /* Receives the stream's bytes, in order, exactly once. */
+    typedef void (*stream_sink)(void* context, flow* current,
+            const uint8_t* data, uint32_t len);
+
+    /**
+     * Compares two sequence numbers allowing for 32-bit wraparound.
+     * 
+     * @return Non-zero if a comes before b.
+     */
+    static inline int sequenceBefore(uint32_t a, uint32_t b) {
+        return (int32_t) (a - b) < 0;
+    }
+
+    /**
+     * Feeds one segment of a flow into reassembly. Bytes at the flow's
+     * nextSequence go straight to the sink, followed by any held segments
+     * they make contiguous. Bytes before it (retransmissions) are dropped,
+     * and bytes after a gap are held until the gap fills.
+     * 
+     * @param current The flow, with nextSequence set.
+     * @param sequence Sequence number of the first byte of data.
+     * @param fin Non-zero if this segment carries a FIN.
+     * @param data The segment payload.
+     * @param len Length of the payload.
+     * @param sink Where in-order bytes go.
+     * @param context Passed through to the sink.
+     * @return Whether the stream is still going, finished or overflowed.
+     */
+    stream_status reassembleSegment(flow* current, uint32_t sequence, int fin,
+            const uint8_t* data, uint32_t len, stream_sink sink,
+            void* context);
+
+    /**
+     * Holds a segment again, as saved from a flow's pending list (see
+     * checkpoint.h). Segments are put back in the order they were held in.
+     * 
+     * @param current The flow.
+     * @param sequence Sequence number of the segment's first byte.
+     * @param data Its bytes.
+     * @param len How many.
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int restoreSegment(flow* current, uint32_t sequence, const uint8_t* data,
+            uint32_t len);
+
+    /**
+     * Frees every segment a flow is holding. Call before removing the flow.
+     * 
+     * @param current The flow.
+     */
+    void discardPending(flow* current);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* REASSEMBLY_H */
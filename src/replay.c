@@ -6,10 +6,41 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <arpa/inet.h>
 
 
 #include "decap_includes.h"
 #include "replay.h"
+#include "follow.h"
+#include "flow.h"
+#include "decode.h"
+#include "reassembly.h"
+#include "match.h"
+#include "output.h"
+#include "pipeline.h"
+#include "index.h"
+#include "scan.h"
+#include "stats.h"
+#include "filter.h"
+#include "capset.h"
+#include "checkpoint.h"
+#include "dedup.h"
+#include "classify.h"
+#include "../include/pcapng.h"
+
+#define PACKET_BATCH 256 /* Packets pulled from the capture per read. */
+#define COMPARE_CHUNK (16 * 1024) /* Read back at a time, comparing a body
+                                   * with the one it looks like a copy of. */
+#define NANOS_PER_SECOND 1000000000ULL
+#define FLOW_IDLE_SECONDS 120 /* Default for -e. */
+#define CLOCK_JUMP_SECONDS 3600 /* Furthest the capture's clock moves on one
+                                 * packet (or the idle limit, if longer). */
+#define FLOW_MEMORY_MB 1024 /* Default for -M. */
+#define MEMORY_PUBLISH_STEP (64 * 1024) /* How far a worker's memory may
+                                         * drift from its share of the
+                                         * global total. */
 
 /**
  * Prints hello message.
@@ -22,7 +53,69 @@ static void hello() {
  * Prints usage message.
  */
 static void usage() {
-    printf("Usage: replay <capturefile>\n");
+    printf("Usage: replay [-c checkpoint] [-C seconds] [-e seconds] [-f]\n"
+            "              [-F filter]... [-i seconds] [-I] [-j workers]\n"
+            "              [-l seconds] [-m pattern]... [-M MB] [-o directory]\n"
+            "              [-p patternfile] [-P] [-s flow] [-S seconds]\n"
+            "              [-t from:to] [-v] <capture>...\n");
+    printf("\t-c\tKeep a checkpoint of how far we've got, in this file, and\n"
+            "\t\tcarry on from it if it's there: reading resumes where it\n"
+            "\t\tleft off, with the same files in progress. It's removed\n"
+            "\t\tonce fixed-size captures have been read in full. Not with\n"
+            "\t\t-I or -P, or from a pipe.\n");
+    printf("\t-C\tWrite the checkpoint this often (default %d), and\n"
+            "\t\twhen stopping.\n", CHECKPOINT_SECONDS);
+    printf("\t-e\tLet go of flows that have had no packets for this long, in\n"
+            "\t\tcapture time (default %d; 0 for never).\n",
+            FLOW_IDLE_SECONDS);
+    printf("\t-f\tCapture is fixed-size (not being appended to): map it,\n"
+            "\t\tread it once and exit at the end.\n");
+    printf("\t-F\tOnly look at segments to or from these hosts and ports,\n"
+            "\t\tas comma-separated terms: [not] [src|dst] host <address>,\n"
+            "\t\t[not] [src|dst] net <address>/<bits> or [not] [src|dst]\n"
+            "\t\tport <port>[-<port>]. Segments need a host or net and a\n"
+            "\t\tport given (if any were) and no \"not\" term. May be\n"
+            "\t\trepeated.\n");
+    printf("\t-i\tWhen following a live capture, stop after this many\n"
+            "\t\tseconds without new data (default: follow forever).\n");
+    printf("\t-I\tRead a fixed-size capture through its index\n"
+            "\t\t(<capturefile>%s), building it first if it's missing or\n"
+            "\t\tout of date.\n", INDEX_SUFFIX);
+    printf("\t-j\tSpread the flows over this many worker threads, with a\n"
+            "\t\tseparate reader and writer (default: one thread does\n"
+            "\t\teverything).\n");
+    printf("\t-l\tLet go of flows this long after their first packet, in\n"
+            "\t\tcapture time (default: never).\n");
+    printf("\t-m\tExtract streams containing this pattern (may be repeated;\n"
+            "\t\tunderstands \\r \\n \\t \\\\ and \\xHH).\n");
+    printf("\t-M\tKeep the memory held by flows under this many megabytes,\n"
+            "\t\tletting go of the longest quiet ones first (default %d;\n"
+            "\t\t0 for no limit).\n", FLOW_MEMORY_MB);
+    printf("\t-o\tWrite extracted files here (default: the current\n"
+            "\t\tdirectory), each named by a digest of its content, so\n"
+            "\t\tnone is saved twice, in a directory for its kind (image,\n"
+            "\t\taudio, video, document, archive or other).\n");
+    printf("\t-p\tRead patterns from a file, one per line.\n");
+    printf("\t-P\tScan a fixed-size capture in parallel chunks, with -j\n"
+            "\t\tworkers (default: one per core).\n");
+    printf("\t-s\tOnly look at one flow, given as address:port,address:port\n"
+            "\t\t(either way round; IPv6 addresses in brackets). Implies\n"
+            "\t\t-I.\n");
+    printf("\t-S\tWrite statistics to stderr, as a line of JSON, this often\n"
+            "\t\t(default: only on SIGUSR1, and at exit).\n");
+    printf("\t-t\tOnly look at packets captured from..to (seconds since the\n"
+            "\t\tepoch, inclusive; either may be left out). Implies -I.\n");
+    printf("\t-v\tSay why each packet that's skipped is skipped.\n");
+    printf("\tWithout -m or -p, the pattern is \"%s\".\n", DEFAULT_PATTERN);
+    printf("\tCaptures may be files, directories or (quoted) glob patterns,\n"
+            "\tsuch as the files tcpdump -G or -C rotates through. They're\n"
+            "\tread one after another in order of their first packets, with\n"
+            "\tflows carrying on from one into the next. When following\n"
+            "\tlive captures, new files in those directories (or matching\n"
+            "\tthose patterns) are read as they appear.\n");
+    printf("\tA capture may also be a FIFO, or - to read it from stdin\n"
+            "\t(tcpdump -w - | replay -): it's read as it arrives, until\n"
+            "\tthe writer closes it.\n");
 }
 
 /**
@@ -33,27 +126,19 @@ static void error(int num) {
     printf("Error %d", num);
 }
 
-static void reverseBytes32(uint32_t* bytes) {
-    uint32_t low = (*bytes) & 0xFF;
-    uint32_t hi = (*bytes) & 0xFF000000;
-    uint32_t left = (*bytes) & 0x00FF0000;
-    uint32_t right = (*bytes) & 0x0000FF00;
-    *bytes = ((low << 24) + (right << 8) + (left >> 8) + (hi >> 24));
-}
-
 int isPrintable(char c) {
     return (c >= 32) && (c <= 126);
 }
 
-void printPacketData(tcp_packet* data) {
+void printPacketData(const packet_layers* layers) {
     printf("--- TCP PACKET ---\n");
 
     printf("Data (ASCII):\n");
     printf("\t");
-    int i = 0;
-    for (i = 0; i < data->payloadSize; i++) {
-        if (isPrintable(data->payload[i])) {
-            printf("%c", data->payload[i]);
+    uint32_t i = 0;
+    for (i = 0; i < layers->payloadLength; i++) {
+        if (isPrintable(layers->payload[i])) {
+            printf("%c", layers->payload[i]);
         } else {
             printf(".");
         }
@@ -64,286 +149,1961 @@ void printPacketData(tcp_packet* data) {
     printf("\n");
 }
 
+void rndstr(char* s, const int len) {
+    static const char chars[] =
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+    int i;
+    for (i = 0; i < len; ++i) {
+        s[i] = chars[rand() % (sizeof(chars) - 1)];
+    }
+
+    s[len] = '\0';
+}
+
+static matcher patterns; /* Read-only once compiled, shared by workers. */
+static int verbose; /* Whether to explain every skipped packet. */
+static packet_filter filter; /* Read-only once set up, like the patterns. */
+static int filtering; /* Whether the filter has any terms. */
+static uint64_t idleLimit = FLOW_IDLE_SECONDS * NANOS_PER_SECOND; /* -e, in
+                                                                 * ns (0 for
+                                                                 * none). */
+static uint64_t lifetimeLimit; /* -l, likewise. */
+static uint64_t memoryBudget = (uint64_t) FLOW_MEMORY_MB << 20; /* -M, in
+                                                                 * bytes. */
+static uint64_t memoryInUse; /* By every worker's flows, give or take. */
+static dedup_index savedBodies; /* Every body saved so far, shared by the
+                                * workers. */
+static int savedDirectory = -1; /* The output directory, open, to read
+                                 * saved bodies back from. */
+
+/* A flow together with the worker it belongs to, for the body sink. */
+typedef struct {
+    worker_state* worker;
+    flow* current;
+} flow_context;
+
 /**
- * Given a reference to a pcap packet, look `offset` bytes in for a tcpPacket of
- * length `len` (also verify the length, I guess).
- * 
- * Also reverses the byte order because these fields are saved in network byte order...
+ * The name a body is saved under once it's complete: a directory for its
+ * kind, and its digest.
  * 
- * And it allocates the payload in tcpPacket.
- * 
- * @param packet
- * @param offset
- * @param len
- * @param tcpPacket
+ * @param digest The body's digest.
+ * @param name Fill-in target, CLASSIFY_NAME_MAX characters.
  */
-int extractTCP(void* packetDataPtr, int offset, int len, tcp_packet* tcpPacket) {
-    //Copy the header
-    memcpy(&(tcpPacket->header), packetDataPtr + offset, sizeof (tcp_header));
+static void savedName(const flow* current, const uint8_t* digest,
+        char* name) {
+    char hex[DIGEST_HEX_SIZE];
 
-    //Fix the data offset field... Stored in the upper nibble is the number of
-    //words in this TCP header.
-    tcpPacket->header.dataOffset = (tcpPacket->header.dataOffset >> 4) * 4;
+    digestHex(digest, hex);
+    classifyName(classifyBody(current->head, current->headLength), hex,
+            name);
+}
 
-    reverseBytes32(&(tcpPacket->header.sequenceNumber));
-  //  printf("Sequence number %x\n", tcpPacket->header.sequenceNumber);
+/**
+ * Whether the next piece of a body taken for a copy is the same as the saved
+ * body, at the same place.
+ */
+static int sameAsOriginal(flow* current, const uint8_t* data, uint32_t len) {
+    uint8_t saved[COMPARE_CHUNK];
+    off_t offset = current->digest.length;
 
-    int payloadLength = len - tcpPacket->header.dataOffset - 20; //Todo: find out where -20 correction factor came from...
+    while (len > 0) {
+        uint32_t take = len < sizeof (saved) ? len : sizeof (saved);
 
- //   printf("The payload must be %d long, and the next sequence number should be %x\n",
- //           payloadLength, tcpPacket->header.sequenceNumber + payloadLength);
+        if (pread(current->original, saved, take, offset) != (ssize_t) take
+                || memcmp(saved, data, take) != 0) {
+            return 0;
+        }
+        data += take;
+        len -= take;
+        offset += take;
+    }
+    return 1;
+}
 
- //   if (payloadLength > 0) {
- //       printf("First character of payload: %c\n", ((char*) packetDataPtr)[offset + tcpPacket->header.dataOffset]);
- //   }
+/**
+ * Stops treating a body as a copy, and brings its file up to where the body
+ * has got to, from the saved body it was the same as so far.
+ * 
+ * @return Non-zero on success.
+ */
+static int stopCopying(flow_context* target, flow* current) {
+    uint8_t saved[COMPARE_CHUNK];
+    int ok = 1;
 
-    tcpPacket->sequenceNumber = tcpPacket->header.sequenceNumber;
-    tcpPacket->payloadSize = payloadLength;
-    tcpPacket->payload = malloc(payloadLength);
-    memcpy(tcpPacket->payload, packetDataPtr + offset + tcpPacket->header.dataOffset, tcpPacket->payloadSize);
+    while (ok && current->bytesWritten < current->digest.length) {
+        uint64_t left = current->digest.length - current->bytesWritten;
+        uint32_t take = left < sizeof (saved) ? left : sizeof (saved);
 
-    return 1;
+        ok = pread(current->original, saved, take, current->bytesWritten)
+                == (ssize_t) take;
+        if (ok) {
+            outputWrite(&(target->worker->output), current->output, saved,
+                    take);
+            statsAdd(&(target->worker->stats.bytesWritten), take);
+            current->bytesWritten += take;
+        }
+    }
+
+    close(current->original);
+    current->copy = 0;
+    return ok;
 }
 
-int isInteresting(uint8_t* str, int len) {
-    char haystack[len + 1];
-    memcpy(haystack, str, len);
-    haystack[len] = '\0';
+/**
+ * Takes a piece of response body into its digest, and appends it to the
+ * flow's output file unless the body is a copy of one saved already.
+ */
+static void saveBody(flow_context* target, const uint8_t* data,
+        uint32_t len) {
+    flow* current = target->current;
 
-    if (strstr(haystack, "tent-Type: audio/mp")) {
-        return 1;
+    //Taken for a copy on the strength of its start, but it isn't one.
+    if (current->copy && !sameAsOriginal(current, data, len)) {
+        printf("Response body differs from the one it started out like, "
+                "writing it after all.\n");
+
+        if (!stopCopying(target, current)) {
+            printf("Couldn't read that one back, giving up.\n");
+            current->failed = 1;
+            return;
+        }
+    }
+
+    digestUpdate(&(current->digest), data, len);
+
+    if (current->copy || len == 0) {
+        return;
     }
 
-    return 0;
+    outputWrite(&(target->worker->output), current->output, data, len);
+    statsAdd(&(target->worker->stats.bytesWritten), len);
+    current->bytesWritten += len;
 }
 
-char* filename;
+/**
+ * With the start of a body in, looks for one saved already with the same
+ * start and size. If there is one, the rest of the body is compared with it
+ * instead of being written. Only bodies that say their size up front can be
+ * checked this early; the rest are checked once they're complete.
+ */
+static void checkForCopy(flow* current) {
+    const http_response* http = &(current->http);
+    char name[CLASSIFY_NAME_MAX];
 
-void rndstr(char* s, const int len) {
-    static const char chars[] =
-        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+    digestFinal(&(current->digest), current->prefix);
 
-    int i;
-    for (i = 0; i < len; ++i) {
-        s[i] = chars[rand() % (sizeof(chars) - 1)];
+    if (http->chunked || http->untilClose || http->contentLength < 0
+            || !dedupFind(&savedBodies, http->contentLength, current->prefix,
+            current->copyOf)) {
+        return;
     }
 
-    s[len] = '\0';
+    //It's only in the index once it's on disk under that name, but it may
+    //have been moved away since; then this one is written out after all.
+    savedName(current, current->copyOf, name);
+    current->original = openat(savedDirectory, name, O_RDONLY);
+
+    if (current->original >= 0) {
+        printf("Response body starts like %s, not writing the rest.\n", name);
+        current->copy = 1;
+    }
 }
 
 /**
- * Streams from a pcap file, looking for packets to reconstruct. Rebuilds TCP
- * PDUs and looks for ones that match a user-defined pattern. They are then
- * extracted and organized (via optional inspection parameters for things like
- * JFIF tags).
- * 
- * NB: Tagged frames or non-EthernetII frames are not supported and will break.
- * Limitation: Can't read overlapping files of interest yet.
- * 
- * @param argc Argument count.
- * @param argv Argument values.
- * @return Zero on normal exit, nonzero otherwise.
+ * Takes in a piece of response body.
  */
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        usage();
-        return 1;
+static void writeBody(void* context, const uint8_t* data, uint32_t len) {
+    flow_context* target = context;
+    flow* current = target->current;
+    uint64_t seen = current->digest.length;
+
+    if (len == 0) {
+        return;
     }
 
-    hello();
+    if (current->headLength < CLASSIFY_BYTES) {
+        uint32_t take = CLASSIFY_BYTES - current->headLength;
 
-    int fd = open(argv[1], O_RDONLY);
+        take = len < take ? len : take;
+        memcpy(current->head + current->headLength, data, take);
+        current->headLength += take;
+    }
 
-    if (fd < 0) {
-        error(1);
-        return 1;
+    //Up to the end of its start first, to see if it's one we've had.
+    if (seen < DEDUP_PREFIX_BYTES && seen + len >= DEDUP_PREFIX_BYTES) {
+        uint32_t head = DEDUP_PREFIX_BYTES - seen;
+
+        saveBody(target, data, head);
+        checkForCopy(current);
+        data += head;
+        len -= head;
     }
+    saveBody(target, data, len);
 
+    current->segments++;
+}
 
-    pcap_file pcapFile;
+/**
+ * Creates the output file for a flow whose body is about to start. It has a
+ * random name until it's complete and its digest is known.
+ * 
+ * @return Non-zero on success.
+ */
+static int startOutput(worker_state* worker, flow* current) {
+    rndstr(current->filename, 16);
+    current->output = outputOpen(&(worker->output), current->filename);
 
-    if (!load(fd, &pcapFile, 0)) {
-        error(2);
-        return 2;
+    if (current->output == NULL) {
+        printf("Out of memory for output file %s, skipping.\n",
+                current->filename);
+        return 0;
     }
 
+    current->bytesWritten = 0;
+    current->segments = 0;
+    digestInit(&(current->digest));
+    current->headLength = 0;
+    current->copy = 0;
+    return 1;
+}
 
-    uint32_t lookingFor = 0;
-    int remindInputAvail = 1;
-    int outputFile = -1;
-    int waited = 0;
-    int packetNum = 0;
-
-    /*
-     * Extract TCP payloads by inspecting these packets and making sure the IP
-     * container is consistent with what we expect.
-     */
-    for (;;) {
-     //   sleep(1); // Hold off for a second.
-        filename = malloc(17);
-        rndstr(filename, 16);
-        if (!more(&pcapFile)) {
-            sleep(1); // Hold off for a second.
-            if (remindInputAvail) {
-                printf("Waiting for input to become available...\n");
-                remindInputAvail = 0;
-            }
-            continue;
-        }
+/**
+ * Settles a body's place in the index once its file is saved under its
+ * digest, so that later copies of it can be left out. One that couldn't be
+ * saved is forgotten.
+ * 
+ * @param context The body, as a dedup_entry (freed here).
+ * @param saved Whether the file got its name.
+ */
+static void bodyPlaced(void* context, int saved) {
+    dedup_entry* body = context;
 
-        remindInputAvail = 1;
-        
-        //Begin by reading Ethernet frames out of the packets... Read a packet
-        //and check its header for a reasonable size (< 1600 bytes))
-        pcap_packet packet;
-        readPacket(&pcapFile, &packet);
+    dedupPlaced(&savedBodies, body->size, body->prefix, body->digest, saved);
+    free(body);
+}
 
-        //I GUESS SOMETIMES some servers do send larger packets even though
-        //it's a violation of the spec... oh well...
-  //      if (packet.header.incl_len > 1600) {
-  //          printf("Unreasonably large packet, skipping...\n");
-  //          unloadPacket(&packet);
-  //          continue;
-  //      }
+/**
+ * Closes the output file of the response a flow is extracting. A complete
+ * body is named by its digest, in a directory for its kind of file, or not
+ * kept at all if it's a copy of one already saved; anything less keeps the
+ * name it was written under.
+ * 
+ * @param current The flow.
+ * @param why How the response ended, for the log.
+ * @param complete Whether the body is all there.
+ */
+static void finishResponse(worker_state* worker, flow* current,
+        const char* why, int complete) {
+    uint64_t size = current->digest.length;
+    uint8_t digest[DIGEST_SIZE];
+    char name[CLASSIFY_NAME_MAX];
+    char outcome[128];
 
-        //These should be EthernetII packets, without the 8-octet preamble. Not
-        //that the header info really matters, we want the TCP frame info.
+    //Anything less than all of it is kept as it is, so it needs what it
+    //had in common with the body it was taken for a copy of.
+    if (!complete) {
+        flow_context target = {worker, current};
 
-        //Check that this is an IP packet - 0x0800 should appear at bytes 12,13.
-        //This is the Ethertype, assuming we're not dealing with tagged frames.
-        if (!(packet.payload.data[12] == 0x08
-                && packet.payload.data[13] == 0x00)) {
-            printf("Not IP packet, skipping.\n");
-            unloadPacket(&packet);
-            continue;
+        if (current->copy && !stopCopying(&target, current)) {
+            printf("Couldn't read back the body this one started out like.\n");
         }
+        snprintf(outcome, sizeof (outcome), "saved to file: %s",
+                current->filename);
+        outputClose(&(worker->output), current->output);
+        statsAdd(&(worker->stats.filesWritten), 1);
+    } else {
+        digestFinal(&(current->digest), digest);
+        savedName(current, digest, name);
 
-        //The payload is at _least_ 42 octets long, so we can read it and make
-        //sure it's TCP over IP...
-        if ((packet.payload.data[14] & 0xF0) != 0x40) {
-            printf("Not IPv4, skipping.\n");
-            unloadPacket(&packet);
-            continue;
+        //Short enough that its start is all of it.
+        if (size < DEDUP_PREFIX_BYTES) {
+            memcpy(current->prefix, digest, DIGEST_SIZE);
         }
 
-        //The second nibble of that is the Internet Header Length which will
-        //allow us to locate the data in this header...
-        int ipDataOffset = (packet.payload.data[14] & 0x0F) * 4 + 14;
+        if (current->copy) {
+            //It's matched the saved body, read back, all the way through.
+            close(current->original);
+            current->copy = 0;
 
+            snprintf(outcome, sizeof (outcome), "already saved as: %s",
+                    name);
+            outputDiscard(&(worker->output), current->output);
+            statsAdd(&(worker->stats.duplicates), 1);
+            statsAdd(&(worker->stats.duplicateBytes), size);
+        } else if (!dedupAdd(&savedBodies, size, current->prefix, digest)) {
+            //Saved already, or on its way. Written out all the same, so it's
+            //only dropped if there's a file under that name by the time it
+            //gets there.
+            snprintf(outcome, sizeof (outcome), "already saved as: %s",
+                    name);
+            outputCloseAs(&(worker->output), current->output, name, NULL,
+                    NULL);
+            statsAdd(&(worker->stats.duplicates), 1);
+            statsAdd(&(worker->stats.duplicateBytes), size);
+        } else {
+            //Known from now on, so copies finishing while this is on its way
+            //to disk are counted as such; their rest is only left out once
+            //it's there.
+            dedup_entry* body = malloc(sizeof (dedup_entry));
 
-        //Also, make sure it's containing a TCP packet
-        if (packet.payload.data[23] != 0x06) {
-            printf("Not TCP, skipping.\n");
-            unloadPacket(&packet);
-            continue;
+            if (body != NULL) {
+                body->size = size;
+                memcpy(body->prefix, current->prefix, DIGEST_SIZE);
+                memcpy(body->digest, digest, DIGEST_SIZE);
+            }
+            snprintf(outcome, sizeof (outcome), "saved to file: %s", name);
+            outputCloseAs(&(worker->output), current->output, name,
+                    body != NULL ? bodyPlaced : NULL, body);
+            statsAdd(&(worker->stats.filesWritten), 1);
         }
+    }
 
-        //Read the length...
-        int ipDataLength = (packet.payload.data[16] << 8) + packet.payload.data[17];
+    printf("Response %s (%s: %s, %llu bytes in %u pieces, %u segments held "
+            "out of order), %s\n", why,
+            matcherRuleName(&patterns, current->rule),
+            current->http.contentType[0] ? current->http.contentType : "no type",
+            (unsigned long long) size, current->segments,
+            current->heldSegments, outcome);
 
-        //See spec violation note above...
- //       if ((ipDataLength < 8) || (ipDataLength > 1500)) {
-  //          printf("This data length doesn't make sense: %d\n", ipDataLength);
-  //          unloadPacket(&packet);
-  //          continue;
-  //      }
-     //   printf("Packet payload length is %d\n", packet.payload.payloadSize);
-    //    printf("IPdataLength is %d\n", ipDataLength);
-     //   printf("Offset is %d\n", ipDataOffset);
+    current->output = NULL;
+    current->responses++;
+}
 
-        //We know this to be TCP, so extract a tcp_packet type from it.
-        tcp_packet tcpPacket;
+/**
+ * Receives a flow's stream in order. Header bytes go to the HTTP parser, the
+ * body after them to the output file, and whatever follows the end of the body
+ * is the next response on the connection.
+ */
+static void streamData(void* context, flow* current, const uint8_t* data,
+        uint32_t len) {
+    flow_context target = {context, current};
 
-        if (!extractTCP(packet.payload.data, ipDataOffset, ipDataLength, &tcpPacket)) {
-            printf("Couldn't extract to TCP, skipping.\n");
-            unloadPacket(&packet);
-            continue;
-        }
+    while (len > 0 && !current->failed && !current->done) {
+        http_response* http = &(current->http);
 
+        if (http->state == HTTP_HEADERS) {
+            uint32_t used = httpConsumeHeaders(http, data, len);
+            data += used;
+            len -= used;
 
+            if (http->state == HTTP_ERROR) {
+                printf("Couldn't read HTTP response headers, giving up.\n");
+                current->failed = 1;
+                return;
+            }
 
-        //Check : could have an interesting packet already, if so check if
-        //this is the next sequential one, keep building the payload , check
-        //for FIN flag
-        if ((lookingFor == 0) && (outputFile == -1)) { //XXX: Corner case when it's actually zero should be avoided by resetting outputFile to -1.
-            //Check if this packet is interesting. if not, unload it.
-            if (isInteresting(tcpPacket.payload, tcpPacket.payloadSize)) {
-                printf("Match found, beginning to build output file...\n");
-
-                //open output file and begin to write into it..
-                
-                //But, this is an HTTP transfer begin so there's some junk
-                //(http response) which needs to be stripped out first... It's
-                //terminated by the byte sequence 0x0d 0x0a 0x0d 0x0a in the payload. (two newlines after the header)
-                //Find it and then write the remainder to the file.
-                int mediaOffset = 0;
-                
-                for (mediaOffset = 0; mediaOffset < tcpPacket.payloadSize; mediaOffset++) {
-                    if ((tcpPacket.payload[mediaOffset] == 0x0d) &&
-                            (tcpPacket.payload[mediaOffset + 1] == 0x0a) &&
-                            (tcpPacket.payload[mediaOffset + 2] == 0x0d) &&
-                            (tcpPacket.payload[mediaOffset + 3] == 0x0a)) {
-                        //Found it, set mediaOffset+4 and break;
-                        mediaOffset+=4;
-                        break;
-                    }
-                }
-                
-                if (mediaOffset == tcpPacket.payloadSize) {
-                    printf("ERROR: Never found end of HTTP response! Is it too big and in the next packet?");
-                    error(3);
-                    return 3;
+            if (http->state == HTTP_HEADERS) {
+                return;
+            }
+
+            //A later response on a kept-alive connection has to match on its
+            //own merits, as does the first if its headers were split.
+            if (current->rule < 0) {
+                current->rule = matcherScan(&patterns, http->header,
+                        http->headerLength, NULL);
+                if (current->rule < 0) {
+                    current->done = 1;
+                    return;
                 }
-                outputFile = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
-                if (write(outputFile, &(tcpPacket.payload[mediaOffset]), tcpPacket.payloadSize - mediaOffset) != tcpPacket.payloadSize - mediaOffset) {
-                    printf("Something went horribly wrong while writing to this file!\n");
+                if (current->responses == 0) {
+                    printf("Match found (%s), beginning to build output "
+                            "file...\n", matcherRuleName(&patterns,
+                            current->rule));
+                    statsAdd(&(target.worker->stats.matches), 1);
                 }
+            }
+            httpReleaseHeaders(http);
 
-                //set the header looking for the next packet
-                lookingFor = tcpPacket.sequenceNumber + tcpPacket.payloadSize;
+            //Nothing to save from a response without a body (304s etc).
+            if (http->state == HTTP_BODY && !startOutput(target.worker, current)) {
+                current->failed = 1;
+                return;
             }
-        } else {
-            //Check if this packet matches the next one in the sequence
-            if (tcpPacket.sequenceNumber == lookingFor) {
-                waited = 0;
-                
-               // printf("Packet [%d] matches, reconstructing and writing out...\n", packetNum);
-                if (write(outputFile, tcpPacket.payload, tcpPacket.payloadSize) != tcpPacket.payloadSize) {
-                    printf("Error during reconstruction!\n");
-                }
+        }
 
-                //set the header looking for the next packet
-                lookingFor = tcpPacket.sequenceNumber + tcpPacket.payloadSize;
+        if (http->state == HTTP_BODY) {
+            uint32_t used = httpConsumeBody(http, data, len, writeBody, &target);
+            data += used;
+            len -= used;
 
-                //Check that it wasn't the last packet...
-                if ((tcpPacket.header.flags & 0x01)) {
-                    printf("Last packet found, saved to file: %s\n", filename);
-                    lookingFor = 0;
-                    close(outputFile);
-                    outputFile = -1;
-                }
-                
-            } else {
-                waited++;
+            if (http->state == HTTP_ERROR) {
+                printf("Bad chunked encoding, giving up.\n");
+                current->failed = 1;
+                return;
             }
-            
-            if (waited >= 1024) {
-                printf("Waited more than %d packets looking for:\nSequence number:\t%x\nNear packet:\t%d\n",waited,lookingFor, packetNum);
-                lookingFor = 0;
-                close(outputFile);
-                outputFile = -1;
+        }
+
+        //Body complete: let go of the file straight away, and get ready for
+        //another response on the same connection.
+        if (http->state == HTTP_DONE) {
+            if (current->output != NULL) {
+                finishResponse(target.worker, current, "complete", 1);
             }
+            httpResponseFree(http);
+            httpResponseInit(http);
+            current->rule = -1;
+        }
+    }
+}
+
+/**
+ * Whether a flow has nothing in flight: its last response is finished and
+ * nothing of the next one has turned up yet. There's no point holding on to
+ * such a flow - if another interesting response comes along, it'll be matched
+ * just like the first one was.
+ */
+static int betweenResponses(flow* current) {
+    return current->rule < 0 && current->http.state == HTTP_HEADERS
+            && current->http.headerLength == 0 && current->pending == NULL;
+}
+
+/**
+ * Adds a worker's change in memory to the global total, once it's changed
+ * enough to be worth the shared write.
+ * 
+ * @param force Add it whatever the size.
+ */
+static void publishMemory(worker_state* worker, int force) {
+    int64_t change = (int64_t) (worker->memory - worker->publishedMemory);
+
+    if (force || change >= MEMORY_PUBLISH_STEP
+            || change <= -MEMORY_PUBLISH_STEP) {
+        __atomic_add_fetch(&memoryInUse, change, __ATOMIC_RELAXED);
+        worker->publishedMemory = worker->memory;
+    }
+}
+
+/**
+ * What a flow is holding on to: itself, segments waiting on a gap, and
+ * response headers still being collected.
+ */
+static uint32_t flowMemory(const flow* current) {
+    return sizeof (flow) + current->pendingBytes
+            + current->http.headerCapacity;
+}
+
+/**
+ * Brings a flow's part of its worker's memory up to date.
+ * 
+ * @param memory What it holds now.
+ */
+static void accountFlow(worker_state* worker, flow* current,
+        uint32_t memory) {
+    worker->memory = worker->memory - current->memory + memory;
+    current->memory = memory;
+
+    statsSet(&(worker->stats.flowMemory), worker->memory);
+    publishMemory(worker, 0);
+}
+
+/**
+ * Closes a flow's output and stops tracking it.
+ * 
+ * @param current The flow.
+ * @param why Why we're done with it, for the log.
+ */
+static void finishFlow(worker_state* worker, flow* current, const char* why) {
+    char reason[64];
+
+    if (current->output != NULL) {
+        //A body that runs until the connection closes is all there once
+        //everything up to the FIN is.
+        int complete = current->http.untilClose && current->sawFin
+                && current->nextSequence == current->finSequence
+                && !current->failed;
+
+        if (current->http.state == HTTP_BODY && !current->http.untilClose) {
+            snprintf(reason, sizeof (reason), "cut short, %s", why);
+            why = reason;
         }
-        
-        packetNum++;
+        finishResponse(worker, current, why, complete);
+    } else if (current->rule >= 0) {
+        printf("Flow %s (%s) before its HTTP headers ended, nothing saved.\n",
+                why, matcherRuleName(&patterns, current->rule));
+    }
+
+    statsAdd(&(worker->stats.flowsClosed), 1);
+    if (current->failed) {
+        statsAdd(&(worker->stats.flowsFailed), 1);
+    }
+
+    discardPending(current);
+    httpResponseFree(&(current->http));
+    accountFlow(worker, current, 0);
+    flowRemove(&(worker->flows), current);
+}
+
+/**
+ * The capture time to give a flow: the clock's, or before it's started, that
+ * of the packet waiting to start it.
+ */
+static uint64_t flowClock(const worker_state* worker) {
+    return worker->now != 0 ? worker->now : worker->leap;
+}
 
-        free(tcpPacket.payload);
+/**
+ * When a flow is due to expire, going by the limits set.
+ * 
+ * @return Capture time in nanoseconds (UINT64_MAX for never).
+ */
+static uint64_t flowDeadline(const flow* current) {
+    uint64_t deadline = UINT64_MAX;
+
+    if (idleLimit) {
+        deadline = current->lastSeen + idleLimit;
+    }
+    if (lifetimeLimit && current->started + lifetimeLimit < deadline) {
+        deadline = current->started + lifetimeLimit;
+    }
+    return deadline;
+}
+
+/**
+ * The first timer tick at or after a capture time.
+ */
+static uint64_t deadlineTick(uint64_t deadline) {
+    return deadline / NANOS_PER_SECOND
+            + (deadline % NANOS_PER_SECOND != 0);
+}
 
+/**
+ * Handles a flow's timer. It may have seen packets since the timer was set,
+ * in which case it's set again for the new deadline; packets themselves
+ * never touch the timer.
+ * 
+ * @param context The worker_state.
+ * @param entry The timer.
+ */
+static void expireFlow(void* context, timer_entry* entry) {
+    worker_state* worker = context;
+    flow* current = flowLookup(&(worker->flows), &(entry->key));
 
+    //Finished with some other way already (maybe with a new flow of the
+    //same key since).
+    if (current == NULL || current->id != entry->id) {
+        timerRelease(&(worker->timers), entry);
+        return;
     }
 
-    unload(&pcapFile);
-    close(fd);
-    return (EXIT_SUCCESS);
+    uint64_t deadline = flowDeadline(current);
+    if (deadline > worker->now) {
+        timerReschedule(&(worker->timers), entry, deadlineTick(deadline));
+        return;
+    }
+    timerRelease(&(worker->timers), entry);
+
+    if (idleLimit && current->lastSeen + idleLimit <= worker->now) {
+        statsAdd(&(worker->stats.evictions[STATS_EVICT_IDLE]), 1);
+        finishFlow(worker, current, "went quiet");
+    } else {
+        statsAdd(&(worker->stats.evictions[STATS_EVICT_LIFETIME]), 1);
+        finishFlow(worker, current, "ran too long");
+    }
+}
+
+/* A flow that may have to go to make room. */
+typedef struct {
+    uint64_t lastSeen;
+    flow_key key;
+} eviction_candidate;
+
+static int compareCandidates(const void* a, const void* b) {
+    uint64_t first = ((const eviction_candidate*) a)->lastSeen;
+    uint64_t second = ((const eviction_candidate*) b)->lastSeen;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * With every worker's flows holding more than the budget between them, lets
+ * go of this worker's quietest flows until it's down to its share of 7/8 of
+ * the budget (so this doesn't happen again on the very next packet).
+ */
+static void evictForMemory(worker_state* worker, uint64_t inUse) {
+    uint64_t target = (double) worker->memory * (memoryBudget / 8 * 7)
+            / inUse;
+    size_t count = 0;
+    size_t i;
+
+    if (worker->memory <= target || worker->flows.count == 0) {
+        return;
+    }
+
+    eviction_candidate* candidates = malloc(worker->flows.count
+            * sizeof (eviction_candidate));
+    if (candidates == NULL) {
+        return;
+    }
+
+    for (i = 0; i < worker->flows.capacity; i++) {
+        if (worker->flows.slots[i].inUse) {
+            candidates[count].lastSeen = worker->flows.slots[i].lastSeen;
+            candidates[count].key = worker->flows.slots[i].key;
+            count++;
+        }
+    }
+    qsort(candidates, count, sizeof (eviction_candidate), compareCandidates);
+
+    //By key, since flows move about as others are removed.
+    for (i = 0; i < count && worker->memory > target; i++) {
+        flow* victim = flowLookup(&(worker->flows), &(candidates[i].key));
+
+        if (victim != NULL) {
+            statsAdd(&(worker->stats.evictions[STATS_EVICT_MEMORY]), 1);
+            finishFlow(worker, victim, "let go to save memory");
+        }
+    }
+    free(candidates);
+
+    publishMemory(worker, 1);
+}
+
+/**
+ * Seconds on a clock that doesn't jump around.
+ */
+static time_t monotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+/**
+ * Parses address:port, or [address]:port for IPv6, into network byte order.
+ * IPv4 addresses come out IPv4-mapped, as in flow_key.
+ * 
+ * @return Non-zero on success.
+ */
+static int parseEndpoint(const char* text, size_t len, uint8_t* address,
+        uint16_t* port) {
+    char host[INET6_ADDRSTRLEN];
+    const char* hostStart = text;
+    const char* colon;
+    size_t hostLength;
+
+    if (len > 0 && text[0] == '[') {
+        const char* close = memchr(text, ']', len);
+
+        if (close == NULL || close + 1 >= text + len || close[1] != ':') {
+            return 0;
+        }
+        hostStart = text + 1;
+        hostLength = close - hostStart;
+        colon = close + 1;
+    } else {
+        colon = memchr(text, ':', len);
+        if (colon == NULL) {
+            return 0;
+        }
+        hostLength = colon - text;
+    }
+
+    if (hostLength >= sizeof (host)) {
+        return 0;
+    }
+
+    memcpy(host, hostStart, hostLength);
+    host[hostLength] = '\0';
+
+    struct in_addr parsed;
+    if (inet_pton(AF_INET6, host, address) != 1) {
+        if (inet_pton(AF_INET, host, &parsed) != 1) {
+            return 0;
+        }
+        memset(address, 0, 10);
+        address[10] = 0xFF;
+        address[11] = 0xFF;
+        memcpy(address + 12, &parsed, 4);
+    }
+
+    int number = atoi(colon + 1);
+    if (number <= 0 || number > 65535) {
+        return 0;
+    }
+
+    *port = htons(number);
+    return 1;
+}
+
+/**
+ * Parses a -s flow: address:port,address:port.
+ * 
+ * @return Non-zero on success.
+ */
+static int parseFlow(const char* text, flow_key* key) {
+    const char* comma = strchr(text, ',');
+
+    return comma != NULL
+            && parseEndpoint(text, comma - text, key->sourceAddress,
+            &(key->sourcePort))
+            && parseEndpoint(comma + 1, strlen(comma + 1),
+            key->destAddress, &(key->destPort));
+}
+
+/**
+ * Parses a -t window: from:to, where either end may be missing.
+ * 
+ * @return Non-zero on success.
+ */
+static int parseTimeWindow(const char* text, uint32_t* from, uint32_t* to) {
+    char* end;
+
+    *from = 0;
+    *to = UINT32_MAX;
+
+    if (*text != ':') {
+        *from = strtoul(text, &end, 10);
+        text = end;
+    }
+
+    if (*text != ':') {
+        return 0;
+    }
+    text++;
+
+    if (*text != '\0') {
+        *to = strtoul(text, &end, 10);
+        if (*end != '\0') {
+            return 0;
+        }
+    }
+
+    return *from <= *to;
+}
+
+/**
+ * Counts a packet that can't be followed any further, and unloads it.
+ * 
+ * @param reason Why, for the counters.
+ * @param message Why, for the log (only with -v).
+ */
+static void dropPacket(worker_state* worker, pcap_packet* packet,
+        stats_drop_reason reason, const char* message) {
+    statsAdd(&(worker->stats.drops[reason]), 1);
+    if (verbose) {
+        printf("%s, skipping.\n", message);
+    }
+    unloadPacket(packet);
 }
 
+/**
+ * Inspects one captured frame: pulls out the TCP segment and either starts a
+ * new output file (if it's interesting) or appends it to the one in progress.
+ * The packet is unloaded when done.
+ * 
+ * @param worker The worker handling it.
+ * @param packet The captured packet.
+ * @param start When the worker started on it, for timing each stage.
+ */
+static void inspectPacket(worker_state* worker, pcap_packet* packet,
+        uint64_t start) {
+    stats_histogram* latency = worker->stats.latency;
+
+    //I GUESS SOMETIMES some servers do send larger packets even though
+    //it's a violation of the spec... oh well...
+  //      if (packet.header.incl_len > 1600) {
+  //          printf("Unreasonably large packet, skipping...\n");
+  //          unloadPacket(packet);
+  //          return;
+  //      }
+
+    //Find the TCP segment, as views into the captured frame: whatever link
+    //layer, tags and IP version it came with.
+    packet_layers layers;
+
+    switch (decodePacket(packet, &layers)) {
+        case DECODE_TCP:
+            break;
+        case DECODE_NOT_LINK:
+            dropPacket(worker, packet, STATS_DROP_NOT_LINK,
+                    "Not a link type we can read");
+            return;
+        case DECODE_NOT_IP:
+            dropPacket(worker, packet, STATS_DROP_NOT_IP, "Not IP packet");
+            return;
+        case DECODE_NOT_TCP:
+            dropPacket(worker, packet, STATS_DROP_NOT_TCP, "Not TCP");
+            return;
+        default:
+            dropPacket(worker, packet, STATS_DROP_TRUNCATED,
+                    "Couldn't extract to TCP");
+            return;
+    }
+
+    uint32_t sequence = tcpSequence(&layers);
+
+    //Which stream is this?
+    flow_key key;
+    flowKeyFromLayers(&layers, &key);
+
+    //Turn away what the filter doesn't want before looking it up.
+    if (filtering && !worker->prefiltered && !filterMatches(&filter, &key)) {
+        dropPacket(worker, packet, STATS_DROP_FILTERED, "Filtered out");
+        return;
+    }
+
+    uint64_t decoded = statsNow();
+    statsRecord(&(latency[STATS_STAGE_DECODE]), decoded - start);
+
+    //Check : could be part of an interesting stream already, if not check
+    //whether it starts one.
+    flow* current = flowLookup(&(worker->flows), &key);
+
+    if (current == NULL) {
+        //Check if this packet is interesting. if not, unload it.
+        size_t matchEnd;
+        int rule = matcherScan(&patterns, layers.payload,
+                layers.payloadLength, &matchEnd);
+
+        //The stream we keep starts with the status line of the matching
+        //response. Without one, we've come in partway through that response,
+        //and its body couldn't be told from the rest of its headers.
+        long responseStart = findResponseStart(layers.payload,
+                rule >= 0 ? matchEnd : layers.payloadLength);
+
+        if (rule >= 0 && responseStart < 0) {
+            dropPacket(worker, packet, STATS_DROP_MID_RESPONSE,
+                    "Match found partway into a response");
+            worker->packetNum++;
+            return;
+        }
+
+        //A response whose headers run on into later segments may match in
+        //those, so it's followed until they're complete and matched as a
+        //whole, like a later response on a kept-alive connection.
+        if (rule < 0 && (responseStart < 0
+                || findHeaderEnd(layers.payload + responseStart,
+                layers.payloadLength - responseStart) >= 0)) {
+            statsAdd(&(worker->stats.ignored), 1);
+            statsRecord(&(latency[STATS_STAGE_MATCH]), statsNow() - decoded);
+            unloadPacket(packet);
+            worker->packetNum++;
+            return;
+        }
+
+        if (rule >= 0) {
+            printf("Match found (%s), beginning to build output file...\n",
+                    matcherRuleName(&patterns, rule));
+            statsAdd(&(worker->stats.matches), 1);
+        }
+
+        //Its timer goes by key, so it can be set before the flow exists (if
+        //the flow then doesn't, the timer just finds nothing there).
+        uint64_t id = ++worker->nextFlowId;
+        int timed = idleLimit || lifetimeLimit;
+        uint64_t now = flowClock(worker);
+        uint64_t due = idleLimit ? now + idleLimit : UINT64_MAX;
+
+        if (lifetimeLimit && now + lifetimeLimit < due) {
+            due = now + lifetimeLimit;
+        }
+
+        current = NULL;
+        if (!timed || timerAdd(&(worker->timers), &key, id,
+                deadlineTick(due))) {
+            current = flowInsert(&(worker->flows), &key);
+        }
+        if (current == NULL) {
+            printf("Out of memory for flows, skipping this one.\n");
+            statsAdd(&(worker->stats.drops[STATS_DROP_NO_FLOW_MEMORY]), 1);
+            unloadPacket(packet);
+            worker->packetNum++;
+            return;
+        }
+
+        //Its headers get stripped before anything is written.
+        current->rule = rule;
+        current->id = id;
+        current->started = now;
+        current->memory = 0;
+        current->nextSequence = sequence + responseStart;
+        httpResponseInit(&(current->http));
+        statsAdd(&(worker->stats.flowsOpened), 1);
+    }
+
+    current->lastSeen = flowClock(worker);
+
+    uint64_t found = statsNow();
+    statsRecord(&(latency[STATS_STAGE_MATCH]), found - decoded);
+
+    //Put it in its place in the stream; early segments wait for the gap
+    //before them to fill.
+    stream_status status = reassembleSegment(current, sequence,
+            tcpSegmentFlags(&layers) & TCP_FIN, layers.payload,
+            layers.payloadLength, streamData, worker);
+
+    statsRecord(&(latency[STATS_STAGE_REASSEMBLY]), statsNow() - found);
+
+    if (current->failed) {
+        finishFlow(worker, current, "gave up");
+    } else if (status == STREAM_FINISHED) {
+        finishFlow(worker, current, "complete");
+    } else if (status == STREAM_OVERFLOW) {
+        printf("Too much data waiting on sequence number %x near packet %u.\n",
+                current->nextSequence, worker->packetNum);
+        current->failed = 1;
+        finishFlow(worker, current, "gave up");
+    } else if (current->done || betweenResponses(current)) {
+        finishFlow(worker, current, "done");
+    } else {
+        accountFlow(worker, current, flowMemory(current));
+    }
+    
+    worker->packetNum++;
+
+    uint64_t inUse = __atomic_load_n(&memoryInUse, __ATOMIC_RELAXED);
+    if (memoryBudget && inUse > memoryBudget) {
+        evictForMemory(worker, inUse);
+    }
+
+    unloadPacket(packet);
+}
+
+/**
+ * Moves a worker's clock up to a packet's capture time. Flows expire on it,
+ * so it only moves forward, and a time far ahead of it (a corrupt timestamp,
+ * most likely) is only believed once another packet near that time backs it
+ * up; until then the clock stays put. A real gap in the capture costs one
+ * packet's worth of waiting. The first packet's time is no more to be trusted
+ * than any other, so the clock doesn't start until a second backs it up.
+ * 
+ * @param worker The worker.
+ * @param captured The packet's capture time, in nanoseconds.
+ */
+static void advanceClock(worker_state* worker, uint64_t captured) {
+    uint64_t horizon = (uint64_t) CLOCK_JUMP_SECONDS * NANOS_PER_SECOND;
+
+    if (idleLimit > horizon) {
+        horizon = idleLimit;
+    }
+
+    if (captured <= worker->now) {
+        return;
+    }
+
+    if ((worker->now != 0 && captured - worker->now <= horizon)
+            || (worker->leap != 0 && (captured > worker->leap
+            ? captured - worker->leap : worker->leap - captured) <= horizon)) {
+        worker->now = captured;
+        worker->leap = 0;
+    } else {
+        worker->leap = captured;
+        if (worker->now != 0) {
+            statsAdd(&(worker->stats.clockJumps), 1);
+        }
+    }
+}
+
+/**
+ * Counts and times a packet on its way through inspectPacket.
+ * 
+ * @param context The worker_state of the worker handling it.
+ * @param packet The captured packet (unloaded when done).
+ */
+static void processPacket(void* context, pcap_packet* packet) {
+    worker_state* worker = context;
+    uint64_t start = statsNow();
+
+    statsAdd(&(worker->stats.packets), 1);
+    statsAdd(&(worker->stats.bytes), packet->payload.payloadSize);
+
+    uint64_t captured = (uint64_t) packet->header.ts_sec * NANOS_PER_SECOND
+            + (worker->nanoResolution ? packet->header.ts_usec
+            : (uint64_t) packet->header.ts_usec * 1000);
+    advanceClock(worker, captured);
+    if (worker->now != 0) {
+        timerAdvance(&(worker->timers), worker->now / NANOS_PER_SECOND,
+                expireFlow, worker);
+    }
+
+    inspectPacket(worker, packet, start);
+
+    statsRecord(&(worker->stats.latency[STATS_STAGE_TOTAL]),
+            statsNow() - start);
+}
+
+/**
+ * Keeps whatever a worker had of any files still in progress, and lets go of
+ * its flows. With a writer thread, also tells it this worker is done.
+ * 
+ * @param context The worker_state.
+ */
+static void finishWorker(void* context) {
+    worker_state* worker = context;
+
+    //Removing a flow can shift another into its slot, so only move on from
+    //empty slots.
+    size_t i = 0;
+    while (i < worker->flows.capacity) {
+        if (worker->flows.slots[i].inUse) {
+            finishFlow(worker, &(worker->flows.slots[i]),
+                    "stopped in progress");
+            continue;
+        }
+        i++;
+    }
+    flowTableFree(&(worker->flows));
+    timerWheelFree(&(worker->timers));
+
+    if (worker->output.ring != NULL) {
+        outputChannelFinish(&(worker->output));
+    }
+}
+
+
+/* What reading the captures, one after another, takes. */
+typedef struct {
+    capture_set* captures;
+    int fixedSize;
+    int streaming; /* Reading a pipe (the only capture). */
+    int idleTimeout;
+    int useIndex;
+    int byFlow;
+    flow_key wantedFlow;
+    int byTime;
+    uint32_t from;
+    uint32_t to;
+    int threaded;
+    int parallelScan;
+    worker_state* workers;
+    void** contexts;
+    int workerCount;
+    pipeline* workerPipeline; /* With -j, unless scanning in parallel. */
+    output_pool* pool;
+    output_writer* writer; /* With -j. */
+    stats_counters* readerStats;
+    int remindInputAvail;
+    time_t idleSince;
+    int finished; /* Set once there's to be no more reading at all. */
+    const char* checkpointPath; /* -c, or NULL. */
+    int checkpointInterval;
+    time_t checkpointDue;
+    int unsaved; /* Packets have been read since the last checkpoint. */
+    checkpoint_state* resume; /* Where the first capture read carries on
+                               * from, or NULL to start at the beginning. */
+} capture_reader;
+
+/**
+ * Opens a capture's index for the query asked for, building it first if
+ * need be.
+ * 
+ * @return Non-zero on success.
+ */
+static int openIndex(capture_reader* reader, const char* path,
+        packet_index* index, index_query* query) {
+    char indexPath[PATH_MAX];
+    snprintf(indexPath, sizeof (indexPath), "%s%s", path, INDEX_SUFFIX);
+
+    if (!indexOpen(index, path, indexPath)) {
+        printf("Indexing %s...\n", path);
+
+        if (!indexBuild(path, indexPath)
+                || !indexOpen(index, path, indexPath)) {
+            return 0;
+        }
+    }
+
+    indexQueryInit(index, query);
+    if (reader->byFlow) {
+        indexQueryFlow(query, &(reader->wantedFlow));
+    }
+    if (reader->byTime) {
+        indexQueryTime(index, query, reader->from, reader->to);
+    }
+    return 1;
+}
+
+/**
+ * Writes a checkpoint of how far we've got through a capture. The workers are
+ * caught up first (with -j, drained), and everything they've written so far
+ * is written out, so the flows, their files and the position all agree.
+ */
+static void saveCheckpoint(capture_reader* reader, size_t current,
+        pcap_file* pcapFile) {
+    checkpoint_state state;
+    checkpoint_writer writer;
+    size_t i;
+    int w;
+
+    if (reader->threaded) {
+        pipelineDrain(reader->workerPipeline);
+        outputWriterSync(reader->writer);
+    } else {
+        outputPoolFlush(reader->pool);
+    }
+
+    memset(&state, 0, sizeof (state));
+    snprintf(state.capture, sizeof (state.capture), "%s",
+            reader->captures->entries[current].path);
+    state.firstPacket = reader->captures->entries[current].firstPacket;
+    state.position = pcapFile->position;
+    state.bytesNeedFlipping = pcapFile->bytesNeedFlipping;
+    state.interfaces = pcapFile->interfaces;
+    state.interfaceCount = pcapFile->interfaceCount;
+    state.ruleCount = patterns.ruleCount;
+
+    for (w = 0; w < reader->workerCount; w++) {
+        if (reader->workers[w].now > state.now) {
+            state.now = reader->workers[w].now;
+        }
+    }
+
+    if (checkpointBegin(&writer, reader->checkpointPath, &state)) {
+        for (w = 0; w < reader->workerCount; w++) {
+            flow_table* flows = &(reader->workers[w].flows);
+
+            for (i = 0; i < flows->capacity; i++) {
+                if (flows->slots[i].inUse) {
+                    checkpointAddFlow(&writer, &(flows->slots[i]));
+                }
+            }
+        }
+        checkpointCommit(&writer);
+    }
+
+    reader->unsaved = 0;
+    reader->checkpointDue = monotonicSeconds() + reader->checkpointInterval;
+}
+
+/**
+ * Puts a flow from a checkpoint back in the table of the worker it belongs
+ * to, with its file cut back to what the checkpoint says was written to it.
+ * 
+ * @param saved The flow (its held segments and headers are taken over).
+ * @param writing Whether it had a file in progress.
+ */
+static void restoreFlow(capture_reader* reader, flow* saved, int writing) {
+    worker_state* worker = &(reader->workers[pipelineShard(saved->hash,
+            reader->workerCount)]);
+    char path[PATH_MAX + OUTPUT_NAME_MAX];
+    char name[CLASSIFY_NAME_MAX];
+    struct stat info;
+
+    //Whatever was written after the checkpoint is written again.
+    if (writing) {
+        snprintf(path, sizeof (path), "%s/%s", reader->pool->directory,
+                saved->filename);
+
+        if (stat(path, &info) != 0
+                || (uint64_t) info.st_size < saved->bytesWritten
+                || truncate(path, saved->bytesWritten) != 0) {
+            printf("Output file %s doesn't have what was written to it, "
+                    "giving up on it.\n", saved->filename);
+            discardPending(saved);
+            httpResponseFree(&(saved->http));
+            return;
+        }
+    }
+
+    //A body taken for a copy goes on being compared with the saved one.
+    saved->copy = writing && saved->copy;
+    if (saved->copy) {
+        savedName(saved, saved->copyOf, name);
+        saved->original = openat(savedDirectory, name, O_RDONLY);
+
+        if (saved->original < 0) {
+            printf("Saved body %s has gone, giving up on output file %s.\n",
+                    name, saved->filename);
+            discardPending(saved);
+            httpResponseFree(&(saved->http));
+            return;
+        }
+    }
+
+    uint64_t id = ++worker->nextFlowId;
+    flow* current = NULL;
+
+    if (!(idleLimit || lifetimeLimit) || timerAdd(&(worker->timers),
+            &(saved->key), id, deadlineTick(flowDeadline(saved)))) {
+        current = flowInsert(&(worker->flows), &(saved->key));
+    }
+    if (current == NULL) {
+        printf("Out of memory for flows, skipping one from the "
+                "checkpoint.\n");
+        if (saved->copy) {
+            close(saved->original);
+        }
+        discardPending(saved);
+        httpResponseFree(&(saved->http));
+        return;
+    }
+
+    *current = *saved;
+    current->id = id;
+    current->memory = 0;
+    current->output = NULL;
+
+    if (writing) {
+        current->output = outputReopen(&(worker->output), current->filename,
+                current->bytesWritten);
+        if (current->output == NULL) {
+            printf("Out of memory for output file %s, skipping.\n",
+                    current->filename);
+            current->failed = 1;
+
+            if (current->copy) {
+                close(current->original);
+                current->copy = 0;
+            }
+        }
+    }
+
+    //Counted as opened again, so the flows open still add up.
+    statsAdd(&(worker->stats.flowsOpened), 1);
+    accountFlow(worker, current, flowMemory(current));
+}
+
+/**
+ * Picks up where an earlier run's checkpoint left off, if there is one and
+ * it's for these captures: its flows go back to the workers, and reading is
+ * to carry on where it was.
+ * 
+ * @param saved Fill-in target: the checkpoint, to close once read from.
+ * @param state Fill-in target: what the checkpoint says.
+ * @param first Set to the capture to carry on with (0 to start over).
+ */
+static void resumeCheckpoint(capture_reader* reader,
+        checkpoint_reader* saved, checkpoint_state* state, size_t* first) {
+    capture_set* captures = reader->captures;
+    struct stat info;
+    size_t c;
+    int w;
+
+    *first = 0;
+    if (checkpointOpen(saved, reader->checkpointPath, state) <= 0) {
+        return;
+    }
+
+    for (c = 0; c < captures->count; c++) {
+        if (strcmp(captures->entries[c].path, state->capture) == 0) {
+            break;
+        }
+    }
+
+    //A capture with no packets when it was read can't be told apart by its
+    //first one.
+    const char* problem = NULL;
+
+    if (c == captures->count) {
+        problem = "isn't one of these captures";
+    } else if (state->firstPacket != UINT64_MAX
+            && state->firstPacket != captures->entries[c].firstPacket) {
+        problem = "has been replaced since";
+    } else if (stat(state->capture, &info) != 0
+            || info.st_size < state->position) {
+        problem = "is shorter than it was";
+    } else if (state->ruleCount != (uint32_t) patterns.ruleCount) {
+        problem = "was read with other patterns";
+    }
+
+    if (problem != NULL) {
+        printf("The checkpoint's capture %s %s, starting from the "
+                "beginning.\n", state->capture, problem);
+        return;
+    }
+
+    //Flows carry on on the capture's clock where it had got to.
+    for (w = 0; w < reader->workerCount; w++) {
+        reader->workers[w].now = state->now;
+        timerAdvance(&(reader->workers[w].timers),
+                state->now / NANOS_PER_SECOND, expireFlow,
+                &(reader->workers[w]));
+    }
+
+    flow current;
+    int writing;
+    int got;
+    size_t restored = 0;
+
+    while ((got = checkpointNextFlow(saved, &current, &writing)) > 0) {
+        restoreFlow(reader, &current, writing);
+        restored++;
+    }
+    if (got < 0) {
+        printf("The rest of checkpoint %s doesn't make sense, carrying on "
+                "without it.\n", reader->checkpointPath);
+    }
+
+    printf("Resuming %s from the checkpoint, with %lu flows in progress.\n",
+            state->capture, (unsigned long) restored);
+    *first = c;
+    reader->resume = state;
+}
+
+/**
+ * Runs a capture's packets through the workers, until it's read in full or
+ * we're told to stop.
+ * 
+ * @return EXIT_SUCCESS, or an error number.
+ */
+static int readPackets(capture_reader* reader, size_t current,
+        pcap_file* pcapFile, file_follower* follower, packet_index* index,
+        index_query* query) {
+    int live = !reader->fixedSize && !reader->streaming;
+    int drained = 0;
+    pcap_packet packets[PACKET_BATCH];
+
+    //The parallel scan does all the reading and processing by itself, given
+    //a mapping to look for records in.
+    if (reader->parallelScan && pcapFile->map != NULL) {
+        if (!scanParallel(pcapFile, reader->workerCount, reader->contexts,
+                reader->workerCount, processPacket, NULL, stopRequested)) {
+            error(4);
+            return 4;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (reader->parallelScan) {
+        printf("Can't split %s up, reading in order instead.\n",
+                reader->captures->entries[current].path);
+    }
+
+    /*
+     * Extract TCP payloads by inspecting these packets and making sure the IP
+     * container is consistent with what we expect.
+     */
+    while (!stopRequested()) {
+        int count = reader->useIndex
+                ? indexReadBatch(index, query, pcapFile, packets, PACKET_BATCH)
+                : readPacketBatch(pcapFile, packets, PACKET_BATCH);
+
+        if (count < 0) {
+            error(4);
+            return 4;
+        }
+
+        if (count == 0) {
+            //A fixed-size capture won't get any more packets, nor will a
+            //stream whose writer is gone.
+            if (reader->fixedSize || pcapFile->streamEnded) {
+                break;
+            }
+
+            //Once there's a newer capture, tcpdump has rotated away from
+            //this one: it's done as soon as what was written to it before
+            //then has been read (so have one more go at that).
+            if (live && (current + 1 < reader->captures->count
+                    || captureSetRefresh(reader->captures) > 0)) {
+                if (drained) {
+                    break;
+                }
+                drained = 1;
+                continue;
+            }
+
+            if (reader->remindInputAvail) {
+                printf("Waiting for input to become available...\n");
+                reader->remindInputAvail = 0;
+            }
+
+            //Block until tcpdump appends something (or we're told to stop).
+            int timeoutMs = -1;
+
+            if (reader->idleTimeout) {
+                time_t idle = monotonicSeconds() - reader->idleSince;
+
+                if (idle >= reader->idleTimeout) {
+                    printf("No new input for %d seconds, stopping.\n",
+                            reader->idleTimeout);
+                    reader->finished = 1;
+                    break;
+                }
+                timeoutMs = (reader->idleTimeout - idle) * 1000;
+            }
+
+            //What's been read so far still makes it into a checkpoint in
+            //time, however long the wait.
+            if (reader->checkpointPath != NULL && reader->unsaved) {
+                time_t left = reader->checkpointDue - monotonicSeconds();
+
+                if (left <= 0) {
+                    saveCheckpoint(reader, current, pcapFile);
+                } else if (timeoutMs < 0 || timeoutMs > left * 1000) {
+                    timeoutMs = left * 1000;
+                }
+            }
+
+            if (waitForInput(follower, timeoutMs) < 0) {
+                reader->finished = 1;
+                break;
+            }
+            continue;
+        }
+
+        reader->remindInputAvail = 1;
+        reader->idleSince = monotonicSeconds();
+        drained = 0;
+
+        int i;
+        if (reader->parallelScan) {
+            //There's no pipeline to hand packets to, only the workers: each
+            //packet is handled here, by the one its flow belongs to.
+            for (i = 0; i < count; i++) {
+                flow_key key;
+                uint32_t hash = 0;
+
+                if (packetFlowKey(&packets[i], &key, NULL)) {
+                    hash = flowHash(&key);
+                }
+                processPacket(&(reader->workers[pipelineShard(hash,
+                        reader->workerCount)]), &packets[i]);
+            }
+        } else if (!reader->threaded) {
+            for (i = 0; i < count; i++) {
+                processPacket(&(reader->workers[0]), &packets[i]);
+            }
+
+            //Write out what the batch produced in one go.
+            outputPoolFlush(reader->pool);
+        } else {
+            //All of a flow's packets go to the same worker. The rest have no
+            //flow to speak of, so any worker can skip them. What the filter
+            //turns away goes no further, not even copied.
+            for (i = 0; i < count; i++) {
+                flow_key key;
+                uint32_t hash = 0;
+
+                if (packetFlowKey(&packets[i], &key, NULL)) {
+                    if (filtering && !filterMatches(&filter, &key)) {
+                        statsAdd(&(reader->readerStats->packets), 1);
+                        statsAdd(&(reader->readerStats->bytes),
+                                packets[i].payload.payloadSize);
+                        statsAdd(&(reader->readerStats->drops[
+                                STATS_DROP_FILTERED]), 1);
+                        continue;
+                    }
+                    hash = flowHash(&key);
+                }
+
+                if (!retainPacket(pcapFile, &packets[i])) {
+                    error(6);
+                    return 6;
+                }
+                pipelineSubmit(reader->workerPipeline, &packets[i], hash);
+            }
+            pipelineFlush(reader->workerPipeline);
+        }
+
+        reader->unsaved = 1;
+        if (reader->checkpointPath != NULL
+                && monotonicSeconds() >= reader->checkpointDue) {
+            saveCheckpoint(reader, current, pcapFile);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads one capture of the set: to its end if it's fixed-size, until its
+ * writer closes it if it's a pipe, or, when following a live capture, until
+ * a newer one appears. Flows carry on into the next capture.
+ * 
+ * @param reader The reading so far (finished is set if there's to be no
+ * more: we were told to stop, or there's been no input for -i seconds).
+ * @param current Which capture.
+ * @return EXIT_SUCCESS, or an error number.
+ */
+static int readCapture(capture_reader* reader, size_t current) {
+    capture_set* captures = reader->captures;
+    const char* path = captures->entries[current].path;
+    int live = !reader->fixedSize && !reader->streaming;
+    int w;
+
+    if (captures->count > 1 || captures->sourceCount > 0) {
+        printf("Reading %s...\n", path);
+    }
+
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+
+    if (fd < 0) {
+        error(1);
+        return 1;
+    }
+
+    //Start watching before the first read so no append can slip through,
+    //nor any newer capture.
+    file_follower follower;
+    size_t d;
+
+    if (live && !follow(&follower, path)) {
+        close(fd);
+        error(5);
+        return 5;
+    }
+    for (d = 0; live && d < captures->directoryCount; d++) {
+        watchDirectory(&follower, captures->directories[d]);
+    }
+
+    pcap_file pcapFile;
+
+    if (!load(fd, &pcapFile, reader->fixedSize)) {
+        if (live) {
+            unfollow(&follower);
+        }
+        close(fd);
+        error(2);
+        return 2;
+    }
+
+    //The header is in (blocking for it was fine), from here on reads take
+    //what has arrived and waits go through epoll.
+    if (reader->streaming && !followStream(&follower, fd)) {
+        unload(&pcapFile);
+        close(fd);
+        error(5);
+        return 5;
+    }
+
+    //Carry on from the checkpoint, the first time round.
+    if (reader->resume != NULL) {
+        checkpoint_state* state = reader->resume;
+
+        reader->resume = NULL;
+        if (!seekRecord(&pcapFile, state->position) || (pcapFile.isNg
+                && !ngRestoreSection(&pcapFile, state->bytesNeedFlipping,
+                state->interfaces, state->interfaceCount))) {
+            if (live) {
+                unfollow(&follower);
+            }
+            unload(&pcapFile);
+            close(fd);
+            error(2);
+            return 2;
+        }
+    }
+
+    //Have the kernel read the next capture in while we're on this one.
+    captureSetPrefetch(captures, current + 1);
+
+    packet_index index;
+    index_query query;
+
+    if (reader->useIndex && !openIndex(reader, path, &index, &query)) {
+        unload(&pcapFile);
+        close(fd);
+        error(7);
+        return 7;
+    }
+
+    //Workers are between captures (with -j, they've been drained), so this
+    //is safe to change.
+    for (w = 0; w < reader->workerCount; w++) {
+        reader->workers[w].nanoResolution = pcapFile.nanoResolution;
+    }
+
+    int status = readPackets(reader, current, &pcapFile, &follower, &index,
+            &query);
+
+    //Queued packets may still point into this capture.
+    if (reader->threaded && !reader->parallelScan) {
+        pipelineDrain(reader->workerPipeline);
+    }
+
+    //Stopping part way through: leave a checkpoint to carry on from.
+    if (reader->checkpointPath != NULL && status == EXIT_SUCCESS
+            && (reader->finished || stopRequested())) {
+        saveCheckpoint(reader, current, &pcapFile);
+    }
+
+    if (live || reader->streaming) {
+        unfollow(&follower);
+    }
+    if (reader->useIndex) {
+        indexClose(&index);
+    }
+    unload(&pcapFile);
+    close(fd);
+    return status;
+}
+
+
+/**
+ * Streams from a pcap file, looking for packets to reconstruct. Rebuilds TCP
+ * PDUs and looks for ones that match a user-defined pattern. They are then
+ * extracted and organized by what their first bytes say they are (JPEG, MP3,
+ * PDF and so on).
+ * 
+ * Any number of overlapping files of interest can be rebuilt at once, each
+ * TCP stream being tracked separately in a flow table. Several captures (such
+ * as rotated ones) are read as one, in order, and a run can carry on from the
+ * checkpoint an earlier one left. With -j, the flows are split between worker
+ * threads by hash, fed by this thread and writing through one shared writer
+ * thread. Files are named by a digest of their content, so a body seen again
+ * (a popular download, say) is only saved once.
+ * 
+ * @param argc Argument count.
+ * @param argv Argument values.
+ * @return Zero on normal exit, nonzero otherwise.
+ */
+int main(int argc, char** argv) {
+    int fixedSize = 0;
+    int idleTimeout = 0;
+    int workerCount = 0;
+    const char* outputDirectory = ".";
+    int useIndex = 0;
+    int parallelScan = 0;
+    int byFlow = 0;
+    int byTime = 0;
+    int statsInterval = 0;
+    const char* checkpointPath = NULL;
+    int checkpointInterval = CHECKPOINT_SECONDS;
+    flow_key wantedFlow;
+    uint32_t from = 0;
+    uint32_t to = 0;
+    int opt;
+
+    if (!matcherInit(&patterns)) {
+        error(6);
+        return 6;
+    }
+    filterInit(&filter);
+
+    while ((opt = getopt(argc, argv, "c:C:e:fF:i:Ij:l:m:M:o:p:Ps:S:t:v"))
+            != -1) {
+        switch (opt) {
+            case 'c':
+                checkpointPath = optarg;
+                break;
+            case 'C':
+                checkpointInterval = atoi(optarg);
+                if (checkpointInterval < 0) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'e':
+                idleLimit = strtoull(optarg, NULL, 10) * NANOS_PER_SECOND;
+                break;
+            case 'f':
+                fixedSize = 1;
+                break;
+            case 'F':
+                if (!filterAdd(&filter, optarg)) {
+                    return 1;
+                }
+                break;
+            case 'i':
+                idleTimeout = atoi(optarg);
+                break;
+            case 'I':
+                useIndex = 1;
+                break;
+            case 'j':
+                workerCount = atoi(optarg);
+                if (workerCount < 0 || workerCount > PIPELINE_MAX_WORKERS) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'l':
+                lifetimeLimit = strtoull(optarg, NULL, 10) * NANOS_PER_SECOND;
+                break;
+            case 'm':
+                if (!matcherAdd(&patterns, optarg)) {
+                    return 1;
+                }
+                break;
+            case 'M':
+                memoryBudget = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'o':
+                outputDirectory = optarg;
+                break;
+            case 'p':
+                if (!matcherLoad(&patterns, optarg)) {
+                    return 1;
+                }
+                break;
+            case 'P':
+                parallelScan = 1;
+                break;
+            case 's':
+                if (!parseFlow(optarg, &wantedFlow)) {
+                    printf("Can't make sense of flow %s.\n", optarg);
+                    return 1;
+                }
+                useIndex = byFlow = 1;
+                break;
+            case 'S':
+                statsInterval = atoi(optarg);
+                if (statsInterval < 0) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 't':
+                if (!parseTimeWindow(optarg, &from, &to)) {
+                    printf("Can't make sense of time window %s.\n", optarg);
+                    return 1;
+                }
+                useIndex = byTime = 1;
+                break;
+            case 'v':
+                verbose = 1;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+
+    //An index only describes the capture as it was.
+    if (useIndex && !fixedSize) {
+        printf("Only fixed-size captures (-f) can be read through an index.\n");
+        return 1;
+    }
+
+    if (parallelScan && (!fixedSize || useIndex)) {
+        printf("Only fixed-size captures (-f) read in full can be scanned in "
+                "parallel.\n");
+        return 1;
+    }
+
+    filtering = filterActive(&filter);
+
+    if (patterns.ruleCount == 0) {
+        matcherAdd(&patterns, DEFAULT_PATTERN);
+    }
+    if (patterns.ruleCount == 0 || !matcherCompile(&patterns)) {
+        error(6);
+        return 6;
+    }
+
+    hello();
+
+    //Output names have to differ from run to run, or a run carrying on from
+    //a checkpoint would reuse (and overwrite) the names of the last one.
+    srand(time(NULL) ^ getpid());
+
+    //Every capture given, in the order they'll be read.
+    capture_set captures;
+    size_t c;
+
+    captureSetInit(&captures);
+    for (opt = optind; opt < argc; opt++) {
+        if (!captureSetAdd(&captures, argv[opt])) {
+            error(1);
+            return 1;
+        }
+    }
+    captureSetSort(&captures, 0);
+
+    if (captures.count == 0) {
+        printf("No captures found.\n");
+        error(1);
+        return 1;
+    }
+
+    //A pipe can't be indexed, mapped or split up: it's read once, in order,
+    //until it's closed (so -f makes no difference).
+    int streaming = 0;
+
+    for (c = 0; c < captures.count; c++) {
+        streaming |= captures.entries[c].isStream;
+    }
+
+    if (streaming && captures.count > 1) {
+        printf("A capture from a pipe has to be the only one.\n");
+        return 1;
+    }
+
+    if (streaming && (useIndex || parallelScan)) {
+        printf("A capture from a pipe can only be read in order (no -I, -P, "
+                "-s or -t).\n");
+        return 1;
+    }
+    if (streaming) {
+        fixedSize = 0;
+    }
+
+    //Carrying on needs a place in a file to carry on from, that everything
+    //before has been read up to.
+    if (checkpointPath != NULL && (useIndex || parallelScan || streaming)) {
+        printf("Checkpoints are only kept of captures read in order from "
+                "files (no -I, -P, -s, -t or pipes).\n");
+        return 1;
+    }
+
+    //Chunks are found by looking around the mapping, for records.
+    for (c = 0; c < captures.count && parallelScan; c++) {
+        if (!captures.entries[c].splittable) {
+            printf("Can't split %s up, reading in order instead.\n",
+                    captures.entries[c].path);
+            parallelScan = 0;
+        }
+    }
+
+    if (parallelScan && workerCount == 0) {
+        workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workerCount < 1) {
+            workerCount = 1;
+        }
+        if (workerCount > PIPELINE_MAX_WORKERS) {
+            workerCount = PIPELINE_MAX_WORKERS;
+        }
+    }
+
+    //Without -j (or -P) everything happens right here, on a single worker.
+    int threaded = workerCount > 0;
+    if (!threaded) {
+        workerCount = 1;
+    }
+
+
+    installStopHandler();
+
+    //SIGUSR1 asks for statistics, which only the reporter thread answers.
+    statsBlockSignal();
+
+    //Everything is written through one pool: on this thread, or on the
+    //writer thread with -j.
+    output_pool pool;
+
+    if (!outputPoolInit(&pool, outputDirectory, 0)) {
+        error(3);
+        return 3;
+    }
+
+    savedDirectory = open(outputDirectory, O_RDONLY | O_DIRECTORY);
+    if (savedDirectory < 0 || !dedupInit(&savedBodies)) {
+        error(6);
+        return 6;
+    }
+
+    worker_state workers[PIPELINE_MAX_WORKERS];
+    void* contexts[PIPELINE_MAX_WORKERS];
+    output_channel channels[PIPELINE_MAX_WORKERS];
+    output_writer writer;
+    pipeline workerPipeline;
+    stats_counters* counters[PIPELINE_MAX_WORKERS + 1];
+    stats_counters readerStats; /* Packets the reader turns away itself. */
+    stats_reporter reporter;
+
+    int w;
+    for (w = 0; w < workerCount; w++) {
+        if (!flowTableInit(&(workers[w].flows), FLOW_TABLE_INITIAL_CAPACITY)) {
+            error(6);
+            return 6;
+        }
+        workers[w].packetNum = 0;
+        timerWheelInit(&(workers[w].timers));
+        workers[w].now = workers[w].leap = 0;
+        workers[w].nanoResolution = 0;
+        workers[w].nextFlowId = 0;
+        workers[w].memory = workers[w].publishedMemory = 0;
+        outputDirect(&(workers[w].output), &pool);
+        memset(&(workers[w].stats), 0, sizeof (stats_counters));
+        counters[w] = &(workers[w].stats);
+        contexts[w] = &(workers[w]);
+
+        //With -j, the reader filters packets before handing them over.
+        workers[w].prefiltered = threaded && !parallelScan;
+    }
+
+    memset(&readerStats, 0, sizeof (stats_counters));
+    counters[workerCount] = &readerStats;
+
+    if (!statsReporterStart(&reporter, counters, workerCount + 1, stderr,
+            statsInterval)) {
+        error(6);
+        return 6;
+    }
+
+    if (threaded) {
+        if (!outputWriterStart(&writer, &pool, channels, workerCount)) {
+            error(6);
+            return 6;
+        }
+        for (w = 0; w < workerCount; w++) {
+            workers[w].output = channels[w];
+        }
+    }
+
+    capture_reader reader;
+    memset(&reader, 0, sizeof (capture_reader));
+    reader.captures = &captures;
+    reader.fixedSize = fixedSize;
+    reader.streaming = streaming;
+    reader.idleTimeout = idleTimeout;
+    reader.useIndex = useIndex;
+    reader.byFlow = byFlow;
+    reader.wantedFlow = wantedFlow;
+    reader.byTime = byTime;
+    reader.from = from;
+    reader.to = to;
+    reader.threaded = threaded;
+    reader.parallelScan = parallelScan;
+    reader.workers = workers;
+    reader.contexts = contexts;
+    reader.workerCount = workerCount;
+    reader.workerPipeline = &workerPipeline;
+    reader.pool = &pool;
+    reader.writer = &writer;
+    reader.readerStats = &readerStats;
+    reader.remindInputAvail = 1;
+    reader.idleSince = monotonicSeconds();
+    reader.checkpointPath = checkpointPath;
+    reader.checkpointInterval = checkpointInterval;
+    reader.checkpointDue = reader.idleSince + checkpointInterval;
+
+    //Pick up where the last run left off, before the workers get going.
+    checkpoint_reader saved;
+    checkpoint_state resumeState;
+    size_t first = 0;
+
+    memset(&saved, 0, sizeof (checkpoint_reader));
+    memset(&resumeState, 0, sizeof (checkpoint_state));
+    if (checkpointPath != NULL) {
+        resumeCheckpoint(&reader, &saved, &resumeState, &first);
+    }
+
+    if (threaded && !parallelScan && !pipelineStart(&workerPipeline, contexts,
+            workerCount, processPacket, finishWorker)) {
+        error(6);
+        return 6;
+    }
+
+    //Flows carry on from one capture into the next.
+    int status = EXIT_SUCCESS;
+
+    for (c = first; c < captures.count && status == EXIT_SUCCESS
+            && !reader.finished && !stopRequested(); c++) {
+        status = readCapture(&reader, c);
+    }
+
+    //Read in full: there's nothing to carry on from.
+    if (checkpointPath != NULL && fixedSize && status == EXIT_SUCCESS
+            && !reader.finished && !stopRequested()) {
+        unlink(checkpointPath);
+    }
+    checkpointClose(&saved, &resumeState);
+
+    //Keep whatever we had of any files still in progress.
+    if (threaded) {
+        if (!parallelScan) {
+            pipelineStop(&workerPipeline);
+        } else {
+            for (w = 0; w < workerCount; w++) {
+                finishWorker(&workers[w]);
+            }
+        }
+        outputWriterJoin(&writer);
+    } else {
+        finishWorker(&workers[0]);
+    }
+    outputPoolFree(&pool);
+    dedupFree(&savedBodies);
+    close(savedDirectory);
+    statsReporterStop(&reporter);
+    matcherFree(&patterns);
+    filterFree(&filter);
+    captureSetFree(&captures);
+
+    return status;
+}
@@ -10,29 +10,35 @@
 
 #include <stdint.h>
 
+#include "flow.h"
+#include "output.h"
+#include "stats.h"
+#include "timer.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+    /* Everything one worker needs to track its share of the flows. With -j,
+     * each worker thread has its own; otherwise there's just one. */
     typedef struct {
-        uint16_t sourcePort;
-        uint16_t destPort;
-        uint32_t sequenceNumber; /* Network byte order! When we read these in,
-                                  * we'll have to reverse them to be little-endian */
-        uint32_t ackNumber;
-        uint8_t dataOffset;
-        uint8_t flags;
-        uint16_t windowSize;
-        uint16_t checksum;
-        uint16_t urgentPtr;
-    } tcp_header;
-    
-    typedef struct {
-        int payloadSize;
-        int sequenceNumber;
-        tcp_header header;
-        uint8_t* payload;
-    } tcp_packet;
+        flow_table flows;
+        uint32_t packetNum; /* Packets this worker has seen. */
+        output_channel output;
+        stats_counters stats; /* Only written by this worker's thread. */
+        int prefiltered; /* The reader has already applied the -F filter. */
+        timer_wheel timers; /* When its flows may have expired, in seconds of
+                             * capture time. */
+        uint64_t now; /* Capture time of the latest packet, in nanoseconds,
+                       * or 0 until the first has been backed up. */
+        uint64_t leap; /* A later time too far ahead of now to move to on
+                        * one packet's say-so, or 0. */
+        int nanoResolution; /* Whether the capture's timestamps are in
+                             * nanoseconds (or microseconds). */
+        uint64_t nextFlowId;
+        uint64_t memory; /* Bytes held by its flows, */
+        uint64_t publishedMemory; /* as last added to the global total. */
+    } worker_state;
 
 
 #ifdef	__cplusplus
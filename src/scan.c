@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "scan.h"
+#include "flow.h"
+
+typedef struct {
+    uint32_t* offsets; /* Records, relative to the start of the chunk. */
+    size_t count;
+    size_t capacity;
+} shard_list;
+
+typedef struct {
+    int index;
+    off_t start;
+    off_t end; /* Records starting before this belong to the chunk. */
+    off_t first; /* The first record as found by its scanner, or -1. */
+    off_t next; /* Where the chunk's last record ends. */
+    int scanned;
+    int failed; /* Hit a bad record, or ran out of memory. */
+    int users; /* Workers still to go through it. */
+    shard_list* shards; /* Its records, by worker. */
+} scan_chunk;
+
+typedef struct {
+    pcap_file* pcapFile;
+    off_t chunkSize;
+    int workers;
+    void** contexts;
+    packet_handler handler;
+    worker_hook finish;
+    scan_stop_check stop;
+    scan_chunk* slots; /* Chunk i lives in slot i % slotCount. */
+    int slotCount;
+    int claimed; /* Chunks handed out to scanners... */
+    int checked; /* ...checked and ready for the workers... */
+    int released; /* ...and finished with, so their slots can be reused. */
+    int last; /* One past the last chunk to use. */
+    off_t seam; /* Where the last checked chunk's records really end. */
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} scan_state;
+
+typedef struct {
+    scan_state* state;
+    int index;
+} scan_start;
+
+static scan_chunk* chunkSlot(scan_state* state, int index) {
+    return &(state->slots[index % state->slotCount]);
+}
+
+static int shardAppend(shard_list* shard, uint32_t offset) {
+    if (shard->count == shard->capacity) {
+        size_t capacity = shard->capacity ? shard->capacity * 2 : 256;
+        uint32_t* grown = realloc(shard->offsets, capacity * sizeof (uint32_t));
+
+        if (grown == NULL) {
+            return 0;
+        }
+        shard->offsets = grown;
+        shard->capacity = capacity;
+    }
+
+    shard->offsets[shard->count++] = offset;
+    return 1;
+}
+
+static void clearShards(scan_state* state, scan_chunk* chunk) {
+    int i;
+
+    for (i = 0; i < state->workers; i++) {
+        chunk->shards[i].count = 0;
+    }
+}
+
+/**
+ * Walks a chunk's records from a known (or guessed) record start, sorting
+ * them by worker.
+ */
+static void walkChunk(scan_state* state, scan_chunk* chunk, off_t from) {
+    off_t position = from;
+
+    clearShards(state, chunk);
+    chunk->first = from;
+    chunk->failed = 0;
+
+    while (position < chunk->end) {
+        pcap_packet packet;
+        flow_key key;
+        uint32_t hash = 0;
+
+        //Walking from a wrong guess runs into nonsense sooner or later, which
+        //is only worth a word once the chunk's been checked.
+        pcap_packet_header header;
+        off_t size = state->pcapFile->fixedSize;
+
+        if (position + (off_t) sizeof (header) > size) {
+            chunk->failed = 1;
+            break;
+        }
+
+        state->pcapFile->decodeRecord(state->pcapFile->map + position,
+                &header);
+        if (header.incl_len < 1
+                || header.incl_len > size - position - sizeof (header)
+                || !readPacketAt(state->pcapFile, position, &packet)) {
+            chunk->failed = 1;
+            break;
+        }
+
+        if (packetFlowKey(&packet, &key, NULL)) {
+            hash = flowHash(&key);
+        }
+
+        if (!shardAppend(&(chunk->shards[pipelineShard(hash, state->workers)]),
+                position - chunk->start)) {
+            chunk->failed = 1;
+            break;
+        }
+
+        position += sizeof (pcap_packet_header) + packet.payload.payloadSize;
+    }
+
+    chunk->next = position;
+}
+
+/**
+ * Makes chunks ready for the workers, in order, as far as they've been
+ * scanned. Call with the lock held.
+ */
+static void checkChunks(scan_state* state) {
+    while (state->checked < state->claimed && state->checked < state->last) {
+        scan_chunk* chunk = chunkSlot(state, state->checked);
+
+        if (!chunk->scanned) {
+            break;
+        }
+
+        if (state->seam >= chunk->end) {
+            //A record from an earlier chunk covers this one completely.
+            clearShards(state, chunk);
+            chunk->failed = 0;
+            chunk->next = state->seam;
+        } else if (chunk->first != state->seam) {
+            //The scanner guessed wrong: start again from the right place.
+            walkChunk(state, chunk, state->seam);
+        }
+
+        if (chunk->failed) {
+            fprintf(stderr, "Bad record at offset %lld, stopping there.\n",
+                    (long long) chunk->next);
+            state->failed = 1;
+            state->last = state->checked + 1;
+        }
+
+        state->seam = chunk->next;
+        state->checked++;
+    }
+}
+
+static void* scannerMain(void* arg) {
+    scan_state* state = arg;
+
+    pthread_mutex_lock(&(state->lock));
+
+    for (;;) {
+        while (state->claimed < state->last
+                && state->claimed >= state->released + state->slotCount) {
+            pthread_cond_wait(&(state->changed), &(state->lock));
+        }
+
+        if (state->claimed >= state->last) {
+            break;
+        }
+
+        int index = state->claimed++;
+        scan_chunk* chunk = chunkSlot(state, index);
+        chunk->index = index;
+        chunk->start = sizeof (pcap_header) + index * state->chunkSize;
+        chunk->end = chunk->start + state->chunkSize;
+        if (chunk->end > state->pcapFile->fixedSize) {
+            chunk->end = state->pcapFile->fixedSize;
+        }
+        chunk->scanned = 0;
+        chunk->users = state->workers;
+
+        pthread_mutex_unlock(&(state->lock));
+
+        //The first chunk starts right after the file header, the others
+        //wherever a record seems to.
+        off_t first = index == 0 ? chunk->start
+                : findRecordBoundary(state->pcapFile, chunk->start, chunk->end);
+
+        if (first >= 0) {
+            walkChunk(state, chunk, first);
+        } else {
+            clearShards(state, chunk);
+            chunk->first = -1;
+            chunk->failed = 0;
+        }
+
+        pthread_mutex_lock(&(state->lock));
+        chunk->scanned = 1;
+        checkChunks(state);
+        pthread_cond_broadcast(&(state->changed));
+    }
+
+    pthread_mutex_unlock(&(state->lock));
+    return NULL;
+}
+
+static void* workerMain(void* arg) {
+    scan_start start = *(scan_start*) arg;
+    free(arg);
+
+    scan_state* state = start.state;
+    void* context = state->contexts[start.index];
+    int index;
+
+    for (index = 0;; index++) {
+        pthread_mutex_lock(&(state->lock));
+        while (index >= state->checked && index < state->last) {
+            pthread_cond_wait(&(state->changed), &(state->lock));
+        }
+
+        if (index >= state->last) {
+            pthread_mutex_unlock(&(state->lock));
+            break;
+        }
+
+        scan_chunk* chunk = chunkSlot(state, index);
+        pthread_mutex_unlock(&(state->lock));
+
+        shard_list* shard = &(chunk->shards[start.index]);
+        size_t i;
+
+        for (i = 0; i < shard->count; i++) {
+            pcap_packet packet;
+
+            if (readPacketAt(state->pcapFile,
+                    chunk->start + shard->offsets[i], &packet)) {
+                state->handler(context, &packet);
+            }
+        }
+
+        pthread_mutex_lock(&(state->lock));
+        chunk->users--;
+        while (state->released < state->checked
+                && chunkSlot(state, state->released)->users == 0) {
+            state->released++;
+        }
+
+        if (state->stop != NULL && state->stop() && state->last > index + 1) {
+            state->last = index + 1;
+        }
+
+        pthread_cond_broadcast(&(state->changed));
+        pthread_mutex_unlock(&(state->lock));
+    }
+
+    if (state->finish != NULL) {
+        state->finish(context);
+    }
+    return NULL;
+}
+
+int scanParallel(pcap_file* pcapFile, int threads, void** contexts,
+        int workers, packet_handler handler, worker_hook finish,
+        scan_stop_check stop) {
+    scan_state state;
+    memset(&state, 0, sizeof (state));
+
+    state.pcapFile = pcapFile;
+    state.workers = workers;
+    state.contexts = contexts;
+    state.handler = handler;
+    state.finish = finish;
+    state.stop = stop;
+    state.seam = sizeof (pcap_header);
+
+    //Enough chunks to keep every scanner busy a few times over, but not so
+    //many that small files are all seams.
+    off_t records = pcapFile->fixedSize - sizeof (pcap_header);
+    state.chunkSize = records / (threads * SCAN_CHUNKS_AHEAD * 2);
+    if (state.chunkSize > SCAN_CHUNK_SIZE) {
+        state.chunkSize = SCAN_CHUNK_SIZE;
+    }
+    if (state.chunkSize < SCAN_MIN_CHUNK_SIZE) {
+        state.chunkSize = SCAN_MIN_CHUNK_SIZE;
+    }
+    state.last = (records + state.chunkSize - 1) / state.chunkSize;
+
+    state.slotCount = threads * SCAN_CHUNKS_AHEAD;
+    state.slots = calloc(state.slotCount, sizeof (scan_chunk));
+    if (state.slots == NULL) {
+        return 0;
+    }
+
+    int i;
+    for (i = 0; i < state.slotCount; i++) {
+        state.slots[i].shards = calloc(workers, sizeof (shard_list));
+        if (state.slots[i].shards == NULL) {
+            return 0;
+        }
+    }
+
+    pthread_mutex_init(&(state.lock), NULL);
+    pthread_cond_init(&(state.changed), NULL);
+
+    pthread_t scanners[threads];
+    pthread_t workerThreads[workers];
+    int scannersStarted = 0;
+    int workersStarted = 0;
+
+    for (i = 0; i < workers; i++) {
+        scan_start* start = malloc(sizeof (scan_start));
+        if (start == NULL) {
+            break;
+        }
+        start->state = &state;
+        start->index = i;
+
+        if (pthread_create(&workerThreads[i], NULL, workerMain, start) != 0) {
+            free(start);
+            break;
+        }
+        workersStarted++;
+    }
+
+    //Every worker has to be there, or some flows would never be handled.
+    if (workersStarted < workers) {
+        pthread_mutex_lock(&(state.lock));
+        state.last = 0;
+        state.failed = 1;
+        pthread_cond_broadcast(&(state.changed));
+        pthread_mutex_unlock(&(state.lock));
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&scanners[i], NULL, scannerMain, &state) != 0) {
+            break;
+        }
+        scannersStarted++;
+    }
+
+    //No scanners at all would leave the workers waiting forever.
+    if (scannersStarted == 0) {
+        pthread_mutex_lock(&(state.lock));
+        state.last = 0;
+        state.failed = 1;
+        pthread_cond_broadcast(&(state.changed));
+        pthread_mutex_unlock(&(state.lock));
+    }
+
+    for (i = 0; i < scannersStarted; i++) {
+        pthread_join(scanners[i], NULL);
+    }
+    for (i = 0; i < workersStarted; i++) {
+        pthread_join(workerThreads[i], NULL);
+    }
+
+    for (i = 0; i < state.slotCount; i++) {
+        int j;
+        for (j = 0; j < workers; j++) {
+            free(state.slots[i].shards[j].offsets);
+        }
+        free(state.slots[i].shards);
+    }
+    free(state.slots);
+
+    pthread_mutex_destroy(&(state.lock));
+    pthread_cond_destroy(&(state.changed));
+
+    return !state.failed;
+}
@@ -0,0 +1,59 @@
+/* 
+ * File:   scan.h
+ *
+ * Parallel scan of a mapped, fixed-size capture. The file is cut into byte
+ * ranges (chunks). Scanner threads take chunks as they become free, find the
+ * first record in each, and sort the chunk's records by flow. Worker threads,
+ * one per flow shard as in pipeline.h, then go through the chunks in file
+ * order, so every flow still sees its packets in order. A flow that spans
+ * chunks just carries on in its worker.
+ * 
+ * Finding the first record of a chunk is a guess (see findRecordBoundary), so
+ * chunks are checked in order before anyone uses them: each must start where
+ * the one before it really ended, and is rescanned from there if not.
+ */
+
+#ifndef SCAN_H
+#define	SCAN_H
+
+#include "decap_includes.h"
+#include "pipeline.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SCAN_CHUNK_SIZE (32 * 1024 * 1024) /* Largest chunk. */
+#define SCAN_MIN_CHUNK_SIZE (64 * 1024) /* Smallest, for small files. */
+#define SCAN_CHUNKS_AHEAD 4 /* Chunks in flight per scanner thread. */
+
+    /* Asked between chunks whether to give up early. */
+    typedef int (*scan_stop_check)(void);
+
+    /**
+     * Scans a mapped capture in parallel and runs every packet through
+     * `handler` on the worker owning its flow, then runs `finish` on each
+     * worker.
+     * 
+     * @param pcapFile The capture, loaded fixed-size and mapped.
+     * @param threads Scanner threads to use.
+     * @param contexts One context per worker.
+     * @param workers How many workers.
+     * @param handler What each worker does with a packet.
+     * @param finish What each worker does at the end, or NULL for nothing
+     * (when it's to carry on with another capture).
+     * @param stop Checked between chunks; non-zero stops the scan there.
+     * @return Non-zero if the whole file was scanned (or the scan was
+     * stopped), zero if it's corrupt or we ran out of memory partway. Either
+     * way, everything before the problem has been handled.
+     */
+    int scanParallel(pcap_file* pcapFile, int threads, void** contexts,
+            int workers, packet_handler handler, worker_hook finish,
+            scan_stop_check stop);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SCAN_H */
@@ -0,0 +1,234 @@
+/* 
+ * File:   spsc.h
+ *
+ * Lock-free single-producer single-consumer ring of fixed-size items, for
+ * handing work between pipeline stages. Each side only writes its own index
+ * and keeps a cached copy of the other's, so in the common case a push or pop
+ * touches no shared cache line at all.
+ *
+ * A consumer that runs out of work spins briefly and then sleeps on its
+ * waiter (one waiter can serve several rings, for a consumer that drains more
+ * than one); producers wake it through spscNotify. A producer that finds the
+ * ring full just backs off until there's room.
+ */
+
+#ifndef SPSC_H
+#define	SPSC_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define SPSC_CACHE_LINE 64
+#define SPSC_SPINS 256 /* Empty polls before a consumer goes to sleep. */
+
+    /* Where a consumer sleeps while its rings are empty. */
+    typedef struct {
+        atomic_int sleeping;
+        pthread_mutex_t lock;
+        pthread_cond_t wake;
+    } spsc_waiter;
+
+    typedef struct {
+        /* Consumer side. */
+        _Atomic size_t head;
+        size_t cachedTail;
+        char padHead[SPSC_CACHE_LINE];
+
+        /* Producer side. */
+        _Atomic size_t tail;
+        size_t cachedHead;
+        char padTail[SPSC_CACHE_LINE];
+
+        /* Shared, read-only after init. */
+        uint8_t* slots;
+        size_t mask;
+        size_t itemSize;
+        spsc_waiter* waiter;
+    } spsc_ring;
+
+    static inline void spscWaiterInit(spsc_waiter* waiter) {
+        atomic_init(&(waiter->sleeping), 0);
+        pthread_mutex_init(&(waiter->lock), NULL);
+        pthread_cond_init(&(waiter->wake), NULL);
+    }
+
+    static inline void spscWaiterFree(spsc_waiter* waiter) {
+        pthread_mutex_destroy(&(waiter->lock));
+        pthread_cond_destroy(&(waiter->wake));
+    }
+
+    /**
+     * Sets up an empty ring.
+     * 
+     * @param ring Fill-in target.
+     * @param capacity Number of items, must be a power of two.
+     * @param itemSize Size of each item in bytes.
+     * @param waiter Where the ring's consumer sleeps.
+     * @return Non-zero on success.
+     */
+    static inline int spscInit(spsc_ring* ring, size_t capacity,
+            size_t itemSize, spsc_waiter* waiter) {
+        memset(ring, 0, sizeof (spsc_ring));
+        ring->slots = malloc(capacity * itemSize);
+        ring->mask = capacity - 1;
+        ring->itemSize = itemSize;
+        ring->waiter = waiter;
+
+        return ring->slots != NULL;
+    }
+
+    static inline void spscFree(spsc_ring* ring) {
+        free(ring->slots);
+        ring->slots = NULL;
+    }
+
+    static inline int spscEmpty(spsc_ring* ring) {
+        return atomic_load_explicit(&(ring->tail), memory_order_acquire)
+                == atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    }
+
+    /**
+     * Adds an item (copied in) if there's room. Producer only.
+     * 
+     * @return Non-zero if it was added, zero if the ring is full.
+     */
+    static inline int spscTryPush(spsc_ring* ring, const void* item) {
+        size_t tail = atomic_load_explicit(&(ring->tail), memory_order_relaxed);
+
+        if (tail - ring->cachedHead > ring->mask) {
+            ring->cachedHead = atomic_load_explicit(&(ring->head),
+                    memory_order_acquire);
+            if (tail - ring->cachedHead > ring->mask) {
+                return 0;
+            }
+        }
+
+        memcpy(ring->slots + (tail & ring->mask) * ring->itemSize, item,
+                ring->itemSize);
+        atomic_store_explicit(&(ring->tail), tail + 1, memory_order_release);
+        return 1;
+    }
+
+    /**
+     * Wakes the consumer if it's asleep. Producers call this after a run of
+     * pushes (not necessarily after each one).
+     */
+    static inline void spscNotify(spsc_ring* ring) {
+        spsc_waiter* waiter = ring->waiter;
+
+        //Pairs with the fence in spscWait: either we see it sleeping, or it
+        //sees our items.
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load_explicit(&(waiter->sleeping), memory_order_relaxed)) {
+            pthread_mutex_lock(&(waiter->lock));
+            pthread_cond_signal(&(waiter->wake));
+            pthread_mutex_unlock(&(waiter->lock));
+        }
+    }
+
+    /**
+     * Adds an item, waiting for room if the ring is full. Producer only.
+     */
+    static inline void spscPush(spsc_ring* ring, const void* item) {
+        unsigned spins = 0;
+
+        while (!spscTryPush(ring, item)) {
+            //The consumer might be asleep on items we haven't announced.
+            spscNotify(ring);
+
+            if (++spins < SPSC_SPINS) {
+                sched_yield();
+            } else {
+                struct timespec pause = {0, 50000};
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+
+    /**
+     * Takes the oldest item (copied out) if there is one. Consumer only.
+     * 
+     * @return Non-zero if an item was taken, zero if the ring is empty.
+     */
+    static inline int spscTryPop(spsc_ring* ring, void* item) {
+        size_t head = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+
+        if (head == ring->cachedTail) {
+            ring->cachedTail = atomic_load_explicit(&(ring->tail),
+                    memory_order_acquire);
+            if (head == ring->cachedTail) {
+                return 0;
+            }
+        }
+
+        memcpy(item, ring->slots + (head & ring->mask) * ring->itemSize,
+                ring->itemSize);
+        atomic_store_explicit(&(ring->head), head + 1, memory_order_release);
+        return 1;
+    }
+
+    /**
+     * Puts a consumer to sleep until one of its rings has items. Returns
+     * straight away if any already does; may also return spuriously.
+     * 
+     * @param waiter The consumer's waiter.
+     * @param rings The rings it consumes.
+     * @param count How many rings.
+     */
+    static inline void spscWait(spsc_waiter* waiter, spsc_ring* rings,
+            int count) {
+        pthread_mutex_lock(&(waiter->lock));
+        atomic_store(&(waiter->sleeping), 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        int empty = 1;
+        int i;
+        for (i = 0; i < count && empty; i++) {
+            empty = spscEmpty(&rings[i]);
+        }
+
+        //The timed wait is only a backstop.
+        if (empty) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec++;
+            pthread_cond_timedwait(&(waiter->wake), &(waiter->lock), &until);
+        }
+
+        atomic_store(&(waiter->sleeping), 0);
+        pthread_mutex_unlock(&(waiter->lock));
+    }
+
+    /**
+     * Takes the oldest item, waiting for one if the ring is empty. Consumer
+     * only, and only for a consumer of this one ring.
+     */
+    static inline void spscPop(spsc_ring* ring, void* item) {
+        unsigned spins = 0;
+
+        while (!spscTryPop(ring, item)) {
+            if (++spins < SPSC_SPINS) {
+                sched_yield();
+            } else {
+                spscWait(ring->waiter, ring, 1);
+                spins = 0;
+            }
+        }
+    }
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SPSC_H */
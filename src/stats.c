@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include "stats.h"
+#include "decap_includes.h"
+
+static const char* dropNames[STATS_DROP_REASONS] = {
+    "not_link", "not_ip", "not_tcp", "truncated", "no_flow_memory",
+    "filtered", "mid_response"
+};
+
+static const char* evictNames[STATS_EVICT_REASONS] = {
+    "idle", "lifetime", "memory"
+};
+
+static const char* stageNames[STATS_STAGES] = {
+    "decode", "match", "reassembly", "total"
+};
+
+static uint64_t loadCounter(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * The largest value that would have gone in a bucket.
+ */
+static uint64_t bucketTop(int bucket) {
+    if (bucket < STATS_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    int shift = bucket / STATS_SUB_BUCKETS - 1;
+    uint64_t sub = bucket % STATS_SUB_BUCKETS;
+    return ((STATS_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+/**
+ * Adds one worker's histogram into a total.
+ */
+static void addHistogram(stats_histogram* total,
+        const stats_histogram* histogram) {
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        total->buckets[i] += loadCounter(&(histogram->buckets[i]));
+    }
+    total->count += loadCounter(&(histogram->count));
+    total->sum += loadCounter(&(histogram->sum));
+
+    uint64_t max = loadCounter(&(histogram->max));
+    if (max > total->max) {
+        total->max = max;
+    }
+}
+
+/**
+ * The value `fraction` of the way through a histogram (to within its
+ * precision).
+ */
+static uint64_t percentile(const stats_histogram* histogram, double fraction) {
+    //Counts are read bucket by bucket while they change, so go by what the
+    //buckets add up to rather than the count.
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        total += histogram->buckets[i];
+    }
+
+    uint64_t wanted = total * fraction;
+    uint64_t seen = 0;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > wanted) {
+            uint64_t top = bucketTop(i);
+            return top < histogram->max ? top : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void writeHistogram(FILE* out, const char* name,
+        const stats_histogram* histogram) {
+    fprintf(out, "\"%s\": {\"count\": %llu, \"mean\": %llu, \"p50\": %llu, "
+            "\"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+            name, (unsigned long long) histogram->count,
+            (unsigned long long) (histogram->count
+            ? histogram->sum / histogram->count : 0),
+            (unsigned long long) percentile(histogram, 0.5),
+            (unsigned long long) percentile(histogram, 0.9),
+            (unsigned long long) percentile(histogram, 0.99),
+            (unsigned long long) percentile(histogram, 0.999),
+            (unsigned long long) histogram->max);
+}
+
+void statsWrite(stats_reporter* reporter, FILE* out) {
+    stats_counters* total = calloc(1, sizeof (stats_counters));
+    struct timespec now;
+    slab_stats buffers;
+    int i;
+    int j;
+
+    if (total == NULL) {
+        return;
+    }
+
+    for (i = 0; i < reporter->count; i++) {
+        const stats_counters* counters = reporter->counters[i];
+
+        total->packets += loadCounter(&(counters->packets));
+        total->bytes += loadCounter(&(counters->bytes));
+        for (j = 0; j < STATS_DROP_REASONS; j++) {
+            total->drops[j] += loadCounter(&(counters->drops[j]));
+        }
+        total->ignored += loadCounter(&(counters->ignored));
+        total->matches += loadCounter(&(counters->matches));
+        total->flowsOpened += loadCounter(&(counters->flowsOpened));
+        total->flowsClosed += loadCounter(&(counters->flowsClosed));
+        total->flowsFailed += loadCounter(&(counters->flowsFailed));
+        for (j = 0; j < STATS_EVICT_REASONS; j++) {
+            total->evictions[j] += loadCounter(&(counters->evictions[j]));
+        }
+        total->flowMemory += loadCounter(&(counters->flowMemory));
+        total->filesWritten += loadCounter(&(counters->filesWritten));
+        total->bytesWritten += loadCounter(&(counters->bytesWritten));
+        total->duplicates += loadCounter(&(counters->duplicates));
+        total->duplicateBytes += loadCounter(&(counters->duplicateBytes));
+        total->clockJumps += loadCounter(&(counters->clockJumps));
+        for (j = 0; j < STATS_STAGES; j++) {
+            addHistogram(&(total->latency[j]), &(counters->latency[j]));
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    slabGetStats(&buffers);
+
+    uint64_t active = total->flowsOpened > total->flowsClosed
+            ? total->flowsOpened - total->flowsClosed : 0;
+
+    flockfile(out);
+    fprintf(out, "{\"time\": %lld, \"elapsed\": %.3f, \"packets\": %llu, "
+            "\"bytes\": %llu, \"drops\": {", (long long) time(NULL),
+            (now.tv_sec - reporter->started.tv_sec)
+            + (now.tv_nsec - reporter->started.tv_nsec) / 1e9,
+            (unsigned long long) total->packets,
+            (unsigned long long) total->bytes);
+    for (j = 0; j < STATS_DROP_REASONS; j++) {
+        fprintf(out, "%s\"%s\": %llu", j ? ", " : "", dropNames[j],
+                (unsigned long long) total->drops[j]);
+    }
+    fprintf(out, "}, \"ignored\": %llu, \"matches\": %llu, "
+            "\"active_flows\": %llu, \"flows_closed\": %llu, "
+            "\"flows_failed\": %llu, \"flow_memory\": %llu, "
+            "\"evictions\": {",
+            (unsigned long long) total->ignored,
+            (unsigned long long) total->matches,
+            (unsigned long long) active,
+            (unsigned long long) total->flowsClosed,
+            (unsigned long long) total->flowsFailed,
+            (unsigned long long) total->flowMemory);
+    for (j = 0; j < STATS_EVICT_REASONS; j++) {
+        fprintf(out, "%s\"%s\": %llu", j ? ", " : "", evictNames[j],
+                (unsigned long long) total->evictions[j]);
+    }
+    fprintf(out, "}, \"files_written\": %llu, \"bytes_written\": %llu, "
+            "\"duplicates\": %llu, \"duplicate_bytes\": %llu, "
+            "\"clock_jumps\": %llu, \"latency_ns\": {",
+            (unsigned long long) total->filesWritten,
+            (unsigned long long) total->bytesWritten,
+            (unsigned long long) total->duplicates,
+            (unsigned long long) total->duplicateBytes,
+            (unsigned long long) total->clockJumps);
+    for (j = 0; j < STATS_STAGES; j++) {
+        if (j) {
+            fprintf(out, ", ");
+        }
+        writeHistogram(out, stageNames[j], &(total->latency[j]));
+    }
+    fprintf(out, "}, \"buffers\": {\"allocated\": %llu, \"cache_hits\": %llu, "
+            "\"depot_refills\": %llu, \"large\": %llu, \"freed\": %llu, "
+            "\"slabs\": %llu, \"slab_bytes\": %llu, \"arena_resets\": %llu}}\n",
+            (unsigned long long) buffers.allocations,
+            (unsigned long long) buffers.cacheHits,
+            (unsigned long long) buffers.depotRefills,
+            (unsigned long long) buffers.largeAllocations,
+            (unsigned long long) buffers.frees,
+            (unsigned long long) buffers.slabs,
+            (unsigned long long) buffers.slabBytes,
+            (unsigned long long) buffers.arenaResets);
+    fflush(out);
+    funlockfile(out);
+
+    free(total);
+}
+
+int statsBlockSignal(void) {
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    return pthread_sigmask(SIG_BLOCK, &set, NULL) == 0;
+}
+
+static void* reporterMain(void* arg) {
+    stats_reporter* reporter = arg;
+    uint64_t due = statsNow() + (uint64_t) reporter->interval * 1000000000;
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    //SIGUSR1 is blocked everywhere, so it waits here for us to take it.
+    //Snapshots asked for in between don't move the regular ones.
+    for (;;) {
+        int received;
+
+        if (reporter->interval) {
+            uint64_t now = statsNow();
+            uint64_t wait = due > now ? due - now : 0;
+            struct timespec timeout = {wait / 1000000000, wait % 1000000000};
+
+            received = sigtimedwait(&set, NULL, &timeout);
+        } else {
+            received = sigwaitinfo(&set, NULL);
+        }
+
+        if (__atomic_load_n(&(reporter->stopping), __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        if (received == SIGUSR1) {
+            statsWrite(reporter, reporter->out);
+        } else if (received < 0 && errno == EAGAIN) {
+            statsWrite(reporter, reporter->out);
+            due += (uint64_t) reporter->interval * 1000000000;
+        }
+    }
+    return NULL;
+}
+
+int statsReporterStart(stats_reporter* reporter, stats_counters** counters,
+        int count, FILE* out, int interval) {
+    reporter->counters = counters;
+    reporter->count = count;
+    reporter->out = out;
+    reporter->interval = interval;
+    reporter->stopping = 0;
+    clock_gettime(CLOCK_MONOTONIC, &(reporter->started));
+
+    return pthread_create(&(reporter->thread), NULL, reporterMain,
+            reporter) == 0;
+}
+
+void statsReporterStop(stats_reporter* reporter) {
+    __atomic_store_n(&(reporter->stopping), 1, __ATOMIC_RELEASE);
+    pthread_kill(reporter->thread, SIGUSR1);
+    pthread_join(reporter->thread, NULL);
+
+    statsWrite(reporter, reporter->out);
+}
@@ -0,0 +1,211 @@
+/*
+ * File:   stats.h
+ *
+ * Counters and latency histograms, so it's possible to see what a long run is
+ * doing (and where its time goes) without a profiler. Each worker has its own
+ * set, written only by its own thread, so counting costs no more than an
+ * increment. A reporter thread adds them all up and writes a JSON snapshot
+ * every so often, and whenever the process gets SIGUSR1.
+ *
+ * Histograms are log-linear, like HdrHistogram: values under
+ * STATS_SUB_BUCKETS get a bucket each, and every power of two above that is
+ * split into STATS_SUB_BUCKETS buckets, so any value is known to within about
+ * 6% however large it is.
+ */
+
+#ifndef STATS_H
+#define	STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define STATS_SUB_BUCKETS 16
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_MAX_BITS 40 /* Nanoseconds up to about 18 minutes. */
+#define STATS_BUCKETS ((STATS_MAX_BITS - STATS_SUB_BUCKET_BITS + 2) \
+        * STATS_SUB_BUCKETS)
+
+    /* Why packets were dropped before reaching a flow. */
+    typedef enum {
+        STATS_DROP_NOT_LINK, /* A link type we can't read. */
+        STATS_DROP_NOT_IP,
+        STATS_DROP_NOT_TCP,
+        STATS_DROP_TRUNCATED, /* Headers cut short, or nonsense. */
+        STATS_DROP_NO_FLOW_MEMORY, /* Matched, but no room for the flow. */
+        STATS_DROP_FILTERED, /* Turned away by the -F filter. */
+        STATS_DROP_MID_RESPONSE, /* Matched partway into a response whose
+                                  * start we never saw. */
+        STATS_DROP_REASONS
+    } stats_drop_reason;
+
+    /* Why flows were let go of before they were finished. */
+    typedef enum {
+        STATS_EVICT_IDLE, /* No packets for the idle limit. */
+        STATS_EVICT_LIFETIME, /* Older than the lifetime limit. */
+        STATS_EVICT_MEMORY, /* Among the oldest when memory ran short. */
+        STATS_EVICT_REASONS
+    } stats_evict_reason;
+
+    /* Where the time for a packet goes. */
+    typedef enum {
+        STATS_STAGE_DECODE, /* Finding its headers and flow. */
+        STATS_STAGE_MATCH, /* Looking up the flow, or matching a new one. */
+        STATS_STAGE_REASSEMBLY, /* Putting it in order, parsing and writing. */
+        STATS_STAGE_TOTAL,
+        STATS_STAGES
+    } stats_stage;
+
+    typedef struct {
+        uint64_t count;
+        uint64_t sum; /* For the mean. */
+        uint64_t max;
+        uint64_t buckets[STATS_BUCKETS];
+    } stats_histogram;
+
+    /* One worker's counters. */
+    typedef struct {
+        uint64_t packets;
+        uint64_t bytes; /* Captured bytes of those packets. */
+        uint64_t drops[STATS_DROP_REASONS];
+        uint64_t ignored; /* TCP, but not part of anything interesting. */
+        uint64_t matches; /* Flows whose first response matched a pattern. */
+        uint64_t flowsOpened; /* Those, and flows opened to see a response's
+                               * headers through before matching them. */
+        uint64_t flowsClosed;
+        uint64_t flowsFailed; /* Of those closed, how many were given up. */
+        uint64_t evictions[STATS_EVICT_REASONS]; /* And how many expired. */
+        uint64_t flowMemory; /* Bytes held by the worker's flows right now
+                              * (a level, not a count). */
+        uint64_t filesWritten;
+        uint64_t bytesWritten;
+        uint64_t duplicates; /* Bodies not saved again, being copies, */
+        uint64_t duplicateBytes; /* and their sizes. */
+        uint64_t clockJumps; /* Timestamps too far ahead to believe alone. */
+        stats_histogram latency[STATS_STAGES]; /* Nanoseconds per packet. */
+    } stats_counters;
+
+    typedef struct {
+        stats_counters** counters; /* One set per worker. */
+        int count;
+        FILE* out;
+        int interval; /* Seconds between snapshots, 0 for SIGUSR1 only. */
+        struct timespec started;
+        int stopping;
+        pthread_t thread;
+    } stats_reporter;
+
+    /**
+     * Adds to a counter. Only the thread that owns it may do this; the store
+     * is atomic so the reporter never reads half of one.
+     *
+     * @param counter The counter.
+     * @param amount How much to add.
+     */
+    static inline void statsAdd(uint64_t* counter, uint64_t amount) {
+        __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * Sets a level, such as flowMemory. Owning thread only, as for statsAdd.
+     *
+     * @param counter The level.
+     * @param value What it is now.
+     */
+    static inline void statsSet(uint64_t* counter, uint64_t value) {
+        __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+    }
+
+    /**
+     * Nanoseconds on the monotonic clock, for timing stages.
+     */
+    static inline uint64_t statsNow(void) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+    /**
+     * Which bucket a value goes in.
+     */
+    static inline int statsBucket(uint64_t value) {
+        if (value < STATS_SUB_BUCKETS) {
+            return value;
+        }
+
+        int bits = 63 - __builtin_clzll(value);
+        if (bits > STATS_MAX_BITS) {
+            return STATS_BUCKETS - 1;
+        }
+
+        //The top bit says which power of two, the ones after it where in it.
+        int shift = bits - STATS_SUB_BUCKET_BITS;
+        return (shift + 1) * STATS_SUB_BUCKETS
+                + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+    }
+
+    /**
+     * Records a value in a histogram. Owning thread only, as for statsAdd.
+     *
+     * @param histogram The histogram.
+     * @param value The value (nanoseconds, say).
+     */
+    static inline void statsRecord(stats_histogram* histogram,
+            uint64_t value) {
+        statsAdd(&(histogram->buckets[statsBucket(value)]), 1);
+        statsAdd(&(histogram->count), 1);
+        statsAdd(&(histogram->sum), value);
+        if (value > histogram->max) {
+            __atomic_store_n(&(histogram->max), value, __ATOMIC_RELAXED);
+        }
+    }
+
+    /**
+     * Writes a snapshot of everything counted so far, as one line of JSON.
+     * Safe while the workers are still counting.
+     *
+     * @param reporter The reporter (which needn't have been started).
+     * @param out Where to write it.
+     */
+    void statsWrite(stats_reporter* reporter, FILE* out);
+
+    /**
+     * Blocks SIGUSR1 in the calling thread and any it starts from now on, so
+     * that it's left for the reporter. Call before starting any threads.
+     *
+     * @return Non-zero on success.
+     */
+    int statsBlockSignal(void);
+
+    /**
+     * Starts the reporter thread.
+     *
+     * @param reporter Fill-in target.
+     * @param counters One set of counters per worker, zeroed.
+     * @param count How many workers.
+     * @param out Where snapshots go.
+     * @param interval Seconds between snapshots, or 0 to only write them on
+     * SIGUSR1.
+     * @return Non-zero on success.
+     */
+    int statsReporterStart(stats_reporter* reporter, stats_counters** counters,
+            int count, FILE* out, int interval);
+
+    /**
+     * Stops the reporter thread and writes a last snapshot.
+     *
+     * @param reporter The reporter.
+     */
+    void statsReporterStop(stats_reporter* reporter);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* STATS_H */
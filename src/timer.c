@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "timer.h"
+
+/**
+ * Puts a timer in the slot it belongs in, going by how far off it is.
+ * 
+ * @param earliest The soonest tick it can go off at: the current one while
+ * cascading (its slot is yet to fire), the next one otherwise.
+ */
+static void place(timer_wheel* wheel, timer_entry* entry, uint64_t earliest) {
+    uint64_t due = entry->due;
+    int level;
+
+    //Anything past due goes off as soon as it can; anything further off
+    //than the wheel reaches waits at the far end, and is put back in its
+    //right place when it gets there.
+    if (due < earliest) {
+        due = earliest;
+    } else if (due - wheel->now >= TIMER_SPAN) {
+        due = wheel->now + TIMER_SPAN - 1;
+    }
+
+    uint64_t delta = due - wheel->now;
+    for (level = 0; level < TIMER_LEVELS - 1; level++) {
+        if (delta < ((uint64_t) 1 << ((level + 1) * TIMER_SLOT_BITS))) {
+            break;
+        }
+    }
+
+    int slot = (due >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+    entry->next = wheel->slots[level][slot];
+    wheel->slots[level][slot] = entry;
+}
+
+/**
+ * Moves the timers of one slot of a level down to where they go now.
+ */
+static void cascade(timer_wheel* wheel, int level) {
+    int slot = (wheel->now >> (level * TIMER_SLOT_BITS)) & (TIMER_SLOTS - 1);
+    timer_entry* entry = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    while (entry != NULL) {
+        timer_entry* next = entry->next;
+        place(wheel, entry, wheel->now);
+        entry = next;
+    }
+}
+
+/**
+ * Sets the clock going at its first tick. Timers set before then were
+ * placed as if it were at tick 0, so they're put back where they go now.
+ */
+static void startClock(timer_wheel* wheel, uint64_t now) {
+    timer_entry* waiting = NULL;
+    int level;
+    int slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            timer_entry* entry = wheel->slots[level][slot];
+
+            wheel->slots[level][slot] = NULL;
+            while (entry != NULL) {
+                timer_entry* next = entry->next;
+                entry->next = waiting;
+                waiting = entry;
+                entry = next;
+            }
+        }
+    }
+
+    wheel->now = now;
+    wheel->started = 1;
+
+    while (waiting != NULL) {
+        timer_entry* next = waiting->next;
+        place(wheel, waiting, now + 1);
+        waiting = next;
+    }
+}
+
+void timerWheelInit(timer_wheel* wheel) {
+    memset(wheel, 0, sizeof (timer_wheel));
+}
+
+int timerAdd(timer_wheel* wheel, const flow_key* key, uint64_t id,
+        uint64_t due) {
+    timer_entry* entry = slabAlloc(sizeof (timer_entry));
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    entry->key = *key;
+    entry->id = id;
+    entry->due = due;
+    place(wheel, entry, wheel->now + 1);
+    wheel->count++;
+    return 1;
+}
+
+void timerReschedule(timer_wheel* wheel, timer_entry* entry, uint64_t due) {
+    entry->due = due;
+    place(wheel, entry, wheel->now + 1);
+}
+
+void timerRelease(timer_wheel* wheel, timer_entry* entry) {
+    slabFree(entry);
+    wheel->count--;
+}
+
+void timerAdvance(timer_wheel* wheel, uint64_t now, timer_handler handler,
+        void* context) {
+    if (!wheel->started) {
+        startClock(wheel, now);
+        return;
+    }
+
+    if (wheel->count == 0) {
+        if (now > wheel->now) {
+            wheel->now = now;
+        }
+        return;
+    }
+
+    while (wheel->now < now) {
+        wheel->now++;
+
+        //When a level comes round, the next one up has a slot's worth of
+        //timers to hand down (coarsest first, so they fall all the way).
+        int level = 1;
+        while (level < TIMER_LEVELS && (wheel->now
+                & (((uint64_t) 1 << (level * TIMER_SLOT_BITS)) - 1)) == 0) {
+            level++;
+        }
+        while (--level > 0) {
+            cascade(wheel, level);
+        }
+
+        int slot = wheel->now & (TIMER_SLOTS - 1);
+        timer_entry* entry = wheel->slots[0][slot];
+
+        wheel->slots[0][slot] = NULL;
+        while (entry != NULL) {
+            timer_entry* next = entry->next;
+            handler(context, entry);
+            entry = next;
+        }
+
+        //Nothing left to fire: the clock can jump straight there.
+        if (wheel->count == 0) {
+            wheel->now = now;
+        }
+    }
+}
+
+void timerWheelFree(timer_wheel* wheel) {
+    int level;
+    int slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            timer_entry* entry = wheel->slots[level][slot];
+
+            while (entry != NULL) {
+                timer_entry* next = entry->next;
+                slabFree(entry);
+                entry = next;
+            }
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+    wheel->count = 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * File:   timer.h
+ *
+ * A hierarchical timer wheel, for expiring flows on the capture's own clock.
+ * Each level has TIMER_SLOTS slots, and each slot of a level spans a whole
+ * turn of the level below: timers wait in the coarsest level that fits, and
+ * are moved down a level at a time as their turn comes. Adding a timer and
+ * firing one are both O(1), and advancing the clock costs one slot per tick.
+ *
+ * Timers name a flow by key (and id), not by pointer, since flows move about
+ * in their table.
+ */
+
+#ifndef TIMER_H
+#define	TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "flow.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SPAN ((uint64_t) 1 << (TIMER_LEVELS * TIMER_SLOT_BITS)) /* Ticks
+                                              * the wheel looks ahead: about
+                                              * 194 days of seconds. */
+
+    typedef struct timer_entry {
+        struct timer_entry* next;
+        flow_key key; /* The flow it's for, */
+        uint64_t id; /* as long as it's still the same flow. */
+        uint64_t due; /* Tick it fires at. */
+    } timer_entry;
+
+    typedef struct {
+        timer_entry* slots[TIMER_LEVELS][TIMER_SLOTS];
+        uint64_t now; /* The current tick. */
+        int started; /* Whether `now` has been set yet. */
+        size_t count; /* Timers waiting. */
+    } timer_wheel;
+
+    /* Called for each timer that comes due. It owns the entry from then on,
+     * and must either pass it to timerReschedule or to timerRelease. */
+    typedef void (*timer_handler)(void* context, timer_entry* entry);
+
+    /**
+     * Sets up an empty wheel. Its clock starts at the first timerAdvance,
+     * though timers can be set before then.
+     *
+     * @param wheel Fill-in target.
+     */
+    void timerWheelInit(timer_wheel* wheel);
+
+    /**
+     * Sets a timer for a flow.
+     *
+     * @param wheel The wheel.
+     * @param key The flow.
+     * @param id Which flow of that key it's for.
+     * @param due Tick it should fire at (the next tick if that's passed).
+     * @return Non-zero on success, zero if out of memory.
+     */
+    int timerAdd(timer_wheel* wheel, const flow_key* key, uint64_t id,
+            uint64_t due);
+
+    /**
+     * Sets a timer that has fired to go off again.
+     *
+     * @param wheel The wheel.
+     * @param entry The timer, as passed to a timer_handler.
+     * @param due Tick it should fire at (the next tick if that's passed).
+     */
+    void timerReschedule(timer_wheel* wheel, timer_entry* entry, uint64_t due);
+
+    /**
+     * Gets rid of a timer that has fired.
+     *
+     * @param wheel The wheel.
+     * @param entry The timer, as passed to a timer_handler.
+     */
+    void timerRelease(timer_wheel* wheel, timer_entry* entry);
+
+    /**
+     * Moves the clock forward (never back), firing every timer that comes
+     * due on the way.
+     *
+     * @param wheel The wheel.
+     * @param now The current tick.
+     * @param handler Gets each timer that fires.
+     * @param context Passed through to the handler.
+     */
+    void timerAdvance(timer_wheel* wheel, uint64_t now, timer_handler handler,
+            void* context);
+
+    /**
+     * Releases every timer without firing it.
+     *
+     * @param wheel The wheel.
+     */
+    void timerWheelFree(timer_wheel* wheel);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TIMER_H */
@@ -0,0 +1,191 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+int uringInit(uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof (params));
+    memset(ring, 0, sizeof (uring));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return 0;
+    }
+    ring->entries = params.sq_entries;
+
+    ring->sqRingSize = params.sq_off.array
+            + params.sq_entries * sizeof (unsigned);
+    ring->cqRingSize = params.cq_off.cqes
+            + params.cq_entries * sizeof (struct io_uring_cqe);
+
+    //Newer kernels map both rings in one go.
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && ring->cqRingSize > ring->sqRingSize) {
+        ring->sqRingSize = ring->cqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        close(ring->fd);
+        return 0;
+    }
+
+    if (single) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED) {
+            munmap(ring->sqRing, ring->sqRingSize);
+            close(ring->fd);
+            return 0;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (!single) {
+            munmap(ring->cqRing, ring->cqRingSize);
+        }
+        munmap(ring->sqRing, ring->sqRingSize);
+        close(ring->fd);
+        return 0;
+    }
+
+    uint8_t* sq = ring->sqRing;
+    ring->sqHead = (unsigned*) (sq + params.sq_off.head);
+    ring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*) (sq + params.sq_off.array);
+
+    uint8_t* cq = ring->cqRing;
+    ring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    ring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+
+    return 1;
+}
+
+int uringQueueWritev(uring* ring, int fd, const struct iovec* iov,
+        int count, off_t offset, uint64_t tag) {
+    if (ring->queued == ring->entries) {
+        return 0;
+    }
+
+    unsigned tail = *(ring->sqTail);
+    unsigned index = tail & *(ring->sqMask);
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*) ring->sqes)[index];
+
+    memset(sqe, 0, sizeof (*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) iov;
+    sqe->len = count;
+    sqe->off = offset;
+    sqe->user_data = tag;
+
+    ring->sqArray[index] = index;
+
+    //The kernel may look at the entry as soon as it sees the new tail.
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return 1;
+}
+
+int uringSubmitAndWait(uring* ring, uring_completion done, void* context) {
+    unsigned outstanding = ring->queued;
+    int refused = 0;
+
+    while (ring->queued > 0) {
+        int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->queued,
+                0, 0, NULL, 0);
+
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            refused = errno;
+            break;
+        }
+        ring->queued -= submitted;
+    }
+
+    //Whatever the kernel wouldn't take fails with its error, and comes off
+    //the ring so the next batch starts clean.
+    if (ring->queued > 0) {
+        unsigned tail = *(ring->sqTail);
+        unsigned i;
+
+        for (i = tail - ring->queued; i != tail; i++) {
+            struct io_uring_sqe* sqe =
+                    &((struct io_uring_sqe*) ring->sqes)[i & *(ring->sqMask)];
+            done(context, sqe->user_data, -refused);
+        }
+
+        __atomic_store_n(ring->sqTail, tail - ring->queued, __ATOMIC_RELEASE);
+        outstanding -= ring->queued;
+        ring->queued = 0;
+    }
+
+    while (outstanding > 0) {
+        unsigned head = *(ring->cqHead);
+
+        if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+            if (syscall(__NR_io_uring_enter, ring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+                return 0;
+            }
+            continue;
+        }
+
+        struct io_uring_cqe* cqe =
+                &((struct io_uring_cqe*) ring->cqes)[head & *(ring->cqMask)];
+        done(context, cqe->user_data, cqe->res);
+
+        __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+        outstanding--;
+    }
+
+    return 1;
+}
+
+void uringFree(uring* ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+#else
+
+int uringInit(uring* ring, unsigned entries) {
+    return 0;
+}
+
+int uringQueueWritev(uring* ring, int fd, const struct iovec* iov,
+        int count, off_t offset, uint64_t tag) {
+    return 0;
+}
+
+int uringSubmitAndWait(uring* ring, uring_completion done, void* context) {
+    return 0;
+}
+
+void uringFree(uring* ring) {
+}
+
+#endif
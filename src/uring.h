@@ -0,0 +1,100 @@
+/* 
+ * File:   uring.h
+ *
+ * Just enough io_uring to submit a batch of vectored writes with one system
+ * call and wait for them all, talking to the kernel directly (no liburing).
+ * Where io_uring isn't there (old kernels, other systems, or blocked by a
+ * sandbox) uringInit fails and the caller writes some other way.
+ */
+
+#ifndef URING_H
+#define	URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    typedef struct {
+        int fd;
+        unsigned entries;
+        unsigned queued; /* Writes queued since the last submit. */
+        unsigned* sqHead;
+        unsigned* sqTail;
+        unsigned* sqMask;
+        unsigned* sqArray;
+        void* sqes; /* struct io_uring_sqe[entries] */
+        unsigned* cqHead;
+        unsigned* cqTail;
+        unsigned* cqMask;
+        void* cqes; /* struct io_uring_cqe[] */
+        void* sqRing;
+        size_t sqRingSize;
+        void* cqRing; /* Same as sqRing if the kernel maps both at once. */
+        size_t cqRingSize;
+        size_t sqesSize;
+    } uring;
+
+    /* Told how each write went: bytes written, or a negative errno. */
+    typedef void (*uring_completion)(void* context, uint64_t tag,
+            int32_t result);
+
+    /**
+     * Sets up a ring.
+     * 
+     * @param ring Fill-in target.
+     * @param entries Most writes per batch (rounded up to a power of two by
+     * the kernel).
+     * @return Non-zero on success, zero if io_uring isn't available.
+     */
+    int uringInit(uring* ring, unsigned entries);
+
+    /**
+     * Queues a pwritev() for the next submit. The iovecs and the memory they
+     * point at must stay put until then.
+     * 
+     * @param ring The ring.
+     * @param fd File to write.
+     * @param iov The pieces.
+     * @param count How many.
+     * @param offset Where in the file.
+     * @param tag Handed back on completion.
+     * @return Non-zero if queued, zero if the batch is full.
+     */
+    int uringQueueWritev(uring* ring, int fd, const struct iovec* iov,
+            int count, off_t offset, uint64_t tag);
+
+    /**
+     * Submits everything queued and waits for all of it to complete.
+     * 
+     * @param ring The ring.
+     * @param done Called once per write, including any the kernel wouldn't
+     * take.
+     * @param context Passed to done.
+     * @return Non-zero on success, zero if waiting for completions failed.
+     */
+    int uringSubmitAndWait(uring* ring, uring_completion done, void* context);
+
+    /**
+     * Tears the ring down.
+     * 
+     * @param ring The ring.
+     */
+    void uringFree(uring* ring);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* URING_H */
@@ -0,0 +1,41 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/classify.h"
+
+static const char* extensionOf(const char* head, uint32_t len) {
+    const file_type* type = classifyBody((const uint8_t*) head, len);
+    return type->extension != NULL ? type->extension : "";
+}
+
+void testClassify(void) {
+    char name[CLASSIFY_NAME_MAX];
+
+    CHECK(strcmp(extensionOf("\xFF\xD8\xFF\xE0\0\x10JFIF", 10), "jpg") == 0);
+    CHECK(strcmp(extensionOf("\x89PNG\r\n\x1A\n\0\0\0\rIHDR", 16), "png")
+            == 0);
+    CHECK(strcmp(extensionOf("GIF89a", 6), "gif") == 0);
+    CHECK(strcmp(extensionOf("%PDF-1.7\n", 9), "pdf") == 0);
+    CHECK(strcmp(extensionOf("PK\x03\x04\x14\0", 6), "zip") == 0);
+    CHECK(strcmp(extensionOf("ID3\x04\0", 5), "mp3") == 0);
+
+    //Bytes that vary (box and chunk sizes) and bits that don't count.
+    CHECK(strcmp(extensionOf("\0\0\0\x20" "ftypisom", 12), "mp4") == 0);
+    CHECK(strcmp(extensionOf("\0\0\0\x1C" "ftypM4A ", 12), "m4a") == 0);
+    CHECK(strcmp(extensionOf("RIFF\x24\x08\0\0WAVEfmt ", 16), "wav") == 0);
+    CHECK(strcmp(extensionOf("RIFF\x24\x08\0\0WEBPVP8 ", 16), "webp") == 0);
+    CHECK(strcmp(extensionOf("\xFF\xFB\x90\x44", 4), "mp3") == 0);
+    CHECK(strcmp(extensionOf("\xFF\xF1\x50\x80", 4), "aac") == 0);
+
+    //Too short for its signature, or nothing known.
+    CHECK(strcmp(extensionOf("\x89PNG", 4), "") == 0);
+    CHECK(strcmp(extensionOf("<html>", 6), "") == 0);
+    CHECK(strcmp(extensionOf("", 0), "") == 0);
+    CHECK(strcmp(classifyBody((const uint8_t*) "<html>", 6)->directory,
+            "other") == 0);
+
+    classifyName(classifyBody((const uint8_t*) "GIF87a", 6), "abc", name);
+    CHECK(strcmp(name, "image/abc.gif") == 0);
+    classifyName(classifyBody((const uint8_t*) "text", 4), "abc", name);
+    CHECK(strcmp(name, "other/abc") == 0);
+}
@@ -0,0 +1,120 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "tests.h"
+#include "../src/dedup.h"
+
+#define BODIES 999 /* Odd, so a body's copies go to different threads. */
+#define FINISHERS 4
+
+typedef struct {
+    dedup_index* index;
+    int first; /* Which of the copies it finishes: every FINISHERS'th. */
+    int duplicates;
+} finisher;
+
+/**
+ * Makes up a body's size, and digests of its start and all of it. Odd and
+ * even bodies share sizes and starts in pairs, as bodies that only differ
+ * later do.
+ */
+static uint64_t body(int n, uint8_t* prefix, uint8_t* digest) {
+    digest_state state;
+    int start = n / 2;
+
+    digestInit(&state);
+    digestUpdate(&state, (const uint8_t*) &start, sizeof (start));
+    digestFinal(&state, prefix);
+
+    digestInit(&state);
+    digestUpdate(&state, (const uint8_t*) &n, sizeof (n));
+    digestFinal(&state, digest);
+    return 1000 + start;
+}
+
+/**
+ * Finishes its share of two copies of every body, as a worker would,
+ * without any of them being on disk yet (the writer hasn't got to them).
+ */
+static void* finishCopies(void* arg) {
+    finisher* self = arg;
+    uint8_t prefix[DIGEST_SIZE];
+    uint8_t digest[DIGEST_SIZE];
+    int i;
+
+    for (i = self->first; i < 2 * BODIES; i += FINISHERS) {
+        uint64_t size = body(i % BODIES, prefix, digest);
+
+        if (!dedupAdd(self->index, size, prefix, digest)) {
+            self->duplicates++;
+        }
+    }
+    return NULL;
+}
+
+void testDedup(void) {
+    uint8_t prefix[DIGEST_SIZE];
+    uint8_t digest[DIGEST_SIZE];
+    uint8_t found[DIGEST_SIZE];
+    dedup_index index;
+    uint64_t size;
+    int i;
+
+    CHECK(dedupInit(&index));
+
+    //On its way to disk: copies are known, but there's nothing to read back.
+    size = body(0, prefix, digest);
+    CHECK(dedupAdd(&index, size, prefix, digest));
+    CHECK(dedupHas(&index, size, prefix, digest));
+    CHECK(!dedupAdd(&index, size, prefix, digest));
+    CHECK(!dedupFind(&index, size, prefix, found));
+
+    dedupPlaced(&index, size, prefix, digest, 1);
+    CHECK(dedupFind(&index, size, prefix, found));
+    CHECK(memcmp(found, digest, DIGEST_SIZE) == 0);
+
+    //One that didn't make it is forgotten, and one sharing its key (later
+    //in the same run of slots) is still found.
+    size = body(2, prefix, digest);
+    CHECK(dedupAdd(&index, size, prefix, digest));
+    size = body(3, prefix, digest);
+    CHECK(dedupAdd(&index, size, prefix, digest));
+    size = body(2, prefix, digest);
+    dedupPlaced(&index, size, prefix, digest, 0);
+    CHECK(!dedupHas(&index, size, prefix, digest));
+    size = body(3, prefix, digest);
+    CHECK(dedupHas(&index, size, prefix, digest));
+    CHECK(index.count == 2);
+    dedupFree(&index);
+
+    //Every body finished twice, across threads, before any is placed: each
+    //second copy is a duplicate whoever gets there first. Enough of them
+    //that the table grows on the way.
+    pthread_t threads[FINISHERS];
+    finisher finishers[FINISHERS];
+    int duplicates = 0;
+
+    CHECK(dedupInit(&index));
+    for (i = 0; i < FINISHERS; i++) {
+        finishers[i].index = &index;
+        finishers[i].first = i;
+        finishers[i].duplicates = 0;
+        pthread_create(&threads[i], NULL, finishCopies, &finishers[i]);
+    }
+    for (i = 0; i < FINISHERS; i++) {
+        pthread_join(threads[i], NULL);
+        duplicates += finishers[i].duplicates;
+    }
+    CHECK(duplicates == BODIES);
+    CHECK(index.count == BODIES);
+
+    for (i = 0; i < BODIES; i++) {
+        size = body(i, prefix, digest);
+        dedupPlaced(&index, size, prefix, digest, i % 3 != 0);
+    }
+    for (i = 0; i < BODIES; i++) {
+        size = body(i, prefix, digest);
+        CHECK(dedupHas(&index, size, prefix, digest) == (i % 3 != 0));
+    }
+    dedupFree(&index);
+}
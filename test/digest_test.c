@@ -0,0 +1,47 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/digest.h"
+
+static void hexOf(const char* text, size_t len, char* hex) {
+    digest_state state;
+    uint8_t digest[DIGEST_SIZE];
+
+    digestInit(&state);
+    digestUpdate(&state, (const uint8_t*) text, len);
+    digestFinal(&state, digest);
+    digestHex(digest, hex);
+}
+
+void testDigest(void) {
+    static const char fox[] = "The quick brown fox jumps over the lazy dog";
+    char hex[DIGEST_HEX_SIZE];
+    char whole[DIGEST_HEX_SIZE];
+    size_t step;
+
+    //MurmurHash3 x64-128, seed 0.
+    hexOf("", 0, hex);
+    CHECK(strcmp(hex, "00000000000000000000000000000000") == 0);
+    hexOf("hello", 5, hex);
+    CHECK(strcmp(hex, "cbd8a7b341bd9b025b1e906a48ae1d19") == 0);
+    hexOf(fox, sizeof (fox) - 1, whole);
+    CHECK(strcmp(whole, "e34bbc7bbc071b6c7a433ca9c49a9347") == 0);
+
+    //Taken in any number of pieces, from any alignment, it comes out the
+    //same.
+    for (step = 1; step <= 17; step++) {
+        digest_state state;
+        uint8_t digest[DIGEST_SIZE];
+        size_t i;
+
+        digestInit(&state);
+        for (i = 0; i < sizeof (fox) - 1; i += step) {
+            size_t len = sizeof (fox) - 1 - i < step
+                    ? sizeof (fox) - 1 - i : step;
+            digestUpdate(&state, (const uint8_t*) fox + i, len);
+        }
+        digestFinal(&state, digest);
+        digestHex(digest, hex);
+        CHECK(strcmp(hex, whole) == 0);
+    }
+}
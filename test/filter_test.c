@@ -0,0 +1,74 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "tests.h"
+#include "../src/filter.h"
+
+/**
+ * Makes the key of a segment, as it would come off the wire.
+ */
+static void makeKey(flow_key* key, const char* source, uint16_t sourcePort,
+        const char* dest, uint16_t destPort) {
+    static const uint8_t mapped[12] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF
+    };
+
+    memset(key, 0, sizeof (flow_key));
+    if (strchr(source, ':') != NULL) {
+        inet_pton(AF_INET6, source, key->sourceAddress);
+        inet_pton(AF_INET6, dest, key->destAddress);
+    } else {
+        memcpy(key->sourceAddress, mapped, 12);
+        inet_pton(AF_INET, source, key->sourceAddress + 12);
+        memcpy(key->destAddress, mapped, 12);
+        inet_pton(AF_INET, dest, key->destAddress + 12);
+    }
+    key->sourcePort = htons(sourcePort);
+    key->destPort = htons(destPort);
+}
+
+static int lets(const packet_filter* filter, const char* source,
+        uint16_t sourcePort, const char* dest, uint16_t destPort) {
+    flow_key key;
+
+    makeKey(&key, source, sourcePort, dest, destPort);
+    return filterMatches(filter, &key);
+}
+
+void testFilter(void) {
+    packet_filter filter;
+
+    filterInit(&filter);
+    CHECK(!filterActive(&filter));
+    CHECK(lets(&filter, "1.2.3.4", 1234, "5.6.7.8", 80));
+
+    CHECK(filterAdd(&filter, "net 10.0.0.0/8, host 192.168.1.1, "
+            "net 2001:db8::/32, port 80, port 8000-8100"));
+    CHECK(filterAdd(&filter, "not src host 10.1.2.3"));
+    CHECK(filterActive(&filter));
+
+    //Either end may be in the set, on a port in the set.
+    CHECK(lets(&filter, "10.200.0.1", 40000, "1.2.3.4", 80));
+    CHECK(lets(&filter, "1.2.3.4", 8050, "10.0.0.1", 40000));
+    CHECK(lets(&filter, "1.2.3.4", 80, "192.168.1.1", 40000));
+    CHECK(!lets(&filter, "1.2.3.4", 80, "192.168.1.2", 40000));
+    CHECK(!lets(&filter, "11.0.0.1", 40000, "1.2.3.4", 80));
+    CHECK(!lets(&filter, "10.0.0.1", 40000, "1.2.3.4", 8101));
+
+    //Prefixes that share a trie path with IPv4 ones don't leak into IPv6.
+    CHECK(lets(&filter, "2001:db8:1::1", 40000, "2002::1", 8000));
+    CHECK(!lets(&filter, "2001:db9::1", 40000, "2002::1", 8000));
+    CHECK(!lets(&filter, "::a00:1", 40000, "2002::1", 80));
+
+    //Exclusions only apply to the end they name.
+    CHECK(!lets(&filter, "10.1.2.3", 80, "1.2.3.4", 40000));
+    CHECK(lets(&filter, "1.2.3.4", 40000, "10.1.2.3", 80));
+
+    filterFree(&filter);
+
+    filterInit(&filter);
+    CHECK(!filterAdd(&filter, "net 10.0.0.0/33"));
+    CHECK(!filterAdd(&filter, "port 90-80"));
+    CHECK(!filterAdd(&filter, "nonsense"));
+    filterFree(&filter);
+}
@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/flow.h"
+
+#define FLOWS 3000
+
+static void makeKey(flow_key* key, uint32_t n) {
+    memset(key, 0, sizeof (flow_key));
+    memcpy(&(key->sourceAddress), &n, sizeof (n));
+    memset(&(key->destAddress), 1, sizeof (key->destAddress));
+    key->sourcePort = (uint16_t) (n * 7);
+    key->destPort = 80;
+}
+
+/**
+ * Every flow still in the table should be found, with what was stored in it,
+ * and none of the removed ones.
+ */
+static int allReachable(flow_table* table, const int* present) {
+    flow_key key;
+    uint32_t n;
+
+    for (n = 0; n < FLOWS; n++) {
+        makeKey(&key, n);
+        flow* found = flowLookup(table, &key);
+
+        if (present[n] ? found == NULL || found->nextSequence != n
+                : found != NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void testFlowTable(void) {
+    flow_table table;
+    flow_key key;
+    int present[FLOWS];
+    uint32_t n;
+
+    //Start small, so it has to grow and runs of collisions build up.
+    CHECK(flowTableInit(&table, 16));
+
+    for (n = 0; n < FLOWS; n++) {
+        makeKey(&key, n);
+        flow* entry = flowInsert(&table, &key);
+
+        CHECK(entry != NULL);
+        if (entry != NULL) {
+            entry->nextSequence = n;
+            present[n] = 1;
+        }
+    }
+    CHECK(table.count == FLOWS);
+    CHECK(allReachable(&table, present));
+
+    //Removing from the middle of runs must leave the rest of them reachable.
+    for (n = 0; n < FLOWS; n += 3) {
+        makeKey(&key, n);
+        flow* entry = flowLookup(&table, &key);
+
+        CHECK(entry != NULL);
+        if (entry != NULL) {
+            flowRemove(&table, entry);
+            present[n] = 0;
+        }
+    }
+    CHECK(table.count == FLOWS - (FLOWS + 2) / 3);
+    CHECK(allReachable(&table, present));
+
+    //And their slots can be used again.
+    for (n = 0; n < FLOWS; n += 3) {
+        makeKey(&key, n);
+        flow* entry = flowInsert(&table, &key);
+
+        if (entry != NULL) {
+            entry->nextSequence = n;
+            present[n] = 1;
+        }
+    }
+    CHECK(allReachable(&table, present));
+
+    for (n = 0; n < FLOWS; n++) {
+        makeKey(&key, n);
+        flow* entry = flowLookup(&table, &key);
+
+        if (entry != NULL) {
+            flowRemove(&table, entry);
+        }
+    }
+    CHECK(table.count == 0);
+
+    flowTableFree(&table);
+}
@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/http.h"
+
+typedef struct {
+    char data[64];
+    uint32_t length;
+} collected;
+
+static void collect(void* context, const uint8_t* data, uint32_t len) {
+    collected* body = context;
+
+    if (body->length + len < sizeof (body->data)) {
+        memcpy(body->data + body->length, data, len);
+    }
+    body->length += len;
+}
+
+/**
+ * Feeds a stream to a response, a few bytes at a time.
+ *
+ * @return How many of the bytes the response took.
+ */
+static uint32_t feed(http_response* response, const char* text, uint32_t step,
+        collected* body) {
+    const uint8_t* data = (const uint8_t*) text;
+    uint32_t len = strlen(text);
+    uint32_t used = 0;
+
+    while (used < len && response->state != HTTP_DONE
+            && response->state != HTTP_ERROR) {
+        uint32_t piece = len - used < step ? len - used : step;
+        uint32_t taken;
+
+        if (response->state == HTTP_HEADERS) {
+            taken = httpConsumeHeaders(response, data + used, piece);
+        } else {
+            taken = httpConsumeBody(response, data + used, piece, collect,
+                    body);
+        }
+        used += taken;
+    }
+    return used;
+}
+
+/**
+ * Headers split anywhere end in the same place, with the same fields.
+ */
+static void testHeaders(void) {
+    static const char sized[] = "HTTP/1.1 200 OK\r\n"
+            "Server: test\r\n"
+            "content-type: image/png\r\n"
+            "Content-Length: 1234\r\n"
+            "\r\n";
+    char stream[sizeof (sized) + 16];
+    uint32_t steps[] = {1, 2, 7, 1000};
+    size_t i;
+
+    strcpy(stream, sized);
+    strcat(stream, "\x89PNG body bytes");
+
+    for (i = 0; i < sizeof (steps) / sizeof (steps[0]); i++) {
+        const uint8_t* data = (const uint8_t*) stream;
+        uint32_t len = strlen(stream);
+        uint32_t used = 0;
+        http_response response;
+
+        httpResponseInit(&response);
+        while (used < len && response.state == HTTP_HEADERS) {
+            uint32_t piece = len - used < steps[i] ? len - used : steps[i];
+
+            used += httpConsumeHeaders(&response, data + used, piece);
+        }
+        CHECK(used == sizeof (sized) - 1);
+        CHECK(response.state == HTTP_BODY);
+        CHECK(response.statusCode == 200);
+        CHECK(strcmp(response.contentType, "image/png") == 0);
+        CHECK(response.contentLength == 1234);
+        CHECK(!response.chunked && !response.untilClose);
+        httpResponseFree(&response);
+    }
+}
+
+void testHttp(void) {
+    static const char chunked[] = "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/plain\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "\r\n"
+            "5\r\nhello\r\n"
+            "6;name=value\r\n world\r\n"
+            "A\r\n, chunked!\r\n"
+            "0\r\n"
+            "Trailer: yes\r\n"
+            "\r\n";
+    static const char next[] = "HTTP/1.1 304 Not Modified\r\n\r\n";
+    char stream[sizeof (chunked) + sizeof (next)];
+    uint32_t steps[] = {1, 2, 7, 1000};
+    size_t i;
+
+    testHeaders();
+
+    strcpy(stream, chunked);
+    strcat(stream, next);
+
+    //However the stream is split, the body is the same and the response
+    //ends exactly where the next one starts.
+    for (i = 0; i < sizeof (steps) / sizeof (steps[0]); i++) {
+        http_response response;
+        collected body;
+
+        memset(&body, 0, sizeof (body));
+        httpResponseInit(&response);
+
+        uint32_t used = feed(&response, stream, steps[i], &body);
+        CHECK(response.state == HTTP_DONE);
+        CHECK(response.statusCode == 200);
+        CHECK(response.chunked);
+        CHECK(strcmp(response.contentType, "text/plain") == 0);
+        CHECK(used == sizeof (chunked) - 1);
+        CHECK(body.length == strlen("hello world, chunked!"));
+        CHECK(memcmp(body.data, "hello world, chunked!", body.length) == 0);
+        httpResponseFree(&response);
+
+        //The next one has no body at all.
+        httpResponseInit(&response);
+        CHECK(feed(&response, stream + used, steps[i], &body)
+                == sizeof (next) - 1);
+        CHECK(response.state == HTTP_DONE);
+        CHECK(response.statusCode == 304);
+        httpResponseFree(&response);
+    }
+
+    CHECK(findHeaderEnd((const uint8_t*) chunked, sizeof (chunked) - 1)
+            == strstr(chunked, "5\r\nhello") - chunked);
+    CHECK(findHeaderEnd((const uint8_t*) "HTTP/1.1 200 OK\r\n", 17) == -1);
+
+    //The tail of a header block has no status line, so no framing either.
+    http_response tail;
+    httpResponseInit(&tail);
+    feed(&tail, "Content-Type: audio/mpeg\r\n\r\nbody", 1000, NULL);
+    CHECK(tail.state == HTTP_ERROR);
+    CHECK(!tail.untilClose);
+    httpResponseFree(&tail);
+
+    CHECK(findResponseStart((const uint8_t*) stream, strlen(stream))
+            == (long) (sizeof (chunked) - 1));
+    CHECK(findResponseStart((const uint8_t*) "Server: x\r\n", 11) == -1);
+}
@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+#include "tests.h"
+
+int testsRun = 0;
+int testsFailed = 0;
+
+int main(void) {
+    testFlowTable();
+    testReassembly();
+    testHttp();
+    testMatcher();
+    testFilter();
+    testTimer();
+    testDigest();
+    testClassify();
+    testDedup();
+
+    printf("%d checks, %d failed\n", testsRun, testsFailed);
+    return testsFailed == 0 ? 0 : 1;
+}
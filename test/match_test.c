@@ -0,0 +1,41 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/match.h"
+
+static int scan(const matcher* m, const char* text, size_t* end) {
+    return matcherScan(m, (const uint8_t*) text, strlen(text), end);
+}
+
+void testMatcher(void) {
+    matcher m;
+    size_t end = 0;
+
+    CHECK(matcherInit(&m));
+    CHECK(matcherAdd(&m, "he"));
+    CHECK(matcherAdd(&m, "she"));
+    CHECK(matcherAdd(&m, "his"));
+    CHECK(matcherAdd(&m, "hers"));
+    CHECK(matcherAdd(&m, "a\\x00b\\r\\n"));
+    CHECK(!matcherAdd(&m, ""));
+    CHECK(!matcherAdd(&m, "bad\\xZZ"));
+    CHECK(m.ruleCount == 5);
+    CHECK(matcherCompile(&m));
+
+    //"she" and, by its failure link, "he" both end here: the lower wins.
+    CHECK(scan(&m, "ushers", &end) == 0);
+    CHECK(end == 4);
+
+    //Falling back from "sh" to "h" mid-match.
+    CHECK(scan(&m, "xshis", &end) == 2);
+    CHECK(end == 5);
+
+    CHECK(scan(&m, "nothing to see", NULL) == -1);
+    CHECK(scan(&m, "", NULL) == -1);
+
+    CHECK(matcherScan(&m, (const uint8_t*) "xa\0b\r\n", 6, &end) == 4);
+    CHECK(end == 6);
+    CHECK(strcmp(matcherRuleName(&m, 3), "hers") == 0);
+
+    matcherFree(&m);
+}
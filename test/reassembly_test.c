@@ -0,0 +1,68 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/reassembly.h"
+
+typedef struct {
+    uint8_t data[256];
+    uint32_t length;
+} collected;
+
+static void collect(void* context, flow* current, const uint8_t* data,
+        uint32_t len) {
+    collected* stream = context;
+
+    if (stream->length + len <= sizeof (stream->data)) {
+        memcpy(stream->data + stream->length, data, len);
+    }
+    stream->length += len;
+}
+
+void testReassembly(void) {
+    static const char text[] = "the quick brown fox jumps over the lazy dog";
+    const uint8_t* bytes = (const uint8_t*) text;
+    uint32_t length = sizeof (text) - 1;
+    //Starts just short of the sequence space wrapping round.
+    uint32_t start = 0xFFFFFFF0U;
+    collected stream;
+    flow current;
+
+    CHECK(sequenceBefore(0xFFFFFFF0U, 5));
+    CHECK(!sequenceBefore(5, 0xFFFFFFF0U));
+
+    //Out of order, overlapping, and across the wrap; with a retransmission
+    //of bytes already delivered.
+    memset(&current, 0, sizeof (current));
+    memset(&stream, 0, sizeof (stream));
+    current.nextSequence = start;
+
+    CHECK(reassembleSegment(&current, start + 20, 0, bytes + 20, 10, collect,
+            &stream) == STREAM_OPEN);
+    CHECK(reassembleSegment(&current, start + 30, 1, bytes + 30, length - 30,
+            collect, &stream) == STREAM_OPEN);
+    CHECK(reassembleSegment(&current, start + 8, 0, bytes + 8, 16, collect,
+            &stream) == STREAM_OPEN);
+    CHECK(stream.length == 0);
+    CHECK(current.pending != NULL);
+
+    CHECK(reassembleSegment(&current, start, 0, bytes, 10, collect, &stream)
+            == STREAM_FINISHED);
+    CHECK(stream.length == length);
+    CHECK(memcmp(stream.data, text, length) == 0);
+    CHECK(current.nextSequence == start + length);
+    CHECK(current.pending == NULL);
+    CHECK(current.pendingBytes == 0);
+
+    CHECK(reassembleSegment(&current, start + 4, 0, bytes + 4, 10, collect,
+            &stream) == STREAM_FINISHED);
+    CHECK(stream.length == length);
+
+    //Held segments are let go with the flow.
+    memset(&current, 0, sizeof (current));
+    current.nextSequence = start;
+    reassembleSegment(&current, start + 10, 0, bytes, 10, collect, &stream);
+    CHECK(current.pendingBytes > 0);
+    discardPending(&current);
+    CHECK(current.pending == NULL);
+    CHECK(current.pendingBytes == 0);
+}
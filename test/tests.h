@@ -0,0 +1,45 @@
+/*
+ * File:   tests.h
+ *
+ * A minimal harness for the unit tests: each module's tests are a function
+ * that checks what it expects with CHECK, which counts and reports failures
+ * but carries on, so one run shows everything that's wrong.
+ */
+
+#ifndef TESTS_H
+#define	TESTS_H
+
+#include <stdio.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    extern int testsRun;
+    extern int testsFailed;
+
+#define CHECK(condition) \
+    do { \
+        testsRun++; \
+        if (!(condition)) { \
+            testsFailed++; \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+    void testFlowTable(void);
+    void testReassembly(void);
+    void testHttp(void);
+    void testMatcher(void);
+    void testFilter(void);
+    void testTimer(void);
+    void testDigest(void);
+    void testClassify(void);
+    void testDedup(void);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* TESTS_H */
@@ -0,0 +1,94 @@
+#include <string.h>
+
+#include "tests.h"
+#include "../src/timer.h"
+
+typedef struct {
+    timer_wheel* wheel;
+    uint64_t firedAt[8]; /* The tick each timer went off at, by id. */
+    int fired;
+    int again; /* Id of a timer to set going again once, or -1. */
+} fired_timers;
+
+static void record(void* context, timer_entry* entry) {
+    fired_timers* timers = context;
+
+    timers->firedAt[entry->id] = timers->wheel->now;
+    timers->fired++;
+
+    if ((int) entry->id == timers->again) {
+        timers->again = -1;
+        timerReschedule(timers->wheel, entry, entry->due + 1000);
+    } else {
+        timerRelease(timers->wheel, entry);
+    }
+}
+
+void testTimer(void) {
+    //One per level, and either side of where a level comes round.
+    static const uint64_t due[] = {3, 63, 64, 70, 4095, 4097, 300000};
+    int timerCount = sizeof (due) / sizeof (due[0]);
+    timer_wheel wheel;
+    fired_timers timers;
+    flow_key key;
+    int i;
+
+    memset(&key, 0, sizeof (key));
+    memset(&timers, 0, sizeof (timers));
+    timers.wheel = &wheel;
+    timers.again = 3;
+
+    timerWheelInit(&wheel);
+    timerAdvance(&wheel, 0, record, &timers);
+    for (i = 0; i < timerCount; i++) {
+        CHECK(timerAdd(&wheel, &key, i, due[i]));
+    }
+    CHECK(wheel.count == (size_t) timerCount);
+
+    timerAdvance(&wheel, 2, record, &timers);
+    CHECK(timers.fired == 0);
+
+    //Each fires on its own tick, however far the clock goes in one step.
+    timerAdvance(&wheel, 3, record, &timers);
+    CHECK(timers.fired == 1);
+    timerAdvance(&wheel, 5000, record, &timers);
+    for (i = 0; i < timerCount - 1; i++) {
+        CHECK(timers.firedAt[i] == (i == 3 ? due[i] + 1000 : due[i]));
+    }
+    CHECK(timers.fired == timerCount);
+
+    timerAdvance(&wheel, 1000000, record, &timers);
+    CHECK(timers.firedAt[timerCount - 1] == due[timerCount - 1]);
+    CHECK(timers.fired == timerCount + 1);
+    CHECK(wheel.count == 0);
+
+    //A timer already due goes off at the next tick; the clock never goes
+    //back.
+    CHECK(timerAdd(&wheel, &key, 0, 10));
+    timerAdvance(&wheel, 5, record, &timers);
+    CHECK(wheel.now == 1000000);
+    timerAdvance(&wheel, 1000001, record, &timers);
+    CHECK(timers.firedAt[0] == 1000001);
+    CHECK(wheel.count == 0);
+
+    CHECK(timerAdd(&wheel, &key, 0, 2000000));
+    timerWheelFree(&wheel);
+    CHECK(wheel.count == 0);
+
+    //Timers set before the clock starts go off when they're due from
+    //wherever it starts.
+    memset(&timers, 0, sizeof (timers));
+    timers.wheel = &wheel;
+    timers.again = -1;
+    timerWheelInit(&wheel);
+    CHECK(timerAdd(&wheel, &key, 0, 1000005));
+    CHECK(timerAdd(&wheel, &key, 1, 10));
+    timerAdvance(&wheel, 1000000, record, &timers);
+    CHECK(timers.fired == 0);
+    timerAdvance(&wheel, 1000004, record, &timers);
+    CHECK(timers.fired == 1);
+    CHECK(timers.firedAt[1] == 1000001);
+    timerAdvance(&wheel, 1000010, record, &timers);
+    CHECK(timers.firedAt[0] == 1000005);
+    CHECK(wheel.count == 0);
+}